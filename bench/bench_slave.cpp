@@ -0,0 +1,90 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "bench_slave.hpp"
+
+#include <cppfmu_cs.hpp>
+#include <cppfmu_state.hpp>
+#include <cppfmu_variables.hpp>
+
+#include <cstring>
+
+
+/* A slave with BENCH_VARIABLE_COUNT real variables, whose DoStep() does a
+ * trivial amount of work and logs one message under the category "bench".
+ * Its state consists of the time and all the variables, the latter split
+ * into blocks of BENCH_STATE_BLOCK_SIZE variables.  If the instance name is
+ * BENCH_INCREMENTAL_INSTANCE, incremental snapshots are enabled, and if it
+ * is BENCH_BUFFERED_INSTANCE, buffered logging is enabled.
+ */
+class BenchSlave : public cppfmu::SlaveInstance
+{
+public:
+    BenchSlave(
+        cppfmu::Memory memory,
+        cppfmu::Logger logger,
+        bool incremental,
+        bool buffered)
+        : logger_(logger)
+        , category_(logger_.RegisterCategory("bench"))
+        , variables_(memory)
+        , state_(memory)
+    {
+        variables_.AddReal(0, values_, BENCH_VARIABLE_COUNT);
+        UseVariableTable(variables_);
+        timeRegion_ = state_.Add(time_);
+        firstValueRegion_ = state_.AddBlock(values_, BENCH_STATE_BLOCK_SIZE * sizeof(cppfmu::FMIReal));
+        for (int i = BENCH_STATE_BLOCK_SIZE; i < BENCH_VARIABLE_COUNT; i += BENCH_STATE_BLOCK_SIZE) {
+            state_.AddBlock(values_ + i, BENCH_STATE_BLOCK_SIZE * sizeof(cppfmu::FMIReal));
+        }
+        if (incremental) state_.EnableIncrementalSnapshots();
+        if (buffered) logger_.EnableBuffering();
+        UseStateTable(state_);
+    }
+
+    bool DoStep(
+        cppfmu::FMIReal currentCommunicationPoint,
+        cppfmu::FMIReal communicationStepSize,
+        cppfmu::FMIBoolean /*newStep*/,
+        cppfmu::FMIReal& /*endOfStep*/) override
+    {
+        time_ = currentCommunicationPoint + communicationStepSize;
+        values_[0] += communicationStepSize;
+        state_.MarkDirty(timeRegion_);
+        state_.MarkDirty(firstValueRegion_);
+        CPPFMU_LOG_DEBUG(logger_, category_, "t = %g", time_);
+        return true;
+    }
+
+private:
+    cppfmu::Logger logger_;
+    cppfmu::LogCategory category_;
+    cppfmu::VariableTable variables_;
+    cppfmu::StateTable state_;
+    cppfmu::StateTable::Region timeRegion_;
+    cppfmu::StateTable::Region firstValueRegion_;
+    cppfmu::FMIReal time_ = 0.0;
+    cppfmu::FMIReal values_[BENCH_VARIABLE_COUNT] = {};
+};
+
+
+cppfmu::UniquePtr<cppfmu::SlaveInstance> CppfmuInstantiateSlave(
+    cppfmu::FMIString instanceName,
+    cppfmu::FMIString /*fmuGUID*/,
+    cppfmu::FMIString /*fmuResourceLocation*/,
+    cppfmu::FMIString /*mimeType*/,
+    cppfmu::FMIReal /*timeout*/,
+    cppfmu::FMIBoolean /*visible*/,
+    cppfmu::FMIBoolean /*interactive*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger logger)
+{
+    return cppfmu::AllocateUnique<BenchSlave>(
+        memory,
+        memory,
+        logger,
+        std::strcmp(instanceName, BENCH_INCREMENTAL_INSTANCE) == 0,
+        std::strcmp(instanceName, BENCH_BUFFERED_INSTANCE) == 0);
+}
@@ -0,0 +1,23 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_BENCH_SLAVE_HPP
+#define CPPFMU_BENCH_SLAVE_HPP
+
+// The number of real variables in the benchmark slave, with value
+// references 0 through BENCH_VARIABLE_COUNT-1.
+#define BENCH_VARIABLE_COUNT 4096
+
+// The number of variables in each block of the benchmark slave's state.
+#define BENCH_STATE_BLOCK_SIZE 64
+
+// The instance name which makes the benchmark slave use incremental
+// snapshots.
+#define BENCH_INCREMENTAL_INSTANCE "bench-incremental"
+
+// The instance name which makes the benchmark slave use buffered logging.
+#define BENCH_BUFFERED_INSTANCE "bench-buffered"
+
+#endif // header guard
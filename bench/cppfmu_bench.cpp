@@ -0,0 +1,442 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/* Micro-benchmarks for the overhead of the FMI functions implemented in
+ * fmi_functions.cpp.
+ *
+ * Usage: cppfmu_bench [min-seconds-per-benchmark]
+ *
+ * The results are written to standard output in JSON Lines format, one
+ * object per benchmark, with the following fields:
+ *
+ *     benchmark   = The name of the operation being measured.
+ *     variant     = A short description of the benchmark parameters.
+ *     n           = A size parameter (e.g. the number of value references
+ *                   per call), or 0 if not applicable.
+ *     iterations  = The number of calls which were timed.
+ *     ns_per_call = The mean wall-clock time per call, in nanoseconds.
+ *
+ * The compression benchmarks also print one object per data set with the
+ * fields benchmark, variant, n (the uncompressed size), compressed_size and
+ * ratio (uncompressed size divided by compressed size).
+ */
+#include "bench_slave.hpp"
+
+#include <cppfmu_pmr.hpp>
+#include <cppfmu_pool.hpp>
+#include <cppfmu_serialization.hpp>
+#include <fmi2Functions.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+
+namespace
+{
+    const char* const GUID = "b5c8e4c6-3f34-4b8e-a0b5-0d0a8c1e2f10";
+
+    double g_minSeconds = 0.2;
+    unsigned long g_logCount = 0;
+
+
+    // Formats the message, like any real logger would, and throws it away.
+    extern "C" void BenchLogger(
+        fmi2ComponentEnvironment,
+        fmi2String,
+        fmi2Status,
+        fmi2String,
+        fmi2String message,
+        ...)
+    {
+        char buffer[512];
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(buffer, sizeof buffer, message, args);
+        va_end(args);
+        ++g_logCount;
+    }
+
+    extern "C" void* BenchAlloc(std::size_t nobj, std::size_t size)
+    {
+        return std::calloc(nobj, size);
+    }
+
+    const fmi2CallbackFunctions g_callbacks = {
+        &BenchLogger,
+        &BenchAlloc,
+        &std::free,
+        nullptr,
+        nullptr,
+    };
+
+
+    void Check(fmi2Status status)
+    {
+        if (status != fmi2OK) throw std::runtime_error("FMI function failed");
+    }
+
+
+    /* Calls 'f' repeatedly, doubling the number of calls until at least
+     * g_minSeconds have elapsed, and prints the mean time per call.
+     */
+    template<typename F>
+    void Run(const char* benchmark, const char* variant, std::size_t n, F f)
+    {
+        using Clock = std::chrono::steady_clock;
+        f(); // warm-up
+        unsigned long iterations = 1;
+        double seconds = 0.0;
+        for (;;) {
+            const auto start = Clock::now();
+            for (unsigned long i = 0; i < iterations; ++i) f();
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if (seconds >= g_minSeconds) break;
+            iterations *= 2;
+        }
+        std::printf(
+            "{\"benchmark\": \"%s\", \"variant\": \"%s\", \"n\": %lu, "
+            "\"iterations\": %lu, \"ns_per_call\": %.2f}\n",
+            benchmark,
+            variant,
+            static_cast<unsigned long>(n),
+            iterations,
+            seconds * 1e9 / iterations);
+        std::fflush(stdout);
+    }
+
+
+    fmi2Component Instantiate(const char* name)
+    {
+        const auto c = fmi2Instantiate(
+            name, fmi2CoSimulation, GUID, nullptr, &g_callbacks, fmi2False, fmi2False);
+        if (c == nullptr) throw std::runtime_error("Instantiation failed");
+        Check(fmi2SetupExperiment(c, fmi2False, 0.0, 0.0, fmi2False, 0.0));
+        Check(fmi2EnterInitializationMode(c));
+        Check(fmi2ExitInitializationMode(c));
+        return c;
+    }
+
+
+    void BenchGetSet(fmi2Component c)
+    {
+        const std::size_t sizes[] = {1, 8, 64, 512, BENCH_VARIABLE_COUNT};
+        std::vector<fmi2ValueReference> vr;
+        std::vector<fmi2Real> values(BENCH_VARIABLE_COUNT, 1.0);
+        for (const auto nvr : sizes) {
+            // Consecutive value references
+            vr.resize(nvr);
+            for (std::size_t i = 0; i < nvr; ++i) {
+                vr[i] = static_cast<fmi2ValueReference>(i);
+            }
+            Run("fmi2GetReal", "contiguous", nvr, [&] {
+                Check(fmi2GetReal(c, vr.data(), nvr, values.data()));
+            });
+            Run("fmi2SetReal", "contiguous", nvr, [&] {
+                Check(fmi2SetReal(c, vr.data(), nvr, values.data()));
+            });
+
+            // Scattered value references (a fixed pseudo-random permutation)
+            for (std::size_t i = 0; i < nvr; ++i) {
+                vr[i] = static_cast<fmi2ValueReference>(
+                    (i * 2654435761u) % BENCH_VARIABLE_COUNT);
+            }
+            Run("fmi2GetReal", "scattered", nvr, [&] {
+                Check(fmi2GetReal(c, vr.data(), nvr, values.data()));
+            });
+            Run("fmi2SetReal", "scattered", nvr, [&] {
+                Check(fmi2SetReal(c, vr.data(), nvr, values.data()));
+            });
+        }
+    }
+
+
+    void BenchDoStep(fmi2Component c)
+    {
+        double t = 0.0;
+        Run("fmi2DoStep", "", 0, [&] {
+            Check(fmi2DoStep(c, t, 0.001, fmi2True));
+            t += 0.001;
+        });
+    }
+
+
+    void BenchState(fmi2Component c)
+    {
+        fmi2FMUstate state = nullptr;
+        Check(fmi2GetFMUstate(c, &state));
+        Run("fmi2GetFMUstate", "reuse", BENCH_VARIABLE_COUNT, [&] {
+            Check(fmi2GetFMUstate(c, &state));
+        });
+        Run("fmi2GetFMUstate", "new", BENCH_VARIABLE_COUNT, [&] {
+            fmi2FMUstate s = nullptr;
+            Check(fmi2GetFMUstate(c, &s));
+            Check(fmi2FreeFMUstate(c, &s));
+        });
+        Run("fmi2SetFMUstate", "", BENCH_VARIABLE_COUNT, [&] {
+            Check(fmi2SetFMUstate(c, state));
+        });
+
+        std::size_t size = 0;
+        Check(fmi2SerializedFMUstateSize(c, state, &size));
+        std::vector<fmi2Byte> data(size);
+        Run("fmi2SerializeFMUstate", "", size, [&] {
+            std::size_t sz = 0;
+            Check(fmi2SerializedFMUstateSize(c, state, &sz));
+            Check(fmi2SerializeFMUstate(c, state, data.data(), sz));
+        });
+        Run("fmi2DeSerializeFMUstate", "", size, [&] {
+            fmi2FMUstate s = nullptr;
+            Check(fmi2DeSerializeFMUstate(c, data.data(), data.size(), &s));
+            Check(fmi2FreeFMUstate(c, &s));
+        });
+        Check(fmi2FreeFMUstate(c, &state));
+    }
+
+
+    void BenchCompression(const char* variant, const std::vector<fmi2Byte>& state)
+    {
+        std::vector<fmi2Byte> compressed(state.size());
+        std::vector<fmi2Byte> decompressed(state.size());
+        std::size_t n = 0;
+        Run("CompressState", variant, state.size(), [&] {
+            n = cppfmu::CompressState(state.data(), state.size(), compressed.data());
+        });
+        Run("DecompressState", variant, state.size(), [&] {
+            cppfmu::DecompressState(compressed.data(), n, decompressed.data());
+        });
+        if (decompressed != state) throw std::runtime_error("Compression failed");
+        std::printf(
+            "{\"benchmark\": \"CompressState\", \"variant\": \"%s\", \"n\": %lu, "
+            "\"compressed_size\": %lu, \"ratio\": %.2f}\n",
+            variant,
+            static_cast<unsigned long>(state.size()),
+            static_cast<unsigned long>(n),
+            static_cast<double>(state.size()) / n);
+        std::fflush(stdout);
+    }
+
+
+    void BenchCompression(fmi2Component c)
+    {
+        // The state of the benchmark slave
+        fmi2FMUstate s = nullptr;
+        Check(fmi2GetFMUstate(c, &s));
+        std::size_t size = 0;
+        Check(fmi2SerializedFMUstateSize(c, s, &size));
+        std::vector<fmi2Byte> state(size);
+        Check(fmi2SerializeFMUstate(c, s, state.data(), size));
+        Check(fmi2FreeFMUstate(c, &s));
+        BenchCompression("fmu state", state);
+
+        // Arrays of zeros, repeated values and slowly varying values
+        std::vector<double> values(BENCH_VARIABLE_COUNT);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            const auto block = 3 * i / values.size();
+            values[i] = block == 0 ? 0.0 : block == 1 ? 1.5 : std::sin(i * 1e-3);
+        }
+        const auto write = [&] (cppfmu::StateWriter& w) {
+            w.BeginSection(1);
+            w.WriteArray(values.data(), values.size());
+            w.EndSection();
+            return w.Finish();
+        };
+        cppfmu::StateWriter measure{GUID};
+        state.resize(write(measure));
+        cppfmu::StateWriter writer{state.data(), state.size(), GUID};
+        write(writer);
+        BenchCompression("mixed", state);
+
+        // Slowly varying values only
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            values[i] = 100.0 + std::sin(i * 1e-3);
+        }
+        cppfmu::StateWriter smoothWriter{state.data(), state.size(), GUID};
+        write(smoothWriter);
+        BenchCompression("smooth", state);
+    }
+
+
+    // Saves the state after every step, as for per-step rollback.
+    void BenchRollback(fmi2Component c, const char* variant)
+    {
+        double t = 0.0;
+        fmi2FMUstate state = nullptr;
+        Check(fmi2GetFMUstate(c, &state));
+        Run("fmi2DoStep+fmi2GetFMUstate", variant, BENCH_VARIABLE_COUNT, [&] {
+            Check(fmi2DoStep(c, t, 0.001, fmi2True));
+            t += 0.001;
+            Check(fmi2GetFMUstate(c, &state));
+        });
+        Run("fmi2SetFMUstate", variant, BENCH_VARIABLE_COUNT, [&] {
+            Check(fmi2SetFMUstate(c, state));
+        });
+        Check(fmi2FreeFMUstate(c, &state));
+    }
+
+
+    void BenchInstantiate()
+    {
+        Run("fmi2Instantiate+fmi2FreeInstance", "", 0, [&] {
+            const auto c = fmi2Instantiate(
+                "bench", fmi2CoSimulation, GUID, nullptr, &g_callbacks,
+                fmi2False, fmi2False);
+            if (c == nullptr) throw std::runtime_error("Instantiation failed");
+            fmi2FreeInstance(c);
+        });
+
+        // Many live instances at a time
+        const std::size_t count = 1000;
+        std::vector<fmi2Component> instances(count);
+        Run("fmi2Instantiate+fmi2FreeInstance", "1000 instances", count, [&] {
+            for (auto& c : instances) {
+                c = fmi2Instantiate(
+                    "bench", fmi2CoSimulation, GUID, nullptr, &g_callbacks,
+                    fmi2False, fmi2False);
+                if (c == nullptr) throw std::runtime_error("Instantiation failed");
+            }
+            for (const auto c : instances) fmi2FreeInstance(c);
+        });
+
+        // The smart pointer which holds the slave
+        struct Small { double x = 0.0; };
+        auto memory = cppfmu::Memory{g_callbacks};
+        std::vector<cppfmu::UniquePtr<Small>> objects(count);
+        Run("cppfmu::AllocateUnique+UniquePtr::reset", "1000 objects", count, [&] {
+            for (auto& p : objects) p = cppfmu::AllocateUnique<Small>(memory);
+            for (auto& p : objects) p.reset();
+        });
+    }
+
+
+    // Fills a map with 'n' elements and empties it again.
+    template<typename Map>
+    void FillAndClear(Map& map, int n)
+    {
+        for (int i = 0; i < n; ++i) map.emplace(i, static_cast<double>(i));
+        map.clear();
+    }
+
+
+    void BenchMemory()
+    {
+        const int n = 256;
+        auto memory = cppfmu::Memory{g_callbacks};
+        using Alloc = cppfmu::Allocator<std::pair<const int, double>>;
+        using Map = std::map<int, double, std::less<int>, Alloc>;
+        {
+            Map map{Alloc{memory}};
+            Run("std::map insert+clear", "host memory", n, [&] {
+                FillAndClear(map, n);
+            });
+        }
+        {
+            cppfmu::PoolMemory pool{memory};
+            Map map{Alloc{cppfmu::Memory{pool}}};
+            Run("std::map insert+clear", "PoolMemory", n, [&] {
+                FillAndClear(map, n);
+            });
+        }
+        {
+            cppfmu::PoolMemory pool{memory, false};
+            Map map{Alloc{cppfmu::Memory{pool}}};
+            Run("std::map insert+clear", "PoolMemory, not thread safe", n, [&] {
+                FillAndClear(map, n);
+            });
+        }
+#if CPPFMU_HAS_PMR
+        {
+            cppfmu::MemoryResource host{memory};
+            std::pmr::map<int, double> map{&host};
+            Run("std::map insert+clear", "pmr, host memory", n, [&] {
+                FillAndClear(map, n);
+            });
+        }
+        {
+            cppfmu::MemoryResource host{memory};
+            std::pmr::unsynchronized_pool_resource pool{&host};
+            std::pmr::map<int, double> map{&pool};
+            Run("std::map insert+clear", "pmr, unsynchronized_pool_resource", n, [&] {
+                FillAndClear(map, n);
+            });
+        }
+#endif
+    }
+
+
+    void BenchLogging(fmi2Component c)
+    {
+        double t = 0.0;
+        auto step = [&] {
+            Check(fmi2DoStep(c, t, 0.001, fmi2True));
+            t += 0.001;
+        };
+
+        Check(fmi2SetDebugLogging(c, fmi2False, 0, nullptr));
+        Run("fmi2DoStep", "debug logging off", 0, step);
+
+        const fmi2String enabled[] = {"cppfmu", "bench"};
+        Check(fmi2SetDebugLogging(c, fmi2True, 2, enabled));
+        Run("fmi2DoStep", "debug logging on, category enabled", 0, step);
+
+        const fmi2String disabled[] = {"cppfmu", "other1", "other2", "other3"};
+        Check(fmi2SetDebugLogging(c, fmi2True, 4, disabled));
+        Run("fmi2DoStep", "debug logging on, category disabled", 0, step);
+
+        Check(fmi2SetDebugLogging(c, fmi2False, 0, nullptr));
+    }
+
+
+    void BenchBufferedLogging(fmi2Component c)
+    {
+        double t = 0.0;
+        const fmi2String enabled[] = {"cppfmu", "bench"};
+        Check(fmi2SetDebugLogging(c, fmi2True, 2, enabled));
+        Run("fmi2DoStep", "debug logging on, category enabled, buffered", 0, [&] {
+            Check(fmi2DoStep(c, t, 0.001, fmi2True));
+            t += 0.001;
+        });
+        Check(fmi2SetDebugLogging(c, fmi2False, 0, nullptr));
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1) g_minSeconds = std::atof(argv[1]);
+    try {
+        const auto c = Instantiate("bench");
+        BenchGetSet(c);
+        BenchDoStep(c);
+        BenchState(c);
+        BenchRollback(c, "full");
+        BenchCompression(c);
+        BenchLogging(c);
+        Check(fmi2Terminate(c));
+        fmi2FreeInstance(c);
+
+        const auto ci = Instantiate(BENCH_INCREMENTAL_INSTANCE);
+        BenchRollback(ci, "incremental");
+        Check(fmi2Terminate(ci));
+        fmi2FreeInstance(ci);
+
+        const auto cb = Instantiate(BENCH_BUFFERED_INSTANCE);
+        BenchBufferedLogging(cb);
+        Check(fmi2Terminate(cb));
+        fmi2FreeInstance(cb);
+        BenchInstantiate();
+        BenchMemory();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -109,6 +109,8 @@ class CppFmuConan(ConanFile):
     def package_info(self):
         self.cpp_info.libs = ["cppfmu"]
         self.cpp_info.srcdirs = ["src"]
+        if self.settings.os in ["Linux", "FreeBSD"]:
+            self.cpp_info.system_libs = ["pthread"]
         if self.options.use_fmi_version == 1:
             self.output.info("Define fmi1")
             self.cpp_info.defines = ["CPPFMU_USE_FMI_1_0=1"]
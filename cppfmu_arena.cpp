@@ -0,0 +1,99 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_arena.hpp"
+
+#include <algorithm>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    // The offset of the usable memory in a chunk.
+    const std::size_t CHUNK_HEADER_SIZE = alignof(std::max_align_t) > 16
+        ? alignof(std::max_align_t)
+        : 16;
+}
+
+
+StepArena::StepArena(const Memory& memory, std::size_t chunkSize)
+    : m_memory{memory}
+    , m_chunkSize{std::max(chunkSize, CHUNK_HEADER_SIZE)}
+{
+}
+
+
+StepArena::~StepArena() CPPFMU_NOEXCEPT
+{
+    FreeChunks();
+}
+
+
+void* StepArena::AllocateSlow(std::size_t size, std::size_t alignment)
+{
+    // Allocate a new chunk which is large enough for this and, preferably,
+    // many subsequent allocations.
+    const auto maxSize = static_cast<std::size_t>(-1);
+    if (size > maxSize - CHUNK_HEADER_SIZE - alignment) throw std::bad_alloc();
+    const auto chunkSize = std::max(m_chunkSize, CHUNK_HEADER_SIZE + size + alignment);
+    const auto chunk = static_cast<Chunk*>(m_memory.Alloc(1, chunkSize));
+    if (chunk == nullptr) throw std::bad_alloc();
+    chunk->next = m_chunks;
+    chunk->size = chunkSize;
+    m_chunks = chunk;
+    m_capacity += chunkSize;
+    m_next = reinterpret_cast<unsigned char*>(chunk) + CHUNK_HEADER_SIZE;
+    m_available = chunkSize - CHUNK_HEADER_SIZE;
+    return Allocate(size, alignment);
+}
+
+
+void StepArena::FreeChunks() CPPFMU_NOEXCEPT
+{
+    while (m_chunks != nullptr) {
+        const auto next = m_chunks->next;
+        m_memory.Free(m_chunks);
+        m_chunks = next;
+    }
+    m_next = nullptr;
+    m_available = 0;
+    m_capacity = 0;
+}
+
+
+void StepArena::Reset() CPPFMU_NOEXCEPT
+{
+    if (m_chunks == nullptr) return;
+    if (m_chunks->next != nullptr) {
+        // More than one chunk was needed, so replace them with a single
+        // chunk that is large enough for all the allocations.  If that
+        // fails, keep using the most recent chunk.
+        const auto total = m_capacity;
+        const auto chunk = static_cast<Chunk*>(m_memory.Alloc(1, total));
+        if (chunk != nullptr) {
+            FreeChunks();
+            chunk->next = nullptr;
+            chunk->size = total;
+            m_chunks = chunk;
+            m_capacity = total;
+        } else {
+            auto c = m_chunks->next;
+            m_chunks->next = nullptr;
+            while (c != nullptr) {
+                const auto next = c->next;
+                m_memory.Free(c);
+                c = next;
+            }
+            m_capacity = m_chunks->size;
+        }
+    }
+    m_next = reinterpret_cast<unsigned char*>(m_chunks) + CHUNK_HEADER_SIZE;
+    m_available = m_chunks->size - CHUNK_HEADER_SIZE;
+}
+
+
+} // namespace cppfmu
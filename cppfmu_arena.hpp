@@ -0,0 +1,153 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_ARENA_HPP
+#define CPPFMU_ARENA_HPP
+
+#include <cstddef>  // std::size_t, std::max_align_t
+#include <cstdint>  // std::uintptr_t
+#include <new>      // std::bad_alloc
+#include <vector>   // std::vector
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// SCRATCH MEMORY
+// ============================================================================
+
+/* A monotonic ("bump") allocator for temporary objects.
+ *
+ * Memory is handed out from large chunks obtained from the simulation
+ * environment through a cppfmu::Memory object.  Individual allocations are
+ * never freed; instead, Reset() makes all the memory available again at
+ * once.  The chunks are kept across resets, and if a cycle needed more than
+ * one chunk, they are replaced by a single chunk large enough for all of
+ * it.  After a few cycles, allocating from the arena therefore requires no
+ * calls to the simulation environment at all.
+ *
+ * A slave can pass a StepArena to SlaveInstance::UseStepArena() to have it
+ * reset automatically after each call to DoStep().  Scratch containers
+ * used within DoStep() can then allocate their memory from it through
+ * ArenaAllocator.  Needless to say, no such object may outlive the step.
+ *
+ * A StepArena is not thread safe.
+ */
+class StepArena
+{
+public:
+    /* Creates an arena which allocates chunks of at least 'chunkSize' bytes
+     * from 'memory'.  No memory is allocated until it is needed.
+     */
+    explicit StepArena(const Memory& memory, std::size_t chunkSize = 64 * 1024);
+
+    ~StepArena() CPPFMU_NOEXCEPT;
+
+    StepArena(const StepArena&) = delete;
+    StepArena& operator=(const StepArena&) = delete;
+
+    /* Allocates 'size' bytes aligned to 'alignment', which must be a power
+     * of two.  Throws std::bad_alloc if memory is exhausted.
+     */
+    void* Allocate(
+        std::size_t size,
+        std::size_t alignment = alignof(std::max_align_t))
+    {
+        const auto p = reinterpret_cast<std::uintptr_t>(m_next);
+        const auto aligned = (p + alignment - 1) & ~(alignment - 1);
+        if (m_next == nullptr || aligned - p > m_available ||
+                size > m_available - (aligned - p)) {
+            return AllocateSlow(size, alignment);
+        }
+        m_available -= (aligned - p) + size;
+        m_next = reinterpret_cast<unsigned char*>(aligned + size);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // Makes all the memory allocated from the arena available again.
+    void Reset() CPPFMU_NOEXCEPT;
+
+    // Returns the number of bytes obtained from the simulation environment.
+    std::size_t Capacity() const CPPFMU_NOEXCEPT { return m_capacity; }
+
+private:
+    struct Chunk
+    {
+        Chunk* next;
+        std::size_t size;
+    };
+
+    void* AllocateSlow(std::size_t size, std::size_t alignment);
+    void FreeChunks() CPPFMU_NOEXCEPT;
+
+    Memory m_memory;
+    std::size_t m_chunkSize;
+    // The chunks, most recently allocated first.
+    Chunk* m_chunks = nullptr;
+    unsigned char* m_next = nullptr;
+    std::size_t m_available = 0;
+    std::size_t m_capacity = 0;
+};
+
+
+/* A class that satisfies the Allocator concept, and which allocates memory
+ * from a StepArena.  Deallocation is a no-op; the memory is reclaimed when
+ * the arena is reset.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(StepArena& arena) CPPFMU_NOEXCEPT : m_arena{&arena} { }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) CPPFMU_NOEXCEPT
+        : m_arena{other.m_arena}
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T)) throw std::bad_alloc();
+        return static_cast<T*>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* /*p*/, std::size_t /*n*/) CPPFMU_NOEXCEPT
+    {
+    }
+
+    bool operator==(const ArenaAllocator& rhs) const CPPFMU_NOEXCEPT
+    {
+        return m_arena == rhs.m_arena;
+    }
+
+    bool operator!=(const ArenaAllocator& rhs) const CPPFMU_NOEXCEPT
+    {
+        return !operator==(rhs);
+    }
+
+    template<typename U>
+    struct rebind { using other = ArenaAllocator<U>; };
+
+private:
+    template<typename U>
+    friend class ArenaAllocator;
+
+    StepArena* m_arena;
+};
+
+
+// An alias for a vector which allocates its memory from a StepArena.
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+} // namespace cppfmu
+#endif // header guard
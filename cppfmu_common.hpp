@@ -8,6 +8,7 @@
 
 #include <algorithm>    // std::find()
 #include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
 #include <functional>   // std::function
 #include <memory>       // std::shared_ptr, std::unique_ptr
 #include <new>          // std::bad_alloc
@@ -112,34 +113,63 @@ public:
 // ============================================================================
 
 
+/* An interface for memory allocators which can be used as the source of a
+ * cppfmu::Memory object, instead of the FMI memory callbacks.  An example
+ * is cppfmu::PoolMemory.
+ *
+ * Like the FMI callback 'allocateMemory', Allocate() must return memory
+ * that is initialised to zero (or null on failure), and Free() must accept
+ * null pointers.
+ */
+class MemorySource
+{
+public:
+    virtual void* Allocate(std::size_t nObj, std::size_t size) CPPFMU_NOEXCEPT = 0;
+    virtual void Free(void* ptr) CPPFMU_NOEXCEPT = 0;
+
+protected:
+    ~MemorySource() = default;
+};
+
+
 /* A wrapper class for the FMI memory allocation and deallocation functions.
  * Alloc() and Free() simply forward to the functions provided by the
- * simulation environment.
+ * simulation environment, or to a MemorySource.
  */
 class Memory
 {
 public:
     explicit Memory(const FMICallbackFunctions& callbackFunctions)
         : m_alloc{callbackFunctions.allocateMemory}
-        , m_free{callbackFunctions.freeMemory}
     {
+        m_free = callbackFunctions.freeMemory;
+    }
+
+    /* Creates a Memory object which forwards to 'source'.  The source is
+     * not copied, so it must outlive this object and all copies of it.
+     */
+    explicit Memory(MemorySource& source) CPPFMU_NOEXCEPT
+        : m_alloc{nullptr}
+    {
+        m_source = &source;
     }
 
     // Allocates memory for 'nObj' objects of size 'size'.
     void* Alloc(std::size_t nObj, std::size_t size) CPPFMU_NOEXCEPT
     {
-        return m_alloc(nObj, size);
+        return m_alloc ? m_alloc(nObj, size) : m_source->Allocate(nObj, size);
     }
 
     // Frees the memory pointed to by 'ptr'.
     void Free(void* ptr) CPPFMU_NOEXCEPT
     {
-        m_free(ptr);
+        if (m_alloc) m_free(ptr); else m_source->Free(ptr);
     }
 
     bool operator==(const Memory& rhs) const CPPFMU_NOEXCEPT
     {
-        return m_alloc == rhs.m_alloc && m_free == rhs.m_free;
+        return m_alloc == rhs.m_alloc
+            && (m_alloc ? m_free == rhs.m_free : m_source == rhs.m_source);
     }
 
     bool operator!=(const Memory& rhs) const CPPFMU_NOEXCEPT
@@ -148,8 +178,18 @@ public:
     }
 
 private:
+    friend class UniqueDeleter;
+
+    // Creates an object which must not be used for allocation.
+    Memory() CPPFMU_NOEXCEPT : m_alloc{nullptr} { m_source = nullptr; }
+
+    // If m_alloc is null, m_source is used.
     FMICallbackAllocateMemory m_alloc;
-    FMICallbackFreeMemory m_free;
+    union
+    {
+        FMICallbackFreeMemory m_free;
+        MemorySource* m_source;
+    };
 };
 
 
@@ -291,9 +331,15 @@ void Delete(const Memory& memory, T* obj) CPPFMU_NOEXCEPT
 }
 
 
+#ifdef CPPFMU_USE_STD_FUNCTION_DELETER
+
 /* An alias for a std::unique_ptr specialisation where the deleter is general
  * and independent of the type of the object pointed to.  This is used for the
  * return type of AllocateUnique() below.
+ *
+ * This is the deleter type used by earlier versions of CPPFMU, which is
+ * kept for code that constructs UniquePtr objects with its own deleters.
+ * It will be removed in a future version.
  */
 template<typename T>
 using UniquePtr = std::unique_ptr<T, std::function<void(void*)>>;
@@ -311,13 +357,99 @@ UniquePtr<T> AllocateUnique(const Memory& memory, Args&&... args)
         [memory] (void* ptr) { Delete(memory, reinterpret_cast<T*>(ptr)); }};
 }
 
+#else
+
+/* The deleter of cppfmu::UniquePtr.
+ *
+ * It holds the Memory object which the object was allocated from, and a
+ * pointer to a function which destroys an object of the type that was
+ * originally allocated.  It is thus independent of the type of the object
+ * pointed to, so that UniquePtr<Derived> can be converted to UniquePtr<Base>,
+ * but unlike std::function, it never allocates memory and calling it does
+ * not involve more than one indirect call.
+ *
+ * A default-constructed deleter does nothing.
+ */
+class UniqueDeleter
+{
+public:
+    using DestroyFunction = void (*)(const Memory&, void*);
+
+    UniqueDeleter() CPPFMU_NOEXCEPT : m_destroy{nullptr} { }
+
+    UniqueDeleter(const Memory& memory, DestroyFunction destroy) CPPFMU_NOEXCEPT
+        : m_memory(memory), m_destroy{destroy}
+    {
+    }
+
+    // Creates a deleter which uses cppfmu::Delete() to destroy a T object.
+    template<typename T>
+    static UniqueDeleter For(const Memory& memory) CPPFMU_NOEXCEPT
+    {
+        return UniqueDeleter{memory, &DestroyObject<T>};
+    }
+
+    void operator()(void* ptr) const CPPFMU_NOEXCEPT
+    {
+        if (m_destroy) m_destroy(m_memory, ptr);
+    }
+
+private:
+    template<typename T>
+    static void DestroyObject(const Memory& memory, void* ptr) CPPFMU_NOEXCEPT
+    {
+        Delete(memory, reinterpret_cast<T*>(ptr));
+    }
+
+    Memory m_memory;
+    DestroyFunction m_destroy;
+};
+
+
+/* An alias for a std::unique_ptr specialisation where the deleter is general
+ * and independent of the type of the object pointed to.  This is used for the
+ * return type of AllocateUnique() below.
+ *
+ * Earlier versions of CPPFMU used std::function<void(void*)> as the deleter.
+ * Code which depends on this can define CPPFMU_USE_STD_FUNCTION_DELETER
+ * (for all translation units, including fmi_functions.cpp) while it is
+ * being migrated.
+ */
+template<typename T>
+using UniquePtr = std::unique_ptr<T, UniqueDeleter>;
+
+
+/* Creates an object of type T which is managed by a std::unique_ptr.
+ * The object is created using cppfmu::New(), and when the time comes, it is
+ * destroyed using cppfmu::Delete().
+ */
+template<typename T, typename... Args>
+UniquePtr<T> AllocateUnique(const Memory& memory, Args&&... args)
+{
+    return UniquePtr<T>{
+        New<T>(memory, std::forward<Args>(args)...),
+        UniqueDeleter::For<T>(memory)};
+}
+
+#endif // CPPFMU_USE_STD_FUNCTION_DELETER
+
 
 // ============================================================================
 // LOGGING
 // ============================================================================
 
+class LogBuffer;
+
 namespace detail
 {
+    // Formats a message and adds it to 'buffer'.  Defined in cppfmu_logging.cpp.
+    void BufferLogMessage(
+        LogBuffer& buffer,
+        FMIStatus status,
+        FMIString category,
+        FMIString format,
+        ...) CPPFMU_NOEXCEPT;
+
     template<typename Container, typename Item>
     bool CanFind(const Container& container, const Item& item)
     {
@@ -329,20 +461,93 @@ namespace detail
 }
 
 
+/* A handle to a log category which has been registered with
+ * Logger::RegisterCategory().
+ */
+class LogCategory
+{
+public:
+    // The index of the category, in the order of registration.
+    unsigned Id() const CPPFMU_NOEXCEPT { return m_id; }
+
+private:
+    friend class Logger;
+    explicit LogCategory(unsigned id) CPPFMU_NOEXCEPT : m_id{id} { }
+
+    unsigned m_id;
+};
+
+
 /* A class that can be used to log messages from model code.  All messages are
  * forwarded to the logging facilities provided by the simulation environment.
+ *
+ * Messages may be logged under arbitrary category names, in which case the
+ * logger has to search the list of categories enabled by the simulation
+ * environment every time.  Alternatively, the model can register up to
+ * MAX_CATEGORIES categories up front (typically when it is instantiated),
+ * and log messages using the returned LogCategory handles.  Whether such a
+ * category is enabled is then determined by a single bit test.
+ *
+ * By default, messages are passed to the simulation environment right
+ * away.  If EnableBuffering() has been called, messages with other
+ * statuses than FMIError and FMIFatal are instead formatted into a buffer,
+ * which is flushed
+ * at the end of each time step, when the slave is terminated, and before
+ * any message with status FMIError or FMIFatal is logged.
  */
 class Logger
 {
 public:
+    // The maximum number of categories that can be registered.
+    static const unsigned MAX_CATEGORIES = 64;
+
+    /* Settings which are shared by all copies of a Logger.
+     *
+     * Update() must be called after 'debugLoggingEnabled' or
+     * 'loggedCategories' has been changed.
+     */
     struct Settings
     {
         Settings(const Memory& memory)
             : loggedCategories(Allocator<String>{memory})
+            , registeredCategories(Allocator<String>{memory})
+            , memory(memory)
         { }
 
         bool debugLoggingEnabled = false;
         std::vector<String, Allocator<String>> loggedCategories;
+
+        // The categories registered with Logger::RegisterCategory().
+        std::vector<String, Allocator<String>> registeredCategories;
+
+        /* The registered categories which are currently enabled for Log()
+         * and DebugLog(), respectively, with bit i corresponding to the
+         * category with ID i.
+         */
+        std::uint64_t enabledCategories = ~std::uint64_t{0};
+        std::uint64_t debugCategories = 0;
+
+        // Used for allocating the message buffer.
+        Memory memory;
+
+        // The message buffer, if buffering is enabled.
+        UniquePtr<LogBuffer> buffer;
+
+        // Recomputes the category masks.
+        void Update()
+        {
+            auto mask = ~std::uint64_t{0};
+            if (!loggedCategories.empty()) {
+                mask = 0;
+                for (std::size_t i = 0; i < registeredCategories.size(); ++i) {
+                    if (detail::CanFind(loggedCategories, registeredCategories[i])) {
+                        mask |= std::uint64_t{1} << i;
+                    }
+                }
+            }
+            enabledCategories = mask;
+            debugCategories = debugLoggingEnabled ? mask : 0;
+        }
     };
 
     Logger(
@@ -367,13 +572,7 @@ public:
     {
         if (m_settings->loggedCategories.empty() ||
             detail::CanFind(m_settings->loggedCategories, category)) {
-            m_fmiLogger(
-                m_component,
-                m_instanceName.c_str(),
-                status,
-                category,
-                message,
-                std::forward<Args>(args)...);
+            Emit(status, category, message, std::forward<Args>(args)...);
         }
     }
 
@@ -396,7 +595,126 @@ public:
         }
     }
 
+    /* Registers a log category and returns a handle to it.  If a category
+     * with the same name has already been registered, its handle is
+     * returned.  Throws std::length_error if MAX_CATEGORIES categories have
+     * already been registered.
+     */
+    LogCategory RegisterCategory(FMIString name)
+    {
+        auto& categories = m_settings->registeredCategories;
+        for (std::size_t i = 0; i < categories.size(); ++i) {
+            if (categories[i] == name) return LogCategory{static_cast<unsigned>(i)};
+        }
+        if (categories.size() >= MAX_CATEGORIES) {
+            throw std::length_error("Too many log categories");
+        }
+        categories.push_back(String{name, categories.get_allocator()});
+        m_settings->Update();
+        return LogCategory{static_cast<unsigned>(categories.size() - 1)};
+    }
+
+    // Returns the name of a registered category.
+    FMIString CategoryName(LogCategory category) const CPPFMU_NOEXCEPT
+    {
+        return m_settings->registeredCategories[category.Id()].c_str();
+    }
+
+    // Returns whether messages in a registered category are logged by Log().
+    bool Enabled(LogCategory category) const CPPFMU_NOEXCEPT
+    {
+        return (m_settings->enabledCategories >> category.Id()) & 1u;
+    }
+
+    // Returns whether messages in a registered category are logged by DebugLog().
+    bool DebugEnabled(LogCategory category) const CPPFMU_NOEXCEPT
+    {
+        return (m_settings->debugCategories >> category.Id()) & 1u;
+    }
+
+    // Returns whether messages in an arbitrary category are logged by Log().
+    bool Enabled(FMIString category) const CPPFMU_NOEXCEPT
+    {
+        return m_settings->loggedCategories.empty() ||
+            detail::CanFind(m_settings->loggedCategories, category);
+    }
+
+    // Returns whether messages in an arbitrary category are logged by DebugLog().
+    bool DebugEnabled(FMIString category) const CPPFMU_NOEXCEPT
+    {
+        return m_settings->debugLoggingEnabled && Enabled(category);
+    }
+
+    // Logs a message in a registered category.
+    template<typename... Args>
+    void Log(
+        FMIStatus status,
+        LogCategory category,
+        FMIString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        if (Enabled(category)) {
+            Emit(status, CategoryName(category), message, std::forward<Args>(args)...);
+        }
+    }
+
+    // Logs a debug message in a registered category.
+    template<typename... Args>
+    void DebugLog(
+        FMIStatus status,
+        LogCategory category,
+        FMIString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        if (DebugEnabled(category)) {
+            Emit(status, CategoryName(category), message, std::forward<Args>(args)...);
+        }
+    }
+
+    /* Enables buffering of messages (see the class documentation), with
+     * room for 'capacity' messages.  Messages which are logged while the
+     * buffer is full are discarded, and the number of discarded messages is
+     * reported when the buffer is flushed.  Buffering applies to all copies
+     * of the logger, and cannot be disabled again.
+     *
+     * This function is not thread safe, and should typically be called
+     * from the slave's constructor.  Defined in cppfmu_logging.cpp.
+     */
+    void EnableBuffering(std::size_t capacity = 128);
+
+    /* Passes all buffered messages on to the simulation environment.
+     * Does nothing if buffering is not enabled.
+     */
+    void Flush() CPPFMU_NOEXCEPT;
+
 private:
+    template<typename... Args>
+    void Emit(
+        FMIStatus status,
+        FMIString category,
+        FMIString message,
+        Args&&... args) CPPFMU_NOEXCEPT
+    {
+        const auto buffer = m_settings->buffer.get();
+        if (buffer != nullptr && status != FMIError && status != FMIFatal) {
+            detail::BufferLogMessage(
+                *buffer,
+                status,
+                category,
+                message,
+                std::forward<Args>(args)...);
+            return;
+        }
+        if (buffer != nullptr) Flush();
+        m_fmiLogger(
+            m_component,
+            m_instanceName.c_str(),
+            status,
+            category,
+            message,
+            std::forward<Args>(args)...);
+    }
+
     const FMIComponentEnvironment m_component;
     const String m_instanceName;
     const FMICallbackLogger m_fmiLogger;
@@ -405,4 +723,94 @@ private:
 
 
 } // namespace cppfmu
+
+
+// ============================================================================
+// COMPILE-TIME LOG FILTERING
+// ============================================================================
+
+/* Log levels, for use with CPPFMU_MIN_LOG_LEVEL and the logging macros
+ * below.
+ */
+#define CPPFMU_LOG_LEVEL_TRACE 0
+#define CPPFMU_LOG_LEVEL_DEBUG 1
+#define CPPFMU_LOG_LEVEL_INFO 2
+#define CPPFMU_LOG_LEVEL_WARNING 3
+#define CPPFMU_LOG_LEVEL_ERROR 4
+#define CPPFMU_LOG_LEVEL_NONE 5
+
+/* The lowest log level which is compiled in.  By default, all levels are.
+ *
+ * For release builds, this may be defined to e.g. CPPFMU_LOG_LEVEL_INFO, in
+ * which case the CPPFMU_LOG_TRACE() and CPPFMU_LOG_DEBUG() statements are
+ * removed entirely, and their arguments are never evaluated.  It should be
+ * defined for the whole build (with CMake, by setting the cache variable
+ * CPPFMU_MIN_LOG_LEVEL), not in individual source files.
+ */
+#ifndef CPPFMU_MIN_LOG_LEVEL
+#   define CPPFMU_MIN_LOG_LEVEL CPPFMU_LOG_LEVEL_TRACE
+#endif
+
+/* Whether messages at the given level are compiled in, for use in
+ * conditions which should be resolved at compile time, e.g.
+ *
+ *     if (CPPFMU_LOG_LEVEL_ENABLED(CPPFMU_LOG_LEVEL_DEBUG)) {
+ *         // Expensive diagnostics
+ *     }
+ *
+ * This is a macro rather than a function so that it is evaluated with the
+ * CPPFMU_MIN_LOG_LEVEL of the translation unit which uses it.
+ */
+#define CPPFMU_LOG_LEVEL_ENABLED(level) ((level) >= CPPFMU_MIN_LOG_LEVEL)
+
+
+/* Logging macros.
+ *
+ *     CPPFMU_LOG_TRACE(logger, category, message, args...)
+ *     CPPFMU_LOG_DEBUG(logger, category, message, args...)
+ *     CPPFMU_LOG_INFO(logger, category, message, args...)
+ *     CPPFMU_LOG_WARNING(logger, category, message, args...)
+ *     CPPFMU_LOG_ERROR(logger, category, message, args...)
+ *
+ * 'logger' is a cppfmu::Logger, and 'category' may be a string or a
+ * cppfmu::LogCategory.  TRACE and DEBUG messages are logged with
+ * Logger::DebugLog() and status FMIOK, and the others with Logger::Log()
+ * and status FMIOK, FMIWarning and FMIError, respectively.
+ *
+ * Unlike the Logger functions, the macros check whether the message will
+ * be logged before evaluating 'args'.  Levels below CPPFMU_MIN_LOG_LEVEL
+ * expand to code which is never executed (but still compiled, so that it
+ * stays valid).
+ */
+#define CPPFMU_DETAIL_LOG(level, enabledFn, logFn, status, logger, category, ...) \
+    do { \
+        if (CPPFMU_LOG_LEVEL_ENABLED(level)) { \
+            auto& cppfmuLogger_ = (logger); \
+            const auto& cppfmuCategory_ = (category); \
+            if (cppfmuLogger_.enabledFn(cppfmuCategory_)) { \
+                cppfmuLogger_.logFn(status, cppfmuCategory_, __VA_ARGS__); \
+            } \
+        } \
+    } while (false)
+
+#define CPPFMU_LOG_TRACE(logger, category, ...) \
+    CPPFMU_DETAIL_LOG(CPPFMU_LOG_LEVEL_TRACE, DebugEnabled, DebugLog, \
+        ::cppfmu::FMIOK, logger, category, __VA_ARGS__)
+
+#define CPPFMU_LOG_DEBUG(logger, category, ...) \
+    CPPFMU_DETAIL_LOG(CPPFMU_LOG_LEVEL_DEBUG, DebugEnabled, DebugLog, \
+        ::cppfmu::FMIOK, logger, category, __VA_ARGS__)
+
+#define CPPFMU_LOG_INFO(logger, category, ...) \
+    CPPFMU_DETAIL_LOG(CPPFMU_LOG_LEVEL_INFO, Enabled, Log, \
+        ::cppfmu::FMIOK, logger, category, __VA_ARGS__)
+
+#define CPPFMU_LOG_WARNING(logger, category, ...) \
+    CPPFMU_DETAIL_LOG(CPPFMU_LOG_LEVEL_WARNING, Enabled, Log, \
+        ::cppfmu::FMIWarning, logger, category, __VA_ARGS__)
+
+#define CPPFMU_LOG_ERROR(logger, category, ...) \
+    CPPFMU_DETAIL_LOG(CPPFMU_LOG_LEVEL_ERROR, Enabled, Log, \
+        ::cppfmu::FMIError, logger, category, __VA_ARGS__)
+
 #endif // header guard
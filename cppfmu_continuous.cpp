@@ -0,0 +1,1027 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_continuous.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+#include "cppfmu_derivatives.hpp"
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    // The number of state-sized buffers: the states, a scratch state, the
+    // seven stages of the Dormand-Prince method, and the states and
+    // derivatives at both ends of the last step, for event location.
+    const std::size_t BUFFER_COUNT = 12;
+
+    // The alignment of the buffers, in bytes and in elements.
+    const std::size_t BUFFER_ALIGNMENT = 64;
+    const std::size_t BUFFER_STRIDE_UNIT = BUFFER_ALIGNMENT / sizeof(FMIReal);
+
+    // Step size control parameters for the Dormand-Prince method.
+    const FMIReal SAFETY_FACTOR = 0.9;
+    const FMIReal MIN_FACTOR = 0.2;
+    const FMIReal MAX_FACTOR = 5.0;
+
+    // Dormand-Prince 5(4) coefficients.
+    const FMIReal C2 = 1.0/5, C3 = 3.0/10, C4 = 4.0/5, C5 = 8.0/9;
+    const FMIReal A21 = 1.0/5;
+    const FMIReal A31 = 3.0/40, A32 = 9.0/40;
+    const FMIReal A41 = 44.0/45, A42 = -56.0/15, A43 = 32.0/9;
+    const FMIReal A51 = 19372.0/6561, A52 = -25360.0/2187,
+        A53 = 64448.0/6561, A54 = -212.0/729;
+    const FMIReal A61 = 9017.0/3168, A62 = -355.0/33, A63 = 46732.0/5247,
+        A64 = 49.0/176, A65 = -5103.0/18656;
+    const FMIReal A71 = 35.0/384, A73 = 500.0/1113, A74 = 125.0/192,
+        A75 = -2187.0/6784, A76 = 11.0/84;
+    // Differences between the 5th and 4th order weights.
+    const FMIReal E1 = 71.0/57600, E3 = -71.0/16695, E4 = 71.0/1920,
+        E5 = -17253.0/339200, E6 = 22.0/525, E7 = -1.0/40;
+
+    // The ROS2 method's diagonal coefficient, 1 + 1/sqrt(2).
+    const FMIReal GAMMA = 1.7071067811865475;
+
+    // The relative change in step size which the iteration matrix of the
+    // Rosenbrock method is allowed to lag behind.  (Being a W-method, it
+    // remains of second order with any matrix, but this is not the place
+    // to stretch that.)
+    const FMIReal REFACTORIZATION_THRESHOLD = 1e-9;
+
+    // The range of step size factors for which the Rosenbrock method keeps
+    // its step size, so the iteration matrix can be reused.
+    const FMIReal HOLD_MIN_FACTOR = 1.0;
+    const FMIReal HOLD_MAX_FACTOR = 1.5;
+
+    /* Computes the LU factorisation, with partial pivoting, of the n-by-n
+     * row-major matrix 'a', in place.  Returns false if it is singular.
+     */
+    bool Factorize(FMIReal* a, std::size_t* pivots, std::size_t n)
+        CPPFMU_NOEXCEPT
+    {
+        for (std::size_t k = 0; k < n; ++k) {
+            auto p = k;
+            for (std::size_t i = k + 1; i < n; ++i) {
+                if (std::fabs(a[i*n + k]) > std::fabs(a[p*n + k])) p = i;
+            }
+            pivots[k] = p;
+            if (a[p*n + k] == 0.0) return false;
+            if (p != k) {
+                std::swap_ranges(a + k*n, a + (k + 1)*n, a + p*n);
+            }
+            const auto rowK = a + k*n;
+            const auto inverse = 1.0 / rowK[k];
+            for (std::size_t i = k + 1; i < n; ++i) {
+                const auto rowI = a + i*n;
+                const auto m = rowI[k] * inverse;
+                rowI[k] = m;
+                if (m == 0.0) continue;
+                for (std::size_t j = k + 1; j < n; ++j) rowI[j] -= m * rowK[j];
+            }
+        }
+        return true;
+    }
+
+    // Solves a x = b, where 'a' has been factorised by Factorize(), in place.
+    void Solve(const FMIReal* a, const std::size_t* pivots, FMIReal* b, std::size_t n)
+        CPPFMU_NOEXCEPT
+    {
+        for (std::size_t k = 0; k < n; ++k) {
+            if (pivots[k] != k) std::swap(b[k], b[pivots[k]]);
+        }
+        for (std::size_t i = 1; i < n; ++i) {
+            const auto rowI = a + i*n;
+            FMIReal sum = b[i];
+            for (std::size_t j = 0; j < i; ++j) sum -= rowI[j] * b[j];
+            b[i] = sum;
+        }
+        for (std::size_t i = n; i-- > 0; ) {
+            const auto rowI = a + i*n;
+            FMIReal sum = b[i];
+            for (std::size_t j = i + 1; j < n; ++j) sum -= rowI[j] * b[j];
+            b[i] = sum / rowI[i];
+        }
+    }
+
+    /* The band storage of an n-by-n matrix with 'kl' subdiagonals and 'ku'
+     * superdiagonals, as used by BandFactorize() and BandSolve(): each
+     * column j holds the elements of rows j-kl-ku through j+kl, of which
+     * the first 'kl' are room for fill-in from row interchanges.  The
+     * matrix has 2*kl + ku + 1 such rows.
+     */
+    std::size_t BandIndex(
+        std::size_t kl,
+        std::size_t ku,
+        std::size_t i,
+        std::size_t j) CPPFMU_NOEXCEPT
+    {
+        return j*(2*kl + ku + 1) + kl + ku + i - j;
+    }
+
+    /* Computes the LU factorisation, with partial pivoting, of a band
+     * matrix in place.  Returns false if it is singular.  (This is the
+     * algorithm of LAPACK's dgbtf2.)
+     */
+    bool BandFactorize(
+        FMIReal* ab,
+        std::size_t* pivots,
+        std::size_t n,
+        std::size_t kl,
+        std::size_t ku)
+        CPPFMU_NOEXCEPT
+    {
+        std::size_t ju = 0;
+        for (std::size_t j = 0; j < n; ++j) {
+            const auto km = std::min(kl, n - 1 - j);
+            auto p = j;
+            for (std::size_t i = j + 1; i <= j + km; ++i) {
+                if (std::fabs(ab[BandIndex(kl, ku, i, j)])
+                        > std::fabs(ab[BandIndex(kl, ku, p, j)])) {
+                    p = i;
+                }
+            }
+            pivots[j] = p;
+            if (ab[BandIndex(kl, ku, p, j)] == 0.0) return false;
+            // The last column which the row interchanges affect.
+            ju = std::max(ju, std::min(p + ku, n - 1));
+            if (p != j) {
+                for (auto c = j; c <= ju; ++c) {
+                    std::swap(
+                        ab[BandIndex(kl, ku, j, c)],
+                        ab[BandIndex(kl, ku, p, c)]);
+                }
+            }
+            const auto inverse = 1.0 / ab[BandIndex(kl, ku, j, j)];
+            for (std::size_t i = j + 1; i <= j + km; ++i) {
+                ab[BandIndex(kl, ku, i, j)] *= inverse;
+            }
+            for (auto c = j + 1; c <= ju; ++c) {
+                const auto u = ab[BandIndex(kl, ku, j, c)];
+                if (u == 0.0) continue;
+                for (std::size_t i = j + 1; i <= j + km; ++i) {
+                    ab[BandIndex(kl, ku, i, c)] -=
+                        ab[BandIndex(kl, ku, i, j)] * u;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Solves a x = b, where 'ab' has been factorised by BandFactorize().
+    void BandSolve(
+        const FMIReal* ab,
+        const std::size_t* pivots,
+        FMIReal* b,
+        std::size_t n,
+        std::size_t kl,
+        std::size_t ku)
+        CPPFMU_NOEXCEPT
+    {
+        for (std::size_t j = 0; j < n; ++j) {
+            if (pivots[j] != j) std::swap(b[j], b[pivots[j]]);
+            const auto km = std::min(kl, n - 1 - j);
+            for (std::size_t i = j + 1; i <= j + km; ++i) {
+                b[i] -= ab[BandIndex(kl, ku, i, j)] * b[j];
+            }
+        }
+        // U has kl + ku superdiagonals.
+        const auto ku2 = kl + ku;
+        for (std::size_t j = n; j-- > 0; ) {
+            b[j] /= ab[BandIndex(kl, ku, j, j)];
+            for (auto i = (j > ku2 ? j - ku2 : 0); i < j; ++i) {
+                b[i] -= ab[BandIndex(kl, ku, i, j)] * b[j];
+            }
+        }
+    }
+
+    void ThrowStepSizeTooSmall(FMIReal minStepSize, FMIReal t)
+    {
+        char msg[128];
+        std::snprintf(
+            msg, sizeof msg,
+            "Integrator step size fell below minimum (%g) at t=%g",
+            minStepSize, t);
+        throw std::runtime_error(msg);
+    }
+
+    /* Returns +1 if an event indicator which was 'before' and is now
+     * 'after' has risen through zero, -1 if it has fallen through zero,
+     * and 0 otherwise.  An indicator which starts at zero has just had its
+     * event, and does not cross.
+     */
+    int Crossing(FMIReal before, FMIReal after) CPPFMU_NOEXCEPT
+    {
+        if (before < 0.0 && after >= 0.0) return 1;
+        if (before > 0.0 && after <= 0.0) return -1;
+        return 0;
+    }
+
+    void ValidateSettings(const IntegratorSettings& settings)
+    {
+        if (!(settings.stepSize > 0.0)) {
+            throw std::invalid_argument("Integrator step size must be positive");
+        }
+        if (!(settings.relativeTolerance > 0.0)
+                || !(settings.absoluteTolerance > 0.0)) {
+            throw std::invalid_argument("Integrator tolerances must be positive");
+        }
+    }
+
+    // Whether 't' is so close to 'tEnd' that the remaining interval is
+    // only rounding error.
+    bool Reached(FMIReal t, FMIReal tEnd) CPPFMU_NOEXCEPT
+    {
+        return tEnd - t <= 1e-12 * std::max(std::fabs(tEnd), 1.0);
+    }
+}
+
+
+// =============================================================================
+// ContinuousSlave
+// =============================================================================
+
+
+ContinuousSlave::ContinuousSlave(
+    const Memory& memory,
+    std::size_t stateCount,
+    const IntegratorSettings& settings)
+    : m_memory{memory}
+    , m_n{stateCount}
+    , m_settings{settings}
+    , m_jacobian{Allocator<FMIReal>{memory}}
+    , m_lu{Allocator<FMIReal>{memory}}
+    , m_pivots{Allocator<std::size_t>{memory}}
+    , m_columnStarts{Allocator<std::size_t>{memory}}
+    , m_rowIndices{Allocator<std::size_t>{memory}}
+    , m_colorStarts{Allocator<std::size_t>{memory}}
+    , m_colorColumns{Allocator<std::size_t>{memory}}
+    , m_z0{Allocator<FMIReal>{memory}}
+    , m_z1{Allocator<FMIReal>{memory}}
+    , m_zm{Allocator<FMIReal>{memory}}
+    , m_directions{Allocator<int>{memory}}
+{
+    ValidateSettings(settings);
+
+    // All buffers are carved out of one block, each starting on a cache
+    // line boundary.
+    const auto stride = std::max(
+        (stateCount + BUFFER_STRIDE_UNIT - 1) / BUFFER_STRIDE_UNIT * BUFFER_STRIDE_UNIT,
+        BUFFER_STRIDE_UNIT);
+    if (stride > static_cast<std::size_t>(-1) / sizeof(FMIReal) / (BUFFER_COUNT + 1)) {
+        throw std::bad_alloc();
+    }
+    m_buffer = m_memory.Alloc(BUFFER_COUNT * stride + BUFFER_STRIDE_UNIT, sizeof(FMIReal));
+    if (m_buffer == nullptr) throw std::bad_alloc();
+
+    const auto address = reinterpret_cast<std::uintptr_t>(m_buffer);
+    auto p = reinterpret_cast<FMIReal*>(
+        (address + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT);
+    std::fill(p, p + BUFFER_COUNT * stride, 0.0);
+    m_x = p;
+    m_tmp = p + stride;
+    for (std::size_t i = 0; i < 7; ++i) m_k[i] = p + (i + 2) * stride;
+    m_xOld = p + 9 * stride;
+    m_fOld = p + 10 * stride;
+    m_fNew = p + 11 * stride;
+
+    if (settings.method == IntegrationMethod::Rosenbrock) {
+        try {
+            AllocateImplicitBuffers();
+        } catch (...) {
+            // The destructor won't run, so the block must be freed here.
+            m_memory.Free(m_buffer);
+            throw;
+        }
+    }
+}
+
+
+ContinuousSlave::~ContinuousSlave() CPPFMU_NOEXCEPT
+{
+    m_memory.Free(m_buffer);
+}
+
+
+void ContinuousSlave::SetupExperiment(
+    FMIBoolean toleranceDefined,
+    FMIReal tolerance,
+    FMIReal tStart,
+    FMIBoolean /*stopTimeDefined*/,
+    FMIReal /*tStop*/)
+{
+    if (toleranceDefined && tolerance > 0.0) {
+        m_settings.relativeTolerance = tolerance;
+    }
+    m_time = tStart;
+}
+
+
+void ContinuousSlave::Reset()
+{
+    m_statistics = IntegratorStatistics{};
+    m_time = 0.0;
+    m_h = 0.0;
+    m_eventTime = std::numeric_limits<FMIReal>::quiet_NaN();
+    InvalidateJacobian();
+}
+
+
+bool ContinuousSlave::DoStep(
+    FMIReal currentCommunicationPoint,
+    FMIReal communicationStepSize,
+    FMIBoolean /*newStep*/,
+    FMIReal& endOfStep)
+{
+    const auto tEnd = currentCommunicationPoint + communicationStepSize;
+    if (!m_z0.empty()) {
+        EventIndicators(currentCommunicationPoint, m_x, m_z0.data());
+        // If the previous step ended at an event, the indicators which
+        // crossed are still practically zero, so don't let them trigger
+        // the same event again.
+        if (currentCommunicationPoint == m_eventTime) {
+            for (std::size_t i = 0; i < m_z0.size(); ++i) {
+                if (m_directions[i] != 0) m_z0[i] = 0.0;
+            }
+        }
+    }
+    m_eventTime = std::numeric_limits<FMIReal>::quiet_NaN();
+    FMIReal t;
+    switch (m_settings.method) {
+        case IntegrationMethod::RK4:
+            t = IntegrateRK4(currentCommunicationPoint, tEnd);
+            break;
+        case IntegrationMethod::Rosenbrock:
+            t = IntegrateRosenbrock(currentCommunicationPoint, tEnd);
+            break;
+        default:
+            t = IntegrateDormandPrince(currentCommunicationPoint, tEnd);
+            break;
+    }
+    m_time = t;
+    endOfStep = t;
+    UpdateOutputs(t);
+    return t == tEnd;
+}
+
+
+void ContinuousSlave::UpdateOutputs(FMIReal /*time*/)
+{
+    // Do nothing
+}
+
+
+void ContinuousSlave::SetIntegratorSettings(const IntegratorSettings& settings)
+{
+    ValidateSettings(settings);
+    if (settings.method == IntegrationMethod::Rosenbrock) {
+        AllocateImplicitBuffers();
+    }
+    m_settings = settings;
+    m_h = 0.0;
+    m_factorizedStepSize = 0.0;
+}
+
+
+void ContinuousSlave::Jacobian(FMIReal t, const FMIReal x[], FMIReal jacobian[])
+{
+    FiniteDifferenceJacobian(t, x, jacobian);
+}
+
+
+void ContinuousSlave::SetJacobianSparsity(
+    const std::size_t rows[],
+    const std::size_t columns[],
+    std::size_t count)
+{
+    const auto n = m_n;
+    for (std::size_t k = 0; k < count; ++k) {
+        if (rows[k] >= n || columns[k] >= n) {
+            throw std::invalid_argument("Jacobian element index out of range");
+        }
+    }
+    using Indices = std::vector<std::size_t, Allocator<std::size_t>>;
+    const auto alloc = Allocator<std::size_t>{m_memory};
+
+    // Sort the elements by column and then by row, dropping duplicates.
+    Indices order(count, 0, alloc);
+    for (std::size_t k = 0; k < count; ++k) order[k] = k;
+    std::sort(order.begin(), order.end(), [=] (std::size_t a, std::size_t b) {
+        return columns[a] < columns[b]
+            || (columns[a] == columns[b] && rows[a] < rows[b]);
+    });
+    Indices columnStarts(n + 1, 0, alloc);
+    Indices rowIndices(alloc);
+    rowIndices.reserve(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        const auto e = order[k];
+        if (k > 0 && rows[e] == rows[order[k-1]] && columns[e] == columns[order[k-1]]) {
+            continue;
+        }
+        rowIndices.push_back(rows[e]);
+        ++columnStarts[columns[e] + 1];
+    }
+    for (std::size_t j = 0; j < n; ++j) columnStarts[j + 1] += columnStarts[j];
+
+    Indices colors(n, 0, alloc);
+    const auto colorCount = ColorColumns(
+        m_memory,
+        n,
+        n,
+        columnStarts.data(),
+        rowIndices.data(),
+        colors.data());
+
+    Indices colorStarts(colorCount + 1, 0, alloc);
+    for (std::size_t j = 0; j < n; ++j) ++colorStarts[colors[j] + 1];
+    for (std::size_t c = 0; c < colorCount; ++c) {
+        colorStarts[c + 1] += colorStarts[c];
+    }
+    Indices colorColumns(n, 0, alloc);
+    Indices colorFill(colorStarts.begin(), colorStarts.end() - 1, alloc);
+    for (std::size_t j = 0; j < n; ++j) colorColumns[colorFill[colors[j]]++] = j;
+
+    // If the pattern is banded narrowly enough, the iteration matrix is
+    // stored and factorised as a band matrix.
+    std::size_t kl = 0, ku = 0;
+    for (std::size_t j = 0; j < n; ++j) {
+        for (auto k = columnStarts[j]; k < columnStarts[j + 1]; ++k) {
+            const auto i = rowIndices[k];
+            if (i > j) kl = std::max(kl, i - j);
+            else ku = std::max(ku, j - i);
+        }
+    }
+    const auto bandRows = 2*kl + ku + 1;
+
+    m_columnStarts.swap(columnStarts);
+    m_rowIndices.swap(rowIndices);
+    m_colorStarts.swap(colorStarts);
+    m_colorColumns.swap(colorColumns);
+    if (bandRows < n) {
+        m_lowerBandwidth = kl;
+        m_upperBandwidth = ku;
+        m_bandRows = bandRows;
+    } else {
+        m_lowerBandwidth = 0;
+        m_upperBandwidth = 0;
+        m_bandRows = 0;
+    }
+    if (!m_jacobian.empty()) AllocateImplicitBuffers();
+    InvalidateJacobian();
+}
+
+
+void ContinuousSlave::SetEventIndicatorCount(std::size_t count)
+{
+    m_z0.assign(count, 0.0);
+    m_z1.assign(count, 0.0);
+    m_zm.assign(count, 0.0);
+    m_directions.assign(count, 0);
+}
+
+
+void ContinuousSlave::EventIndicators(
+    FMIReal /*t*/,
+    const FMIReal /*x*/[],
+    FMIReal /*z*/[])
+{
+    throw std::logic_error("Slave does not implement EventIndicators()");
+}
+
+
+bool ContinuousSlave::HandleEvent(FMIReal /*time*/, const int /*directions*/[])
+{
+    return true;
+}
+
+
+void ContinuousSlave::InvalidateJacobian() CPPFMU_NOEXCEPT
+{
+    m_jacobianValid = false;
+    m_factorizedStepSize = 0.0;
+}
+
+
+FMIReal ContinuousSlave::IntegrateRK4(FMIReal t, FMIReal tEnd)
+{
+    const auto n = m_n;
+    const auto x = m_x;
+    const auto tmp = m_tmp;
+    const auto k1 = m_k[0];
+    const auto k2 = m_k[1];
+    const auto k3 = m_k[2];
+    const auto k4 = m_k[3];
+
+    while (!Reached(t, tEnd)) {
+        // Divide the rest of the communication step into steps of equal
+        // length.
+        const auto remaining = tEnd - t;
+        const auto steps = std::max(
+            std::ceil(remaining / m_settings.stepSize * (1.0 - 1e-12)),
+            1.0);
+        const auto h = steps == 1.0 ? remaining : remaining / steps;
+
+        Evaluate(t, x, k1);
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = x[i] + 0.5*h*k1[i];
+        Evaluate(t + 0.5*h, tmp, k2);
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = x[i] + 0.5*h*k2[i];
+        Evaluate(t + 0.5*h, tmp, k3);
+        for (std::size_t i = 0; i < n; ++i) tmp[i] = x[i] + h*k3[i];
+        Evaluate(t + h, tmp, k4);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h/6 * (k1[i] + 2*k2[i] + 2*k3[i] + k4[i]);
+        }
+
+        const auto t0 = t;
+        t = (steps == 1.0) ? tEnd : t + h;
+        AcceptStep(t, tmp);
+        ++m_statistics.steps;
+        m_statistics.lastStepSize = h;
+        if (EndStep(t0, t) == StepResult::Stop) return t;
+    }
+    return tEnd;
+}
+
+
+FMIReal ContinuousSlave::IntegrateDormandPrince(FMIReal t, FMIReal tEnd)
+{
+    const auto n = m_n;
+    const auto x = m_x;
+    const auto tmp = m_tmp;
+    const auto rtol = m_settings.relativeTolerance;
+    const auto atol = m_settings.absoluteTolerance;
+    const auto hMax = m_settings.maxStepSize > 0.0
+        ? m_settings.maxStepSize
+        : tEnd - t;
+
+    if (!(m_h > 0.0)) m_h = m_settings.stepSize;
+    m_h = std::min(m_h, hMax);
+
+    // The derivatives at the start of the communication step are computed
+    // anew, since the inputs or the states may have been changed since the
+    // previous one.  Thereafter, the last stage of each step is reused as
+    // the first stage of the next one ("first same as last").
+    Evaluate(t, x, m_k[0]);
+
+    while (!Reached(t, tEnd)) {
+        const auto clipped = t + m_h >= tEnd;
+        const auto h = clipped ? tEnd - t : m_h;
+        const auto k1 = m_k[0];
+        const auto k2 = m_k[1];
+        const auto k3 = m_k[2];
+        const auto k4 = m_k[3];
+        const auto k5 = m_k[4];
+        const auto k6 = m_k[5];
+        const auto k7 = m_k[6];
+
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*A21*k1[i];
+        }
+        Evaluate(t + C2*h, tmp, k2);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*(A31*k1[i] + A32*k2[i]);
+        }
+        Evaluate(t + C3*h, tmp, k3);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*(A41*k1[i] + A42*k2[i] + A43*k3[i]);
+        }
+        Evaluate(t + C4*h, tmp, k4);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*(A51*k1[i] + A52*k2[i] + A53*k3[i] + A54*k4[i]);
+        }
+        Evaluate(t + C5*h, tmp, k5);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*(A61*k1[i] + A62*k2[i] + A63*k3[i]
+                + A64*k4[i] + A65*k5[i]);
+        }
+        Evaluate(t + h, tmp, k6);
+        for (std::size_t i = 0; i < n; ++i) {
+            tmp[i] = x[i] + h*(A71*k1[i] + A73*k3[i] + A74*k4[i]
+                + A75*k5[i] + A76*k6[i]);
+        }
+        Evaluate(t + h, tmp, k7);
+
+        // Root-mean-square norm of the local error estimate, scaled by the
+        // tolerances.
+        FMIReal sum = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto e = h*(E1*k1[i] + E3*k3[i] + E4*k4[i]
+                + E5*k5[i] + E6*k6[i] + E7*k7[i]);
+            const auto scale =
+                atol + rtol*std::max(std::fabs(x[i]), std::fabs(tmp[i]));
+            sum += (e/scale) * (e/scale);
+        }
+        const auto error = n > 0 ? std::sqrt(sum / n) : 0.0;
+
+        auto factor = error > 0.0
+            ? SAFETY_FACTOR * std::pow(error, -0.2)
+            : MAX_FACTOR;
+        factor = std::min(std::max(factor, MIN_FACTOR), MAX_FACTOR);
+
+        if (error <= 1.0) {
+            const auto t0 = t;
+            t = clipped ? tEnd : t + h;
+            AcceptStep(t, tmp);
+            std::swap(m_k[0], m_k[6]);
+            ++m_statistics.steps;
+            m_statistics.lastStepSize = h;
+
+            // A step which was shortened to hit the end point says little
+            // about the step size, so don't let it shrink the next one.
+            m_h = std::min(std::max(h * factor, clipped ? m_h : 0.0), hMax);
+            const auto result = EndStep(t0, t);
+            if (result == StepResult::Stop) return t;
+            if (result == StepResult::Restart) Evaluate(t, x, m_k[0]);
+        } else {
+            ++m_statistics.rejectedSteps;
+            m_h = h * std::min(factor, 1.0);
+            if (m_h < m_settings.minStepSize) {
+                ThrowStepSizeTooSmall(m_settings.minStepSize, t);
+            }
+        }
+    }
+    return tEnd;
+}
+
+
+FMIReal ContinuousSlave::IntegrateRosenbrock(FMIReal t, FMIReal tEnd)
+{
+    const auto n = m_n;
+    const auto x = m_x;
+    const auto tmp = m_tmp;
+    const auto k1 = m_k[0];
+    const auto k2 = m_k[1];
+    const auto e = m_k[2];
+    const auto rtol = m_settings.relativeTolerance;
+    const auto atol = m_settings.absoluteTolerance;
+    const auto hMax = m_settings.maxStepSize > 0.0
+        ? m_settings.maxStepSize
+        : tEnd - t;
+
+    if (!(m_h > 0.0)) m_h = m_settings.stepSize;
+    m_h = std::min(m_h, hMax);
+
+    while (!Reached(t, tEnd)) {
+        // Divide the rest of the communication step into steps of equal
+        // length, so that a constant step size gives the same 'h' in every
+        // communication step of the same length, and the iteration matrix
+        // can be reused across them.
+        const auto remaining = tEnd - t;
+        const auto steps = std::max(std::ceil(remaining / m_h * (1.0 - 1e-12)), 1.0);
+        const auto h = steps == 1.0 ? remaining : remaining / steps;
+
+        // Whether f(t, x) was computed along with the Jacobian, in the
+        // buffer FiniteDifferenceJacobian() uses for it.
+        auto haveF0 = false;
+        if (!m_jacobianValid) {
+            m_f0States = nullptr;
+            Jacobian(t, x, m_jacobian.data());
+            haveF0 = m_f0States == x && m_f0Time == t;
+            ++m_statistics.jacobianEvaluations;
+            m_jacobianValid = true;
+            m_jacobianFresh = true;
+            m_factorizedStepSize = 0.0;
+        }
+        auto singular = false;
+        if (std::fabs(h - m_factorizedStepSize) > REFACTORIZATION_THRESHOLD * h) {
+            ++m_statistics.factorizations;
+            if (FactorizeIterationMatrix(GAMMA * h)) {
+                m_factorizedStepSize = h;
+            } else {
+                m_factorizedStepSize = 0.0;
+                singular = true;
+            }
+        }
+
+        FMIReal error = 2.0;
+        if (!singular) {
+            // (I - gamma*h*J) k1 = f(t, x)
+            if (haveF0) {
+                std::copy(m_k[4], m_k[4] + n, k1);
+            } else {
+                Evaluate(t, x, k1);
+            }
+            SolveIterationMatrix(k1);
+
+            // (I - gamma*h*J) k2 = f(t + h, x + h*k1) - 2*k1
+            for (std::size_t i = 0; i < n; ++i) tmp[i] = x[i] + h*k1[i];
+            Evaluate(t + h, tmp, k2);
+            for (std::size_t i = 0; i < n; ++i) k2[i] -= 2*k1[i];
+            SolveIterationMatrix(k2);
+
+            // The new states, x + 3/2*h*k1 + 1/2*h*k2, and the error
+            // estimate, their difference from the first-order x + h*k1.
+            // The latter is not L-stable, so the estimate is filtered
+            // through the iteration matrix, which damps its stiff
+            // components, as in RADAU5 and ode23s.
+            for (std::size_t i = 0; i < n; ++i) {
+                e[i] = 0.5*h*(k1[i] + k2[i]);
+                tmp[i] += e[i];
+            }
+            SolveIterationMatrix(e);
+            FMIReal sum = 0.0;
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto scale =
+                    atol + rtol*std::max(std::fabs(x[i]), std::fabs(tmp[i]));
+                sum += (e[i]/scale) * (e[i]/scale);
+            }
+            error = n > 0 ? std::sqrt(sum / n) : 0.0;
+        }
+
+        auto factor = error > 0.0
+            ? SAFETY_FACTOR / std::sqrt(error)
+            : MAX_FACTOR;
+        factor = std::min(std::max(factor, MIN_FACTOR), MAX_FACTOR);
+
+        if (error <= 1.0) {
+            const auto t0 = t;
+            t = (steps == 1.0) ? tEnd : t + h;
+            AcceptStep(t, tmp);
+            ++m_statistics.steps;
+            m_statistics.lastStepSize = h;
+            m_jacobianFresh = false;
+
+            // Keep the step size, and thereby the factorisation, unless
+            // the error estimate calls for a substantial change.
+            if (factor >= HOLD_MIN_FACTOR && factor <= HOLD_MAX_FACTOR) {
+                m_h = std::max(h, m_h);
+            } else {
+                m_h = h * factor;
+            }
+            m_h = std::min(m_h, hMax);
+            if (EndStep(t0, t) == StepResult::Stop) return t;
+        } else {
+            ++m_statistics.rejectedSteps;
+            // An outdated Jacobian may be the culprit.
+            if (!m_jacobianFresh) {
+                InvalidateJacobian();
+            }
+            m_h = h * std::min(factor, 1.0);
+            if (m_h < m_settings.minStepSize) {
+                ThrowStepSizeTooSmall(m_settings.minStepSize, t);
+            }
+        }
+    }
+    return tEnd;
+}
+
+
+void ContinuousSlave::AllocateImplicitBuffers()
+{
+    const auto luSize = m_bandRows > 0 ? m_n * m_bandRows : m_n * m_n;
+    if (m_jacobian.size() == m_n * m_n && m_lu.size() == luSize) return;
+    m_jacobian.assign(m_n * m_n, 0.0);
+    m_lu.assign(luSize, 0.0);
+    m_pivots.assign(m_n, 0);
+    InvalidateJacobian();
+}
+
+
+bool ContinuousSlave::FactorizeIterationMatrix(FMIReal gh) CPPFMU_NOEXCEPT
+{
+    // Form I - gamma*h*J and factorise it.
+    const auto n = m_n;
+    const auto jacobian = m_jacobian.data();
+    const auto lu = m_lu.data();
+    if (m_bandRows == 0) {
+        for (std::size_t i = 0; i < n*n; ++i) lu[i] = -gh * jacobian[i];
+        for (std::size_t i = 0; i < n; ++i) lu[i*n + i] += 1.0;
+        return Factorize(lu, m_pivots.data(), n);
+    }
+
+    // Only the band is copied; the elements outside it are zero by
+    // declaration.
+    const auto kl = m_lowerBandwidth;
+    const auto ku = m_upperBandwidth;
+    std::fill(lu, lu + n * m_bandRows, 0.0);
+    for (std::size_t j = 0; j < n; ++j) {
+        const auto iEnd = std::min(j + kl + 1, n);
+        for (auto i = (j > ku ? j - ku : 0); i < iEnd; ++i) {
+            lu[BandIndex(kl, ku, i, j)] = -gh * jacobian[i*n + j];
+        }
+        lu[BandIndex(kl, ku, j, j)] += 1.0;
+    }
+    return BandFactorize(lu, m_pivots.data(), n, kl, ku);
+}
+
+
+void ContinuousSlave::SolveIterationMatrix(FMIReal b[]) const CPPFMU_NOEXCEPT
+{
+    if (m_bandRows == 0) {
+        Solve(m_lu.data(), m_pivots.data(), b, m_n);
+    } else {
+        BandSolve(
+            m_lu.data(),
+            m_pivots.data(),
+            b,
+            m_n,
+            m_lowerBandwidth,
+            m_upperBandwidth);
+    }
+}
+
+
+void ContinuousSlave::FiniteDifferenceJacobian(
+    FMIReal t,
+    const FMIReal x[],
+    FMIReal jacobian[])
+{
+    // The Rosenbrock step, which this is normally called from, uses the
+    // first three stage buffers, so use the others.
+    const auto n = m_n;
+    const auto f0 = m_k[4];
+    const auto xp = m_k[5];
+    const auto fp = m_k[6];
+    const auto delta = m_k[3];
+    const auto sqrtEpsilon = std::sqrt(DBL_EPSILON);
+
+    Evaluate(t, x, f0);
+    m_f0States = x;
+    m_f0Time = t;
+    std::copy(x, x + n, xp);
+    std::fill(jacobian, jacobian + n*n, 0.0);
+
+    if (m_colorStarts.empty()) {
+        // Dense: one column at a time.
+        for (std::size_t j = 0; j < n; ++j) {
+            xp[j] = x[j] + sqrtEpsilon * std::max(std::fabs(x[j]), 1.0);
+            const auto d = xp[j] - x[j];
+            Evaluate(t, xp, fp);
+            for (std::size_t i = 0; i < n; ++i) {
+                jacobian[i*n + j] = (fp[i] - f0[i]) / d;
+            }
+            xp[j] = x[j];
+        }
+        return;
+    }
+
+    // Sparse: perturb all the columns of one colour at once, and attribute
+    // each row's change to the only column of that colour it depends on.
+    const auto colorCount = m_colorStarts.size() - 1;
+    for (std::size_t c = 0; c < colorCount; ++c) {
+        for (auto k = m_colorStarts[c]; k < m_colorStarts[c + 1]; ++k) {
+            const auto j = m_colorColumns[k];
+            xp[j] = x[j] + sqrtEpsilon * std::max(std::fabs(x[j]), 1.0);
+            delta[j] = xp[j] - x[j];
+        }
+        Evaluate(t, xp, fp);
+        for (auto k = m_colorStarts[c]; k < m_colorStarts[c + 1]; ++k) {
+            const auto j = m_colorColumns[k];
+            for (auto l = m_columnStarts[j]; l < m_columnStarts[j + 1]; ++l) {
+                const auto i = m_rowIndices[l];
+                jacobian[i*n + j] = (fp[i] - f0[i]) / delta[j];
+            }
+            xp[j] = x[j];
+        }
+    }
+}
+
+
+void ContinuousSlave::AcceptStep(
+    FMIReal t,
+    const FMIReal xNew[]) CPPFMU_NOEXCEPT
+{
+    if (!m_z0.empty()) std::copy(m_x, m_x + m_n, m_xOld);
+    std::copy(xNew, xNew + m_n, m_x);
+    m_time = t;
+}
+
+
+ContinuousSlave::StepResult ContinuousSlave::EndStep(FMIReal t0, FMIReal& t)
+{
+    auto result = StepResult::Continue;
+    if (!m_z0.empty() && LocateEvent(t0, t)) {
+        ++m_statistics.events;
+        m_time = t;
+        m_eventTime = t;
+        result = HandleEvent(t, m_directions.data())
+            ? StepResult::Stop
+            : StepResult::Restart;
+
+        // The handler may have changed the states.
+        EventIndicators(t, m_x, m_z0.data());
+        for (std::size_t i = 0; i < m_z0.size(); ++i) {
+            if (m_directions[i] != 0) m_z0[i] = 0.0;
+        }
+    }
+    ReportStepProgress(t);
+    if (StepCancelled()) result = StepResult::Stop;
+    return result;
+}
+
+
+bool ContinuousSlave::LocateEvent(FMIReal t0, FMIReal& t1)
+{
+    const auto n = m_n;
+    const auto m = m_z0.size();
+    const auto x = m_x;
+    const auto tmp = m_tmp;
+
+    EventIndicators(t1, x, m_z1.data());
+    auto crossed = false;
+    for (std::size_t i = 0; i < m; ++i) {
+        if (Crossing(m_z0[i], m_z1[i]) != 0) crossed = true;
+    }
+    if (!crossed) {
+        m_z0.swap(m_z1);
+        return false;
+    }
+
+    // Locate the earliest crossing with the Illinois variant of regula
+    // falsi, on a cubic Hermite interpolant of the states over the step.
+    // Several indicators may change sign in the same step, so each
+    // iteration aims for the earliest of their secant estimates.
+    Evaluate(t0, m_xOld, m_fOld);
+    Evaluate(t1, x, m_fNew);
+    const auto tolerance = std::max(
+        m_settings.eventTolerance,
+        4 * DBL_EPSILON * std::max(std::fabs(t1), 1.0));
+    auto ta = t0;
+    auto tb = t1;
+    auto za = m_z0.data();
+    auto zb = m_z1.data();
+    auto zm = m_zm.data();
+    FMIReal wa = 1.0, wb = 1.0;
+    int lastSide = 0;
+    for (int iteration = 0; tb - ta > tolerance && iteration < 100; ++iteration) {
+        auto tm = tb;
+        for (std::size_t i = 0; i < m; ++i) {
+            if (Crossing(za[i], zb[i]) == 0) continue;
+            const auto a = wa * za[i];
+            const auto b = wb * zb[i];
+            tm = std::min(tm, tb - b * (tb - ta) / (b - a));
+        }
+        tm = std::max(ta + 0.5*tolerance, std::min(tb - 0.5*tolerance, tm));
+
+        Interpolate(t0, t1, tm, tmp);
+        EventIndicators(tm, tmp, zm);
+        auto left = false;
+        for (std::size_t i = 0; i < m; ++i) {
+            if (Crossing(za[i], zm[i]) != 0) left = true;
+        }
+        if (left) {
+            tb = tm;
+            std::swap(zb, zm);
+            wb = 1.0;
+            if (lastSide < 0) wa *= 0.5;
+            lastSide = -1;
+        } else {
+            ta = tm;
+            std::swap(za, zm);
+            wa = 1.0;
+            if (lastSide > 0) wb *= 0.5;
+            lastSide = 1;
+        }
+    }
+
+    // End the step just after the crossing, so the indicators have changed
+    // sign.
+    for (std::size_t i = 0; i < m; ++i) m_directions[i] = Crossing(za[i], zb[i]);
+    if (tb < t1) {
+        Interpolate(t0, t1, tb, tmp);
+        std::copy(tmp, tmp + n, x);
+        t1 = tb;
+    }
+    return true;
+}
+
+
+void ContinuousSlave::Interpolate(
+    FMIReal t0,
+    FMIReal t1,
+    FMIReal t,
+    FMIReal x[]) const CPPFMU_NOEXCEPT
+{
+    const auto h = t1 - t0;
+    const auto s = (t - t0) / h;
+    const auto s2 = s * s;
+    const auto s3 = s2 * s;
+    const auto h00 = 2*s3 - 3*s2 + 1;
+    const auto h10 = (s3 - 2*s2 + s) * h;
+    const auto h01 = -2*s3 + 3*s2;
+    const auto h11 = (s3 - s2) * h;
+    for (std::size_t i = 0; i < m_n; ++i) {
+        x[i] = h00*m_xOld[i] + h10*m_fOld[i] + h01*m_x[i] + h11*m_fNew[i];
+    }
+}
+
+
+void ContinuousSlave::Evaluate(FMIReal t, const FMIReal x[], FMIReal dx[])
+{
+    ++m_statistics.evaluations;
+    Derivatives(t, x, dx);
+}
+
+
+} // namespace cppfmu
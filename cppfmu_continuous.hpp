@@ -0,0 +1,368 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_CONTINUOUS_HPP
+#define CPPFMU_CONTINUOUS_HPP
+
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint64_t
+#include <limits>   // std::numeric_limits
+#include <vector>   // std::vector
+
+#include "cppfmu_common.hpp"
+#include "cppfmu_cs.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// CONTINUOUS SLAVES
+// ============================================================================
+
+// The integration methods supported by ContinuousSlave.
+enum class IntegrationMethod
+{
+    // The classic fourth-order Runge-Kutta method, with a fixed step size.
+    RK4,
+
+    /* The Dormand-Prince 5(4) embedded Runge-Kutta method, with adaptive
+     * step size control.
+     */
+    DormandPrince,
+
+    /* The linearly implicit, L-stable Rosenbrock-W method ROS2, of second
+     * order, with adaptive step size control, for stiff systems.  Being a
+     * W-method, it keeps its order with an approximate Jacobian, so the
+     * Jacobian and the factorised iteration matrix are reused across steps,
+     * and across communication steps, for as long as the step size stays
+     * the same and no step is rejected.  Best suited to moderate
+     * tolerances (a relative tolerance of 1e-3 to 1e-5).
+     */
+    Rosenbrock,
+};
+
+
+// Settings for the integrator of a ContinuousSlave.
+struct IntegratorSettings
+{
+    IntegrationMethod method = IntegrationMethod::DormandPrince;
+
+    /* With RK4, the largest step size.  (Each communication step is divided
+     * into steps of equal length, no longer than this.)  With
+     * DormandPrince, the size of the first step.
+     */
+    FMIReal stepSize = 1e-3;
+
+    // The error tolerances of adaptive methods.
+    FMIReal relativeTolerance = 1e-6;
+    FMIReal absoluteTolerance = 1e-9;
+
+    /* The step size limits of adaptive methods.  If the step size needed to
+     * meet the tolerances falls below 'minStepSize', the step fails.  Zero
+     * means no upper limit.
+     */
+    FMIReal minStepSize = 1e-12;
+    FMIReal maxStepSize = 0.0;
+
+    // The accuracy with which the times of state events are located.
+    FMIReal eventTolerance = 1e-10;
+};
+
+
+// Statistics for the integrator of a ContinuousSlave.
+struct IntegratorStatistics
+{
+    // The number of accepted and rejected internal steps.
+    std::uint64_t steps = 0;
+    std::uint64_t rejectedSteps = 0;
+
+    /* The number of calls to ContinuousSlave::Derivatives(), including
+     * those made to compute finite-difference Jacobians.
+     */
+    std::uint64_t evaluations = 0;
+
+    /* The number of Jacobian evaluations and LU factorisations of the
+     * iteration matrix (Rosenbrock only).
+     */
+    std::uint64_t jacobianEvaluations = 0;
+    std::uint64_t factorizations = 0;
+
+    // The number of state events located.
+    std::uint64_t events = 0;
+
+    // The size of the last accepted internal step.
+    FMIReal lastStepSize = 0.0;
+};
+
+
+/* A base class for slaves whose dynamics are given by a system of ordinary
+ * differential equations, dx/dt = f(t, x).
+ *
+ * The derived class implements Derivatives(), and ContinuousSlave
+ * implements DoStep() by integrating the equations across each
+ * communication step with the method chosen in its IntegratorSettings.
+ * The state vector is owned by ContinuousSlave, and can be accessed with
+ * States(), e.g. to register the states in a VariableTable or StateTable.
+ *
+ * All the buffers used by the integrator are allocated once, when the slave
+ * is created, as contiguous, cache-line aligned arrays, so DoStep() does not
+ * allocate memory, and the loops over the states can be vectorised.
+ *
+ * For the Rosenbrock method, the class also needs the Jacobian of the
+ * derivatives with respect to the states.  By default, it is computed by
+ * finite differences.  If the model declares which elements of the Jacobian
+ * may be nonzero with SetJacobianSparsity(), columns which have no nonzero
+ * rows in common are perturbed together, which may reduce the number of
+ * evaluations per Jacobian from StateCount() to a handful.  If the pattern
+ * is also a narrow band, the iteration matrix is factorised in band
+ * storage, in time and memory proportional to StateCount() rather than its
+ * cube and square.  (The Jacobian itself is always passed around as a
+ * dense matrix.)  Models which know their Jacobian analytically can
+ * override Jacobian() instead.
+ *
+ * The slave may also have event indicators, functions of the time and the
+ * states whose zero crossings are events, e.g. a ball hitting the floor.
+ * After each internal step, DoStep() checks whether any of them has changed
+ * sign, and if so, locates the crossing with an Illinois root finder on an
+ * interpolant of the states over the step, moves the states back to it, and
+ * calls HandleEvent().  By default, the communication step then ends at the
+ * event: DoStep() returns false with 'endOfStep' set to the event time,
+ * which fmi2DoStep() reports as fmi2Discard with that fmi2LastSuccessfulTime,
+ * so the master can see exactly how far it got.
+ *
+ * Between internal steps, DoStep() reports the time reached with
+ * ReportStepProgress() and stops early if StepCancelled() returns true.
+ * If the step size of an adaptive method falls below the minimum, DoStep()
+ * throws std::runtime_error.
+ */
+class ContinuousSlave : public SlaveInstance
+{
+public:
+    /* Sets the relative tolerance of adaptive methods to 'tolerance', if
+     * 'toleranceDefined' is true.  Derived classes which override this
+     * function should call it.
+     */
+    void SetupExperiment(
+        FMIBoolean toleranceDefined,
+        FMIReal tolerance,
+        FMIReal tStart,
+        FMIBoolean stopTimeDefined,
+        FMIReal tStop) override;
+
+    /* Clears the integrator statistics and step size history.  The states
+     * are left as they are, so derived classes which need to restore their
+     * initial values should override this function, and call it.
+     */
+    void Reset() override;
+
+    /* Integrates from 'currentCommunicationPoint' to the end of the step,
+     * and then calls UpdateOutputs().
+     */
+    bool DoStep(
+        FMIReal currentCommunicationPoint,
+        FMIReal communicationStepSize,
+        FMIBoolean newStep,
+        FMIReal& endOfStep) override;
+
+    // Returns the integrator statistics accumulated so far.
+    const IntegratorStatistics& Statistics() const CPPFMU_NOEXCEPT
+    {
+        return m_statistics;
+    }
+
+protected:
+    /* Creates a slave with 'stateCount' continuous states, all of them
+     * initially zero, whose buffers are allocated from 'memory'.
+     */
+    ContinuousSlave(
+        const Memory& memory,
+        std::size_t stateCount,
+        const IntegratorSettings& settings = IntegratorSettings{});
+
+    ~ContinuousSlave() CPPFMU_NOEXCEPT;
+
+    ContinuousSlave(const ContinuousSlave&) = delete;
+    ContinuousSlave& operator=(const ContinuousSlave&) = delete;
+
+    /* Computes the derivatives 'dx' of the states 'x' at time 't'.  Both
+     * arrays have StateCount() elements.  Note that 'x' is generally not
+     * the array returned by States(), but an intermediate state of the
+     * integrator.
+     */
+    virtual void Derivatives(FMIReal t, const FMIReal x[], FMIReal dx[]) = 0;
+
+    /* Called by DoStep() at the end of each communication step (or where it
+     * stopped), e.g. to compute output variables from the states.
+     * Does nothing by default.
+     */
+    virtual void UpdateOutputs(FMIReal time);
+
+    /* Computes the Jacobian of the derivatives with respect to the states,
+     * at time 't' and states 'x', as a dense, row-major matrix:
+     * jacobian[i*StateCount() + j] = d(dx[i])/d(x[j]).
+     *
+     * Only used by the Rosenbrock method.  By default, it is computed by
+     * forward differences, exploiting the sparsity pattern set with
+     * SetJacobianSparsity(), if any.
+     */
+    virtual void Jacobian(FMIReal t, const FMIReal x[], FMIReal jacobian[]);
+
+    /* Declares the structurally nonzero elements of the Jacobian, i.e.,
+     * that dx[rows[k]] may depend on x[columns[k]], for k < count.  All
+     * other elements are assumed to be zero, also those of a Jacobian()
+     * override.  (Duplicates are allowed.)
+     *
+     * Allocates memory, so this should be done when the slave is created.
+     * Throws std::invalid_argument if an index is out of range.
+     */
+    void SetJacobianSparsity(
+        const std::size_t rows[],
+        const std::size_t columns[],
+        std::size_t count);
+
+    /* Makes DoStep() monitor 'count' event indicators, computed by
+     * EventIndicators().  Allocates memory, so this should be done when
+     * the slave is created.
+     */
+    void SetEventIndicatorCount(std::size_t count);
+
+    std::size_t EventIndicatorCount() const CPPFMU_NOEXCEPT
+    {
+        return m_z0.size();
+    }
+
+    /* Computes the event indicators 'z' at time 't' and states 'x'.  An
+     * event occurs when an indicator changes sign.  Only called if
+     * SetEventIndicatorCount() has been called with a nonzero count.
+     * Throws std::logic_error by default.
+     */
+    virtual void EventIndicators(FMIReal t, const FMIReal x[], FMIReal z[]);
+
+    /* Called by DoStep() when one or more event indicators have changed
+     * sign, with the states moved to 'time', the time of the (earliest)
+     * crossing, or just after it.  directions[i] is +1 if indicator i rose
+     * through zero, -1 if it fell, and 0 if it did not cross.
+     *
+     * The function may change the states, e.g. to reverse the velocity of
+     * a bouncing ball.  If it returns true, the communication step ends at
+     * the event.  Otherwise, integration continues from it.  Indicators
+     * which have just crossed are not checked again until the end of the
+     * next internal step, so the handler need not move them away from zero.
+     * Returns true by default.
+     */
+    virtual bool HandleEvent(FMIReal time, const int directions[]);
+
+    /* Makes the Rosenbrock method recompute the Jacobian before the next
+     * step, e.g. after an abrupt change in the inputs.  (It is also
+     * recomputed automatically when a step is rejected.)
+     */
+    void InvalidateJacobian() CPPFMU_NOEXCEPT;
+
+    // The state vector.
+    FMIReal* States() CPPFMU_NOEXCEPT { return m_x; }
+    const FMIReal* States() const CPPFMU_NOEXCEPT { return m_x; }
+
+    std::size_t StateCount() const CPPFMU_NOEXCEPT { return m_n; }
+
+    /* The time of the current states, i.e. the start time given to
+     * SetupExperiment(), or the time reached by the last DoStep().
+     */
+    FMIReal Time() const CPPFMU_NOEXCEPT { return m_time; }
+
+    /* Replaces the integrator settings.  Throws std::invalid_argument if
+     * the step size or the tolerances are not positive.
+     */
+    void SetIntegratorSettings(const IntegratorSettings& settings);
+
+    const IntegratorSettings& GetIntegratorSettings() const CPPFMU_NOEXCEPT
+    {
+        return m_settings;
+    }
+
+private:
+    // Integrates from 't' to 'tEnd', returning the time actually reached.
+    FMIReal IntegrateRK4(FMIReal t, FMIReal tEnd);
+    FMIReal IntegrateDormandPrince(FMIReal t, FMIReal tEnd);
+    FMIReal IntegrateRosenbrock(FMIReal t, FMIReal tEnd);
+
+    enum class StepResult { Continue, Restart, Stop };
+
+    /* Called after each accepted internal step, which ends at 't'.  Time()
+     * and the states are kept in step with each other, so that they stay
+     * consistent if a later internal step throws.
+     */
+    void AcceptStep(FMIReal t, const FMIReal xNew[]) CPPFMU_NOEXCEPT;
+    StepResult EndStep(FMIReal t0, FMIReal& t);
+    bool LocateEvent(FMIReal t0, FMIReal& t1);
+    void Interpolate(FMIReal t0, FMIReal t1, FMIReal t, FMIReal x[])
+        const CPPFMU_NOEXCEPT;
+
+    void AllocateImplicitBuffers();
+    bool FactorizeIterationMatrix(FMIReal gh) CPPFMU_NOEXCEPT;
+    void SolveIterationMatrix(FMIReal b[]) const CPPFMU_NOEXCEPT;
+    void FiniteDifferenceJacobian(FMIReal t, const FMIReal x[], FMIReal jacobian[]);
+
+    void Evaluate(FMIReal t, const FMIReal x[], FMIReal dx[]);
+
+    Memory m_memory;
+    std::size_t m_n;
+    IntegratorSettings m_settings;
+    IntegratorStatistics m_statistics;
+    FMIReal m_time = 0.0;
+
+    // The step size proposed by the step size control for the next step.
+    FMIReal m_h = 0.0;
+
+    // The memory block that holds all the buffers below.
+    void* m_buffer = nullptr;
+    FMIReal* m_x = nullptr;
+    FMIReal* m_tmp = nullptr;
+    FMIReal* m_k[7] = {};
+    FMIReal* m_xOld = nullptr;
+    FMIReal* m_fOld = nullptr;
+    FMIReal* m_fNew = nullptr;
+
+    /* The Jacobian, the LU factors of the iteration matrix and its pivots.
+     * If the sparsity pattern is a narrow band, with the given number of
+     * sub- and superdiagonals, the LU factors are kept in band storage with
+     * 'm_bandRows' rows; otherwise, 'm_bandRows' is zero and they are dense.
+     */
+    std::vector<FMIReal, Allocator<FMIReal>> m_jacobian;
+    std::vector<FMIReal, Allocator<FMIReal>> m_lu;
+    std::vector<std::size_t, Allocator<std::size_t>> m_pivots;
+    std::size_t m_lowerBandwidth = 0;
+    std::size_t m_upperBandwidth = 0;
+    std::size_t m_bandRows = 0;
+    bool m_jacobianValid = false;
+    bool m_jacobianFresh = false;
+    FMIReal m_factorizedStepSize = 0.0;
+
+    // The point at which FiniteDifferenceJacobian() last evaluated the
+    // unperturbed derivatives, which the Rosenbrock step can reuse.
+    const FMIReal* m_f0States = nullptr;
+    FMIReal m_f0Time = 0.0;
+
+    /* The sparsity pattern, as the rows of the nonzero elements in each
+     * column (compressed column storage), and the columns grouped by
+     * colour.  Empty if the Jacobian is dense.
+     */
+    std::vector<std::size_t, Allocator<std::size_t>> m_columnStarts;
+    std::vector<std::size_t, Allocator<std::size_t>> m_rowIndices;
+    std::vector<std::size_t, Allocator<std::size_t>> m_colorStarts;
+    std::vector<std::size_t, Allocator<std::size_t>> m_colorColumns;
+
+    // The event indicators at the start of the step, at its end and at
+    // the root finder's trial point, and the directions of the crossings.
+    std::vector<FMIReal, Allocator<FMIReal>> m_z0;
+    std::vector<FMIReal, Allocator<FMIReal>> m_z1;
+    std::vector<FMIReal, Allocator<FMIReal>> m_zm;
+    std::vector<int, Allocator<int>> m_directions;
+    FMIReal m_eventTime = std::numeric_limits<FMIReal>::quiet_NaN();
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -7,6 +7,9 @@
 
 #include <stdexcept>
 
+#include "cppfmu_arena.hpp"
+#include "cppfmu_monitor.hpp"
+
 
 namespace cppfmu
 {
@@ -16,174 +19,34 @@ namespace cppfmu
 // =============================================================================
 
 
-void SlaveInstance::SetupExperiment(
-    FMIBoolean /*toleranceDefined*/,
-    FMIReal /*tolerance*/,
-    FMIReal /*tStart*/,
-    FMIBoolean /*stopTimeDefined*/,
-    FMIReal /*tStop*/)
-{
-    // Do nothing
-}
-
-
-void SlaveInstance::EnterInitializationMode()
-{
-    // Do nothing
-}
-
-
-void SlaveInstance::ExitInitializationMode()
-{
-    // Do nothing
-}
-
-
-void SlaveInstance::Terminate()
-{
-    // Do nothing
-}
-
-
-void SlaveInstance::Reset()
-{
-    // Do nothing
-}
-
-
-void SlaveInstance::SetReal(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    const FMIReal /*value*/[])
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::SetInteger(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    const FMIInteger /*value*/[])
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::SetBoolean(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    const FMIBoolean /*value*/[])
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::SetString(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    const FMIString /*value*/[])
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::GetReal(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    FMIReal /*value*/[]) const
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to get nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::GetInteger(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    FMIInteger /*value*/[]) const
-{
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to get nonexistent variable");
-    }
-}
-
-
-void SlaveInstance::GetBoolean(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    FMIBoolean /*value*/[]) const
+bool SlaveInstance::TerminationRequested() const
 {
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
+    return false;
 }
 
 
-void SlaveInstance::GetString(
-    const FMIValueReference /*vr*/[],
-    std::size_t nvr,
-    FMIString /*value*/[]) const
+SlaveInstance::SlaveInstance() CPPFMU_NOEXCEPT
+    : m_cancelRequested{false}
+    , m_stepProgress{0.0}
 {
-    if (nvr != 0) {
-        throw std::logic_error("Attempted to set nonexistent variable");
-    }
 }
 
 
-void SlaveInstance::GetFMUState(FMIFMUState* state)
+void SlaveInstance::CancelStep() CPPFMU_NOEXCEPT
 {
-    throw std::logic_error("Operation not supported: get FMU state");
+    m_cancelRequested.store(true, std::memory_order_relaxed);
 }
 
 
-void SlaveInstance::SetFMUState(FMIFMUState state)
+void SlaveInstance::UseStepArena(StepArena& arena) CPPFMU_NOEXCEPT
 {
-    throw std::logic_error("Operation not supported: set FMU state");
+    m_stepArena = &arena;
 }
 
 
-void SlaveInstance::FreeFMUState(FMIFMUState state)
-{
-    throw std::logic_error("Operation not supported: free FMU state");
-}
-
-
-std::size_t SlaveInstance::SerializedFMUStateSize(FMIFMUState state)
-{
-    throw std::logic_error("Operation not supported: get serialized FMU state size");
-}
-
-
-void SlaveInstance::SerializeFMUState(
-    FMIFMUState state,
-    FMIByte data[],
-    std::size_t size)
-{
-    throw std::logic_error("Operation not supported: serialize FMU state");
-}
-
-
-FMIFMUState SlaveInstance::DeserializeFMUState(
-    const FMIByte data[],
-    std::size_t size)
-{
-    throw std::logic_error("Operation not supported: deserialize FMU state");
-}
-
-
-
-SlaveInstance::~SlaveInstance() CPPFMU_NOEXCEPT
+void SlaveInstance::UseStepMonitor(StepMonitor& monitor) CPPFMU_NOEXCEPT
 {
-    // Do nothing
+    m_stepMonitor = &monitor;
 }
 
 
@@ -6,12 +6,17 @@
 #ifndef CPPFMU_CS_HPP
 #define CPPFMU_CS_HPP
 
-#include <vector>
+#include <atomic>
 #include "cppfmu_common.hpp"
+#include "cppfmu_instance.hpp"
 
 namespace cppfmu
 {
 
+class StepArena;    // cppfmu_arena.hpp
+class StepMonitor;  // cppfmu_monitor.hpp
+
+
 /* ============================================================================
  * CO-SIMULATION INTERFACE
  * ============================================================================
@@ -26,133 +31,115 @@ namespace cppfmu
  * The methods map directly to the C functions defined by FMI 2.0 (and, with
  * some adaptations, FMI 1.0), so the documentation here is intentionally
  * sparse.  We refer to the FMI specifications for detailed information.
+ * The functions which are common to all FMU types are declared in the base
+ * class, cppfmu::Instance.
  */
-class SlaveInstance
+class SlaveInstance : public Instance
 {
 public:
-    /* Called from fmi2SetupExperiment() (FMI 2.0) or fmiInitializeSlave()
-     * (FMI 1.0).
-     * Does nothing by default.
-     */
-    virtual void SetupExperiment(
-        FMIBoolean toleranceDefined,
-        FMIReal tolerance,
-        FMIReal tStart,
-        FMIBoolean stopTimeDefined,
-        FMIReal tStop);
-
-    /* Called from fmi2EnterInitializationMode() (FMI 2.0) or
-     * fmiInitializeSlave() (FMI 1.0).
-     * Does nothing by default.
+    /* Called from fmi2GetBooleanStatus() with fmi2Terminated, to find out
+     * whether the slave wants to terminate the simulation (typically after
+     * DoStep() has returned false).
+     * Never called with FMI 1.x.
+     * Returns false by default.
      */
-    virtual void EnterInitializationMode();
+    virtual bool TerminationRequested() const;
 
-    /* Called from fmi2ExitInitializationMode() (FMI 2.0) or
-     * fmiInitializeSlave() (FMI 1.0).
-     * Does nothing by default.
-     */
-    virtual void ExitInitializationMode();
+    // Called from fmi2DoStep()/fmiDoStep(). Must be implemented in model code.
+    virtual bool DoStep(
+        FMIReal currentCommunicationPoint,
+        FMIReal communicationStepSize,
+        FMIBoolean newStep,
+        FMIReal& endOfStep) = 0;
 
-    /* Called from fmi2Terminate()/fmiTerminateSlave().
-     * Does nothing by default.
+    /* Requests that the step in progress be cancelled.
+     *
+     * Called from fmi2CancelStep()/fmiCancelStep(), but may also be called
+     * by model code, from any thread.  Cancellation is cooperative:
+     * it only takes effect if DoStep() polls StepCancelled().  The request
+     * is cleared when the next step starts.
      */
-    virtual void Terminate();
+    void CancelStep() CPPFMU_NOEXCEPT;
 
-    /* Called from fmi2Reset()/fmiResetSlave().
-     * Does nothing by default.
-     */
-    virtual void Reset();
+protected:
+    SlaveInstance() CPPFMU_NOEXCEPT;
 
-    /* Called from fmi2SetXxx()/fmiSetXxx().
-     * Throws std::logic_error by default.
+    /* Returns whether cancellation of the step in progress has been
+     * requested.  This is a single relaxed atomic load, so it is cheap
+     * enough to call in every iteration of an internal solver loop.
+     * If it returns true, DoStep() should stop as soon as possible, set
+     * 'endOfStep' to the time it has reached, and return false.
      */
-    virtual void SetReal(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        const FMIReal value[]);
-    virtual void SetInteger(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        const FMIInteger value[]);
-    virtual void SetBoolean(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        const FMIBoolean value[]);
-    virtual void SetString(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        const FMIString value[]);
-
-    /* Called from fmi2GetXxx()/fmiGetXxx().
-     * Throws std::logic_error by default.
+    bool StepCancelled() const CPPFMU_NOEXCEPT
+    {
+        return m_cancelRequested.load(std::memory_order_relaxed);
+    }
+
+    /* Reports that the step in progress has successfully reached 'time'.
+     * While the step is pending, this is the value returned by
+     * fmi2GetRealStatus(fmi2LastSuccessfulTime).
      */
-    virtual void GetReal(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        FMIReal value[]) const;
-    virtual void GetInteger(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        FMIInteger value[]) const;
-    virtual void GetBoolean(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        FMIBoolean value[]) const;
-    virtual void GetString(
-        const FMIValueReference vr[],
-        std::size_t nvr,
-        FMIString value[]) const;
-
-    /* Called from fmi2GetFMUState().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
+    void ReportStepProgress(FMIReal time) CPPFMU_NOEXCEPT
+    {
+        m_stepProgress.store(time, std::memory_order_relaxed);
+    }
+
+    /* Makes fmi2DoStep()/fmiDoStep() reset 'arena' after each call to
+     * DoStep(), so DoStep() can use it for scratch memory.  The arena is
+     * not copied, so it must outlive this object.
      */
-    virtual void GetFMUState(FMIFMUState* state);
+    void UseStepArena(StepArena& arena) CPPFMU_NOEXCEPT;
 
-    /* Called from fmi2SetFMUstate().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
+    /* Makes fmi2DoStep()/fmiDoStep() measure the wall-clock time taken by
+     * each call to DoStep() and record it in 'monitor', and makes
+     * fmi2Terminate()/fmiTerminateSlave() log its summary.  The monitor is
+     * not copied, so it must outlive this object.
      */
-    virtual void SetFMUState(FMIFMUState state);
+    void UseStepMonitor(StepMonitor& monitor) CPPFMU_NOEXCEPT;
 
-    /* Called from fmi2FreeFMUstate().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
-     */
-    virtual void FreeFMUState(FMIFMUState state);
-
-    /* Called from fmi2SerializedFMUstateSize().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
-     */
-    virtual std::size_t SerializedFMUStateSize(FMIFMUState state);
+private:
+    friend struct detail::InstanceAccess;
 
-    /* Called from fmi2SerializeFMUstate().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
-     */
-    virtual void SerializeFMUState(
-        FMIFMUState state,
-        FMIByte data[],
-        std::size_t size);
+    StepArena* m_stepArena = nullptr;
+    StepMonitor* m_stepMonitor = nullptr;
+    std::atomic<bool> m_cancelRequested;
+    std::atomic<FMIReal> m_stepProgress;
+};
 
-    /* Called from fmi2DeSerializeFMUstate().
-     * Never called with FMI 1.x.
-     * Throws std::logic_error by default.
-     */
-    virtual FMIFMUState DeserializeFMUState(
-        const FMIByte data[],
-        std::size_t size);
 
-    // Called from fmi2DoStep()/fmiDoStep(). Must be implemented in model code.
-    virtual bool DoStep(
-        FMIReal currentCommunicationPoint,
-        FMIReal communicationStepSize,
-        FMIBoolean newStep,
-        FMIReal& endOfStep) = 0;
+/* A base class for slaves that are used in "static" mode.
+ *
+ * By default, fmi_functions.cpp calls the slave through the virtual
+ * functions of SlaveInstance, which prevents the compiler from inlining
+ * small GetXxx()/SetXxx()/DoStep() implementations into the FMI functions.
+ * If the FMU only contains one slave type, this can be avoided as follows:
+ *
+ *   1. Derive the slave class from StaticSlave<T>, where T is the slave
+ *      class itself, and declare it 'final'.
+ *
+ *   2. Compile fmi_functions.cpp with the macro CPPFMU_STATIC_SLAVE defined
+ *      to the name of the slave class, and CPPFMU_STATIC_SLAVE_HEADER to a
+ *      header (in quotes or angle brackets) which defines it.
+ *      Alternatively, define CPPFMU_STATIC_SLAVE and then #include
+ *      fmi_functions.cpp at the end of the source file which defines the
+ *      slave (a "unity build").
+ *
+ * fmi_functions.cpp then calls the slave through a pointer to T, so the
+ * calls can be resolved statically.  For inlining to happen across
+ * translation units, link-time optimisation must be enabled (see the
+ * CPPFMU_INTERPROCEDURAL_OPTIMIZATION option in CMakeLists.txt).
+ *
+ * The slave remains a SlaveInstance, and is still created by
+ * CppfmuInstantiateSlave() as usual.
+ */
+template<typename Derived>
+class StaticSlave : public SlaveInstance
+{
+public:
+    using SlaveType = Derived;
 
-    // The instance is destroyed in fmi2FreeInstance()/fmiFreeSlaveInstance().
-    virtual ~SlaveInstance() CPPFMU_NOEXCEPT;
+protected:
+    StaticSlave() = default;
 };
 
 } // namespace cppfmu
@@ -161,10 +148,9 @@ public:
 /* A function which must be defined by model code, and which should create
  * and return a new slave instance.
  *
- * The returned instance must be managed by a std::unique_ptr with a deleter
- * of type std::function<void(void*)> that takes care of freeing the memory.
- * The simplest way to set this up is to use cppfmu::AllocateUnique() to
- * create the slave instance.
+ * The returned instance must be managed by a cppfmu::UniquePtr, whose
+ * deleter takes care of freeing the memory.  The simplest way to set this up
+ * is to use cppfmu::AllocateUnique() to create the slave instance.
  *
  * Most of its parameters correspond to those of fmi2Instantiate() and
  * fmiInstantiateSlave(), except that 'functions' and 'loggingOn' have been
@@ -0,0 +1,496 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_derivatives.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    template<typename T>
+    using Vector = std::vector<T, Allocator<T>>;
+
+    /* Saves the FMU state of an instance on construction, so it can be
+     * restored, and frees it on destruction.  Unless Dismiss() is called,
+     * the state is also restored on destruction, so the instance is left
+     * as it was if the estimate fails.
+     */
+    class SavedState
+    {
+    public:
+        explicit SavedState(Instance& instance)
+            : m_instance(instance)
+        {
+            try {
+                m_instance.GetFMUState(&m_state);
+            } catch (const std::logic_error& e) {
+                throw std::logic_error(
+                    std::string("Finite-difference derivatives require FMU state support: ")
+                    + e.what());
+            }
+        }
+
+        ~SavedState() CPPFMU_NOEXCEPT
+        {
+            try {
+                if (!m_dismissed) m_instance.SetFMUState(m_state);
+            } catch (...) {
+                // The exception that got us here is more informative.
+            }
+            try {
+                m_instance.FreeFMUState(m_state);
+            } catch (...) {
+                // Leak the state rather than terminate.
+            }
+        }
+
+        SavedState(const SavedState&) = delete;
+        SavedState& operator=(const SavedState&) = delete;
+
+        void Restore()
+        {
+            m_instance.SetFMUState(m_state);
+        }
+
+        // Declares that the instance is in the saved state.
+        void Dismiss() CPPFMU_NOEXCEPT { m_dismissed = true; }
+
+        FMIFMUState State() const CPPFMU_NOEXCEPT { return m_state; }
+
+    private:
+        Instance& m_instance;
+        FMIFMUState m_state = nullptr;
+        bool m_dismissed = false;
+    };
+
+    FMIReal Perturbation(FMIReal relativeStep, FMIReal value) CPPFMU_NOEXCEPT
+    {
+        return relativeStep * std::max(std::fabs(value), 1.0);
+    }
+}
+
+
+std::size_t ColorColumns(
+    const Memory& memory,
+    std::size_t rowCount,
+    std::size_t columnCount,
+    const std::size_t columnStarts[],
+    const std::size_t rowIndices[],
+    std::size_t colors[])
+{
+    const auto alloc = Allocator<std::size_t>{memory};
+    const auto nnz = columnStarts[columnCount];
+
+    // Transpose the structure, to find the columns in each row.
+    Vector<std::size_t> rowStarts(rowCount + 1, 0, alloc);
+    for (std::size_t k = 0; k < nnz; ++k) ++rowStarts[rowIndices[k] + 1];
+    for (std::size_t i = 0; i < rowCount; ++i) rowStarts[i + 1] += rowStarts[i];
+    Vector<std::size_t> rowColumns(nnz, 0, alloc);
+    Vector<std::size_t> rowFill(rowStarts.begin(), rowStarts.end() - 1, alloc);
+    for (std::size_t j = 0; j < columnCount; ++j) {
+        for (auto k = columnStarts[j]; k < columnStarts[j + 1]; ++k) {
+            rowColumns[rowFill[rowIndices[k]]++] = j;
+        }
+    }
+
+    // Give each column the lowest colour which is not used by any column
+    // that shares a nonzero row with it.
+    const auto none = static_cast<std::size_t>(-1);
+    std::fill(colors, colors + columnCount, none);
+    Vector<std::size_t> forbidden(columnCount, none, alloc);
+    std::size_t colorCount = 0;
+    for (std::size_t j = 0; j < columnCount; ++j) {
+        for (auto k = columnStarts[j]; k < columnStarts[j + 1]; ++k) {
+            const auto i = rowIndices[k];
+            for (auto l = rowStarts[i]; l < rowStarts[i + 1]; ++l) {
+                const auto c = colors[rowColumns[l]];
+                if (c != none) forbidden[c] = j;
+            }
+        }
+        std::size_t c = 0;
+        while (forbidden[c] == j) ++c;
+        colors[j] = c;
+        colorCount = std::max(colorCount, c + 1);
+    }
+    return colorCount;
+}
+
+
+void EstimateDirectionalDerivative(
+    const Memory& memory,
+    Instance& instance,
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    const FMIReal dvKnown[],
+    FMIReal dvUnknown[],
+    FMIReal relativeStep)
+{
+    // Scale the step so that the largest perturbation of any input is
+    // relativeStep times its magnitude.
+    FMIReal maxSeed = 0.0;
+    for (std::size_t j = 0; j < nKnown; ++j) {
+        maxSeed = std::max(maxSeed, std::fabs(dvKnown[j]));
+    }
+    if (maxSeed == 0.0) {
+        std::fill(dvUnknown, dvUnknown + nUnknown, 0.0);
+        return;
+    }
+
+    const auto alloc = Allocator<FMIReal>{memory};
+    Vector<FMIReal> x0(nKnown, 0.0, alloc);
+    Vector<FMIReal> xp(nKnown, 0.0, alloc);
+    Vector<FMIReal> y0(nUnknown, 0.0, alloc);
+    instance.GetReal(vKnown, nKnown, x0.data());
+    FMIReal scale = 1.0;
+    for (std::size_t j = 0; j < nKnown; ++j) {
+        if (dvKnown[j] != 0.0) scale = std::max(scale, std::fabs(x0[j]));
+    }
+    const auto h = relativeStep * scale / maxSeed;
+    for (std::size_t j = 0; j < nKnown; ++j) xp[j] = x0[j] + h * dvKnown[j];
+
+    SavedState saved{instance};
+    instance.EvaluateOutputs();
+    instance.GetReal(vUnknown, nUnknown, y0.data());
+    instance.SetReal(vKnown, nKnown, xp.data());
+    instance.EvaluateOutputs();
+    instance.GetReal(vUnknown, nUnknown, dvUnknown);
+    instance.SetReal(vKnown, nKnown, x0.data());
+    saved.Restore();
+    saved.Dismiss();
+
+    for (std::size_t i = 0; i < nUnknown; ++i) {
+        dvUnknown[i] = (dvUnknown[i] - y0[i]) / h;
+    }
+}
+
+
+// =============================================================================
+// DerivativeEstimator
+// =============================================================================
+
+
+DerivativeEstimator::DerivativeEstimator(const Memory& memory)
+    : m_memory{memory}
+    , m_relativeStep{std::sqrt(DBL_EPSILON)}
+    , m_patternUnknowns{Allocator<FMIValueReference>{memory}}
+    , m_patternKnowns{Allocator<FMIValueReference>{memory}}
+    , m_pattern{Allocator<std::pair<std::size_t, std::size_t>>{memory}}
+    , m_unknowns{Allocator<FMIValueReference>{memory}}
+    , m_knowns{Allocator<FMIValueReference>{memory}}
+    , m_columnStarts{Allocator<std::size_t>{memory}}
+    , m_rowIndices{Allocator<std::size_t>{memory}}
+    , m_colorStarts{Allocator<std::size_t>{memory}}
+    , m_colorColumns{Allocator<std::size_t>{memory}}
+    , m_jacobian{Allocator<FMIReal>{memory}}
+    , m_clones{Allocator<UniquePtr<Instance>>{memory}}
+{
+}
+
+
+DerivativeEstimator::~DerivativeEstimator() CPPFMU_NOEXCEPT
+{
+}
+
+
+void DerivativeEstimator::SetRelativeStep(FMIReal relativeStep)
+{
+    if (!(relativeStep > 0.0)) {
+        throw std::invalid_argument("Relative step must be positive");
+    }
+    m_relativeStep = relativeStep;
+    m_cacheValid = false;
+}
+
+
+void DerivativeEstimator::SetSparsity(
+    const FMIValueReference unknowns[],
+    std::size_t nUnknown,
+    const FMIValueReference knowns[],
+    std::size_t nKnown,
+    const std::size_t rows[],
+    const std::size_t columns[],
+    std::size_t count)
+{
+    Vector<std::pair<std::size_t, std::size_t>> pattern{
+        Allocator<std::pair<std::size_t, std::size_t>>{m_memory}};
+    pattern.reserve(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        if (rows[k] >= nUnknown || columns[k] >= nKnown) {
+            throw std::invalid_argument("Sparsity pattern index out of range");
+        }
+        pattern.emplace_back(rows[k], columns[k]);
+    }
+    std::sort(pattern.begin(), pattern.end());
+
+    m_patternUnknowns.assign(unknowns, unknowns + nUnknown);
+    m_patternKnowns.assign(knowns, knowns + nKnown);
+    m_pattern.swap(pattern);
+    m_structureValid = false;
+    m_cacheValid = false;
+}
+
+
+void DerivativeEstimator::SetParallelism(
+    std::size_t threadCount,
+    CloneFactory factory)
+{
+    m_threadCount = std::max(threadCount, std::size_t{1});
+    m_cloneFactory = std::move(factory);
+    if (m_clones.size() > m_threadCount - 1) m_clones.resize(m_threadCount - 1);
+}
+
+
+void DerivativeEstimator::GetDirectionalDerivative(
+    Instance& instance,
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    const FMIReal dvKnown[],
+    FMIReal dvUnknown[])
+{
+    const auto same = m_cacheValid
+        && m_unknowns.size() == nUnknown
+        && m_knowns.size() == nKnown
+        && std::equal(vUnknown, vUnknown + nUnknown, m_unknowns.begin())
+        && std::equal(vKnown, vKnown + nKnown, m_knowns.begin());
+    if (!same) {
+        m_cacheValid = false;
+        m_jacobian.resize(nUnknown * nKnown);
+        GetJacobian(instance, vUnknown, nUnknown, vKnown, nKnown, m_jacobian.data());
+        m_cacheValid = true;
+    }
+    for (std::size_t i = 0; i < nUnknown; ++i) {
+        const auto row = m_jacobian.data() + i*nKnown;
+        FMIReal sum = 0.0;
+        for (std::size_t j = 0; j < nKnown; ++j) sum += row[j] * dvKnown[j];
+        dvUnknown[i] = sum;
+    }
+}
+
+
+void DerivativeEstimator::GetJacobian(
+    Instance& instance,
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    FMIReal jacobian[])
+{
+    Structure(vUnknown, nUnknown, vKnown, nKnown);
+    std::fill(jacobian, jacobian + nUnknown*nKnown, 0.0);
+    const auto colorCount = m_colorStarts.size() - 1;
+    if (colorCount == 0) return;
+
+    const auto workerCount = std::min(m_threadCount, colorCount);
+    if (workerCount > 1) {
+        if (!m_cloneFactory) {
+            throw std::logic_error("No clone factory given to DerivativeEstimator");
+        }
+        while (m_clones.size() < workerCount - 1) {
+            m_clones.push_back(m_cloneFactory());
+        }
+    }
+
+    // Everything the workers need is allocated here, since the memory
+    // functions of the simulation environment need not be thread safe.
+    // Each worker has an input vector 'xp', an output vector 'yp' and the
+    // perturbations 'delta', and the saved state of its instance.
+    const auto allocReal = Allocator<FMIReal>{m_memory};
+    const auto stride = 2*nKnown + nUnknown;
+    Vector<FMIReal> x0(nKnown, 0.0, allocReal);
+    Vector<FMIReal> y0(nUnknown, 0.0, allocReal);
+    Vector<FMIReal> scratch(workerCount * stride, 0.0, allocReal);
+    Vector<UniquePtr<SavedState>> saved{
+        Allocator<UniquePtr<SavedState>>{m_memory}};
+    saved.reserve(workerCount);
+    saved.push_back(AllocateUnique<SavedState>(m_memory, instance));
+
+    instance.GetReal(vKnown, nKnown, x0.data());
+    instance.EvaluateOutputs();
+    instance.GetReal(vUnknown, nUnknown, y0.data());
+    for (std::size_t w = 0; w < workerCount; ++w) {
+        std::copy(x0.begin(), x0.end(), scratch.begin() + w*stride);
+    }
+
+    // Bring the clones, if any, into the same state as the instance.
+    if (workerCount > 1) {
+        const auto state = saved[0]->State();
+        Vector<FMIByte> data{Allocator<FMIByte>{m_memory}};
+        data.resize(instance.SerializedFMUStateSize(state));
+        instance.SerializeFMUState(state, data.data(), data.size());
+        for (std::size_t w = 0; w + 1 < workerCount; ++w) {
+            auto& clone = *m_clones[w];
+            const auto cloneState = clone.DeserializeFMUState(data.data(), data.size());
+            try {
+                clone.SetFMUState(cloneState);
+            } catch (...) {
+                clone.FreeFMUState(cloneState);
+                throw;
+            }
+            clone.FreeFMUState(cloneState);
+            clone.SetReal(vKnown, nKnown, x0.data());
+            saved.push_back(AllocateUnique<SavedState>(m_memory, clone));
+        }
+    }
+
+    // Worker w evaluates every workerCount-th colour on its instance, and
+    // writes the columns of those colours, which no other worker touches.
+    const auto work = [&] (Instance& target, std::size_t w) {
+        const auto xp = scratch.data() + w*stride;
+        const auto delta = xp + nKnown;
+        const auto yp = delta + nKnown;
+        for (auto c = w; c < colorCount; c += workerCount) {
+            for (auto k = m_colorStarts[c]; k < m_colorStarts[c + 1]; ++k) {
+                const auto j = m_colorColumns[k];
+                xp[j] = x0[j] + Perturbation(m_relativeStep, x0[j]);
+                delta[j] = xp[j] - x0[j];
+            }
+            target.SetReal(vKnown, nKnown, xp);
+            target.EvaluateOutputs();
+            target.GetReal(vUnknown, nUnknown, yp);
+            for (auto k = m_colorStarts[c]; k < m_colorStarts[c + 1]; ++k) {
+                const auto j = m_colorColumns[k];
+                for (auto l = m_columnStarts[j]; l < m_columnStarts[j + 1]; ++l) {
+                    const auto i = m_rowIndices[l];
+                    jacobian[i*nKnown + j] = (yp[i] - y0[i]) / delta[j];
+                }
+                xp[j] = x0[j];
+            }
+            target.SetReal(vKnown, nKnown, x0.data());
+            saved[w]->Restore();
+        }
+        saved[w]->Dismiss();
+    };
+
+    Vector<std::exception_ptr> errors(
+        workerCount,
+        nullptr,
+        Allocator<std::exception_ptr>{m_memory});
+    const auto runWorker = [&] (std::size_t w) {
+        try {
+            work(w == 0 ? instance : *m_clones[w - 1], w);
+        } catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
+    Vector<std::thread> threads{Allocator<std::thread>{m_memory}};
+    threads.reserve(workerCount - 1);
+    std::size_t started = 1;
+    try {
+        for (; started < workerCount; ++started) {
+            const auto w = started;
+            threads.emplace_back([&runWorker, w] { runWorker(w); });
+        }
+    } catch (...) {
+        // The thread could not be started (std::system_error), so the
+        // calling thread runs this worker and the remaining ones below.
+    }
+    runWorker(0);
+    for (auto w = started; w < workerCount; ++w) runWorker(w);
+    for (auto& t : threads) t.join();
+    m_evaluations += colorCount;
+    for (const auto& e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+}
+
+
+void DerivativeEstimator::Structure(
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown)
+{
+    if (m_structureValid
+            && m_unknowns.size() == nUnknown
+            && m_knowns.size() == nKnown
+            && std::equal(vUnknown, vUnknown + nUnknown, m_unknowns.begin())
+            && std::equal(vKnown, vKnown + nKnown, m_knowns.begin())) {
+        return;
+    }
+    m_structureValid = false;
+    m_cacheValid = false;
+    m_unknowns.assign(vUnknown, vUnknown + nUnknown);
+    m_knowns.assign(vKnown, vKnown + nKnown);
+
+    // Map the variables to their positions in the declared pattern.
+    const auto none = static_cast<std::size_t>(-1);
+    const auto alloc = Allocator<std::size_t>{m_memory};
+    const auto indexIn = [none] (const Vector<FMIValueReference>& list, FMIValueReference vr) {
+        const auto it = std::find(list.begin(), list.end(), vr);
+        return it == list.end() ? none : static_cast<std::size_t>(it - list.begin());
+    };
+    Vector<std::size_t> patternRow(nUnknown, none, alloc);
+    for (std::size_t i = 0; i < nUnknown; ++i) {
+        patternRow[i] = indexIn(m_patternUnknowns, vUnknown[i]);
+    }
+
+    m_columnStarts.assign(nKnown + 1, 0);
+    m_rowIndices.clear();
+    for (std::size_t j = 0; j < nKnown; ++j) {
+        const auto patternColumn = indexIn(m_patternKnowns, vKnown[j]);
+        for (std::size_t i = 0; i < nUnknown; ++i) {
+            if (patternRow[i] == none || patternColumn == none
+                    || std::binary_search(
+                        m_pattern.begin(),
+                        m_pattern.end(),
+                        std::make_pair(patternRow[i], patternColumn))) {
+                m_rowIndices.push_back(i);
+            }
+        }
+        m_columnStarts[j + 1] = m_rowIndices.size();
+    }
+
+    // Group the columns by colour.  Columns without any nonzero elements
+    // need not be evaluated at all.
+    Vector<std::size_t> colors(nKnown, 0, alloc);
+    const auto colorCount = ColorColumns(
+        m_memory,
+        nUnknown,
+        nKnown,
+        m_columnStarts.data(),
+        m_rowIndices.data(),
+        colors.data());
+    m_colorStarts.assign(colorCount + 1, 0);
+    for (std::size_t j = 0; j < nKnown; ++j) {
+        if (m_columnStarts[j + 1] > m_columnStarts[j]) ++m_colorStarts[colors[j] + 1];
+    }
+    for (std::size_t c = 0; c < colorCount; ++c) {
+        m_colorStarts[c + 1] += m_colorStarts[c];
+    }
+    m_colorColumns.assign(m_colorStarts.back(), 0);
+    Vector<std::size_t> fill(m_colorStarts.begin(), m_colorStarts.end() - 1, alloc);
+    for (std::size_t j = 0; j < nKnown; ++j) {
+        if (m_columnStarts[j + 1] > m_columnStarts[j]) {
+            m_colorColumns[fill[colors[j]]++] = j;
+        }
+    }
+
+    // Drop colours that only had empty columns.
+    std::size_t used = 0;
+    for (std::size_t c = 0; c < colorCount; ++c) {
+        if (m_colorStarts[c + 1] > m_colorStarts[c]) {
+            m_colorStarts[used + 1] = m_colorStarts[c + 1];
+            ++used;
+        }
+    }
+    m_colorStarts.resize(used + 1);
+    m_structureValid = true;
+}
+
+
+} // namespace cppfmu
@@ -0,0 +1,229 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_DERIVATIVES_HPP
+#define CPPFMU_DERIVATIVES_HPP
+
+#include <cstddef>     // std::size_t
+#include <cstdint>     // std::uint64_t
+#include <functional>  // std::function
+#include <utility>     // std::pair
+#include <vector>      // std::vector
+
+#include "cppfmu_common.hpp"
+#include "cppfmu_instance.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// FINITE-DIFFERENCE DERIVATIVES
+// ============================================================================
+
+/* Partitions the columns of a sparse matrix into groups ("colours") such
+ * that no two columns in a group have a nonzero element in the same row, so
+ * all the columns of a group can be estimated with one finite-difference
+ * evaluation.  Uses a greedy algorithm, which is not optimal, but usually
+ * close.
+ *
+ * The nonzero elements are given in compressed column storage: the rows of
+ * column j are rowIndices[columnStarts[j]] to
+ * rowIndices[columnStarts[j+1]-1], all less than 'rowCount'.  On return,
+ * colors[j] is the colour of column j.  Returns the number of colours.
+ */
+std::size_t ColorColumns(
+    const Memory& memory,
+    std::size_t rowCount,
+    std::size_t columnCount,
+    const std::size_t columnStarts[],
+    const std::size_t rowIndices[],
+    std::size_t colors[]);
+
+
+/* Estimates the directional derivative of the real variables 'vUnknown'
+ * with respect to the real variables 'vKnown' of 'instance', in the
+ * direction 'dvKnown', by forward differences.
+ *
+ * The instance's state is saved with GetFMUState() before the inputs are
+ * perturbed, and restored with SetFMUState() afterwards, also if the
+ * estimate fails, so the instance must support FMU state, and its state
+ * must include everything that the perturbation may change.  The outputs
+ * are computed with Instance::EvaluateOutputs(), at the current and at the
+ * perturbed inputs.  'relativeStep' is the size of the perturbation
+ * relative to the magnitude of the inputs (or 1, if that is larger).
+ * Temporary arrays are allocated from 'memory'.
+ *
+ * This is what Instance::GetDirectionalDerivative() does by default, unless
+ * the instance uses a DerivativeEstimator.
+ */
+void EstimateDirectionalDerivative(
+    const Memory& memory,
+    Instance& instance,
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    const FMIReal dvKnown[],
+    FMIReal dvUnknown[],
+    FMIReal relativeStep);
+
+
+/* Estimates Jacobians of an instance's outputs with respect to its inputs
+ * by finite differences, for masters which need whole Jacobians, e.g. for
+ * implicit coupling.
+ *
+ * Such masters call fmi2GetDirectionalDerivative() once per input, with
+ * unit seed vectors, without changing the instance in between.  When an
+ * instance uses a DerivativeEstimator (see
+ * Instance::UseDerivativeEstimator()), the first of these calls estimates
+ * the whole Jacobian, and the rest are served from it, until the instance
+ * is changed by any other FMI function call.
+ *
+ * The Jacobian is estimated with as few evaluations as possible:
+ *
+ *   - If the model declares which outputs may depend on which inputs with
+ *     SetSparsity(), inputs which don't affect any common outputs are
+ *     perturbed together (column compression), so a Jacobian with a
+ *     diagonal or banded structure costs only a few evaluations.
+ *
+ *   - With SetParallelism(), the groups of inputs are divided between the
+ *     instance itself and clones of it, each on its own thread.  The
+ *     clones are created by a factory function on first use, and their
+ *     state is copied from the instance, by serialising its FMU state and
+ *     setting its inputs, before each Jacobian.  The FMU state must
+ *     therefore capture everything the outputs depend on, apart from
+ *     the inputs being differentiated.  All the memory the estimate needs
+ *     is allocated before the threads are started, so the worker threads
+ *     only call SetReal(), EvaluateOutputs(), GetReal() and SetFMUState()
+ *     on their instances.  These must not allocate memory through the
+ *     simulation environment, which need not be thread safe.  With a
+ *     StateTable, this means that EvaluateOutputs() must not change the
+ *     size of a registered container, since SetFMUState() would then
+ *     resize it back.  If a thread can't be started, the calling thread
+ *     evaluates its share.
+ *
+ * As with EstimateDirectionalDerivative(), the outputs are computed with
+ * Instance::EvaluateOutputs(), and the FMU state of the instance is
+ * restored afterwards, also if the estimate fails.
+ */
+class DerivativeEstimator
+{
+public:
+    // A function which creates a new instance of the same kind.
+    using CloneFactory = std::function<UniquePtr<Instance>()>;
+
+    explicit DerivativeEstimator(const Memory& memory);
+
+    ~DerivativeEstimator() CPPFMU_NOEXCEPT;
+
+    DerivativeEstimator(const DerivativeEstimator&) = delete;
+    DerivativeEstimator& operator=(const DerivativeEstimator&) = delete;
+
+    /* Sets the size of the perturbation of each input, relative to its
+     * magnitude (or 1, if that is larger).  The default is the square root
+     * of the machine epsilon.
+     */
+    void SetRelativeStep(FMIReal relativeStep);
+
+    /* Declares that output unknowns[rows[k]] may depend on input
+     * knowns[columns[k]], for k < count, and that, for the outputs and
+     * inputs listed, there are no other dependencies.  Outputs and inputs
+     * which are not listed are assumed to depend on everything.
+     * Throws std::invalid_argument if an index is out of range.
+     */
+    void SetSparsity(
+        const FMIValueReference unknowns[],
+        std::size_t nUnknown,
+        const FMIValueReference knowns[],
+        std::size_t nKnown,
+        const std::size_t rows[],
+        const std::size_t columns[],
+        std::size_t count);
+
+    /* Makes GetJacobian() use 'threadCount' threads, one on the instance
+     * itself and the others on clones created by 'factory'.  Clones which
+     * are no longer needed are destroyed.
+     */
+    void SetParallelism(std::size_t threadCount, CloneFactory factory);
+
+    // Discards the Jacobian held for GetDirectionalDerivative().
+    void Invalidate() CPPFMU_NOEXCEPT { m_cacheValid = false; }
+
+    /* Computes dvUnknown = J*dvKnown, where J is the Jacobian of the
+     * outputs 'vUnknown' with respect to the inputs 'vKnown', which is
+     * estimated with GetJacobian() unless it is held from a previous call
+     * with the same value references since the last Invalidate().
+     */
+    void GetDirectionalDerivative(
+        Instance& instance,
+        const FMIValueReference vUnknown[],
+        std::size_t nUnknown,
+        const FMIValueReference vKnown[],
+        std::size_t nKnown,
+        const FMIReal dvKnown[],
+        FMIReal dvUnknown[]);
+
+    /* Estimates the Jacobian of the outputs 'vUnknown' with respect to the
+     * inputs 'vKnown', as a row-major nUnknown-by-nKnown matrix.  The
+     * instance is left as it was.
+     */
+    void GetJacobian(
+        Instance& instance,
+        const FMIValueReference vUnknown[],
+        std::size_t nUnknown,
+        const FMIValueReference vKnown[],
+        std::size_t nKnown,
+        FMIReal jacobian[]);
+
+    /* The number of times the outputs have been evaluated with perturbed
+     * inputs, i.e., the cost of the estimates so far.
+     */
+    std::uint64_t EvaluationCount() const CPPFMU_NOEXCEPT
+    {
+        return m_evaluations;
+    }
+
+private:
+    template<typename T>
+    using Vector = std::vector<T, Allocator<T>>;
+
+    // Computes the column structure and colouring for the given variables.
+    void Structure(
+        const FMIValueReference vUnknown[],
+        std::size_t nUnknown,
+        const FMIValueReference vKnown[],
+        std::size_t nKnown);
+
+    Memory m_memory;
+    FMIReal m_relativeStep;
+    std::uint64_t m_evaluations = 0;
+
+    // The declared sparsity pattern, as sorted (unknown, known) pairs.
+    Vector<FMIValueReference> m_patternUnknowns;
+    Vector<FMIValueReference> m_patternKnowns;
+    Vector<std::pair<std::size_t, std::size_t>> m_pattern;
+
+    // The structure of the last Jacobian, and its columns grouped by colour.
+    Vector<FMIValueReference> m_unknowns;
+    Vector<FMIValueReference> m_knowns;
+    bool m_structureValid = false;
+    Vector<std::size_t> m_columnStarts;
+    Vector<std::size_t> m_rowIndices;
+    Vector<std::size_t> m_colorStarts;
+    Vector<std::size_t> m_colorColumns;
+
+    // The Jacobian held for GetDirectionalDerivative().
+    Vector<FMIReal> m_jacobian;
+    bool m_cacheValid = false;
+
+    std::size_t m_threadCount = 1;
+    CloneFactory m_cloneFactory;
+    Vector<UniquePtr<Instance>> m_clones;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,316 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_instance.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+#include "cppfmu_derivatives.hpp"
+#include "cppfmu_state.hpp"
+#include "cppfmu_variables.hpp"
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    /* Marks the state regions which hold the variables with the given value
+     * references as modified, so that incremental snapshots include values
+     * set by the environment.  'find' maps a value reference to its
+     * variable.
+     */
+    template<typename Find>
+    void MarkWritten(
+        StateTable* state,
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        Find find) CPPFMU_NOEXCEPT
+    {
+        if (state == nullptr || !state->IncrementalSnapshotsEnabled()) return;
+        for (std::size_t i = 0; i < nvr; ++i) {
+            const auto variable = find(vr[i]);
+            if (variable != nullptr) state->MarkVariableDirty(variable);
+        }
+    }
+}
+
+
+// =============================================================================
+// Instance
+// =============================================================================
+
+
+void Instance::SetupExperiment(
+    FMIBoolean /*toleranceDefined*/,
+    FMIReal /*tolerance*/,
+    FMIReal /*tStart*/,
+    FMIBoolean /*stopTimeDefined*/,
+    FMIReal /*tStop*/)
+{
+    // Do nothing
+}
+
+
+void Instance::EnterInitializationMode()
+{
+    // Do nothing
+}
+
+
+void Instance::ExitInitializationMode()
+{
+    // Do nothing
+}
+
+
+void Instance::Terminate()
+{
+    // Do nothing
+}
+
+
+void Instance::Reset()
+{
+    // Do nothing
+}
+
+
+void Instance::SetReal(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    const FMIReal value[])
+{
+    if (m_variables) {
+        const auto variables = m_variables;
+        MarkWritten(m_state, vr, nvr, [variables] (FMIValueReference v) {
+            return variables->FindReal(v);
+        });
+        m_variables->SetReal(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::SetInteger(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    const FMIInteger value[])
+{
+    if (m_variables) {
+        const auto variables = m_variables;
+        MarkWritten(m_state, vr, nvr, [variables] (FMIValueReference v) {
+            return variables->FindInteger(v);
+        });
+        m_variables->SetInteger(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::SetBoolean(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    const FMIBoolean value[])
+{
+    if (m_variables) {
+        const auto variables = m_variables;
+        MarkWritten(m_state, vr, nvr, [variables] (FMIValueReference v) {
+            return variables->FindBoolean(v);
+        });
+        m_variables->SetBoolean(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::SetString(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    const FMIString value[])
+{
+    if (m_variables) {
+        const auto variables = m_variables;
+        MarkWritten(m_state, vr, nvr, [variables] (FMIValueReference v) {
+            return variables->FindString(v);
+        });
+        m_variables->SetString(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::GetReal(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIReal value[]) const
+{
+    if (m_variables) {
+        m_variables->GetReal(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to get nonexistent variable");
+    }
+}
+
+
+void Instance::GetInteger(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIInteger value[]) const
+{
+    if (m_variables) {
+        m_variables->GetInteger(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to get nonexistent variable");
+    }
+}
+
+
+void Instance::GetBoolean(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIBoolean value[]) const
+{
+    if (m_variables) {
+        m_variables->GetBoolean(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::GetString(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIString value[]) const
+{
+    if (m_variables) {
+        m_variables->GetString(vr, nvr, value);
+    } else if (nvr != 0) {
+        throw std::logic_error("Attempted to set nonexistent variable");
+    }
+}
+
+
+void Instance::GetFMUState(FMIFMUState* state)
+{
+    if (m_state) return m_state->GetState(state);
+    throw std::logic_error("Operation not supported: get FMU state");
+}
+
+
+void Instance::SetFMUState(FMIFMUState state)
+{
+    if (m_state) return m_state->SetState(state);
+    throw std::logic_error("Operation not supported: set FMU state");
+}
+
+
+void Instance::FreeFMUState(FMIFMUState state)
+{
+    if (m_state) return m_state->FreeState(state);
+    throw std::logic_error("Operation not supported: free FMU state");
+}
+
+
+std::size_t Instance::SerializedFMUStateSize(FMIFMUState state)
+{
+    if (m_state) return m_state->SerializedStateSize(state);
+    throw std::logic_error("Operation not supported: get serialized FMU state size");
+}
+
+
+void Instance::SerializeFMUState(
+    FMIFMUState state,
+    FMIByte data[],
+    std::size_t size)
+{
+    if (m_state) return m_state->SerializeState(state, data, size);
+    throw std::logic_error("Operation not supported: serialize FMU state");
+}
+
+
+FMIFMUState Instance::DeserializeFMUState(
+    const FMIByte data[],
+    std::size_t size)
+{
+    if (m_state) return m_state->DeserializeState(data, size);
+    throw std::logic_error("Operation not supported: deserialize FMU state");
+}
+
+
+void Instance::GetDirectionalDerivative(
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    const FMIReal dvKnown[],
+    FMIReal dvUnknown[])
+{
+    if (m_derivativeEstimator) {
+        m_derivativeEstimator->GetDirectionalDerivative(
+            *this, vUnknown, nUnknown, vKnown, nKnown, dvKnown, dvUnknown);
+        return;
+    }
+    // The memory of the FMU instance, or that of the state table if the
+    // instance was not created through the FMI functions.
+    const auto memory = m_memory != nullptr ? m_memory
+        : m_state != nullptr ? &m_state->GetMemory()
+        : nullptr;
+    if (memory == nullptr) {
+        throw std::logic_error(
+            "Finite-difference derivatives require FMU state support");
+    }
+    EstimateDirectionalDerivative(
+        *memory, *this, vUnknown, nUnknown, vKnown, nKnown, dvKnown, dvUnknown,
+        std::sqrt(DBL_EPSILON));
+}
+
+
+void Instance::EvaluateOutputs()
+{
+    throw std::logic_error(
+        "Finite-difference derivatives require the instance to implement "
+        "EvaluateOutputs()");
+}
+
+
+Instance::Instance() CPPFMU_NOEXCEPT
+{
+}
+
+
+Instance::~Instance() CPPFMU_NOEXCEPT
+{
+    // Do nothing
+}
+
+
+void Instance::UseVariableTable(VariableTable& table) CPPFMU_NOEXCEPT
+{
+    m_variables = &table;
+}
+
+
+void Instance::UseStateTable(StateTable& table) CPPFMU_NOEXCEPT
+{
+    m_state = &table;
+}
+
+
+void Instance::UseDerivativeEstimator(DerivativeEstimator& estimator)
+    CPPFMU_NOEXCEPT
+{
+    m_derivativeEstimator = &estimator;
+}
+
+
+} // namespace
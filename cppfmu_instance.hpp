@@ -0,0 +1,253 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_INSTANCE_HPP
+#define CPPFMU_INSTANCE_HPP
+
+#include "cppfmu_common.hpp"
+
+namespace cppfmu
+{
+
+namespace detail
+{
+    // Gives fmi_functions.cpp access to the internals of the instance classes.
+    struct InstanceAccess;
+}
+
+class CallStatistics;       // cppfmu_stats.hpp
+class DerivativeEstimator;  // cppfmu_derivatives.hpp
+class StateTable;           // cppfmu_state.hpp
+class Tracer;               // cppfmu_trace.hpp
+class VariableTable;        // cppfmu_variables.hpp
+
+
+/* ============================================================================
+ * COMMON INTERFACE
+ * ============================================================================
+ */
+
+/* The base class for FMU instances, i.e., co-simulation slaves
+ * (SlaveInstance) and model exchange models (ModelInstance).
+ *
+ * It declares the functions which are common to both FMU types, and which
+ * map directly to the C functions defined by FMI 2.0 (and, with some
+ * adaptations, FMI 1.0).  Model code should derive from SlaveInstance or
+ * ModelInstance rather than from this class.
+ */
+class Instance
+{
+public:
+    /* Called from fmi2SetupExperiment() (FMI 2.0) or fmiInitializeSlave()
+     * (FMI 1.0).
+     * Does nothing by default.
+     */
+    virtual void SetupExperiment(
+        FMIBoolean toleranceDefined,
+        FMIReal tolerance,
+        FMIReal tStart,
+        FMIBoolean stopTimeDefined,
+        FMIReal tStop);
+
+    /* Called from fmi2EnterInitializationMode() (FMI 2.0) or
+     * fmiInitializeSlave() (FMI 1.0).
+     * Does nothing by default.
+     */
+    virtual void EnterInitializationMode();
+
+    /* Called from fmi2ExitInitializationMode() (FMI 2.0) or
+     * fmiInitializeSlave() (FMI 1.0).
+     * Does nothing by default.
+     */
+    virtual void ExitInitializationMode();
+
+    /* Called from fmi2Terminate()/fmiTerminateSlave().
+     * Does nothing by default.
+     */
+    virtual void Terminate();
+
+    /* Called from fmi2Reset()/fmiResetSlave().
+     * Does nothing by default.
+     */
+    virtual void Reset();
+
+    /* Called from fmi2SetXxx()/fmiSetXxx().
+     * If a variable table has been set with UseVariableTable(), the values
+     * are written to the variables registered in it.  Otherwise, throws
+     * std::logic_error by default.
+     */
+    virtual void SetReal(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIReal value[]);
+    virtual void SetInteger(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIInteger value[]);
+    virtual void SetBoolean(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIBoolean value[]);
+    virtual void SetString(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIString value[]);
+
+    /* Called from fmi2GetXxx()/fmiGetXxx().
+     * If a variable table has been set with UseVariableTable(), the values
+     * are read from the variables registered in it.  Otherwise, throws
+     * std::logic_error by default.
+     */
+    virtual void GetReal(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIReal value[]) const;
+    virtual void GetInteger(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIInteger value[]) const;
+    virtual void GetBoolean(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIBoolean value[]) const;
+    virtual void GetString(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIString value[]) const;
+
+    /* Called from fmi2GetFMUState().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual void GetFMUState(FMIFMUState* state);
+
+    /* Called from fmi2SetFMUstate().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual void SetFMUState(FMIFMUState state);
+
+    /* Called from fmi2FreeFMUstate().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual void FreeFMUState(FMIFMUState state);
+
+    /* Called from fmi2SerializedFMUstateSize().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual std::size_t SerializedFMUStateSize(FMIFMUState state);
+
+    /* Called from fmi2SerializeFMUstate().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual void SerializeFMUState(
+        FMIFMUState state,
+        FMIByte data[],
+        std::size_t size);
+
+    /* Called from fmi2DeSerializeFMUstate().
+     * Never called with FMI 1.x.
+     * Forwards to the state table set with UseStateTable(), if any.
+     * Otherwise, throws std::logic_error by default.
+     */
+    virtual FMIFMUState DeserializeFMUState(
+        const FMIByte data[],
+        std::size_t size);
+
+    /* Called from fmi2GetDirectionalDerivative().
+     * Never called with FMI 1.x.
+     * Computes the derivatives of the real variables 'vUnknown' with
+     * respect to the real variables 'vKnown' in the direction 'dvKnown'.
+     * By default, they are estimated by finite differences: with the
+     * estimator set with UseDerivativeEstimator(), if any, and otherwise
+     * with EstimateDirectionalDerivative().  Either way, this requires
+     * support for FMU state and an implementation of EvaluateOutputs(),
+     * and throws std::logic_error otherwise.
+     */
+    virtual void GetDirectionalDerivative(
+        const FMIValueReference vUnknown[],
+        std::size_t nUnknown,
+        const FMIValueReference vKnown[],
+        std::size_t nKnown,
+        const FMIReal dvKnown[],
+        FMIReal dvUnknown[]);
+
+    /* Called by the finite-difference estimates of directional derivatives
+     * after setting the inputs, to bring the outputs up to date with the
+     * current inputs and states, without advancing time.  A slave which
+     * computes its outputs in DoStep() must do the same here, and one whose
+     * outputs are always up to date (e.g. computed in SetXxx() or GetXxx())
+     * can simply do nothing.  Changes made here are undone by restoring
+     * the FMU state afterwards.
+     * Throws std::logic_error by default.
+     */
+    virtual void EvaluateOutputs();
+
+
+    // The instance is destroyed in fmi2FreeInstance()/fmiFreeSlaveInstance().
+    virtual ~Instance() CPPFMU_NOEXCEPT;
+
+protected:
+    Instance() CPPFMU_NOEXCEPT;
+
+    /* Makes the default implementations of the GetXxx() and SetXxx()
+     * functions serve all requests from 'table'.  The table is not copied,
+     * so it must outlive this object (typically by being a member of the
+     * derived class).
+     */
+    void UseVariableTable(VariableTable& table) CPPFMU_NOEXCEPT;
+
+    /* Makes the default implementations of the FMU state functions
+     * (GetFMUState(), SetFMUState(), etc.) forward to 'table'.  The table
+     * is not copied, so it must outlive this object.
+     */
+    void UseStateTable(StateTable& table) CPPFMU_NOEXCEPT;
+
+    /* Makes the default implementation of GetDirectionalDerivative() use
+     * 'estimator', which holds the estimated Jacobian between calls.  The
+     * estimator is not copied, so it must outlive this object.
+     */
+    void UseDerivativeEstimator(DerivativeEstimator& estimator) CPPFMU_NOEXCEPT;
+
+    /* Returns the statistics for the FMI function calls made on this
+     * instance so far, or null if fmi_functions.cpp was not compiled with
+     * CPPFMU_FUNCTION_STATISTICS defined.
+     */
+    const CallStatistics* GetCallStatistics() const CPPFMU_NOEXCEPT
+    {
+        return m_callStatistics;
+    }
+
+    /* Returns the tracer which records the FMI function calls made on this
+     * instance, or null if tracing is disabled.  (See cppfmu::Tracer.)
+     * The instance can add its own spans to the trace with
+     * cppfmu::TraceScope.
+     */
+    Tracer* GetTracer() const CPPFMU_NOEXCEPT
+    {
+        return m_tracer;
+    }
+
+private:
+    friend struct detail::InstanceAccess;
+
+    VariableTable* m_variables = nullptr;
+    StateTable* m_state = nullptr;
+    DerivativeEstimator* m_derivativeEstimator = nullptr;
+    const Memory* m_memory = nullptr;
+    const CallStatistics* m_callStatistics = nullptr;
+    Tracer* m_tracer = nullptr;
+};
+
+} // namespace cppfmu
+#endif // header guard
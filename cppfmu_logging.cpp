@@ -0,0 +1,143 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_logging.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+
+namespace cppfmu
+{
+
+// =============================================================================
+// LogBuffer
+// =============================================================================
+
+
+LogBuffer::LogBuffer(const Memory& memory, std::size_t capacity)
+    : m_memory{memory}
+    , m_enqueuePos{0}
+    , m_dropped{0}
+{
+    std::size_t n = 1;
+    while (n < capacity) {
+        if (n > static_cast<std::size_t>(-1) / 2 / sizeof(Slot)) throw std::bad_alloc();
+        n *= 2;
+    }
+    m_slots = static_cast<Slot*>(m_memory.Alloc(n, sizeof(Slot)));
+    if (m_slots == nullptr) throw std::bad_alloc();
+    for (std::size_t i = 0; i < n; ++i) {
+        ::new(static_cast<void*>(&m_slots[i].sequence)) std::atomic<std::size_t>(i);
+    }
+    m_mask = n - 1;
+}
+
+
+LogBuffer::~LogBuffer() CPPFMU_NOEXCEPT
+{
+    m_memory.Free(m_slots);
+}
+
+
+bool LogBuffer::Push(
+    FMIStatus status,
+    FMIString category,
+    FMIString format,
+    std::va_list args) CPPFMU_NOEXCEPT
+{
+    // Claim a slot.  This is the bounded queue algorithm of D. Vyukov,
+    // where a slot is free for position 'pos' when its sequence number is
+    // 'pos', and holds a message when it is 'pos + 1'.
+    auto pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &m_slots[pos & m_mask];
+        const auto seq = slot->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->status = status;
+    std::size_t categoryLength = category == nullptr ? 0 : std::strlen(category);
+    if (categoryLength > MAX_CATEGORY_LENGTH) categoryLength = MAX_CATEGORY_LENGTH;
+    if (categoryLength > 0) std::memcpy(slot->category, category, categoryLength);
+    slot->category[categoryLength] = '\0';
+    if (std::vsnprintf(slot->message, sizeof slot->message, format, args) < 0) {
+        slot->message[0] = '\0';
+    }
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+
+// =============================================================================
+// Logger
+// =============================================================================
+
+
+void Logger::EnableBuffering(std::size_t capacity)
+{
+    if (m_settings->buffer) return;
+    const auto& memory = m_settings->memory;
+    m_settings->buffer = AllocateUnique<LogBuffer>(memory, memory, capacity);
+}
+
+
+void Logger::Flush() CPPFMU_NOEXCEPT
+{
+    const auto buffer = m_settings->buffer.get();
+    if (buffer == nullptr) return;
+    buffer->Drain([this] (FMIStatus status, FMIString category, FMIString message) {
+        m_fmiLogger(
+            m_component,
+            m_instanceName.c_str(),
+            status,
+            category,
+            "%s",
+            message);
+    });
+    if (const auto dropped = buffer->TakeDroppedCount()) {
+        m_fmiLogger(
+            m_component,
+            m_instanceName.c_str(),
+            FMIWarning,
+            "cppfmu",
+            "%lu log messages were discarded because the log buffer was full",
+            static_cast<unsigned long>(dropped));
+    }
+}
+
+
+namespace detail
+{
+    void BufferLogMessage(
+        LogBuffer& buffer,
+        FMIStatus status,
+        FMIString category,
+        FMIString format,
+        ...) CPPFMU_NOEXCEPT
+    {
+        std::va_list args;
+        va_start(args, format);
+        buffer.Push(status, category, format, args);
+        va_end(args);
+    }
+}
+
+
+} // namespace cppfmu
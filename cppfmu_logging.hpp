@@ -0,0 +1,119 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_LOGGING_HPP
+#define CPPFMU_LOGGING_HPP
+
+#include <atomic>   // std::atomic, std::atomic_flag
+#include <cstdarg>  // std::va_list
+#include <cstddef>  // std::size_t
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// BUFFERED LOGGING
+// ============================================================================
+
+/* A bounded queue of formatted log messages, used by Logger when buffering
+ * has been enabled with Logger::EnableBuffering().
+ *
+ * Any number of threads may add messages concurrently with Push(), which
+ * never blocks and never allocates memory.  If the buffer is full, the
+ * message is discarded and counted instead.  Drain() passes the messages on
+ * in the order in which they were added.  It may also be called from any
+ * thread, but if it is called while another thread is draining the buffer,
+ * it returns immediately.
+ *
+ * Messages are stored in fixed-size slots, so categories longer than
+ * MAX_CATEGORY_LENGTH and messages longer than MAX_MESSAGE_LENGTH
+ * characters are truncated.
+ */
+class LogBuffer
+{
+public:
+    static const std::size_t MAX_CATEGORY_LENGTH = 63;
+    static const std::size_t MAX_MESSAGE_LENGTH = 447;
+
+    /* Creates a buffer with room for 'capacity' messages (rounded up to a
+     * power of two), whose memory is allocated from 'memory'.
+     */
+    LogBuffer(const Memory& memory, std::size_t capacity);
+
+    ~LogBuffer() CPPFMU_NOEXCEPT;
+
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    /* Formats a message with std::vsnprintf() and adds it to the buffer.
+     * Returns false if the buffer was full.
+     */
+    bool Push(
+        FMIStatus status,
+        FMIString category,
+        FMIString format,
+        std::va_list args) CPPFMU_NOEXCEPT;
+
+    /* Removes all messages from the buffer, calling
+     * sink(status, category, message) for each of them.
+     */
+    template<typename Sink>
+    void Drain(Sink sink) CPPFMU_NOEXCEPT
+    {
+        if (m_draining.test_and_set(std::memory_order_acquire)) return;
+        for (;;) {
+            auto& slot = m_slots[m_dequeuePos & m_mask];
+            if (slot.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1) {
+                break;
+            }
+            sink(slot.status, slot.category, slot.message);
+            slot.sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+            ++m_dequeuePos;
+        }
+        m_draining.clear(std::memory_order_release);
+    }
+
+    /* Returns the number of messages that have been discarded because the
+     * buffer was full since the last call, and resets the count.
+     */
+    std::size_t TakeDroppedCount() CPPFMU_NOEXCEPT
+    {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Returns the number of messages the buffer can hold.
+    std::size_t Capacity() const CPPFMU_NOEXCEPT { return m_mask + 1; }
+
+private:
+    /* A message slot.  'sequence' tells whether the slot is free or holds a
+     * message, and for which round through the buffer.
+     */
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        FMIStatus status;
+        char category[MAX_CATEGORY_LENGTH + 1];
+        char message[MAX_MESSAGE_LENGTH + 1];
+    };
+
+    Memory m_memory;
+    Slot* m_slots;
+    std::size_t m_mask;
+
+    // The position of the next message to be added (shared by producers)
+    std::atomic<std::size_t> m_enqueuePos;
+    std::atomic<std::size_t> m_dropped;
+
+    // The position of the next message to be removed (owned by the consumer)
+    std::atomic_flag m_draining = ATOMIC_FLAG_INIT;
+    std::size_t m_dequeuePos = 0;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
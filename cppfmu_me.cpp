@@ -0,0 +1,222 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_me.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    void CheckSize(std::size_t requested, std::size_t actual, const char* what)
+    {
+        if (requested != actual) {
+            throw std::logic_error(
+                std::string("Wrong number of ") + what + " requested");
+        }
+    }
+
+    void Copy(FMIReal* dst, const FMIReal* src, std::size_t n) CPPFMU_NOEXCEPT
+    {
+        if (n > 0) std::memcpy(dst, src, n * sizeof(FMIReal));
+    }
+}
+
+
+// =============================================================================
+// ModelInstance
+// =============================================================================
+
+
+void ModelInstance::SetTime(FMIReal time)
+{
+    m_time = time;
+}
+
+
+void ModelInstance::SetContinuousStates(const FMIReal states[], std::size_t nx)
+{
+    CheckSize(nx, m_nx, "continuous states");
+    Copy(m_states, states, nx);
+}
+
+
+void ModelInstance::GetContinuousStates(FMIReal states[], std::size_t nx)
+{
+    CheckSize(nx, m_nx, "continuous states");
+    Copy(states, m_states, nx);
+}
+
+
+void ModelInstance::GetNominalsOfContinuousStates(
+    FMIReal nominals[],
+    std::size_t nx)
+{
+    for (std::size_t i = 0; i < nx; ++i) nominals[i] = 1.0;
+}
+
+
+void ModelInstance::GetDerivatives(FMIReal derivatives[], std::size_t nx)
+{
+    CheckSize(nx, m_nx, "derivatives");
+    if (nx == 0) return;
+    EnsureEvaluated();
+    Copy(derivatives, m_derivatives, nx);
+}
+
+
+void ModelInstance::GetEventIndicators(FMIReal eventIndicators[], std::size_t ni)
+{
+    CheckSize(ni, m_ni, "event indicators");
+    if (ni == 0) return;
+    EnsureEvaluated();
+    Copy(eventIndicators, m_eventIndicators, ni);
+}
+
+
+void ModelInstance::GetReal(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIReal value[]) const
+{
+    // Evaluation doesn't change the variables' values as seen from outside.
+    const_cast<ModelInstance*>(this)->EnsureEvaluated();
+    Instance::GetReal(vr, nvr, value);
+}
+
+
+void ModelInstance::GetInteger(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIInteger value[]) const
+{
+    const_cast<ModelInstance*>(this)->EnsureEvaluated();
+    Instance::GetInteger(vr, nvr, value);
+}
+
+
+void ModelInstance::GetBoolean(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIBoolean value[]) const
+{
+    const_cast<ModelInstance*>(this)->EnsureEvaluated();
+    Instance::GetBoolean(vr, nvr, value);
+}
+
+
+void ModelInstance::GetString(
+    const FMIValueReference vr[],
+    std::size_t nvr,
+    FMIString value[]) const
+{
+    const_cast<ModelInstance*>(this)->EnsureEvaluated();
+    Instance::GetString(vr, nvr, value);
+}
+
+
+void ModelInstance::EnterEventMode()
+{
+    // Do nothing
+}
+
+
+void ModelInstance::NewDiscreteStates(EventInfo& /*eventInfo*/)
+{
+    // Do nothing
+}
+
+
+void ModelInstance::EnterContinuousTimeMode()
+{
+    // Do nothing
+}
+
+
+void ModelInstance::CompletedIntegratorStep(
+    bool /*noSetFMUStatePriorToCurrentPoint*/,
+    bool& enterEventMode,
+    bool& terminateSimulation)
+{
+    enterEventMode = false;
+    terminateSimulation = false;
+}
+
+
+void ModelInstance::GetDirectionalDerivative(
+    const FMIValueReference vUnknown[],
+    std::size_t nUnknown,
+    const FMIValueReference vKnown[],
+    std::size_t nKnown,
+    const FMIReal dvKnown[],
+    FMIReal dvUnknown[])
+{
+    try {
+        Instance::GetDirectionalDerivative(
+            vUnknown, nUnknown, vKnown, nKnown, dvKnown, dvUnknown);
+    } catch (...) {
+        m_evaluated = false;
+        throw;
+    }
+    m_evaluated = false;
+}
+
+
+void ModelInstance::EvaluateOutputs()
+{
+    Evaluate();
+    m_evaluated = true;
+}
+
+
+ModelInstance::ModelInstance() CPPFMU_NOEXCEPT
+{
+}
+
+
+void ModelInstance::Evaluate()
+{
+    if (m_nx > 0 || m_ni > 0) {
+        throw std::logic_error("Model does not implement Evaluate()");
+    }
+}
+
+
+void ModelInstance::UseContinuousStates(
+    FMIReal* states,
+    FMIReal* derivatives,
+    std::size_t nx) CPPFMU_NOEXCEPT
+{
+    m_states = states;
+    m_derivatives = derivatives;
+    m_nx = nx;
+    m_evaluated = false;
+}
+
+
+void ModelInstance::UseEventIndicators(FMIReal* eventIndicators, std::size_t ni)
+    CPPFMU_NOEXCEPT
+{
+    m_eventIndicators = eventIndicators;
+    m_ni = ni;
+    m_evaluated = false;
+}
+
+
+void ModelInstance::EnsureEvaluated()
+{
+    if (!m_evaluated) {
+        Evaluate();
+        m_evaluated = true;
+    }
+}
+
+
+} // namespace
@@ -0,0 +1,257 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_ME_HPP
+#define CPPFMU_ME_HPP
+
+#include <cstddef>  // std::size_t
+#include "cppfmu_common.hpp"
+#include "cppfmu_instance.hpp"
+
+namespace cppfmu
+{
+
+/* ============================================================================
+ * MODEL EXCHANGE INTERFACE
+ * ============================================================================
+ */
+
+// The information returned by ModelInstance::NewDiscreteStates().
+struct EventInfo
+{
+    bool newDiscreteStatesNeeded = false;
+    bool terminateSimulation = false;
+    bool nominalsOfContinuousStatesChanged = false;
+    bool valuesOfContinuousStatesChanged = false;
+    bool nextEventTimeDefined = false;
+    FMIReal nextEventTime = 0.0;
+};
+
+
+/* A base class for model exchange instances.
+ *
+ * Model exchange is only supported with FMI 2.0, and must be enabled by
+ * compiling fmi_functions.cpp with the macro CPPFMU_MODEL_EXCHANGE defined.
+ * The instances are then created by CppfmuInstantiateModel().
+ *
+ * The methods map directly to the C functions defined by FMI 2.0, so the
+ * documentation here is intentionally sparse.  The functions which are
+ * common to all FMU types are declared in the base class, cppfmu::Instance.
+ *
+ * The continuous states, their derivatives and the event indicators are
+ * always exchanged as whole arrays.  In the simplest case, a model stores
+ * them in arrays of its own, registers these with UseContinuousStates()
+ * and UseEventIndicators(), and overrides Evaluate() to compute the
+ * derivatives, event indicators and outputs, all at once, for the current
+ * time, states and inputs:
+ *
+ *     class Ball : public cppfmu::ModelInstance
+ *     {
+ *     public:
+ *         Ball() { UseContinuousStates(x_, dx_, 2); }
+ *
+ *     protected:
+ *         void Evaluate() override
+ *         {
+ *             dx_[0] = x_[1];
+ *             dx_[1] = -9.81;
+ *         }
+ *
+ *     private:
+ *         cppfmu::FMIReal x_[2] = {1.0, 0.0};
+ *         cppfmu::FMIReal dx_[2];
+ *     };
+ *
+ * Evaluate() is called at most once per time/state/input combination, the
+ * first time fmi2GetDerivatives(), fmi2GetEventIndicators() or one of the
+ * fmi2GetXxx() functions is called after one of them has changed.  Outputs
+ * which depend on the time or the states therefore belong in Evaluate(), so
+ * that they are up to date when they are read.  Alternatively, the functions
+ * that exchange the arrays may be overridden directly; overrides of
+ * GetReal() etc. should call EnsureEvaluated() first.
+ */
+class ModelInstance : public Instance
+{
+public:
+    /* Called from fmi2SetTime().
+     * Stores the time, which is returned by Time(), by default.
+     */
+    virtual void SetTime(FMIReal time);
+
+    /* Called from fmi2SetContinuousStates().
+     * Copies the states to the array set with UseContinuousStates() by
+     * default.
+     */
+    virtual void SetContinuousStates(const FMIReal states[], std::size_t nx);
+
+    /* Called from fmi2GetContinuousStates().
+     * Copies the states from the array set with UseContinuousStates() by
+     * default.
+     */
+    virtual void GetContinuousStates(FMIReal states[], std::size_t nx);
+
+    /* Called from fmi2GetNominalsOfContinuousStates().
+     * Sets all nominals to 1 by default.
+     */
+    virtual void GetNominalsOfContinuousStates(
+        FMIReal nominals[],
+        std::size_t nx);
+
+    /* Called from fmi2GetDerivatives().
+     * Calls Evaluate() if necessary, and copies the derivatives from the
+     * array set with UseContinuousStates() by default.
+     */
+    virtual void GetDerivatives(FMIReal derivatives[], std::size_t nx);
+
+    /* Called from fmi2GetEventIndicators().
+     * Calls Evaluate() if necessary, and copies the event indicators from
+     * the array set with UseEventIndicators() by default.
+     */
+    virtual void GetEventIndicators(FMIReal eventIndicators[], std::size_t ni);
+
+    /* Called from fmi2GetXxx().
+     * Call Evaluate() if necessary, so that outputs computed there are up
+     * to date, and then read the values as Instance does.
+     */
+    void GetReal(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIReal value[]) const override;
+    void GetInteger(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIInteger value[]) const override;
+    void GetBoolean(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIBoolean value[]) const override;
+    void GetString(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIString value[]) const override;
+
+    /* Called from fmi2EnterEventMode().
+     * Does nothing by default.
+     */
+    virtual void EnterEventMode();
+
+    /* Called from fmi2NewDiscreteStates().
+     * Leaves 'eventInfo' as it is (i.e., no new discrete states and no
+     * time events) by default.
+     */
+    virtual void NewDiscreteStates(EventInfo& eventInfo);
+
+    /* Called from fmi2EnterContinuousTimeMode().
+     * Does nothing by default.
+     */
+    virtual void EnterContinuousTimeMode();
+
+    /* Called from fmi2CompletedIntegratorStep().
+     * Sets both 'enterEventMode' and 'terminateSimulation' to false by
+     * default.
+     */
+    virtual void CompletedIntegratorStep(
+        bool noSetFMUStatePriorToCurrentPoint,
+        bool& enterEventMode,
+        bool& terminateSimulation);
+
+    /* Estimates the derivatives as Instance::GetDirectionalDerivative()
+     * does, and then makes the next GetDerivatives() or
+     * GetEventIndicators() call Evaluate() again, since restoring the FMU
+     * state after the estimate need not restore the derivatives.
+     */
+    void GetDirectionalDerivative(
+        const FMIValueReference vUnknown[],
+        std::size_t nUnknown,
+        const FMIValueReference vKnown[],
+        std::size_t nKnown,
+        const FMIReal dvKnown[],
+        FMIReal dvUnknown[]) override;
+
+    /* Calls Evaluate(), so models which compute their outputs along with
+     * the derivatives need not override this.
+     */
+    void EvaluateOutputs() override;
+
+protected:
+    ModelInstance() CPPFMU_NOEXCEPT;
+
+    /* Computes the derivatives of the continuous states, the event
+     * indicators and the outputs, and stores the former two in the arrays
+     * set with UseContinuousStates() and UseEventIndicators().
+     * Only called via EnsureEvaluated() and EvaluateOutputs().  By default,
+     * throws std::logic_error if the model has continuous states or event
+     * indicators, and does nothing otherwise.
+     */
+    virtual void Evaluate();
+
+    /* Calls Evaluate(), unless it has already been called since the time,
+     * the states or any variables last changed (see InvalidateEvaluation()).
+     */
+    void EnsureEvaluated();
+
+    /* Makes the default implementations of the functions that exchange
+     * continuous states and derivatives use 'states' and 'derivatives',
+     * which are arrays of 'nx' elements.  The arrays are not copied, so
+     * they must outlive this object.
+     */
+    void UseContinuousStates(
+        FMIReal* states,
+        FMIReal* derivatives,
+        std::size_t nx) CPPFMU_NOEXCEPT;
+
+    /* Makes the default implementation of GetEventIndicators() use
+     * 'eventIndicators', an array of 'ni' elements.  The array is not
+     * copied, so it must outlive this object.
+     */
+    void UseEventIndicators(FMIReal* eventIndicators, std::size_t ni)
+        CPPFMU_NOEXCEPT;
+
+    /* Makes the next call to GetDerivatives() or GetEventIndicators() call
+     * Evaluate().  This happens automatically when the time, the states or
+     * any variables are set, when the model is reset or its state is
+     * restored, and in event mode, so models only need to call it if they
+     * change in other ways.
+     */
+    void InvalidateEvaluation() CPPFMU_NOEXCEPT { m_evaluated = false; }
+
+    // The time set by the default implementation of SetTime().
+    FMIReal Time() const CPPFMU_NOEXCEPT { return m_time; }
+
+private:
+    friend struct detail::InstanceAccess;
+
+    FMIReal m_time = 0.0;
+    FMIReal* m_states = nullptr;
+    FMIReal* m_derivatives = nullptr;
+    std::size_t m_nx = 0;
+    FMIReal* m_eventIndicators = nullptr;
+    std::size_t m_ni = 0;
+    bool m_evaluated = false;
+};
+
+} // namespace cppfmu
+
+
+/* A function which must be defined by model code if fmi_functions.cpp is
+ * compiled with CPPFMU_MODEL_EXCHANGE defined, and which should create and
+ * return a new model exchange instance.
+ *
+ * It works like CppfmuInstantiateSlave(), and its parameters correspond to
+ * those of fmi2Instantiate().  (See CppfmuInstantiateSlave() for an
+ * explanation of 'memory' and 'logger'.)
+ *
+ * Note that this function is declared in the global namespace.
+ */
+cppfmu::UniquePtr<cppfmu::ModelInstance> CppfmuInstantiateModel(
+    cppfmu::FMIString instanceName,
+    cppfmu::FMIString fmuGUID,
+    cppfmu::FMIString fmuResourceLocation,
+    cppfmu::FMIBoolean visible,
+    cppfmu::Memory memory,
+    cppfmu::Logger logger);
+
+
+#endif // header guard
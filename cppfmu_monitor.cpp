@@ -0,0 +1,148 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_monitor.hpp"
+
+#include <limits>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    const char* const category = "cppfmu.realtime";
+
+    std::uint64_t SecondsToNanoseconds(FMIReal seconds) CPPFMU_NOEXCEPT
+    {
+        const auto ns = seconds * 1e9;
+        if (!(ns > 0.0)) return 0;
+        if (ns >= 1.8e19) return std::numeric_limits<std::uint64_t>::max();
+        return static_cast<std::uint64_t>(ns);
+    }
+
+    FMIInteger Saturate(std::uint64_t value) CPPFMU_NOEXCEPT
+    {
+        const auto max = std::numeric_limits<FMIInteger>::max();
+        return value > static_cast<std::uint64_t>(max)
+            ? max
+            : static_cast<FMIInteger>(value);
+    }
+}
+
+
+// =============================================================================
+// StepMonitor
+// =============================================================================
+
+
+StepMonitor::StepMonitor(FMIReal deadline, std::size_t reportInterval)
+    CPPFMU_NOEXCEPT
+    : m_deadline{deadline}
+    , m_reportInterval{reportInterval}
+{
+}
+
+
+void StepMonitor::AddOutputs(
+    VariableTable& table,
+    FMIValueReference firstRealVr,
+    FMIValueReference firstIntegerVr)
+{
+    table.AddReal(firstRealVr, m_realOutputs, REAL_OUTPUT_COUNT);
+    table.AddInteger(firstIntegerVr, m_integerOutputs, INTEGER_OUTPUT_COUNT);
+}
+
+
+void StepMonitor::Record(
+    FMIReal time,
+    FMIReal stepSize,
+    std::uint64_t ns,
+    Logger& logger)
+    CPPFMU_NOEXCEPT
+{
+    m_histogram.Record(ns);
+    ++m_steps;
+    if (ns > m_maxNs) m_maxNs = ns;
+
+    const auto deadlineNs =
+        SecondsToNanoseconds(m_deadline > 0.0 ? m_deadline : stepSize);
+    ++m_batchSteps;
+    if (ns > deadlineNs) {
+        ++m_misses;
+        ++m_batchMisses;
+        if (ns - deadlineNs > m_batchWorstNs - m_batchWorstDeadlineNs) {
+            m_batchWorstNs = ns;
+            m_batchWorstDeadlineNs = deadlineNs;
+            m_batchWorstTime = time;
+        }
+    }
+
+    static const double percentiles[] = { 50.0, 99.0, 99.9 };
+    std::uint64_t values[3];
+    m_histogram.Percentiles(percentiles, values, 3);
+    m_realOutputs[LAST_STEP_TIME] = ns * 1e-9;
+    m_realOutputs[STEP_TIME_P50] = (values[0] < m_maxNs ? values[0] : m_maxNs) * 1e-9;
+    m_realOutputs[STEP_TIME_P99] = (values[1] < m_maxNs ? values[1] : m_maxNs) * 1e-9;
+    m_realOutputs[STEP_TIME_P999] = (values[2] < m_maxNs ? values[2] : m_maxNs) * 1e-9;
+    m_realOutputs[STEP_TIME_MAX] = m_maxNs * 1e-9;
+    m_integerOutputs[STEP_COUNT] = Saturate(m_steps);
+    m_integerOutputs[DEADLINE_MISS_COUNT] = Saturate(m_misses);
+
+    if (m_reportInterval > 0 && m_batchSteps >= m_reportInterval) {
+        ReportMisses(logger);
+    }
+}
+
+
+void StepMonitor::Report(Logger& logger) CPPFMU_NOEXCEPT
+{
+    ReportMisses(logger);
+    if (m_steps == 0) return;
+    logger.Log(
+        FMIOK,
+        category,
+        "Step time: steps=%llu misses=%llu p50=%.3fms p99=%.3fms "
+        "p99.9=%.3fms max=%.3fms",
+        static_cast<unsigned long long>(m_steps),
+        static_cast<unsigned long long>(m_misses),
+        m_realOutputs[STEP_TIME_P50] * 1e3,
+        m_realOutputs[STEP_TIME_P99] * 1e3,
+        m_realOutputs[STEP_TIME_P999] * 1e3,
+        m_realOutputs[STEP_TIME_MAX] * 1e3);
+}
+
+
+void StepMonitor::Clear() CPPFMU_NOEXCEPT
+{
+    const auto deadline = m_deadline;
+    const auto reportInterval = m_reportInterval;
+    *this = StepMonitor{deadline, reportInterval};
+}
+
+
+void StepMonitor::ReportMisses(Logger& logger) CPPFMU_NOEXCEPT
+{
+    if (m_batchMisses > 0) {
+        logger.Log(
+            FMIWarning,
+            category,
+            "%llu of the last %llu steps missed their deadline "
+            "(worst: %.3fms for a deadline of %.3fms, at t=%g)",
+            static_cast<unsigned long long>(m_batchMisses),
+            static_cast<unsigned long long>(m_batchSteps),
+            m_batchWorstNs * 1e-6,
+            m_batchWorstDeadlineNs * 1e-6,
+            m_batchWorstTime);
+    }
+    m_batchSteps = 0;
+    m_batchMisses = 0;
+    m_batchWorstNs = 0;
+    m_batchWorstDeadlineNs = 0;
+    m_batchWorstTime = 0.0;
+}
+
+
+} // namespace cppfmu
@@ -0,0 +1,166 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_MONITOR_HPP
+#define CPPFMU_MONITOR_HPP
+
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint64_t
+
+#include "cppfmu_common.hpp"
+#include "cppfmu_stats.hpp"
+#include "cppfmu_variables.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// REAL-TIME MONITORING
+// ============================================================================
+
+/* Monitors the wall-clock time taken by DoStep() against a deadline, for
+ * slaves that run in real time (e.g. in hardware-in-the-loop setups).
+ *
+ * A slave which wants its steps monitored keeps a StepMonitor as a member
+ * and passes it to SlaveInstance::UseStepMonitor().  fmi_functions.cpp then
+ * times each call to DoStep() and passes the result to Record().  The
+ * monitor
+ *
+ *   - keeps a histogram of the step times, using a fixed amount of memory,
+ *   - counts the steps which exceed the deadline, and logs them as one
+ *     warning per ReportInterval() steps (in the category
+ *     "cppfmu.realtime") rather than one per step, and
+ *   - logs a summary when the slave is terminated.
+ *
+ * The statistics can also be exposed to the simulation environment as
+ * output variables, with AddOutputs().
+ *
+ * The deadline is typically set in the slave's SetupExperiment() function,
+ * e.g. from a parameter.  The default, 0, means that each step must not take
+ * longer (in wall-clock time) than its communication step size.
+ */
+class StepMonitor
+{
+public:
+    // The indices of the real outputs (see AddOutputs()), all in seconds.
+    enum RealOutput
+    {
+        LAST_STEP_TIME,
+        STEP_TIME_P50,
+        STEP_TIME_P99,
+        STEP_TIME_P999,
+        STEP_TIME_MAX,
+        REAL_OUTPUT_COUNT
+    };
+
+    // The indices of the integer outputs (see AddOutputs()).
+    enum IntegerOutput
+    {
+        STEP_COUNT,
+        DEADLINE_MISS_COUNT,
+        INTEGER_OUTPUT_COUNT
+    };
+
+    /* Creates a monitor with the given deadline, in seconds (see
+     * SetDeadline()), which logs missed deadlines every 'reportInterval'
+     * steps (see SetReportInterval()).
+     */
+    explicit StepMonitor(
+        FMIReal deadline = 0.0,
+        std::size_t reportInterval = 1000) CPPFMU_NOEXCEPT;
+
+    /* Sets the longest wall-clock time, in seconds, a step may take.
+     * If 'deadline' is zero, the communication step size of each step is
+     * used as its deadline.
+     */
+    void SetDeadline(FMIReal deadline) CPPFMU_NOEXCEPT { m_deadline = deadline; }
+
+    FMIReal Deadline() const CPPFMU_NOEXCEPT { return m_deadline; }
+
+    /* Sets how many steps the missed deadlines are collected over before
+     * they are logged.  If 'steps' is zero, they are only logged at
+     * termination.
+     */
+    void SetReportInterval(std::size_t steps) CPPFMU_NOEXCEPT
+    {
+        m_reportInterval = steps;
+    }
+
+    std::size_t ReportInterval() const CPPFMU_NOEXCEPT { return m_reportInterval; }
+
+    /* Registers the outputs in 'table': REAL_OUTPUT_COUNT real variables,
+     * with value references starting at 'firstRealVr' in the order given by
+     * RealOutput, and INTEGER_OUTPUT_COUNT integer variables, with value
+     * references starting at 'firstIntegerVr' in the order given by
+     * IntegerOutput.  They are updated after each step.
+     */
+    void AddOutputs(
+        VariableTable& table,
+        FMIValueReference firstRealVr,
+        FMIValueReference firstIntegerVr);
+
+    /* Records that the step starting at 'time', with size 'stepSize', took
+     * 'ns' nanoseconds of wall-clock time, and logs the missed deadlines
+     * if a report is due.
+     */
+    void Record(
+        FMIReal time,
+        FMIReal stepSize,
+        std::uint64_t ns,
+        Logger& logger) CPPFMU_NOEXCEPT;
+
+    // Logs the missed deadlines that haven't been logged yet, and a summary.
+    void Report(Logger& logger) CPPFMU_NOEXCEPT;
+
+    // Removes all statistics.
+    void Clear() CPPFMU_NOEXCEPT;
+
+    // The step time histogram, in nanoseconds.
+    const LatencyHistogram& Histogram() const CPPFMU_NOEXCEPT { return m_histogram; }
+
+    std::uint64_t StepCount() const CPPFMU_NOEXCEPT { return m_steps; }
+
+    std::uint64_t DeadlineMissCount() const CPPFMU_NOEXCEPT { return m_misses; }
+
+    // The longest step time, in nanoseconds.
+    std::uint64_t MaxStepTime() const CPPFMU_NOEXCEPT { return m_maxNs; }
+
+    // The current value of an output.
+    FMIReal Output(RealOutput output) const CPPFMU_NOEXCEPT
+    {
+        return m_realOutputs[output];
+    }
+
+    FMIInteger Output(IntegerOutput output) const CPPFMU_NOEXCEPT
+    {
+        return m_integerOutputs[output];
+    }
+
+private:
+    void ReportMisses(Logger& logger) CPPFMU_NOEXCEPT;
+
+    FMIReal m_deadline;
+    std::size_t m_reportInterval;
+
+    LatencyHistogram m_histogram;
+    std::uint64_t m_steps = 0;
+    std::uint64_t m_misses = 0;
+    std::uint64_t m_maxNs = 0;
+
+    // The steps since the missed deadlines were last logged.
+    std::uint64_t m_batchSteps = 0;
+    std::uint64_t m_batchMisses = 0;
+    std::uint64_t m_batchWorstNs = 0;
+    std::uint64_t m_batchWorstDeadlineNs = 0;
+    FMIReal m_batchWorstTime = 0.0;
+
+    FMIReal m_realOutputs[REAL_OUTPUT_COUNT] = {};
+    FMIInteger m_integerOutputs[INTEGER_OUTPUT_COUNT] = {};
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,123 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_PMR_HPP
+#define CPPFMU_PMR_HPP
+
+#include "cppfmu_common.hpp"
+
+
+/* CPPFMU_HAS_PMR is defined to 1 if the compiler and standard library
+ * support polymorphic memory resources (C++17), and to 0 otherwise.  The
+ * contents of this header are only available in the former case.
+ */
+#ifndef CPPFMU_HAS_PMR
+#   if ((__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) \
+        && defined(__has_include)
+#       if __has_include(<memory_resource>)
+#           define CPPFMU_HAS_PMR 1
+#       endif
+#   endif
+#   ifndef CPPFMU_HAS_PMR
+#       define CPPFMU_HAS_PMR 0
+#   endif
+#endif
+
+#if CPPFMU_HAS_PMR
+
+#include <cstdint>          // std::uintptr_t
+#include <memory_resource>  // std::pmr::memory_resource
+#include <string>           // std::pmr::string
+#include <vector>           // std::pmr::vector
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// POLYMORPHIC MEMORY RESOURCES
+// ============================================================================
+
+/* A std::pmr::memory_resource which gets its memory from a cppfmu::Memory
+ * object, and thereby from the simulation environment (or a MemorySource).
+ *
+ * This allows the standard memory resources to be layered on top of the
+ * simulation environment's memory management, e.g.:
+ *
+ *     cppfmu::MemoryResource host{memory};
+ *     std::pmr::unsynchronized_pool_resource pool{&host};
+ *     cppfmu::pmr::Vector<double> v{&pool};
+ *
+ * Unlike cppfmu::Allocator, which stores a copy of the Memory object, a
+ * std::pmr::polymorphic_allocator only holds a pointer to the resource, so
+ * the resource must outlive every container which uses it.
+ *
+ * This class is only available if CPPFMU_HAS_PMR is nonzero.
+ */
+class MemoryResource : public std::pmr::memory_resource
+{
+public:
+    explicit MemoryResource(const Memory& memory) CPPFMU_NOEXCEPT
+        : m_memory{memory}
+    {
+    }
+
+    // Returns the underlying Memory object.
+    const Memory& GetMemory() const CPPFMU_NOEXCEPT { return m_memory; }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (alignment <= alignof(std::max_align_t)) {
+            const auto p = m_memory.Alloc(1, bytes);
+            if (p == nullptr) throw std::bad_alloc();
+            return p;
+        }
+        // The simulation environment only guarantees fundamental alignment,
+        // so over-allocate, and store the original pointer just before the
+        // aligned block.
+        const auto extra = alignment - 1 + sizeof(void*);
+        if (bytes > static_cast<std::size_t>(-1) - extra) throw std::bad_alloc();
+        const auto p = m_memory.Alloc(1, bytes + extra);
+        if (p == nullptr) throw std::bad_alloc();
+        const auto aligned = (reinterpret_cast<std::uintptr_t>(p) + extra)
+            & ~static_cast<std::uintptr_t>(alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = p;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void do_deallocate(void* p, std::size_t /*bytes*/, std::size_t alignment) override
+    {
+        if (alignment <= alignof(std::max_align_t)) {
+            m_memory.Free(p);
+        } else {
+            m_memory.Free(static_cast<void**>(p)[-1]);
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const CPPFMU_NOEXCEPT override
+    {
+        const auto r = dynamic_cast<const MemoryResource*>(&other);
+        return r != nullptr && r->m_memory == m_memory;
+    }
+
+private:
+    Memory m_memory;
+};
+
+
+// Aliases for standard containers which use polymorphic allocators.
+namespace pmr
+{
+    using String = std::pmr::string;
+
+    template<typename T>
+    using Vector = std::pmr::vector<T>;
+}
+
+
+} // namespace cppfmu
+#endif // CPPFMU_HAS_PMR
+#endif // header guard
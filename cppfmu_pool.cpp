@@ -0,0 +1,222 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    /* Each block is preceded by a header which holds the index of its size
+     * class (or CLASS_COUNT for blocks that bypass the pool) and, for the
+     * latter, the size of the allocation.  The header size also keeps the
+     * blocks suitably aligned.
+     */
+    const std::size_t HEADER_SIZE = 16;
+
+    struct BlockHeader
+    {
+        std::uint32_t sizeClass;
+        std::size_t size;
+    };
+    static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "Block header too large");
+
+    BlockHeader& HeaderOf(void* block) CPPFMU_NOEXCEPT
+    {
+        return *reinterpret_cast<BlockHeader*>(
+            static_cast<unsigned char*>(block) - HEADER_SIZE);
+    }
+
+    /* The size classes are multiples of 16 up to 128 bytes, followed by four
+     * classes for each doubling of the size: 160, 192, 224, 256, 320, ...,
+     * up to 4096.  This bounds the internal fragmentation to 25%.
+     */
+    std::size_t ClassSize(std::size_t index) CPPFMU_NOEXCEPT
+    {
+        if (index < 8) return (index + 1) * 16;
+        const auto p = 7 + (index - 8) / 4;
+        const auto step = std::size_t{1} << (p - 2);
+        return (std::size_t{1} << p) + ((index - 8) % 4 + 1) * step;
+    }
+
+    std::size_t ClassIndex(std::size_t size) CPPFMU_NOEXCEPT
+    {
+        if (size <= 128) return size == 0 ? 0 : (size + 15) / 16 - 1;
+        std::size_t p = 7;
+        while (((size - 1) >> (p + 1)) != 0) ++p;
+        const auto step = std::size_t{1} << (p - 2);
+        const auto i = (size - (std::size_t{1} << p) + step - 1) / step;
+        return 8 + (p - 7) * 4 + (i - 1);
+    }
+}
+
+
+/* A spin lock on a size class.  It is normally held only for a few
+ * instructions, but the holder may be refilling the class from the upstream
+ * memory, so after a few failed attempts we yield to other threads rather
+ * than burn the CPU the holder might need.
+ */
+class PoolMemory::Lock
+{
+public:
+    Lock(const SizeClass& c, bool enabled) CPPFMU_NOEXCEPT
+        : m_flag{enabled ? &c.lock : nullptr}
+    {
+        if (!m_flag) return;
+        int spins = 0;
+        while (m_flag->test_and_set(std::memory_order_acquire)) {
+            if (++spins >= 16) std::this_thread::yield();
+        }
+    }
+
+    ~Lock() CPPFMU_NOEXCEPT
+    {
+        if (m_flag) m_flag->clear(std::memory_order_release);
+    }
+
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+private:
+    std::atomic_flag* m_flag;
+};
+
+
+PoolMemory::PoolMemory(
+    const Memory& upstream,
+    bool threadSafe,
+    std::size_t slabSize)
+    : m_upstream{upstream}
+    , m_threadSafe{threadSafe}
+    , m_slabSize{slabSize}
+    , m_largeAllocations{0}
+    , m_largeDeallocations{0}
+    , m_largeBytes{0}
+{
+    static_assert(
+        HEADER_SIZE >= sizeof(Slab) && HEADER_SIZE >= sizeof(FreeBlock),
+        "Header too small");
+    for (std::size_t i = 0; i < CLASS_COUNT; ++i) {
+        m_classes[i].blockSize = ClassSize(i);
+    }
+}
+
+
+PoolMemory::~PoolMemory() CPPFMU_NOEXCEPT
+{
+    for (auto& c : m_classes) {
+        while (c.slabs != nullptr) {
+            const auto next = c.slabs->next;
+            m_upstream.Free(c.slabs);
+            c.slabs = next;
+        }
+    }
+}
+
+
+void* PoolMemory::Allocate(std::size_t nObj, std::size_t size) CPPFMU_NOEXCEPT
+{
+    if (size != 0 && nObj > static_cast<std::size_t>(-1) / size) return nullptr;
+    const auto n = nObj * size;
+    if (n > MAX_POOLED_SIZE) return AllocateLarge(n);
+
+    const auto index = ClassIndex(n);
+    auto& c = m_classes[index];
+    Lock lock{c, m_threadSafe};
+    unsigned char* block = nullptr;
+    if (c.freeList != nullptr) {
+        block = reinterpret_cast<unsigned char*>(c.freeList);
+        c.freeList = c.freeList->next;
+        std::memset(block, 0, n);
+    } else {
+        const auto stride = HEADER_SIZE + c.blockSize;
+        if (static_cast<std::size_t>(c.end - c.next) < stride) {
+            // Start a new slab.  Its memory is zero-initialised by
+            // 'upstream', so the blocks carved from it need not be cleared.
+            const auto slabSize = std::max(m_slabSize, HEADER_SIZE + stride);
+            const auto slab = static_cast<Slab*>(m_upstream.Alloc(1, slabSize));
+            if (slab == nullptr) return nullptr;
+            slab->next = c.slabs;
+            c.slabs = slab;
+            ++c.slabCount;
+            c.slabBytes += slabSize;
+            c.next = reinterpret_cast<unsigned char*>(slab) + HEADER_SIZE;
+            c.end = reinterpret_cast<unsigned char*>(slab) + slabSize;
+        }
+        block = c.next + HEADER_SIZE;
+        c.next += stride;
+        HeaderOf(block).sizeClass = static_cast<std::uint32_t>(index);
+    }
+    ++c.allocations;
+    return block;
+}
+
+
+void* PoolMemory::AllocateLarge(std::size_t size) CPPFMU_NOEXCEPT
+{
+    if (size > static_cast<std::size_t>(-1) - HEADER_SIZE) return nullptr;
+    const auto m = static_cast<unsigned char*>(m_upstream.Alloc(1, HEADER_SIZE + size));
+    if (m == nullptr) return nullptr;
+    const auto block = m + HEADER_SIZE;
+    HeaderOf(block).sizeClass = static_cast<std::uint32_t>(CLASS_COUNT);
+    HeaderOf(block).size = size;
+    m_largeAllocations.fetch_add(1, std::memory_order_relaxed);
+    m_largeBytes.fetch_add(size, std::memory_order_relaxed);
+    return block;
+}
+
+
+void PoolMemory::Free(void* ptr) CPPFMU_NOEXCEPT
+{
+    if (ptr == nullptr) return;
+    const auto& header = HeaderOf(ptr);
+    if (header.sizeClass == CLASS_COUNT) {
+        m_largeDeallocations.fetch_add(1, std::memory_order_relaxed);
+        m_largeBytes.fetch_sub(header.size, std::memory_order_relaxed);
+        m_upstream.Free(static_cast<unsigned char*>(ptr) - HEADER_SIZE);
+        return;
+    }
+    auto& c = m_classes[header.sizeClass];
+    Lock lock{c, m_threadSafe};
+    const auto block = static_cast<FreeBlock*>(ptr);
+    block->next = c.freeList;
+    c.freeList = block;
+    ++c.deallocations;
+}
+
+
+PoolStatistics PoolMemory::Statistics() const CPPFMU_NOEXCEPT
+{
+    const auto largeAllocations = m_largeAllocations.load(std::memory_order_relaxed);
+    const auto largeDeallocations = m_largeDeallocations.load(std::memory_order_relaxed);
+    const auto largeBytes = m_largeBytes.load(std::memory_order_relaxed);
+    PoolStatistics s = {
+        largeAllocations,
+        largeDeallocations,
+        largeAllocations,
+        largeDeallocations,
+        largeBytes,
+        largeBytes + (largeAllocations - largeDeallocations) * HEADER_SIZE
+    };
+    for (const auto& c : m_classes) {
+        Lock lock{c, m_threadSafe};
+        s.allocations += c.allocations;
+        s.deallocations += c.deallocations;
+        s.upstreamAllocations += c.slabCount;
+        s.bytesInUse += (c.allocations - c.deallocations) * c.blockSize;
+        s.bytesReserved += c.slabBytes;
+    }
+    return s;
+}
+
+
+} // namespace cppfmu
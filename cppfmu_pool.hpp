@@ -0,0 +1,138 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_POOL_HPP
+#define CPPFMU_POOL_HPP
+
+#include <atomic>   // std::atomic_flag
+#include <cstddef>  // std::size_t
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// POOLED MEMORY
+// ============================================================================
+
+// Usage statistics for a PoolMemory object.
+struct PoolStatistics
+{
+    // The number of calls to Allocate() and Free() (with non-null pointers).
+    std::size_t allocations;
+    std::size_t deallocations;
+
+    // The number of allocations and deallocations passed on to the
+    // underlying cppfmu::Memory object.
+    std::size_t upstreamAllocations;
+    std::size_t upstreamDeallocations;
+
+    // The number of bytes in blocks which are currently allocated,
+    // including the rounding up to the block size.
+    std::size_t bytesInUse;
+
+    // The number of bytes currently obtained from the underlying Memory.
+    std::size_t bytesReserved;
+};
+
+
+/* A memory allocator which recycles blocks of memory, to reduce the number
+ * of calls to the simulation environment's memory management functions.
+ *
+ * Requests for up to MAX_POOLED_SIZE bytes are rounded up to one of a set of
+ * size classes, each of which has a list of free blocks.  New blocks are
+ * carved out of large "slabs" obtained from an underlying cppfmu::Memory
+ * object.  Freed blocks are put back on the free list of their size class
+ * rather than returned to the simulation environment, which only happens
+ * when the pool is destroyed.  Larger requests are forwarded directly.
+ * This is only worthwhile if the environment's allocation functions are
+ * expensive; a pool in front of a plain calloc()/free() gains little.
+ *
+ * PoolMemory is a MemorySource, so it can be used with everything that
+ * takes a cppfmu::Memory object -- Allocator, New(), Delete(),
+ * AllocateUnique(), StateTable, etc.:
+ *
+ *     cppfmu::PoolMemory pool{memory};
+ *     cppfmu::Memory pooled{pool};
+ *     std::map<int, double, std::less<int>,
+ *         cppfmu::Allocator<std::pair<const int, double>>> m{
+ *             cppfmu::Allocator<std::pair<const int, double>>{pooled}};
+ *
+ * All blocks allocated from the pool must be freed before it is destroyed.
+ *
+ * By default, each size class is protected by its own spinlock, which
+ * yields to other threads if it can't be taken after a few tries, so the
+ * pool may be used from several threads (e.g. by a slave which uses worker
+ * threads in DoStep()).  A pool which is only used by one thread at a time
+ * may be created with 'threadSafe' set to false, which skips the locking.
+ */
+class PoolMemory : public MemorySource
+{
+public:
+    // The largest request which is served from a size class.
+    static const std::size_t MAX_POOLED_SIZE = 4096;
+
+    /* Creates a pool which gets its memory from 'upstream', in slabs of
+     * at least 'slabSize' bytes.
+     */
+    explicit PoolMemory(
+        const Memory& upstream,
+        bool threadSafe = true,
+        std::size_t slabSize = 64 * 1024);
+
+    ~PoolMemory() CPPFMU_NOEXCEPT;
+
+    PoolMemory(const PoolMemory&) = delete;
+    PoolMemory& operator=(const PoolMemory&) = delete;
+
+    void* Allocate(std::size_t nObj, std::size_t size) CPPFMU_NOEXCEPT override;
+
+    void Free(void* ptr) CPPFMU_NOEXCEPT override;
+
+    // Returns usage statistics.
+    PoolStatistics Statistics() const CPPFMU_NOEXCEPT;
+
+private:
+    struct FreeBlock { FreeBlock* next; };
+    struct Slab { Slab* next; };
+
+    struct SizeClass
+    {
+        std::size_t blockSize = 0;
+        mutable std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        FreeBlock* freeList = nullptr;
+        // The unused part of the class' most recent slab
+        unsigned char* next = nullptr;
+        unsigned char* end = nullptr;
+        Slab* slabs = nullptr;
+
+        std::size_t allocations = 0;
+        std::size_t deallocations = 0;
+        std::size_t slabCount = 0;
+        std::size_t slabBytes = 0;
+    };
+
+    class Lock;
+
+    static const std::size_t CLASS_COUNT = 28;
+
+    void* AllocateLarge(std::size_t size) CPPFMU_NOEXCEPT;
+
+    Memory m_upstream;
+    bool m_threadSafe;
+    std::size_t m_slabSize;
+    SizeClass m_classes[CLASS_COUNT];
+
+    // Statistics for the allocations that bypass the size classes.
+    std::atomic<std::size_t> m_largeAllocations;
+    std::atomic<std::size_t> m_largeDeallocations;
+    std::atomic<std::size_t> m_largeBytes;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,654 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_serialization.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    const std::uint32_t FORMAT_MAGIC = 0x554d4643; // "CFMU"
+    const std::size_t HEADER_SIZE = 32;
+    const std::size_t SECTION_HEADER_SIZE = 16;
+
+    // Header flags
+    const std::uint16_t FLAG_COMPRESSED = 1;
+
+    // A compressed state has a second header, which contains the size and
+    // CRC-32 of the uncompressed state, followed by the compressed payload.
+    const std::size_t COMPRESSION_HEADER_SIZE = 16;
+
+    bool IsLittleEndian() CPPFMU_NOEXCEPT
+    {
+        const std::uint16_t one = 1;
+        unsigned char first;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    // Copies 'count' elements of 'elementSize' bytes, converting between
+    // host and little-endian byte order.
+    void CopyLittleEndian(
+        void* dst,
+        const void* src,
+        std::size_t count,
+        std::size_t elementSize) CPPFMU_NOEXCEPT
+    {
+        if (IsLittleEndian() || elementSize == 1) {
+            if (count > 0) std::memcpy(dst, src, count * elementSize);
+            return;
+        }
+        auto d = static_cast<unsigned char*>(dst);
+        auto s = static_cast<const unsigned char*>(src);
+        for (std::size_t i = 0; i < count; ++i) {
+            for (std::size_t j = 0; j < elementSize; ++j) {
+                d[j] = s[elementSize - 1 - j];
+            }
+            d += elementSize;
+            s += elementSize;
+        }
+    }
+
+    template<typename T>
+    void Store(unsigned char* p, T value) CPPFMU_NOEXCEPT
+    {
+        CopyLittleEndian(p, &value, 1, sizeof value);
+    }
+
+    template<typename T>
+    T Load(const unsigned char* p) CPPFMU_NOEXCEPT
+    {
+        T value;
+        CopyLittleEndian(&value, p, 1, sizeof value);
+        return value;
+    }
+
+    std::size_t Aligned(std::size_t offset, std::size_t alignment) CPPFMU_NOEXCEPT
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    std::uint64_t GuidHash(FMIString guid) CPPFMU_NOEXCEPT
+    {
+        std::uint64_t hash = 0xcbf29ce484222325u;
+        if (guid != nullptr) {
+            for (auto p = guid; *p != '\0'; ++p) {
+                hash ^= static_cast<unsigned char>(*p);
+                hash *= 0x100000001b3u;
+            }
+        }
+        return hash;
+    }
+
+    /* CRC-32 (ISO-HDLC, as used by zlib), computed eight bytes at a time
+     * with the "slicing-by-8" algorithm.
+     */
+    std::uint32_t Crc32(const unsigned char* data, std::size_t size) CPPFMU_NOEXCEPT
+    {
+        struct Tables
+        {
+            std::uint32_t t[8][256];
+            Tables() CPPFMU_NOEXCEPT
+            {
+                for (std::uint32_t i = 0; i < 256; ++i) {
+                    auto c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+                    }
+                    t[0][i] = c;
+                }
+                for (std::uint32_t i = 0; i < 256; ++i) {
+                    for (int k = 1; k < 8; ++k) {
+                        t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+                    }
+                }
+            }
+        };
+        static const Tables tables;
+        const auto& t = tables.t;
+
+        std::uint32_t crc = 0xffffffffu;
+        for (; size >= 8; size -= 8, data += 8) {
+            const auto lo = crc
+                ^ (std::uint32_t{data[0]} | std::uint32_t{data[1]} << 8
+                    | std::uint32_t{data[2]} << 16 | std::uint32_t{data[3]} << 24);
+            crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+                ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        }
+        for (; size > 0; --size, ++data) {
+            crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        }
+        return crc ^ 0xffffffffu;
+    }
+
+    [[noreturn]] void ThrowInvalid(const char* reason)
+    {
+        throw std::runtime_error(
+            std::string("Invalid serialized FMU state: ") + reason);
+    }
+
+    /* Validates the header of a serialized state, except for the GUID and
+     * the checksum, and returns the size given in it.  Only looks at the
+     * header.
+     */
+    std::size_t CheckHeader(const unsigned char* data, std::size_t size)
+    {
+        if (size < HEADER_SIZE || Load<std::uint32_t>(data) != FORMAT_MAGIC) {
+            ThrowInvalid("unrecognised format");
+        }
+        if (Load<std::uint16_t>(data + 4) != STATE_FORMAT_VERSION ||
+                (Load<std::uint16_t>(data + 6) & ~FLAG_COMPRESSED) != 0) {
+            ThrowInvalid("unsupported format version");
+        }
+        const auto stateSize = Load<std::uint64_t>(data + 8);
+        if (stateSize < HEADER_SIZE || stateSize > size) {
+            ThrowInvalid("truncated data");
+        }
+        return static_cast<std::size_t>(stateSize);
+    }
+
+    bool IsCompressed(const unsigned char* data) CPPFMU_NOEXCEPT
+    {
+        return (Load<std::uint16_t>(data + 6) & FLAG_COMPRESSED) != 0;
+    }
+
+
+    /* Compression
+     * -----------
+     * The payload (everything after the header) is viewed as a sequence of
+     * 64-bit words, each of which is replaced by its XOR with the previous
+     * word.  Slowly varying floating-point numbers then have mostly zero
+     * sign, exponent and high mantissa bytes, and repeated values become
+     * all zeros.  The bytes are then shuffled into eight "byte planes", one
+     * for each byte position in a word, and each plane is run-length coded
+     * separately.  The shuffle and the XOR are done on the fly, so no
+     * temporary buffers are needed.
+     *
+     * The run-length code is a sequence of tokens.  A token byte c < 0x80
+     * is followed by c+1 literal bytes.  A token byte c >= 0x80 is followed
+     * by a single byte which is repeated (c & 0x7f) + MIN_RUN times, plus,
+     * if (c & 0x7f) == 0x7f, the value of a LEB128-coded integer between
+     * the token and the byte.
+     */
+    const std::size_t MIN_RUN = 3;
+    const std::size_t MAX_LITERAL = 128;
+
+    // Encodes 'size' bytes at 'in' (a multiple of 8), and returns the
+    // encoded size, or 0 if it would exceed 'capacity'.
+    std::size_t EncodePlanes(
+        const unsigned char* in,
+        std::size_t size,
+        unsigned char* out,
+        std::size_t capacity) CPPFMU_NOEXCEPT
+    {
+        const auto words = size / 8;
+        std::size_t o = 0;
+        for (std::size_t k = 0; k < 8; ++k) {
+            const auto byteAt = [in, k] (std::size_t i) {
+                return static_cast<unsigned char>(
+                    in[8*i + k] ^ (i > 0 ? in[8*i - 8 + k] : 0));
+            };
+            std::size_t literalPos = 0, literalCount = 0;
+            std::size_t i = 0;
+            while (i < words) {
+                const auto b = byteAt(i);
+                std::size_t run = 1;
+                while (i + run < words && byteAt(i + run) == b) ++run;
+                if (run >= MIN_RUN) {
+                    literalCount = 0;
+                    const auto m = std::min<std::size_t>(run - MIN_RUN, 0x7f);
+                    if (capacity - o < 2 + 10) return 0;
+                    out[o++] = static_cast<unsigned char>(0x80 | m);
+                    if (m == 0x7f) {
+                        auto extra = run - MIN_RUN - 0x7f;
+                        do {
+                            out[o++] = static_cast<unsigned char>(
+                                (extra & 0x7f) | (extra > 0x7f ? 0x80 : 0));
+                            extra >>= 7;
+                        } while (extra > 0);
+                    }
+                    out[o++] = b;
+                    i += run;
+                } else {
+                    if (literalCount == 0 || literalCount == MAX_LITERAL) {
+                        if (o == capacity) return 0;
+                        literalPos = o++;
+                        literalCount = 0;
+                    }
+                    if (o == capacity) return 0;
+                    out[o++] = b;
+                    out[literalPos] = static_cast<unsigned char>(literalCount++);
+                    ++i;
+                }
+            }
+        }
+        return o;
+    }
+
+    /* Decodes the output of EncodePlanes() into 'size' bytes at 'out'.
+     * If 'out' is null, only checks that the input decodes to exactly
+     * 'size' bytes, which bounds the size that a header may claim by what
+     * the run-length code can actually expand to.
+     */
+    void DecodePlanes(
+        const unsigned char* in,
+        std::size_t inSize,
+        unsigned char* out,
+        std::size_t size)
+    {
+        const auto words = size / 8;
+        const auto end = in + inSize;
+        for (std::size_t k = 0; k < 8; ++k) {
+            std::size_t i = 0;
+            while (i < words) {
+                if (in == end) ThrowInvalid("bad compressed data");
+                const auto c = *in++;
+                if (c < 0x80) {
+                    const std::size_t n = c + 1u;
+                    if (n > words - i || n > static_cast<std::size_t>(end - in)) {
+                        ThrowInvalid("bad compressed data");
+                    }
+                    if (out == nullptr) {
+                        i += n;
+                        in += n;
+                    } else {
+                        for (std::size_t j = 0; j < n; ++j) out[8*(i++) + k] = *in++;
+                    }
+                } else {
+                    std::size_t n = (c & 0x7fu) + MIN_RUN;
+                    if ((c & 0x7f) == 0x7f) {
+                        std::size_t extra = 0;
+                        for (unsigned shift = 0; ; shift += 7) {
+                            if (in == end || shift > 56) ThrowInvalid("bad compressed data");
+                            const auto v = *in++;
+                            extra |= static_cast<std::size_t>(v & 0x7f) << shift;
+                            if ((v & 0x80) == 0) break;
+                        }
+                        if (extra > words) ThrowInvalid("bad compressed data");
+                        n += extra;
+                    }
+                    if (in == end || n > words - i) ThrowInvalid("bad compressed data");
+                    const auto b = *in++;
+                    if (out == nullptr) {
+                        i += n;
+                    } else {
+                        for (std::size_t j = 0; j < n; ++j) out[8*(i++) + k] = b;
+                    }
+                }
+            }
+        }
+        if (in != end) ThrowInvalid("bad compressed data");
+        if (out == nullptr) return;
+        std::uint64_t previous = 0;
+        for (std::size_t i = 0; i < words; ++i) {
+            std::uint64_t word;
+            std::memcpy(&word, out + 8*i, 8);
+            previous ^= word;
+            std::memcpy(out + 8*i, &previous, 8);
+        }
+    }
+}
+
+
+// =============================================================================
+// StateWriter
+// =============================================================================
+
+
+StateWriter::StateWriter(FMIByte data[], std::size_t size, FMIString guid)
+    : m_data{reinterpret_cast<unsigned char*>(data)}
+    , m_capacity{size}
+    , m_offset{0}
+    , m_sectionStart{0}
+    , m_guidHash{GuidHash(guid)}
+{
+    Reserve(HEADER_SIZE, 8);
+}
+
+
+StateWriter::StateWriter(FMIString guid)
+    : m_data{nullptr}
+    , m_capacity{static_cast<std::size_t>(-1)}
+    , m_offset{HEADER_SIZE}
+    , m_sectionStart{0}
+    , m_guidHash{GuidHash(guid)}
+{
+}
+
+
+unsigned char* StateWriter::Reserve(std::size_t size, std::size_t alignment)
+{
+    const auto start = Aligned(m_offset, alignment);
+    if (start > m_capacity || size > m_capacity - start) {
+        throw std::logic_error("Buffer too small for serialized FMU state");
+    }
+    if (m_data == nullptr) {
+        m_offset = start + size;
+        return nullptr;
+    }
+    std::memset(m_data + m_offset, 0, start - m_offset);
+    m_offset = start + size;
+    return m_data + start;
+}
+
+
+void StateWriter::BeginSection(std::uint32_t tag)
+{
+    if (m_sectionStart != 0) {
+        throw std::logic_error("Nested sections in serialized FMU state");
+    }
+    const auto p = Reserve(SECTION_HEADER_SIZE, 8);
+    m_sectionStart = m_offset;
+    if (p == nullptr) return;
+    Store(p, tag);
+    Store(p + 4, std::uint32_t{0});
+    Store(p + 8, std::uint64_t{0});
+}
+
+
+void StateWriter::EndSection()
+{
+    if (m_sectionStart == 0) {
+        throw std::logic_error("No section to end in serialized FMU state");
+    }
+    const auto size = m_offset - m_sectionStart;
+    if (m_data != nullptr) {
+        Store(m_data + m_sectionStart - 8, static_cast<std::uint64_t>(size));
+    }
+    m_sectionStart = 0;
+}
+
+
+void StateWriter::WriteUInt32(std::uint32_t value)
+{
+    if (const auto p = Reserve(sizeof value, sizeof value)) Store(p, value);
+}
+
+
+void StateWriter::WriteInt32(std::int32_t value)
+{
+    if (const auto p = Reserve(sizeof value, sizeof value)) Store(p, value);
+}
+
+
+void StateWriter::WriteUInt64(std::uint64_t value)
+{
+    if (const auto p = Reserve(sizeof value, sizeof value)) Store(p, value);
+}
+
+
+void StateWriter::WriteInt64(std::int64_t value)
+{
+    if (const auto p = Reserve(sizeof value, sizeof value)) Store(p, value);
+}
+
+
+void StateWriter::WriteReal(FMIReal value)
+{
+    if (const auto p = Reserve(sizeof value, sizeof value)) Store(p, value);
+}
+
+
+void StateWriter::WriteElements(
+    const void* values,
+    std::size_t count,
+    std::size_t elementSize)
+{
+    if (count > m_capacity / elementSize) {
+        throw std::logic_error("Buffer too small for serialized FMU state");
+    }
+    const auto p = Reserve(count * elementSize, 8);
+    if (p != nullptr) CopyLittleEndian(p, values, count, elementSize);
+}
+
+
+void StateWriter::WriteBytes(const void* data, std::size_t size)
+{
+    const auto p = Reserve(size, 8);
+    if (p != nullptr && size > 0) std::memcpy(p, data, size);
+}
+
+
+void StateWriter::WriteString(const char* string, std::size_t length)
+{
+    WriteUInt64(length);
+    WriteBytes(string, length);
+}
+
+
+std::size_t StateWriter::Finish()
+{
+    if (m_sectionStart != 0) EndSection();
+    Reserve(0, 8);
+    if (m_data != nullptr) {
+        const auto p = m_data;
+        Store(p, FORMAT_MAGIC);
+        Store(p + 4, STATE_FORMAT_VERSION);
+        Store(p + 6, std::uint16_t{0});
+        Store(p + 8, static_cast<std::uint64_t>(m_offset));
+        Store(p + 16, m_guidHash);
+        Store(p + 24, Crc32(p + HEADER_SIZE, m_offset - HEADER_SIZE));
+        Store(p + 28, std::uint32_t{0});
+    }
+    return m_offset;
+}
+
+
+// =============================================================================
+// StateReader
+// =============================================================================
+
+
+StateReader::StateReader(const FMIByte data[], std::size_t size, FMIString guid)
+    : m_data{reinterpret_cast<const unsigned char*>(data)}
+    , m_size{CheckHeader(m_data, size)}
+    , m_offset{HEADER_SIZE}
+    , m_sectionEnd{HEADER_SIZE}
+{
+    if (IsCompressed(m_data)) {
+        ThrowInvalid("state is compressed");
+    }
+    if (Load<std::uint64_t>(m_data + 16) != GuidHash(guid)) {
+        ThrowInvalid("state belongs to a different FMU");
+    }
+    if (Load<std::uint32_t>(m_data + 24) != Crc32(m_data + HEADER_SIZE, m_size - HEADER_SIZE)) {
+        ThrowInvalid("checksum mismatch");
+    }
+}
+
+
+const unsigned char* StateReader::Consume(std::size_t size, std::size_t alignment)
+{
+    const auto start = Aligned(m_offset, alignment);
+    if (start > m_sectionEnd || size > m_sectionEnd - start) {
+        ThrowInvalid("read past end of section");
+    }
+    m_offset = start + size;
+    return m_data + start;
+}
+
+
+void StateReader::OpenSection(std::uint32_t tag)
+{
+    m_offset = m_sectionEnd;
+    m_sectionEnd = m_size;
+    const auto p = Consume(SECTION_HEADER_SIZE, 8);
+    const auto size = Load<std::uint64_t>(p + 8);
+    if (Load<std::uint32_t>(p) != tag) {
+        ThrowInvalid("unexpected section");
+    }
+    if (size > m_size - m_offset) {
+        ThrowInvalid("truncated section");
+    }
+    m_sectionEnd = m_offset + static_cast<std::size_t>(size);
+}
+
+
+void StateReader::CloseSection()
+{
+    m_offset = m_sectionEnd;
+}
+
+
+std::uint32_t StateReader::ReadUInt32()
+{
+    return Load<std::uint32_t>(Consume(4, 4));
+}
+
+
+std::int32_t StateReader::ReadInt32()
+{
+    return Load<std::int32_t>(Consume(4, 4));
+}
+
+
+std::uint64_t StateReader::ReadUInt64()
+{
+    return Load<std::uint64_t>(Consume(8, 8));
+}
+
+
+std::int64_t StateReader::ReadInt64()
+{
+    return Load<std::int64_t>(Consume(8, 8));
+}
+
+
+FMIReal StateReader::ReadReal()
+{
+    return Load<FMIReal>(Consume(sizeof(FMIReal), sizeof(FMIReal)));
+}
+
+
+void StateReader::ReadElements(
+    void* values,
+    std::size_t count,
+    std::size_t elementSize)
+{
+    if (count > m_size / elementSize) ThrowInvalid("read past end of section");
+    CopyLittleEndian(values, Consume(count * elementSize, 8), count, elementSize);
+}
+
+
+void StateReader::ReadBytes(void* data, std::size_t size)
+{
+    const auto p = Consume(size, 8);
+    if (size > 0) std::memcpy(data, p, size);
+}
+
+
+void StateReader::SkipBytes(std::size_t size)
+{
+    Consume(size, 8);
+}
+
+
+// =============================================================================
+// Compression
+// =============================================================================
+
+
+std::size_t CompressState(const FMIByte state[], std::size_t size, FMIByte out[])
+{
+    const auto in = reinterpret_cast<const unsigned char*>(state);
+    const auto dst = reinterpret_cast<unsigned char*>(out);
+    const auto n = CheckHeader(in, size);
+    const auto payload = n - HEADER_SIZE;
+    std::size_t compressedSize = 0;
+    if (!IsCompressed(in) && payload % 8 == 0 && n > HEADER_SIZE + COMPRESSION_HEADER_SIZE) {
+        const auto offset = HEADER_SIZE + COMPRESSION_HEADER_SIZE;
+        const auto encoded = EncodePlanes(in + HEADER_SIZE, payload, dst + offset, n - offset);
+        if (encoded > 0) compressedSize = offset + encoded;
+    }
+    if (compressedSize == 0) {
+        // Not compressible (or already compressed)
+        std::memcpy(dst, in, n);
+        return n;
+    }
+    std::memcpy(dst, in, HEADER_SIZE);
+    Store(dst + 6, static_cast<std::uint16_t>(Load<std::uint16_t>(in + 6) | FLAG_COMPRESSED));
+    Store(dst + 8, static_cast<std::uint64_t>(compressedSize));
+    Store(dst + HEADER_SIZE, static_cast<std::uint64_t>(n));
+    std::memcpy(dst + HEADER_SIZE + 8, in + 24, 4); // the uncompressed CRC
+    Store(dst + HEADER_SIZE + 12, std::uint32_t{0});
+    Store(dst + 24, Crc32(dst + HEADER_SIZE, compressedSize - HEADER_SIZE));
+    return compressedSize;
+}
+
+
+bool IsCompressedState(const FMIByte data[], std::size_t size)
+{
+    const auto in = reinterpret_cast<const unsigned char*>(data);
+    CheckHeader(in, size);
+    return IsCompressed(in);
+}
+
+
+namespace
+{
+    /* Checks the header and checksum of a compressed state of 'n' bytes,
+     * and returns the decompressed size recorded in it.
+     */
+    std::size_t CheckCompressedHeader(const unsigned char* in, std::size_t n)
+    {
+        if (n < HEADER_SIZE + COMPRESSION_HEADER_SIZE) ThrowInvalid("truncated data");
+        const auto decompressedSize = Load<std::uint64_t>(in + HEADER_SIZE);
+        if (decompressedSize < HEADER_SIZE ||
+                (decompressedSize - HEADER_SIZE) % 8 != 0 ||
+                decompressedSize != static_cast<std::size_t>(decompressedSize)) {
+            ThrowInvalid("bad compressed data");
+        }
+        if (Load<std::uint32_t>(in + 24) != Crc32(in + HEADER_SIZE, n - HEADER_SIZE)) {
+            ThrowInvalid("checksum mismatch");
+        }
+        return static_cast<std::size_t>(decompressedSize);
+    }
+}
+
+
+std::size_t DecompressedStateSize(const FMIByte data[], std::size_t size)
+{
+    const auto in = reinterpret_cast<const unsigned char*>(data);
+    const auto n = CheckHeader(in, size);
+    if (!IsCompressed(in)) return n;
+    const auto decompressedSize = CheckCompressedHeader(in, n);
+    // The size is used to allocate memory, so don't trust it until the
+    // data has been found to decode to exactly that size.
+    const auto offset = HEADER_SIZE + COMPRESSION_HEADER_SIZE;
+    DecodePlanes(in + offset, n - offset, nullptr, decompressedSize - HEADER_SIZE);
+    return decompressedSize;
+}
+
+
+void DecompressState(const FMIByte data[], std::size_t size, FMIByte out[])
+{
+    const auto in = reinterpret_cast<const unsigned char*>(data);
+    const auto dst = reinterpret_cast<unsigned char*>(out);
+    const auto n = CheckHeader(in, size);
+    if (!IsCompressed(in)) {
+        std::memcpy(dst, in, n);
+        return;
+    }
+    const auto decompressedSize = CheckCompressedHeader(in, n);
+    const auto offset = HEADER_SIZE + COMPRESSION_HEADER_SIZE;
+    DecodePlanes(
+        in + offset, n - offset,
+        dst + HEADER_SIZE, decompressedSize - HEADER_SIZE);
+    std::memcpy(dst, in, HEADER_SIZE);
+    Store(dst + 6, static_cast<std::uint16_t>(Load<std::uint16_t>(in + 6) & ~FLAG_COMPRESSED));
+    Store(dst + 8, static_cast<std::uint64_t>(decompressedSize));
+    std::memcpy(dst + 24, in + HEADER_SIZE + 8, 4);
+}
+
+
+} // namespace cppfmu
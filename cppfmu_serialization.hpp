@@ -0,0 +1,252 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_SERIALIZATION_HPP
+#define CPPFMU_SERIALIZATION_HPP
+
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint32_t, std::uint64_t, ...
+#include <type_traits>  // std::is_arithmetic
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// SERIALIZED FMU STATES
+// ============================================================================
+
+/* The cppfmu serialized FMU state format
+ * --------------------------------------
+ * All integers and floating-point numbers are stored in little-endian byte
+ * order.  A serialized state starts with a 32-byte header:
+ *
+ *     offset  size  field
+ *          0     4  magic number, the characters "CFMU"
+ *          4     2  format version (currently 1)
+ *          6     2  flags: bit 0 is set if the state is compressed
+ *          8     8  total size of the serialized state, in bytes
+ *         16     8  64-bit FNV-1a hash of the FMU's GUID
+ *         24     4  CRC-32 (ISO-HDLC) of everything after the header
+ *         28     4  reserved, zero
+ *
+ * This is followed by a sequence of sections, each starting with a 16-byte
+ * section header consisting of a 32-bit tag, 4 reserved bytes and the
+ * 64-bit size of the section contents.  Sections start at offsets which are
+ * multiples of 8, as do arrays and byte blocks within them, and scalars are
+ * aligned to their own size.  Padding bytes are zero.
+ *
+ * A reader can thus reject a state that was written by a different FMU or
+ * a newer version of cppfmu, or that is truncated, by looking at the header
+ * alone.  Readers skip any unread data at the end of a section, so new
+ * fields may be appended to a section without breaking older readers.
+ *
+ * A compressed state has the same header, except for the flag, the size and
+ * the checksum, which refer to the compressed state.  It is followed by the
+ * 64-bit size and the 32-bit checksum of the uncompressed state, 4 reserved
+ * bytes, and the compressed payload.  See CompressState().
+ */
+const std::uint16_t STATE_FORMAT_VERSION = 1;
+
+
+/* Writes a serialized FMU state in the cppfmu format, directly into the
+ * buffer passed to fmi2SerializeFMUstate().
+ *
+ * Typically, a slave implements one function which writes its state to a
+ * StateWriter, and uses it both for SerializedFMUStateSize(), with a
+ * writer that only measures, and for SerializeFMUState():
+ *
+ *     void Write(const MyState& s, cppfmu::StateWriter& w)
+ *     {
+ *         w.BeginSection(MY_STATE_TAG);
+ *         w.WriteReal(s.time);
+ *         w.WriteUInt64(s.values.size());
+ *         w.WriteArray(s.values.data(), s.values.size());
+ *         w.EndSection();
+ *     }
+ *
+ *     std::size_t SerializedFMUStateSize(cppfmu::FMIFMUState state) override
+ *     {
+ *         cppfmu::StateWriter w{guid_.c_str()};
+ *         Write(*static_cast<MyState*>(state), w);
+ *         return w.Finish();
+ *     }
+ *
+ *     void SerializeFMUState(
+ *         cppfmu::FMIFMUState state, cppfmu::FMIByte data[], std::size_t size)
+ *         override
+ *     {
+ *         cppfmu::StateWriter w{data, size, guid_.c_str()};
+ *         Write(*static_cast<MyState*>(state), w);
+ *         w.Finish();
+ *     }
+ *
+ * All data must be written inside sections.  The functions throw
+ * std::logic_error if the buffer is too small.
+ */
+class StateWriter
+{
+public:
+    // Creates a writer which writes to data[0] through data[size-1].
+    StateWriter(FMIByte data[], std::size_t size, FMIString guid);
+
+    // Creates a writer which only computes the size of the state.
+    explicit StateWriter(FMIString guid);
+
+    // Starts a new section, identified by an application-defined tag.
+    void BeginSection(std::uint32_t tag);
+
+    // Ends the current section.
+    void EndSection();
+
+    void WriteUInt32(std::uint32_t value);
+    void WriteInt32(std::int32_t value);
+    void WriteUInt64(std::uint64_t value);
+    void WriteInt64(std::int64_t value);
+    void WriteReal(FMIReal value);
+
+    /* Writes an array of numbers.  Note that the number of elements is not
+     * written, so it must be known to the reader by other means.
+     */
+    template<typename T>
+    void WriteArray(const T* values, std::size_t count)
+    {
+        static_assert(
+            std::is_arithmetic<T>::value,
+            "StateWriter::WriteArray() requires an arithmetic element type");
+        WriteElements(values, count, sizeof(T));
+    }
+
+    /* Writes a block of bytes which are copied as-is, e.g. the object
+     * representation of a trivially copyable object.  (Such data is not
+     * portable between platforms with different byte orders.)
+     */
+    void WriteBytes(const void* data, std::size_t size);
+
+    // Writes a string, preceded by its length.
+    void WriteString(const char* string, std::size_t length);
+
+    /* Completes the serialized state by filling in its header, and returns
+     * its total size.
+     */
+    std::size_t Finish();
+
+    // Returns the number of bytes written so far.
+    std::size_t Size() const CPPFMU_NOEXCEPT { return m_offset; }
+
+private:
+    void WriteElements(const void* values, std::size_t count, std::size_t elementSize);
+    unsigned char* Reserve(std::size_t size, std::size_t alignment);
+
+    unsigned char* m_data;
+    std::size_t m_capacity;
+    std::size_t m_offset;
+    std::size_t m_sectionStart;
+    std::uint64_t m_guidHash;
+};
+
+
+/* Reads a serialized FMU state in the cppfmu format, directly from the
+ * buffer passed to fmi2DeSerializeFMUstate().
+ *
+ * The constructor validates the header and the checksum, and the reading
+ * functions throw std::runtime_error if they run past the end of the
+ * current section.  The reading functions mirror those of StateWriter.
+ */
+class StateReader
+{
+public:
+    /* Creates a reader for data[0] through data[size-1].
+     * Throws std::runtime_error if the data is not a serialized state for
+     * the FMU with the given GUID, in a format version supported by this
+     * version of cppfmu, or if it is corrupt.  All checks except the
+     * checksum only look at the header.  Compressed states must be
+     * decompressed with DecompressState() first.
+     */
+    StateReader(const FMIByte data[], std::size_t size, FMIString guid);
+
+    /* Opens the next section, skipping any unread data in the current one.
+     * Throws std::runtime_error if it doesn't have the given tag.
+     */
+    void OpenSection(std::uint32_t tag);
+
+    // Skips any unread data in the current section.
+    void CloseSection();
+
+    std::uint32_t ReadUInt32();
+    std::int32_t ReadInt32();
+    std::uint64_t ReadUInt64();
+    std::int64_t ReadInt64();
+    FMIReal ReadReal();
+
+    template<typename T>
+    void ReadArray(T* values, std::size_t count)
+    {
+        static_assert(
+            std::is_arithmetic<T>::value,
+            "StateReader::ReadArray() requires an arithmetic element type");
+        ReadElements(values, count, sizeof(T));
+    }
+
+    void ReadBytes(void* data, std::size_t size);
+
+    // Skips a block of bytes written with StateWriter::WriteBytes().
+    void SkipBytes(std::size_t size);
+
+    // Reads a string into 'string', which may be e.g. a cppfmu::String.
+    template<typename StringType>
+    void ReadString(StringType& string)
+    {
+        const auto length = static_cast<std::size_t>(ReadUInt64());
+        string.assign(reinterpret_cast<const char*>(Consume(length, 8)), length);
+    }
+
+private:
+    void ReadElements(void* values, std::size_t count, std::size_t elementSize);
+    const unsigned char* Consume(std::size_t size, std::size_t alignment);
+
+    const unsigned char* m_data;
+    std::size_t m_size;
+    std::size_t m_offset;
+    std::size_t m_sectionEnd;
+};
+
+
+/* Compresses a serialized state.
+ *
+ * The compression is designed for the kind of data that typically makes up
+ * the state of a model: zeros, repeated values and slowly varying arrays of
+ * floating-point numbers.  It is a simple, fast run-length code applied to
+ * the bytes of the state after a delta and byte-plane transformation.
+ *
+ * 'out' must have room for 'size' bytes.  If compression doesn't make the
+ * state smaller, it is copied as-is.  Returns the size of the result.
+ */
+std::size_t CompressState(const FMIByte state[], std::size_t size, FMIByte out[]);
+
+/* Returns whether a serialized state is compressed.  Only looks at the
+ * header, which is validated.
+ */
+bool IsCompressedState(const FMIByte data[], std::size_t size);
+
+/* Returns the size of a serialized state after decompression, or its
+ * current size if it isn't compressed.  Throws std::runtime_error if the
+ * data is corrupt, i.e., if the checksum doesn't match or the compressed
+ * data doesn't decode to the size recorded in the header, so the result
+ * can safely be used to allocate memory for DecompressState().
+ */
+std::size_t DecompressedStateSize(const FMIByte data[], std::size_t size);
+
+/* Decompresses a serialized state, or copies it if it isn't compressed.
+ * 'out' must have room for DecompressedStateSize(data, size) bytes.
+ * Throws std::runtime_error if the data is corrupt.
+ */
+void DecompressState(const FMIByte data[], std::size_t size, FMIByte out[]);
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,566 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_state.hpp"
+
+#include "cppfmu_serialization.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+
+
+namespace cppfmu
+{
+
+/* A snapshot consists of this header, followed by 'recordCount' records.
+ * Each record consists of a RecordHeader followed by the bytes of one
+ * region, padded to a multiple of 8 bytes.  A full snapshot contains one
+ * record for every region, while a delta snapshot only contains the regions
+ * that changed since its base snapshot.
+ *
+ * Snapshots are reference counted.  The simulation environment holds one
+ * reference to each snapshot it has obtained, a delta snapshot holds one
+ * reference to its base, and the table holds one reference to the last
+ * snapshot taken or restored when incremental snapshots are enabled.
+ */
+struct StateTable::Snapshot
+{
+    std::uint32_t magic;
+    std::uint32_t entryCount;
+    // The number of bytes allocated for the snapshot, including the header.
+    std::uint64_t capacity;
+    // The number of bytes used by the snapshot, including the header.
+    std::uint64_t size;
+    std::uint64_t recordCount;
+    Snapshot* base;
+    std::uint32_t refCount;
+    // The number of delta snapshots between this and a full snapshot.
+    std::uint32_t chainLength;
+    // Changes whenever the snapshot is (re)written.
+    std::uint64_t generation;
+};
+
+
+namespace
+{
+    struct RecordHeader
+    {
+        std::uint64_t region;
+        std::uint64_t size;
+    };
+
+    const std::uint32_t SNAPSHOT_MAGIC = 0x53554d46; // "FMUS"
+
+    // The tag of the section which contains the state in serialized form.
+    // The section contains the number of regions, followed by the size and
+    // contents of each region.
+    const std::uint32_t STATE_TABLE_SECTION = 0x4c425453; // "STBL"
+
+    std::size_t Padded(std::size_t size) CPPFMU_NOEXCEPT
+    {
+        return (size + 7) & ~std::size_t{7};
+    }
+
+    template<typename Snapshot>
+    Snapshot* CheckedSnapshot(FMIFMUState state)
+    {
+        const auto snapshot = static_cast<Snapshot*>(state);
+        if (snapshot == nullptr || snapshot->magic != SNAPSHOT_MAGIC) {
+            throw std::logic_error("Invalid FMU state");
+        }
+        return snapshot;
+    }
+
+    template<typename Snapshot>
+    unsigned char* BodyOf(Snapshot* snapshot) CPPFMU_NOEXCEPT
+    {
+        return reinterpret_cast<unsigned char*>(snapshot + 1);
+    }
+
+    template<typename Snapshot>
+    unsigned char* EndOf(Snapshot* snapshot) CPPFMU_NOEXCEPT
+    {
+        return reinterpret_cast<unsigned char*>(snapshot)
+            + static_cast<std::size_t>(snapshot->size);
+    }
+
+    /* Calls f(region, data, size) for each record in a snapshot, after
+     * checking that the record lies within the snapshot.
+     */
+    template<typename Snapshot, typename F>
+    void ForEachRecord(Snapshot* snapshot, std::size_t regionCount, F f)
+    {
+        auto p = BodyOf(snapshot);
+        const auto end = EndOf(snapshot);
+        for (std::uint64_t i = 0; i < snapshot->recordCount; ++i) {
+            RecordHeader record;
+            if (static_cast<std::size_t>(end - p) < sizeof record) {
+                throw std::logic_error("Invalid FMU state");
+            }
+            std::memcpy(&record, p, sizeof record);
+            p += sizeof record;
+            if (record.region >= regionCount ||
+                    record.size > static_cast<std::uint64_t>(end - p)) {
+                throw std::logic_error("Invalid FMU state");
+            }
+            const auto size = static_cast<std::size_t>(record.size);
+            f(static_cast<std::size_t>(record.region), p, size);
+            p += std::min(Padded(size), static_cast<std::size_t>(end - p));
+        }
+    }
+
+    unsigned char* WriteRecord(
+        unsigned char* p,
+        std::size_t region,
+        const void* data,
+        std::size_t size) CPPFMU_NOEXCEPT
+    {
+        const auto record = RecordHeader{region, size};
+        std::memcpy(p, &record, sizeof record);
+        p += sizeof record;
+        if (size > 0) std::memcpy(p, data, size);
+        return p + Padded(size);
+    }
+}
+
+
+StateTable::StateTable(const Memory& memory)
+    : StateTable{memory, nullptr}
+{
+}
+
+
+StateTable::StateTable(const Memory& memory, FMIString guid)
+    : m_memory{memory}
+    , m_guid(guid ? CopyString(memory, guid) : String{Allocator<char>{memory}})
+    , m_entries(Allocator<Entry>{memory})
+    , m_addresses(Allocator<AddressRange>{memory})
+    , m_containers(Allocator<Region>{memory})
+    , m_dirty(Allocator<unsigned char>{memory})
+    , m_resolved(Allocator<RegionData>{memory})
+    , m_buffer(Allocator<FMIByte>{memory})
+{
+}
+
+
+StateTable::~StateTable() CPPFMU_NOEXCEPT
+{
+    Release(m_lastSnapshot);
+}
+
+
+StateTable::Region StateTable::AddBlock(void* data, std::size_t size)
+{
+    if (data == nullptr) {
+        throw std::logic_error("Attempted to register null state variable");
+    }
+    return AddEntry(Entry{data, size, nullptr, nullptr, nullptr});
+}
+
+
+StateTable::Region StateTable::AddEntry(const Entry& entry)
+{
+    m_entries.reserve(m_entries.size() + 1);
+    m_addresses.reserve(m_entries.size() + 1);
+    if (entry.containerSize) m_containers.reserve(m_containers.size() + 1);
+    m_dirty.reserve(m_entries.size() + 1);
+    m_resolved.reserve(m_entries.size() + 1);
+
+    // A container is identified by the address of the container object
+    // here.  Its elements move, so MarkVariableDirty() looks them up via
+    // m_containers instead.
+    const auto begin = static_cast<const unsigned char*>(entry.object);
+    const auto range = AddressRange{
+        begin,
+        begin + (entry.containerSize ? 1 : entry.size),
+        m_entries.size()};
+    m_addresses.insert(
+        std::upper_bound(
+            m_addresses.begin(), m_addresses.end(), range,
+            [] (const AddressRange& a, const AddressRange& b) {
+                return std::less<const unsigned char*>{}(a.begin, b.begin);
+            }),
+        range);
+    if (entry.containerSize) m_containers.push_back(m_entries.size());
+    m_entries.push_back(entry);
+    m_dirty.push_back(1);
+    m_resolved.push_back(RegionData{nullptr, 0});
+    // Snapshots taken before this can't be used as the base of a delta.
+    SetLastSnapshot(nullptr);
+    return m_entries.size() - 1;
+}
+
+
+void StateTable::MarkVariableDirty(const void* variable) CPPFMU_NOEXCEPT
+{
+    if (m_maxChainLength == 0 || m_allDirty) return;
+    const auto p = static_cast<const unsigned char*>(variable);
+    const auto less = std::less<const unsigned char*>{};
+    // Find the last region which starts at or before p.
+    auto it = std::upper_bound(
+        m_addresses.begin(), m_addresses.end(), p,
+        [less] (const unsigned char* q, const AddressRange& r) {
+            return less(q, r.begin);
+        });
+    if (it != m_addresses.begin() && less(p, (it - 1)->end)) {
+        m_dirty[(it - 1)->region] = 1;
+        return;
+    }
+    // The elements of a container are wherever it currently keeps them.
+    for (const auto region : m_containers) {
+        const auto& e = m_entries[region];
+        const auto data =
+            static_cast<const unsigned char*>(e.containerData(e.object));
+        if (data != nullptr
+                && !less(p, data)
+                && less(p, data + e.containerSize(e.object))) {
+            m_dirty[region] = 1;
+            return;
+        }
+    }
+}
+
+
+void StateTable::EnableIncrementalSnapshots(std::size_t maxChainLength)
+{
+    m_maxChainLength = maxChainLength;
+    if (maxChainLength == 0) SetLastSnapshot(nullptr);
+}
+
+
+void StateTable::EnableCompression(bool enabled) CPPFMU_NOEXCEPT
+{
+    m_compress = enabled;
+}
+
+
+void StateTable::Retain(Snapshot* snapshot) CPPFMU_NOEXCEPT
+{
+    if (snapshot != nullptr) ++snapshot->refCount;
+}
+
+
+void StateTable::Release(Snapshot* snapshot) CPPFMU_NOEXCEPT
+{
+    while (snapshot != nullptr && --snapshot->refCount == 0) {
+        const auto base = snapshot->base;
+        m_memory.Free(snapshot);
+        snapshot = base;
+    }
+}
+
+
+// Makes 'snapshot' the base of the next delta snapshot, and marks all
+// regions as clean.
+void StateTable::SetLastSnapshot(Snapshot* snapshot) CPPFMU_NOEXCEPT
+{
+    Retain(snapshot);
+    Release(m_lastSnapshot);
+    m_lastSnapshot = snapshot;
+    std::fill(m_dirty.begin(), m_dirty.end(), static_cast<unsigned char>(0));
+    m_allDirty = (snapshot == nullptr);
+}
+
+
+// Overwrites the dirty regions of a full snapshot with their current
+// contents.  Returns false, without changing anything, if the size of one
+// of them has changed.
+bool StateTable::UpdateInPlace(Snapshot* snapshot)
+{
+    bool sizesMatch = true;
+    ForEachRecord(snapshot, m_entries.size(),
+        [&] (std::size_t i, const unsigned char*, std::size_t size) {
+            const auto& e = m_entries[i];
+            if (m_dirty[i] && e.containerSize && e.containerSize(e.object) != size) {
+                sizesMatch = false;
+            }
+        });
+    if (!sizesMatch) return false;
+    ForEachRecord(snapshot, m_entries.size(),
+        [&] (std::size_t i, unsigned char* data, std::size_t size) {
+            if (!m_dirty[i] || size == 0) return;
+            const auto& e = m_entries[i];
+            const auto src = e.containerData ? e.containerData(e.object) : e.object;
+            std::memcpy(data, src, size);
+        });
+    snapshot->generation = m_nextGeneration++;
+    return true;
+}
+
+
+void StateTable::GetState(FMIFMUState* state)
+{
+    const auto old = *state ? CheckedSnapshot<Snapshot>(*state) : nullptr;
+    // Whether no one but the caller, and the table if it is the last
+    // snapshot, refers to the old snapshot, so that it may be overwritten.
+    const bool oldIsLast = old != nullptr && old == m_lastSnapshot;
+    const bool oldExclusive =
+        old != nullptr && old->refCount == (oldIsLast ? 2u : 1u);
+    const bool delta = m_maxChainLength > 0
+        && m_lastSnapshot != nullptr
+        && !m_allDirty
+        && m_lastSnapshot->chainLength < m_maxChainLength;
+
+    // A full snapshot which was the last one can simply be brought up to
+    // date, which is both cheaper than a delta and doesn't allocate.
+    if (delta && oldIsLast && oldExclusive && old->base == nullptr
+            && UpdateInPlace(old)) {
+        SetLastSnapshot(old);
+        return;
+    }
+
+    const auto regionSize = [] (const Entry& e) {
+        return e.containerSize ? e.containerSize(e.object) : e.size;
+    };
+    std::size_t size = sizeof(Snapshot);
+    std::size_t recordCount = 0;
+    for (std::size_t i = 0; i < m_entries.size(); ++i) {
+        if (delta && !m_dirty[i]) continue;
+        size += sizeof(RecordHeader) + Padded(regionSize(m_entries[i]));
+        ++recordCount;
+    }
+
+    // The old snapshot's memory can only be reused if no one else holds a
+    // reference to it, and a delta can't overwrite its own base.
+    Snapshot* snapshot = nullptr;
+    if (oldExclusive && !(delta && oldIsLast) && old->capacity >= size) {
+        Release(old->base);
+        snapshot = old;
+    } else {
+        snapshot = static_cast<Snapshot*>(m_memory.Alloc(1, size));
+        if (snapshot == nullptr) throw std::bad_alloc();
+        snapshot->magic = SNAPSHOT_MAGIC;
+        snapshot->capacity = size;
+        snapshot->refCount = 1;
+    }
+    snapshot->entryCount = static_cast<std::uint32_t>(m_entries.size());
+    snapshot->size = size;
+    snapshot->recordCount = recordCount;
+    snapshot->generation = m_nextGeneration++;
+    if (delta) {
+        Retain(m_lastSnapshot);
+        snapshot->base = m_lastSnapshot;
+        snapshot->chainLength = m_lastSnapshot->chainLength + 1;
+    } else {
+        snapshot->base = nullptr;
+        snapshot->chainLength = 0;
+    }
+
+    auto p = BodyOf(snapshot);
+    for (std::size_t i = 0; i < m_entries.size(); ++i) {
+        if (delta && !m_dirty[i]) continue;
+        const auto& e = m_entries[i];
+        const auto src = e.containerData ? e.containerData(e.object) : e.object;
+        p = WriteRecord(p, i, src, regionSize(e));
+    }
+
+    // The caller's reference to the old snapshot is transferred to the new
+    // one.
+    if (old != nullptr && old != snapshot) Release(old);
+    *state = snapshot;
+    if (m_maxChainLength > 0) SetLastSnapshot(snapshot);
+}
+
+
+// Finds the contents of each region in a snapshot, which is the record
+// for that region in the newest snapshot in the chain that contains one.
+void StateTable::Resolve(Snapshot* snapshot)
+{
+    if (snapshot->entryCount != m_entries.size()) {
+        throw std::logic_error("FMU state does not match state table");
+    }
+    std::fill(m_resolved.begin(), m_resolved.end(), RegionData{nullptr, 0});
+    auto remaining = m_entries.size();
+    for (auto s = snapshot; s != nullptr && remaining > 0; s = s->base) {
+        ForEachRecord(s, m_entries.size(),
+            [&] (std::size_t i, const unsigned char* data, std::size_t size) {
+                if (m_resolved[i].data != nullptr) return;
+                const auto& e = m_entries[i];
+                if (!e.containerResize && size != e.size) {
+                    throw std::logic_error("FMU state does not match state table");
+                }
+                m_resolved[i] = RegionData{data, size};
+                --remaining;
+            });
+    }
+    if (remaining > 0) throw std::logic_error("Invalid FMU state");
+}
+
+
+void StateTable::SetState(FMIFMUState state)
+{
+    Resolve(CheckedSnapshot<Snapshot>(state));
+    try {
+        for (std::size_t i = 0; i < m_entries.size(); ++i) {
+            const auto& e = m_entries[i];
+            const auto& r = m_resolved[i];
+            const auto dst = e.containerResize
+                ? e.containerResize(e.object, r.size)
+                : e.object;
+            if (r.size > 0) std::memcpy(dst, r.data, r.size);
+        }
+    } catch (...) {
+        // The variables may have been partially restored.
+        m_allDirty = true;
+        throw;
+    }
+    if (m_maxChainLength > 0) SetLastSnapshot(static_cast<Snapshot*>(state));
+}
+
+
+void StateTable::FreeState(FMIFMUState state) CPPFMU_NOEXCEPT
+{
+    Release(static_cast<Snapshot*>(state));
+}
+
+
+// Writes the snapshot most recently passed to Resolve().
+void StateTable::Write(StateWriter& writer) const
+{
+    writer.BeginSection(STATE_TABLE_SECTION);
+    writer.WriteUInt64(m_resolved.size());
+    for (const auto& r : m_resolved) {
+        writer.WriteUInt64(r.size);
+        writer.WriteBytes(r.data, r.size);
+    }
+    writer.EndSection();
+}
+
+
+// Checks that 'size' is a plausible size for a serialized state of this
+// table: exactly the registered size if all regions have a fixed size,
+// and otherwise at least the size with all containers empty.
+void StateTable::CheckSerializedSize(std::size_t size) const
+{
+    StateWriter measure{m_guid.c_str()};
+    measure.BeginSection(STATE_TABLE_SECTION);
+    measure.WriteUInt64(m_entries.size());
+    bool fixedSize = true;
+    for (const auto& e : m_entries) {
+        if (e.containerSize) fixedSize = false;
+        measure.WriteUInt64(e.size);
+        measure.WriteBytes(nullptr, e.size);
+    }
+    const auto minSize = measure.Finish();
+    if (size < minSize || (fixedSize && size != minSize)) {
+        throw std::runtime_error("Serialized FMU state does not match state table");
+    }
+}
+
+
+// Serializes and compresses a snapshot into m_buffer, unless this has
+// already been done, and returns the compressed size.
+std::size_t StateTable::Compress(Snapshot* snapshot)
+{
+    if (snapshot == m_compressedSnapshot &&
+            snapshot->generation == m_compressedGeneration) {
+        return m_compressedSize;
+    }
+    m_compressedSnapshot = nullptr;
+    Resolve(snapshot);
+    StateWriter measure{m_guid.c_str()};
+    Write(measure);
+    const auto size = measure.Finish();
+    m_buffer.resize(2 * size);
+    StateWriter writer{m_buffer.data(), size, m_guid.c_str()};
+    Write(writer);
+    writer.Finish();
+    m_compressedOffset = size;
+    m_compressedSize = CompressState(m_buffer.data(), size, m_buffer.data() + size);
+    m_compressedSnapshot = snapshot;
+    m_compressedGeneration = snapshot->generation;
+    return m_compressedSize;
+}
+
+
+std::size_t StateTable::SerializedStateSize(FMIFMUState state)
+{
+    const auto snapshot = CheckedSnapshot<Snapshot>(state);
+    if (m_compress) return Compress(snapshot);
+    Resolve(snapshot);
+    StateWriter writer{m_guid.c_str()};
+    Write(writer);
+    return writer.Finish();
+}
+
+
+void StateTable::SerializeState(
+    FMIFMUState state,
+    FMIByte data[],
+    std::size_t size)
+{
+    const auto snapshot = CheckedSnapshot<Snapshot>(state);
+    if (m_compress) {
+        const auto n = Compress(snapshot);
+        if (size < n) {
+            throw std::logic_error("Buffer too small for serialized FMU state");
+        }
+        std::memcpy(data, m_buffer.data() + m_compressedOffset, n);
+        return;
+    }
+    Resolve(snapshot);
+    StateWriter writer{data, size, m_guid.c_str()};
+    Write(writer);
+    writer.Finish();
+}
+
+
+FMIFMUState StateTable::DeserializeState(const FMIByte data[], std::size_t size)
+{
+    if (IsCompressedState(data, size)) {
+        m_compressedSnapshot = nullptr;
+        const auto decompressedSize = DecompressedStateSize(data, size);
+        CheckSerializedSize(decompressedSize);
+        m_buffer.resize(decompressedSize);
+        DecompressState(data, size, m_buffer.data());
+        data = m_buffer.data();
+        size = m_buffer.size();
+    }
+    StateReader reader{data, size, m_guid.c_str()};
+    reader.OpenSection(STATE_TABLE_SECTION);
+    if (reader.ReadUInt64() != m_entries.size()) {
+        throw std::runtime_error("Serialized FMU state does not match state table");
+    }
+
+    // First pass: find the size of the snapshot.
+    auto sizePass = reader;
+    std::size_t snapshotSize = sizeof(Snapshot);
+    for (std::size_t i = 0; i < m_entries.size(); ++i) {
+        const auto n = sizePass.ReadUInt64();
+        if (n > size) throw std::runtime_error("Invalid serialized FMU state");
+        sizePass.SkipBytes(static_cast<std::size_t>(n));
+        snapshotSize += sizeof(RecordHeader) + Padded(static_cast<std::size_t>(n));
+    }
+
+    // Second pass: copy the data.
+    const auto snapshot = static_cast<Snapshot*>(m_memory.Alloc(1, snapshotSize));
+    if (snapshot == nullptr) throw std::bad_alloc();
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->entryCount = static_cast<std::uint32_t>(m_entries.size());
+    snapshot->capacity = snapshotSize;
+    snapshot->size = snapshotSize;
+    snapshot->recordCount = m_entries.size();
+    snapshot->base = nullptr;
+    snapshot->refCount = 1;
+    snapshot->chainLength = 0;
+    snapshot->generation = m_nextGeneration++;
+    auto p = BodyOf(snapshot);
+    for (std::size_t i = 0; i < m_entries.size(); ++i) {
+        const auto n = static_cast<std::size_t>(reader.ReadUInt64());
+        const auto record = RecordHeader{i, n};
+        std::memcpy(p, &record, sizeof record);
+        p += sizeof record;
+        reader.ReadBytes(p, n);
+        p += Padded(n);
+    }
+    return snapshot;
+}
+
+
+} // namespace cppfmu
@@ -0,0 +1,298 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_STATE_HPP
+#define CPPFMU_STATE_HPP
+
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint64_t
+#include <string>       // std::basic_string
+#include <type_traits>  // std::is_trivially_copyable
+#include <vector>       // std::vector
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+class StateWriter;
+
+
+// ============================================================================
+// FMU STATE SNAPSHOTS
+// ============================================================================
+
+namespace detail
+{
+    /* Type-erased operations on a container whose elements are trivially
+     * copyable and stored contiguously (std::vector, std::basic_string).
+     * Sizes are in bytes.
+     */
+    template<typename Container>
+    struct ContainerOps
+    {
+        using Element = typename Container::value_type;
+
+        static std::size_t Size(const void* object) CPPFMU_NOEXCEPT
+        {
+            return static_cast<const Container*>(object)->size() * sizeof(Element);
+        }
+
+        static const void* Data(const void* object) CPPFMU_NOEXCEPT
+        {
+            const auto& c = *static_cast<const Container*>(object);
+            return c.empty() ? nullptr : &c[0];
+        }
+
+        static void* Resize(void* object, std::size_t size)
+        {
+            auto& c = *static_cast<Container*>(object);
+            c.resize(size / sizeof(Element));
+            return c.empty() ? nullptr : &c[0];
+        }
+    };
+}
+
+
+/* A table of the variables that make up the internal state of a slave,
+ * which implements the FMU state functions on top of them.
+ *
+ * A slave typically keeps a StateTable as a member, registers its state
+ * variables in its constructor, and passes the table to
+ * SlaveInstance::UseStateTable().  The default implementations of the
+ * SlaveInstance FMU state functions then forward to the table.
+ *
+ * The state may consist of trivially copyable objects (which includes
+ * arrays and structs of such) and of std::vector/std::basic_string objects
+ * with trivially copyable elements, e.g. vectors using cppfmu::Allocator.
+ *
+ * A snapshot is a single, flat block of memory allocated with the
+ * cppfmu::Memory given to the constructor.  Taking a snapshot into an
+ * existing FMU state reuses its memory whenever it is large enough, so
+ * repeated calls to fmi2GetFMUstate() with the same state don't allocate.
+ * Snapshots are serialized in the cppfmu format (see
+ * cppfmu_serialization.hpp), with the bytes of each registered variable
+ * copied as-is.  If the table is constructed with the FMU's GUID, states
+ * serialized by other FMUs are rejected.  With EnableCompression(), the
+ * serialized states are compressed (see CompressState()).  Compressed
+ * states are always accepted by DeserializeState().
+ *
+ * Incremental snapshots
+ * ---------------------
+ * For large models where only a small part of the state changes between
+ * snapshots, EnableIncrementalSnapshots() makes the table store only the
+ * regions (registered variables) that have changed since the previous
+ * snapshot.  The model must then call MarkDirty() for every region it
+ * modifies.  Variables which the environment sets through the default
+ * SlaveInstance::SetXxx() functions, i.e., through the table given to
+ * UseVariableTable(), are marked automatically (see MarkVariableDirty()).
+ * Such a delta snapshot refers to the snapshot it is based on,
+ * which is kept alive until all the snapshots that depend on it have been
+ * freed.  When the environment passes the last snapshot back to
+ * fmi2GetFMUstate(), and no other snapshot depends on it, the changed
+ * regions are instead copied into it in place, so saving the state into
+ * the same FMU state over and over doesn't allocate either.  SetState() rebuilds the state by copying each region from the
+ * newest snapshot in the chain that contains it, and serialization always
+ * produces a self-contained (full) snapshot.
+ *
+ * The registered variables must outlive the table.
+ */
+class StateTable
+{
+public:
+    // Identifies a registered state variable, for use with MarkDirty().
+    using Region = std::size_t;
+
+    explicit StateTable(const Memory& memory);
+
+    StateTable(const Memory& memory, FMIString guid);
+
+    ~StateTable() CPPFMU_NOEXCEPT;
+
+    StateTable(const StateTable&) = delete;
+    StateTable& operator=(const StateTable&) = delete;
+
+    // Registers a block of 'size' bytes starting at 'data'.
+    Region AddBlock(void* data, std::size_t size);
+
+    // Registers a trivially copyable object.
+    template<typename T>
+    Region Add(T& variable)
+    {
+        static_assert(
+            std::is_trivially_copyable<T>::value,
+            "StateTable::Add() requires a trivially copyable type or a supported container");
+        return AddBlock(&variable, sizeof(T));
+    }
+
+    // Registers a vector whose elements are trivially copyable.
+    template<typename T, typename Alloc>
+    Region Add(std::vector<T, Alloc>& variable)
+    {
+        static_assert(
+            std::is_trivially_copyable<T>::value,
+            "StateTable::Add() requires vector elements to be trivially copyable");
+        return AddContainer<std::vector<T, Alloc>>(&variable);
+    }
+
+    // Registers a string (e.g. a cppfmu::String).
+    template<typename CharT, typename Traits, typename Alloc>
+    Region Add(std::basic_string<CharT, Traits, Alloc>& variable)
+    {
+        return AddContainer<std::basic_string<CharT, Traits, Alloc>>(&variable);
+    }
+
+    /* Enables incremental snapshots.  A full snapshot is taken after at
+     * most 'maxChainLength' consecutive delta snapshots, which bounds the
+     * cost of SetState().
+     */
+    void EnableIncrementalSnapshots(std::size_t maxChainLength = 16);
+
+    /* Records that a region has been modified since the last snapshot.
+     * Only needed with incremental snapshots.
+     */
+    void MarkDirty(Region region) CPPFMU_NOEXCEPT
+    {
+        m_dirty[region] = 1;
+    }
+
+    // Records that all regions may have been modified.
+    void MarkAllDirty() CPPFMU_NOEXCEPT
+    {
+        m_allDirty = true;
+    }
+
+    /* Records that the variable at 'variable' has been modified, by marking
+     * the region which contains it: a block which spans the address, a
+     * container object at that address, or a container whose elements
+     * currently span it.  Does nothing if no region contains it.  Only
+     * needed with incremental snapshots.
+     */
+    void MarkVariableDirty(const void* variable) CPPFMU_NOEXCEPT;
+
+    // The memory that the table and its snapshots are allocated from.
+    const Memory& GetMemory() const CPPFMU_NOEXCEPT { return m_memory; }
+
+    // Whether incremental snapshots are enabled, i.e., dirty regions matter.
+    bool IncrementalSnapshotsEnabled() const CPPFMU_NOEXCEPT
+    {
+        return m_maxChainLength > 0;
+    }
+
+    /* Enables or disables compression of serialized states.
+     * The compressed state is computed by SerializedStateSize() and kept
+     * until the next call to SerializeState(), which then only copies it.
+     */
+    void EnableCompression(bool enabled = true) CPPFMU_NOEXCEPT;
+
+    /* Takes a snapshot of the registered variables.  If '*state' is not
+     * null, it must be a snapshot created by this table, and its memory is
+     * reused if possible.
+     */
+    void GetState(FMIFMUState* state);
+
+    // Restores the registered variables from a snapshot.
+    void SetState(FMIFMUState state);
+
+    // Frees a snapshot.
+    void FreeState(FMIFMUState state) CPPFMU_NOEXCEPT;
+
+    // Returns the size of the serialized form of a snapshot.
+    std::size_t SerializedStateSize(FMIFMUState state);
+
+    // Serializes a snapshot.
+    void SerializeState(FMIFMUState state, FMIByte data[], std::size_t size);
+
+    // Creates a snapshot from its serialized form.
+    FMIFMUState DeserializeState(const FMIByte data[], std::size_t size);
+
+private:
+    struct Entry
+    {
+        void* object;
+        // For blocks: the size in bytes.  For containers: zero.
+        std::size_t size;
+        // For containers only; null for blocks.
+        std::size_t (*containerSize)(const void*);
+        const void* (*containerData)(const void*);
+        void* (*containerResize)(void*, std::size_t);
+    };
+
+    struct Snapshot;
+
+    template<typename Container>
+    Region AddContainer(Container* container)
+    {
+        using Ops = detail::ContainerOps<Container>;
+        return AddEntry(Entry{
+            container,
+            0,
+            &Ops::Size,
+            &Ops::Data,
+            &Ops::Resize});
+    }
+
+    // The memory occupied by a region, for MarkVariableDirty().
+    struct AddressRange
+    {
+        const unsigned char* begin;
+        const unsigned char* end;
+        Region region;
+    };
+
+    // The contents of a region in a snapshot.
+    struct RegionData
+    {
+        const unsigned char* data;
+        std::size_t size;
+    };
+
+    Region AddEntry(const Entry& entry);
+    bool UpdateInPlace(Snapshot* snapshot);
+    void Retain(Snapshot* snapshot) CPPFMU_NOEXCEPT;
+    void Release(Snapshot* snapshot) CPPFMU_NOEXCEPT;
+    void SetLastSnapshot(Snapshot* snapshot) CPPFMU_NOEXCEPT;
+    void Resolve(Snapshot* snapshot);
+    void Write(StateWriter& writer) const;
+    void CheckSerializedSize(std::size_t size) const;
+    std::size_t Compress(Snapshot* snapshot);
+
+    Memory m_memory;
+    String m_guid;
+    std::vector<Entry, Allocator<Entry>> m_entries;
+    // The regions' address ranges, sorted by start address.
+    std::vector<AddressRange, Allocator<AddressRange>> m_addresses;
+    // The container regions, whose elements may move.
+    std::vector<Region, Allocator<Region>> m_containers;
+
+    // Incremental snapshots
+    std::size_t m_maxChainLength = 0;
+    std::vector<unsigned char, Allocator<unsigned char>> m_dirty;
+    bool m_allDirty = true;
+    Snapshot* m_lastSnapshot = nullptr;
+
+    // The contents of each region in the snapshot most recently passed to
+    // Resolve().
+    std::vector<RegionData, Allocator<RegionData>> m_resolved;
+
+    // Snapshots are numbered, so we can tell whether a snapshot has been
+    // overwritten since it was compressed.
+    std::uint64_t m_nextGeneration = 1;
+
+    // Compression.  m_buffer holds the uncompressed serialized state,
+    // followed by the compressed one, of the snapshot with the given
+    // generation.
+    bool m_compress = false;
+    std::vector<FMIByte, Allocator<FMIByte>> m_buffer;
+    const Snapshot* m_compressedSnapshot = nullptr;
+    std::uint64_t m_compressedGeneration = 0;
+    std::size_t m_compressedOffset = 0;
+    std::size_t m_compressedSize = 0;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,194 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_stats.hpp"
+
+#include <cmath>
+
+
+namespace cppfmu
+{
+
+// =============================================================================
+// FMIFunction
+// =============================================================================
+
+
+FMIString FMIFunctionName(FMIFunction function) CPPFMU_NOEXCEPT
+{
+    static const FMIString names[FMI_FUNCTION_COUNT] = {
+#ifdef CPPFMU_USE_FMI_1_0
+        "fmiInitializeSlave",
+        nullptr,
+        nullptr,
+        "fmiTerminateSlave",
+        "fmiResetSlave",
+        "fmiGetReal",
+        "fmiGetInteger",
+        "fmiGetBoolean",
+        "fmiGetString",
+        "fmiSetReal",
+        "fmiSetInteger",
+        "fmiSetBoolean",
+        "fmiSetString",
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        "fmiDoStep",
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+#else
+        "fmi2SetupExperiment",
+        "fmi2EnterInitializationMode",
+        "fmi2ExitInitializationMode",
+        "fmi2Terminate",
+        "fmi2Reset",
+        "fmi2GetReal",
+        "fmi2GetInteger",
+        "fmi2GetBoolean",
+        "fmi2GetString",
+        "fmi2SetReal",
+        "fmi2SetInteger",
+        "fmi2SetBoolean",
+        "fmi2SetString",
+        "fmi2GetFMUstate",
+        "fmi2SetFMUstate",
+        "fmi2FreeFMUstate",
+        "fmi2SerializedFMUstateSize",
+        "fmi2SerializeFMUstate",
+        "fmi2DeSerializeFMUstate",
+        "fmi2DoStep",
+        "fmi2EnterEventMode",
+        "fmi2NewDiscreteStates",
+        "fmi2EnterContinuousTimeMode",
+        "fmi2CompletedIntegratorStep",
+        "fmi2SetTime",
+        "fmi2SetContinuousStates",
+        "fmi2GetDerivatives",
+        "fmi2GetEventIndicators",
+        "fmi2GetContinuousStates",
+        "fmi2GetNominalsOfContinuousStates",
+        "fmi2GetDirectionalDerivative",
+#endif
+    };
+    return names[static_cast<std::size_t>(function)];
+}
+
+
+// =============================================================================
+// LatencyHistogram
+// =============================================================================
+
+
+std::size_t LatencyHistogram::BucketIndex(std::uint64_t ns) CPPFMU_NOEXCEPT
+{
+    const std::uint64_t subBuckets = 1u << SUB_BUCKET_BITS;
+    if (ns < subBuckets) return static_cast<std::size_t>(ns);
+    unsigned e = SUB_BUCKET_BITS;
+    while (e < MAX_EXPONENT && (ns >> (e + 1)) != 0) ++e;
+    if ((ns >> (e + 1)) != 0) return BUCKET_COUNT - 1;
+    const auto sub = (ns >> (e - SUB_BUCKET_BITS)) & (subBuckets - 1);
+    return static_cast<std::size_t>(((e - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub);
+}
+
+
+std::uint64_t LatencyHistogram::BucketLimit(std::size_t index) CPPFMU_NOEXCEPT
+{
+    const std::size_t subBuckets = 1u << SUB_BUCKET_BITS;
+    if (index < subBuckets) return index;
+    if (index == BUCKET_COUNT - 1) return std::numeric_limits<std::uint64_t>::max();
+    const auto e = static_cast<unsigned>(index / subBuckets) + SUB_BUCKET_BITS - 1;
+    const auto sub = index % subBuckets;
+    const auto width = std::uint64_t{1} << (e - SUB_BUCKET_BITS);
+    return (subBuckets + sub) * width + width - 1;
+}
+
+
+std::uint64_t LatencyHistogram::Percentile(double p) const CPPFMU_NOEXCEPT
+{
+    std::uint64_t value;
+    Percentiles(&p, &value, 1);
+    return value;
+}
+
+
+void LatencyHistogram::Percentiles(
+    const double p[],
+    std::uint64_t values[],
+    std::size_t n)
+    const CPPFMU_NOEXCEPT
+{
+    std::size_t bucket = 0;
+    std::uint64_t seen = m_buckets[0];
+    for (std::size_t k = 0; k < n; ++k) {
+        if (m_count == 0) {
+            values[k] = 0;
+            continue;
+        }
+        auto rank = static_cast<std::uint64_t>(std::ceil(p[k] / 100.0 * m_count));
+        if (rank < 1) rank = 1;
+        if (rank > m_count) rank = m_count;
+        while (seen < rank && bucket < BUCKET_COUNT - 1) {
+            seen += m_buckets[++bucket];
+        }
+        values[k] = BucketLimit(bucket);
+    }
+}
+
+
+void LatencyHistogram::Clear() CPPFMU_NOEXCEPT
+{
+    m_count = 0;
+    for (auto& b : m_buckets) b = 0;
+}
+
+
+// =============================================================================
+// CallStatistics
+// =============================================================================
+
+
+void CallStatistics::Clear() CPPFMU_NOEXCEPT
+{
+    for (auto& f : m_functions) f = FunctionStatistics{};
+}
+
+
+void CallStatistics::Log(Logger& logger) const CPPFMU_NOEXCEPT
+{
+    for (std::size_t i = 0; i < FMI_FUNCTION_COUNT; ++i) {
+        const auto& f = m_functions[i];
+        if (f.calls == 0) continue;
+        logger.Log(
+            FMIOK,
+            "cppfmu.stats",
+            "%s: calls=%llu total=%.3fms mean=%.0fns min=%lluns "
+            "p50=%lluns p99=%lluns p99.9=%lluns max=%lluns",
+            FMIFunctionName(static_cast<FMIFunction>(i)),
+            static_cast<unsigned long long>(f.calls),
+            f.totalNs * 1e-6,
+            static_cast<double>(f.totalNs) / f.calls,
+            static_cast<unsigned long long>(f.minNs),
+            static_cast<unsigned long long>(f.Percentile(50.0)),
+            static_cast<unsigned long long>(f.Percentile(99.0)),
+            static_cast<unsigned long long>(f.Percentile(99.9)),
+            static_cast<unsigned long long>(f.maxNs));
+    }
+}
+
+
+} // namespace cppfmu
@@ -0,0 +1,189 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_STATS_HPP
+#define CPPFMU_STATS_HPP
+
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint32_t, std::uint64_t
+#include <limits>   // std::numeric_limits
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// CALL STATISTICS
+// ============================================================================
+
+// The FMI functions for which call statistics are collected.
+enum class FMIFunction
+{
+    SetupExperiment,
+    EnterInitializationMode,
+    ExitInitializationMode,
+    Terminate,
+    Reset,
+    GetReal,
+    GetInteger,
+    GetBoolean,
+    GetString,
+    SetReal,
+    SetInteger,
+    SetBoolean,
+    SetString,
+    GetFMUState,
+    SetFMUState,
+    FreeFMUState,
+    SerializedFMUStateSize,
+    SerializeFMUState,
+    DeserializeFMUState,
+    DoStep,
+    EnterEventMode,
+    NewDiscreteStates,
+    EnterContinuousTimeMode,
+    CompletedIntegratorStep,
+    SetTime,
+    SetContinuousStates,
+    GetDerivatives,
+    GetEventIndicators,
+    GetContinuousStates,
+    GetNominalsOfContinuousStates,
+    GetDirectionalDerivative,
+};
+
+// The number of enumerators in FMIFunction.
+const std::size_t FMI_FUNCTION_COUNT = 31;
+
+
+/* Returns the C name of an FMI function, e.g. "fmi2DoStep", or with FMI 1.0,
+ * "fmiDoStep".  Returns null for functions which don't exist in FMI 1.0
+ * co-simulation.
+ * (fmiInitializeSlave() is counted as SetupExperiment.)
+ */
+FMIString FMIFunctionName(FMIFunction function) CPPFMU_NOEXCEPT;
+
+
+/* A histogram of durations in nanoseconds, with logarithmically spaced
+ * buckets in the style of HdrHistogram.
+ *
+ * Each power of two is divided into 2^SUB_BUCKET_BITS buckets, so the
+ * values reported by Percentile() are at most 1/8 (12.5%) too large.
+ * Durations up to about 2^(MAX_EXPONENT+1) ns (37 minutes) are resolved;
+ * longer ones are counted in the last bucket.  The memory usage is fixed, and
+ * recording a value does not allocate memory.
+ */
+class LatencyHistogram
+{
+public:
+    static const unsigned SUB_BUCKET_BITS = 3;
+    static const unsigned MAX_EXPONENT = 40;
+    static const std::size_t BUCKET_COUNT =
+        (MAX_EXPONENT - SUB_BUCKET_BITS + 2) << SUB_BUCKET_BITS;
+
+    // Adds a value.
+    void Record(std::uint64_t ns) CPPFMU_NOEXCEPT
+    {
+        ++m_buckets[BucketIndex(ns)];
+        ++m_count;
+    }
+
+    // Returns the number of values recorded.
+    std::uint64_t Count() const CPPFMU_NOEXCEPT { return m_count; }
+
+    /* Returns an upper bound on the 'p'th percentile (0 <= p <= 100) of the
+     * recorded values, or 0 if there are none.
+     */
+    std::uint64_t Percentile(double p) const CPPFMU_NOEXCEPT;
+
+    /* Like Percentile(), but computes several percentiles in one pass over
+     * the buckets.  'p' must be sorted in ascending order, and the results
+     * are stored in 'values', which must have room for 'n' elements.
+     */
+    void Percentiles(const double p[], std::uint64_t values[], std::size_t n)
+        const CPPFMU_NOEXCEPT;
+
+    // Removes all values.
+    void Clear() CPPFMU_NOEXCEPT;
+
+    // The index of the bucket that contains 'ns'.
+    static std::size_t BucketIndex(std::uint64_t ns) CPPFMU_NOEXCEPT;
+
+    // The largest value in the bucket with index 'index'.
+    static std::uint64_t BucketLimit(std::size_t index) CPPFMU_NOEXCEPT;
+
+private:
+    std::uint64_t m_count = 0;
+    std::uint32_t m_buckets[BUCKET_COUNT] = {};
+};
+
+
+// Statistics for the calls to one FMI function.
+struct FunctionStatistics
+{
+    std::uint64_t calls = 0;
+    std::uint64_t totalNs = 0;
+    std::uint64_t minNs = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t maxNs = 0;
+    LatencyHistogram histogram;
+
+    void Record(std::uint64_t ns) CPPFMU_NOEXCEPT
+    {
+        ++calls;
+        totalNs += ns;
+        if (ns < minNs) minNs = ns;
+        if (ns > maxNs) maxNs = ns;
+        histogram.Record(ns);
+    }
+
+    /* Returns an estimate of the 'p'th percentile of the call durations,
+     * in nanoseconds.  (See LatencyHistogram::Percentile().)
+     */
+    std::uint64_t Percentile(double p) const CPPFMU_NOEXCEPT
+    {
+        const auto v = histogram.Percentile(p);
+        return v < minNs ? minNs : v > maxNs ? maxNs : v;
+    }
+};
+
+
+/* Statistics for the calls to all FMI functions on one instance.
+ *
+ * If fmi_functions.cpp is compiled with CPPFMU_FUNCTION_STATISTICS defined,
+ * each instance measures the wall-clock time spent in each of the FMI
+ * functions listed in FMIFunction.  The statistics are available to the
+ * slave through Instance::GetCallStatistics(), and they are logged in the
+ * category "cppfmu.stats" when the instance is terminated.
+ */
+class CallStatistics
+{
+public:
+    const FunctionStatistics& operator[](FMIFunction function) const CPPFMU_NOEXCEPT
+    {
+        return m_functions[static_cast<std::size_t>(function)];
+    }
+
+    void Record(FMIFunction function, std::uint64_t ns) CPPFMU_NOEXCEPT
+    {
+        m_functions[static_cast<std::size_t>(function)].Record(ns);
+    }
+
+    // Removes all statistics.
+    void Clear() CPPFMU_NOEXCEPT;
+
+    /* Logs one message per function that has been called, in the category
+     * "cppfmu.stats".
+     */
+    void Log(Logger& logger) const CPPFMU_NOEXCEPT;
+
+private:
+    FunctionStatistics m_functions[FMI_FUNCTION_COUNT];
+};
+
+
+} // namespace cppfmu
+#endif // header guard
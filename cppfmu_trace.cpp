@@ -0,0 +1,173 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "cppfmu_trace.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+
+namespace cppfmu
+{
+
+namespace
+{
+    // A small number that identifies the calling thread in trace files.
+    std::uint32_t ThisThreadID() CPPFMU_NOEXCEPT
+    {
+        static std::atomic<std::uint32_t> nextID{1};
+        static thread_local const std::uint32_t id =
+            nextID.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    // The 32-bit FNV-1a hash of 'string', truncated to a positive int.
+    std::uint32_t Hash(FMIString string) CPPFMU_NOEXCEPT
+    {
+        std::uint32_t hash = 2166136261u;
+        for (auto c = string; *c; ++c) {
+            hash ^= static_cast<unsigned char>(*c);
+            hash *= 16777619u;
+        }
+        return hash & 0x7FFFFFFFu;
+    }
+
+    // Writes 'string' as a quoted JSON string.
+    void WriteJSONString(std::FILE* file, FMIString string)
+    {
+        std::fputc('"', file);
+        for (auto c = string; *c; ++c) {
+            const auto u = static_cast<unsigned char>(*c);
+            if (u == '"' || u == '\\') {
+                std::fputc('\\', file);
+                std::fputc(u, file);
+            } else if (u < 0x20) {
+                std::fprintf(file, "\\u%04x", u);
+            } else {
+                std::fputc(u, file);
+            }
+        }
+        std::fputc('"', file);
+    }
+
+    // Writes a time in nanoseconds as microseconds, the unit of the format.
+    void WriteMicroseconds(std::FILE* file, std::uint64_t ns)
+    {
+        std::fprintf(
+            file,
+            "%llu.%03u",
+            static_cast<unsigned long long>(ns / 1000),
+            static_cast<unsigned>(ns % 1000));
+    }
+}
+
+
+// =============================================================================
+// Tracer
+// =============================================================================
+
+
+Tracer::Tracer(
+    const Memory& memory,
+    FMIString processName,
+    std::size_t capacity)
+    : m_memory{memory}
+    , m_processName{CopyString(memory, processName)}
+    , m_processID{Hash(processName)}
+    , m_events{static_cast<Event*>(m_memory.Alloc(capacity, sizeof(Event)))}
+    , m_capacity{capacity}
+    , m_next{0}
+{
+    if (m_events == nullptr && capacity > 0) throw std::bad_alloc();
+}
+
+
+Tracer::~Tracer() CPPFMU_NOEXCEPT
+{
+    m_memory.Free(m_events);
+}
+
+
+void Tracer::Record(
+    FMIString name,
+    std::uint64_t beginNs,
+    std::uint64_t endNs)
+    CPPFMU_NOEXCEPT
+{
+    const auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= m_capacity) return;
+    auto& event = m_events[index];
+    event.name = name;
+    event.beginNs = beginNs;
+    event.endNs = endNs < beginNs ? beginNs : endNs;
+    event.thread = ThisThreadID();
+}
+
+
+std::size_t Tracer::Size() const CPPFMU_NOEXCEPT
+{
+    const auto next = m_next.load(std::memory_order_relaxed);
+    return next < m_capacity ? next : m_capacity;
+}
+
+
+std::size_t Tracer::DroppedCount() const CPPFMU_NOEXCEPT
+{
+    return m_next.load(std::memory_order_relaxed) - Size();
+}
+
+
+void Tracer::Write(FMIString path) const
+{
+    const auto file = std::fopen(path, "w");
+    if (file == nullptr) {
+        throw std::runtime_error(
+            std::string("Failed to open trace file '") + path + "': "
+            + std::strerror(errno));
+    }
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ns\",");
+    std::fprintf(
+        file,
+        "\"otherData\":{\"droppedEvents\":%llu},\n\"traceEvents\":[\n",
+        static_cast<unsigned long long>(DroppedCount()));
+    std::fprintf(
+        file,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,"
+        "\"args\":{\"name\":",
+        static_cast<unsigned long>(m_processID));
+    WriteJSONString(file, m_processName.c_str());
+    std::fprintf(file, "}}");
+
+    const auto size = Size();
+    for (std::size_t i = 0; i < size; ++i) {
+        const auto& event = m_events[i];
+        std::fprintf(file, ",\n{\"name\":");
+        WriteJSONString(file, event.name ? event.name : "");
+        std::fprintf(file, ",\"ph\":\"X\",\"ts\":");
+        WriteMicroseconds(file, event.beginNs);
+        std::fprintf(file, ",\"dur\":");
+        WriteMicroseconds(file, event.endNs - event.beginNs);
+        std::fprintf(
+            file,
+            ",\"pid\":%lu,\"tid\":%lu}",
+            static_cast<unsigned long>(m_processID),
+            static_cast<unsigned long>(event.thread));
+    }
+    std::fprintf(file, "\n]}\n");
+
+    const bool failed = std::ferror(file) != 0;
+    if (std::fclose(file) != 0 || failed) {
+        throw std::runtime_error(
+            std::string("Failed to write trace file '") + path + "'");
+    }
+}
+
+
+} // namespace cppfmu
@@ -0,0 +1,137 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_TRACE_HPP
+#define CPPFMU_TRACE_HPP
+
+#include <atomic>   // std::atomic
+#include <chrono>   // std::chrono::steady_clock
+#include <cstddef>  // std::size_t
+#include <cstdint>  // std::uint32_t, std::uint64_t
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// TRACING
+// ============================================================================
+
+/* Records a timeline of named spans (e.g. FMI function calls) for one
+ * instance, and writes it as a Chrome trace-event JSON file, which can be
+ * viewed in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * All memory for the events is allocated up front, so Record() never
+ * allocates.  When the buffer is full, further events are counted and
+ * discarded.  Record() may be called concurrently from several threads.
+ *
+ * The span names are stored as pointers, so they must remain valid until
+ * the trace has been written.  String literals are the obvious choice.
+ *
+ * If fmi_functions.cpp is compiled with CPPFMU_TRACE defined, and the
+ * environment variable CPPFMU_TRACE_DIR is set when an instance is created,
+ * each instance gets a Tracer which records all FMI function calls.  The
+ * trace is written to the file "<instance name>.<pid>-<n>.trace.json" in
+ * that directory when the instance is freed, where <n> numbers the traced
+ * instances of the process.  Slaves can add their own spans with
+ * TraceScope and Instance::GetTracer().
+ */
+class Tracer
+{
+public:
+    /* Creates a tracer with room for 'capacity' events.  'processName'
+     * labels the instance's timeline in the trace viewer, and is used to
+     * give it a (most likely) unique process ID, so traces of several
+     * instances can be merged.
+     */
+    Tracer(const Memory& memory, FMIString processName, std::size_t capacity);
+
+    ~Tracer() CPPFMU_NOEXCEPT;
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // The current time, in nanoseconds, on the clock used for all events.
+    static std::uint64_t Now() CPPFMU_NOEXCEPT
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /* Records a span called 'name' which started at 'beginNs' and ended at
+     * 'endNs' (both as returned by Now()), on the calling thread.
+     */
+    void Record(FMIString name, std::uint64_t beginNs, std::uint64_t endNs)
+        CPPFMU_NOEXCEPT;
+
+    // The number of events recorded.
+    std::size_t Size() const CPPFMU_NOEXCEPT;
+
+    // The number of events discarded because the buffer was full.
+    std::size_t DroppedCount() const CPPFMU_NOEXCEPT;
+
+    /* Writes the trace to the file at 'path', replacing it if it exists.
+     * Must not be called concurrently with Record().
+     * Throws std::runtime_error on failure.
+     */
+    void Write(FMIString path) const;
+
+private:
+    struct Event
+    {
+        FMIString name;
+        std::uint64_t beginNs;
+        std::uint64_t endNs;
+        std::uint32_t thread;
+    };
+
+    Memory m_memory;
+    String m_processName;
+    std::uint32_t m_processID;
+    Event* m_events;
+    std::size_t m_capacity;
+    std::atomic<std::size_t> m_next;
+};
+
+
+/* Records a span from its construction to its destruction, unless the
+ * tracer is null, in which case it does nothing (not even read the clock).
+ *
+ *     bool DoStep(...) override
+ *     {
+ *         const cppfmu::TraceScope span{GetTracer(), "solve"};
+ *         ...
+ *     }
+ */
+class TraceScope
+{
+public:
+    TraceScope(Tracer* tracer, FMIString name) CPPFMU_NOEXCEPT
+        : m_tracer{tracer}
+        , m_name{name}
+        , m_begin{tracer ? Tracer::Now() : 0}
+    {
+    }
+
+    ~TraceScope() CPPFMU_NOEXCEPT
+    {
+        if (m_tracer) m_tracer->Record(m_name, m_begin, Tracer::Now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    Tracer* m_tracer;
+    FMIString m_name;
+    std::uint64_t m_begin;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
@@ -0,0 +1,590 @@
+/* Copyright 2016-2024, SINTEF Ocean.
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#ifndef CPPFMU_VARIABLES_HPP
+#define CPPFMU_VARIABLES_HPP
+
+#include <algorithm>    // std::lower_bound, std::max, std::min,
+                        // std::upper_bound
+#include <cstddef>      // std::size_t
+#include <cstdint>      // std::uint32_t
+#include <cstring>      // std::memcpy
+#include <limits>       // std::numeric_limits
+#include <stdexcept>    // std::invalid_argument, std::logic_error
+#include <type_traits>  // std::integral_constant, std::is_same
+#include <utility>      // std::pair
+#include <vector>       // std::vector
+
+#include "cppfmu_common.hpp"
+
+
+namespace cppfmu
+{
+
+// ============================================================================
+// VARIABLE REGISTRY
+// ============================================================================
+
+namespace detail
+{
+    // Conversions between stored variables and the values exchanged via FMI.
+    template<typename T>
+    T LoadVariable(const T& variable) CPPFMU_NOEXCEPT { return variable; }
+
+    inline FMIString LoadVariable(const String& variable) CPPFMU_NOEXCEPT
+    {
+        return variable.c_str();
+    }
+
+    template<typename T>
+    void StoreVariable(T& variable, const T& value) { variable = value; }
+
+    inline void StoreVariable(String& variable, FMIString value)
+    {
+        if (value == nullptr) {
+            throw std::invalid_argument("String value is null");
+        }
+        variable = value;
+    }
+
+
+    // Copies a run of 'n' values between contiguous variables and an FMI
+    // value array, for types where this can be done with memcpy.
+    template<typename T>
+    void CopyRun(T* dst, const T* src, std::size_t n, std::true_type)
+        CPPFMU_NOEXCEPT
+    {
+        std::memcpy(dst, src, n * sizeof(T));
+    }
+
+    template<typename T, typename U>
+    void CopyRun(T*, const U*, std::size_t, std::false_type) CPPFMU_NOEXCEPT
+    {
+    }
+
+
+    /* Maps value references to the storage of variables of one type.
+     *
+     * Value references are normally assigned densely from zero, in which case
+     * a lookup is a single array access.  Each entry in the dense table also
+     * records how many of the following value references refer to variables
+     * that are laid out contiguously in memory (e.g. the elements of an
+     * array), so that requests for runs of consecutive value references can
+     * be served with a single memcpy.
+     *
+     * Value references beyond the densely assigned ones (e.g. a few
+     * outputs with large, unrelated value references) are instead kept in
+     * an open addressing hash table.  When it is built, we search for a hash
+     * multiplier which makes it collision free, so that in most cases a
+     * lookup only needs to examine a single slot.  Contiguous runs among
+     * these are recorded separately, so they too can be copied in one go.
+     *
+     * The lookup tables are only rebuilt when they are next needed after
+     * variables have been added, so that registering N variables one at a
+     * time doesn't cost O(N^2).  Until then, Find() falls back to a binary
+     * search.
+     */
+    template<typename Stored, typename Value>
+    class VariableIndex
+    {
+    public:
+        explicit VariableIndex(const Memory& memory)
+            : m_entries(Allocator<Entry>{memory})
+            , m_dense(Allocator<Slot>{memory})
+            , m_hashed(Allocator<Entry>{memory})
+            , m_runs(Allocator<Run>{memory})
+        {
+        }
+
+        void Add(FMIValueReference vr, Stored* variable)
+        {
+            Insert(vr, variable);
+            m_indexed = false;
+        }
+
+        void Add(FMIValueReference firstVr, Stored* variables, std::size_t count)
+        {
+            if (count == 0) return;
+            if (count - 1 > std::numeric_limits<FMIValueReference>::max() - firstVr) {
+                throw std::logic_error("Value reference range overflows");
+            }
+            if (variables == nullptr) {
+                throw std::logic_error("Attempted to register null variable");
+            }
+            // Insert the whole range at once, rather than searching for the
+            // position of each element.
+            const auto lastVr = static_cast<FMIValueReference>(firstVr + (count - 1));
+            const auto it = std::lower_bound(
+                m_entries.begin(), m_entries.end(), firstVr, EntryLess{});
+            if (it != m_entries.end() && it->first <= lastVr) {
+                throw std::logic_error("Value reference registered twice");
+            }
+            const auto pos = m_entries.insert(it, count, Entry{});
+            for (std::size_t i = 0; i < count; ++i) {
+                pos[i] = Entry{static_cast<FMIValueReference>(firstVr + i), variables + i};
+            }
+            m_indexed = false;
+        }
+
+        Stored* Find(FMIValueReference vr) const CPPFMU_NOEXCEPT
+        {
+            if (!m_indexed) {
+                const auto it = std::lower_bound(
+                    m_entries.begin(), m_entries.end(), vr, EntryLess{});
+                return it != m_entries.end() && it->first == vr ? it->second : nullptr;
+            }
+            if (vr < m_dense.size()) return m_dense[vr].variable;
+            if (m_hashed.empty()) return nullptr;
+            auto i = Hash(vr);
+            for (unsigned p = 0; p < m_maxProbe; ++p) {
+                const auto& e = m_hashed[i];
+                if (e.first == vr && e.second != nullptr) return e.second;
+                if (e.second == nullptr) return nullptr;
+                i = (i + 1) & (m_hashed.size() - 1);
+            }
+            return nullptr;
+        }
+
+        /* Returns the number of consecutive value references, starting
+         * with 'vr', whose variables are contiguous in memory, and sets
+         * 'start' to the variable of the first one.  Returns 0 if 'vr' is
+         * not registered.
+         */
+        std::size_t RunAt(FMIValueReference vr, Stored*& start) const
+        {
+            Index();
+            if (vr < m_dense.size()) {
+                start = m_dense[vr].variable;
+                return m_dense[vr].run;
+            }
+            // Find the last run that starts at or before vr.
+            auto it = std::upper_bound(
+                m_runs.begin(), m_runs.end(), vr,
+                [] (FMIValueReference v, const Run& r) { return v < r.first; });
+            if (it != m_runs.begin()) {
+                --it;
+                const auto offset = static_cast<std::size_t>(vr - it->first);
+                if (offset < it->count) {
+                    start = it->variables + offset;
+                    return it->count - offset;
+                }
+            }
+            start = Find(vr);
+            return start == nullptr ? 0 : 1;
+        }
+
+        void Get(
+            const FMIValueReference vr[],
+            std::size_t nvr,
+            Value value[]) const
+        {
+            Index();
+            for (std::size_t i = 0; i < nvr; ) {
+                Stored* run = nullptr;
+                const auto n = RunLength(vr + i, nvr - i, run);
+                if (n > 1) {
+                    CopyRun(value + i, run, n, Contiguous{});
+                    i += n;
+                    continue;
+                }
+                const auto variable = Find(vr[i]);
+                if (variable == nullptr) {
+                    throw std::logic_error("Attempted to get nonexistent variable");
+                }
+                value[i] = LoadVariable(*variable);
+                ++i;
+            }
+        }
+
+        void Set(
+            const FMIValueReference vr[],
+            std::size_t nvr,
+            const Value value[])
+        {
+            Index();
+            for (std::size_t i = 0; i < nvr; ) {
+                Stored* run = nullptr;
+                const auto n = RunLength(vr + i, nvr - i, run);
+                if (n > 1) {
+                    CopyRun(run, value + i, n, Contiguous{});
+                    i += n;
+                    continue;
+                }
+                const auto variable = Find(vr[i]);
+                if (variable == nullptr) {
+                    throw std::logic_error("Attempted to set nonexistent variable");
+                }
+                StoreVariable(*variable, value[i]);
+                ++i;
+            }
+        }
+
+    private:
+        using Entry = std::pair<FMIValueReference, Stored*>;
+
+        // Whether runs of variables can be copied with memcpy.
+        using Contiguous = std::integral_constant<bool,
+            std::is_same<Stored, Value>::value &&
+            std::is_trivially_copyable<Stored>::value>;
+
+        struct Slot
+        {
+            Stored* variable;
+            // The number of consecutive value references, starting with this
+            // one, whose variables are contiguous in memory.
+            std::size_t run;
+        };
+
+        // A run of consecutive value references outside the dense table
+        // whose variables are contiguous in memory.
+        struct Run
+        {
+            FMIValueReference first;
+            std::size_t count;
+            Stored* variables;
+        };
+
+        struct EntryLess
+        {
+            bool operator()(const Entry& e, FMIValueReference vr) const
+            {
+                return e.first < vr;
+            }
+        };
+
+        void Insert(FMIValueReference vr, Stored* variable)
+        {
+            if (variable == nullptr) {
+                throw std::logic_error("Attempted to register null variable");
+            }
+            const auto it = std::lower_bound(
+                m_entries.begin(), m_entries.end(), vr, EntryLess{});
+            if (it != m_entries.end() && it->first == vr) {
+                throw std::logic_error("Value reference registered twice");
+            }
+            m_entries.insert(it, Entry{vr, variable});
+        }
+
+        /* Returns the number of leading elements of 'vr' (at most 'nvr')
+         * that can be copied in one go, and sets 'start' to the variable of
+         * the first one, or returns 1 if the first value reference does not
+         * start a contiguous run.
+         */
+        std::size_t RunLength(
+            const FMIValueReference vr[],
+            std::size_t nvr,
+            Stored*& start) const
+        {
+            if (!Contiguous::value) return 1;
+            const auto maxRun = std::min(RunAt(vr[0], start), nvr);
+            std::size_t n = 1;
+            while (n < maxRun && vr[n] == vr[0] + n) ++n;
+            return n;
+        }
+
+        std::size_t Hash(FMIValueReference vr) const CPPFMU_NOEXCEPT
+        {
+            return static_cast<std::size_t>(
+                (static_cast<std::uint32_t>(vr) * m_multiplier) >> m_shift);
+        }
+
+        // Rebuilds the lookup tables if variables have been added since
+        // they were last built.
+        void Index() const
+        {
+            if (m_indexed) return;
+            Reindex();
+            m_indexed = true;
+        }
+
+        /* Rebuilds the lookup tables.  The dense table covers the longest
+         * prefix of the (sorted) entries whose value references are dense
+         * enough, and the hash table the rest.
+         */
+        void Reindex() const
+        {
+            m_dense.clear();
+            m_hashed.clear();
+            m_runs.clear();
+            std::size_t denseCount = 0;
+            for (std::size_t k = 0; k < m_entries.size(); ++k) {
+                if (m_entries[k].first < 4 * (k + 1) + 64) denseCount = k + 1;
+            }
+            if (denseCount > 0) BuildDense(denseCount);
+            if (denseCount < m_entries.size()) BuildHashed(denseCount);
+        }
+
+        // Builds the dense table from the first 'count' entries.
+        void BuildDense(std::size_t count) const
+        {
+            const std::size_t maxVr = m_entries[count - 1].first;
+            m_dense.resize(maxVr + 1, Slot{nullptr, 0});
+            for (std::size_t k = 0; k < count; ++k) {
+                m_dense[m_entries[k].first].variable = m_entries[k].second;
+            }
+            std::size_t run = 0;
+            for (auto v = m_dense.size(); v-- > 0; ) {
+                auto& slot = m_dense[v];
+                if (slot.variable == nullptr) {
+                    run = 0;
+                } else if (run > 0 && slot.variable + 1 == m_dense[v+1].variable) {
+                    ++run;
+                } else {
+                    run = 1;
+                }
+                slot.run = run;
+            }
+        }
+
+        // Builds the hash table and run list from the entries from 'first' on.
+        void BuildHashed(std::size_t first) const
+        {
+            const auto begin = m_entries.begin() + first;
+            const auto end = m_entries.end();
+            for (auto it = begin; it != end; ) {
+                auto last = it;
+                while (last + 1 != end
+                        && (last + 1)->first == last->first + 1
+                        && (last + 1)->second == last->second + 1) {
+                    ++last;
+                }
+                const auto count = static_cast<std::size_t>(last - it) + 1;
+                if (count > 1) m_runs.push_back(Run{it->first, count, it->second});
+                it = last + 1;
+            }
+
+            // Table size: the smallest power of two >= 2*n, at least 2^4.
+            const auto n = static_cast<std::size_t>(end - begin);
+            unsigned bits = 4;
+            while ((std::size_t{1} << bits) < 2 * n) ++bits;
+            const auto size = std::size_t{1} << bits;
+            m_shift = 32 - bits;
+
+            // Try a handful of odd multipliers (the first being the
+            // golden-ratio one) and keep the one with the shortest probes.
+            std::vector<Entry, Allocator<Entry>> table(m_hashed.get_allocator());
+            std::uint32_t bestMultiplier = 0;
+            unsigned bestProbe = 0;
+            std::uint32_t multiplier = 2654435769u;
+            for (int attempt = 0; attempt < 16; ++attempt) {
+                m_multiplier = multiplier;
+                table.assign(size, Entry{0, nullptr});
+                unsigned maxProbe = 0;
+                for (auto it = begin; it != end; ++it) {
+                    const auto& e = *it;
+                    auto i = Hash(e.first);
+                    unsigned probe = 1;
+                    while (table[i].second != nullptr) {
+                        i = (i + 1) & (size - 1);
+                        ++probe;
+                    }
+                    table[i] = e;
+                    maxProbe = std::max(maxProbe, probe);
+                }
+                if (bestProbe == 0 || maxProbe < bestProbe) {
+                    bestMultiplier = multiplier;
+                    bestProbe = maxProbe;
+                    m_hashed.swap(table);
+                    if (maxProbe == 1) break;
+                }
+                multiplier = multiplier * 747796405u + 2891336453u;
+                multiplier |= 1u;
+            }
+            m_multiplier = bestMultiplier;
+            m_maxProbe = bestProbe;
+        }
+
+        std::vector<Entry, Allocator<Entry>> m_entries;
+
+        // The lookup tables, which are built from m_entries on demand.
+        mutable std::vector<Slot, Allocator<Slot>> m_dense;
+        mutable std::vector<Entry, Allocator<Entry>> m_hashed;
+        mutable std::vector<Run, Allocator<Run>> m_runs;
+        mutable std::uint32_t m_multiplier = 0;
+        mutable unsigned m_shift = 0;
+        mutable unsigned m_maxProbe = 0;
+        mutable bool m_indexed = true;
+    };
+}
+
+
+/* A table which maps value references to variables, i.e., to the locations
+ * where the model stores their values.
+ *
+ * A slave typically keeps a VariableTable as a member, registers its member
+ * variables in its constructor, and passes the table to
+ * SlaveInstance::UseVariableTable().  The default implementations of the
+ * SlaveInstance::GetXxx() and SetXxx() functions then serve all requests
+ * directly from the table.
+ *
+ * Several value references may refer to the same storage location, which is
+ * how aliases are expressed.  The registered variables must outlive the
+ * table.
+ */
+class VariableTable
+{
+public:
+    explicit VariableTable(const Memory& memory)
+        : m_real{memory}
+        , m_integer{memory}
+        , m_boolean{memory}
+        , m_string{memory}
+    {
+    }
+
+    // Registers a variable.  Throws std::logic_error if 'vr' is in use.
+    void AddReal(FMIValueReference vr, FMIReal* variable)
+    {
+        m_real.Add(vr, variable);
+    }
+
+    void AddInteger(FMIValueReference vr, FMIInteger* variable)
+    {
+        m_integer.Add(vr, variable);
+    }
+
+    void AddBoolean(FMIValueReference vr, FMIBoolean* variable)
+    {
+        m_boolean.Add(vr, variable);
+    }
+
+    void AddString(FMIValueReference vr, String* variable)
+    {
+        m_string.Add(vr, variable);
+    }
+
+    /* Registers 'count' variables stored contiguously in memory, with
+     * consecutive value references starting at 'firstVr'.  Requests for
+     * runs of consecutive value references within such a block are served
+     * with a single memory copy.
+     */
+    void AddReal(FMIValueReference firstVr, FMIReal* variables, std::size_t count)
+    {
+        m_real.Add(firstVr, variables, count);
+    }
+
+    void AddInteger(FMIValueReference firstVr, FMIInteger* variables, std::size_t count)
+    {
+        m_integer.Add(firstVr, variables, count);
+    }
+
+    void AddBoolean(FMIValueReference firstVr, FMIBoolean* variables, std::size_t count)
+    {
+        m_boolean.Add(firstVr, variables, count);
+    }
+
+    /* Returns the variable registered with the given value reference, or
+     * null if there is none.
+     */
+    FMIReal* FindReal(FMIValueReference vr) const CPPFMU_NOEXCEPT
+    {
+        return m_real.Find(vr);
+    }
+
+    FMIInteger* FindInteger(FMIValueReference vr) const CPPFMU_NOEXCEPT
+    {
+        return m_integer.Find(vr);
+    }
+
+    FMIBoolean* FindBoolean(FMIValueReference vr) const CPPFMU_NOEXCEPT
+    {
+        return m_boolean.Find(vr);
+    }
+
+    String* FindString(FMIValueReference vr) const CPPFMU_NOEXCEPT
+    {
+        return m_string.Find(vr);
+    }
+
+    /* Returns the number of consecutive value references, starting with
+     * 'vr', whose real variables are contiguous in memory, and which are
+     * therefore served with a single memory copy when requested together.
+     * Returns 0 if 'vr' has not been registered.
+     */
+    std::size_t ContiguousRealCount(FMIValueReference vr) const
+    {
+        FMIReal* start = nullptr;
+        return m_real.RunAt(vr, start);
+    }
+
+    /* Gets/sets the values of the variables with the given value
+     * references.  Throws std::logic_error if a value reference has not
+     * been registered, and SetString() throws std::invalid_argument if a
+     * value is null.
+     */
+    void GetReal(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIReal value[]) const
+    {
+        m_real.Get(vr, nvr, value);
+    }
+
+    void GetInteger(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIInteger value[]) const
+    {
+        m_integer.Get(vr, nvr, value);
+    }
+
+    void GetBoolean(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIBoolean value[]) const
+    {
+        m_boolean.Get(vr, nvr, value);
+    }
+
+    void GetString(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        FMIString value[]) const
+    {
+        m_string.Get(vr, nvr, value);
+    }
+
+    void SetReal(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIReal value[])
+    {
+        m_real.Set(vr, nvr, value);
+    }
+
+    void SetInteger(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIInteger value[])
+    {
+        m_integer.Set(vr, nvr, value);
+    }
+
+    void SetBoolean(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIBoolean value[])
+    {
+        m_boolean.Set(vr, nvr, value);
+    }
+
+    void SetString(
+        const FMIValueReference vr[],
+        std::size_t nvr,
+        const FMIString value[])
+    {
+        m_string.Set(vr, nvr, value);
+    }
+
+private:
+    detail::VariableIndex<FMIReal, FMIReal> m_real;
+    detail::VariableIndex<FMIInteger, FMIInteger> m_integer;
+    detail::VariableIndex<FMIBoolean, FMIBoolean> m_boolean;
+    detail::VariableIndex<String, FMIString> m_string;
+};
+
+
+} // namespace cppfmu
+#endif // header guard
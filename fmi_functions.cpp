@@ -3,10 +3,124 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
+#include <chrono>
 #include <exception>
 #include <limits>
+#include <type_traits>
+
+#ifdef CPPFMU_TRACE
+#   include <atomic>
+#   include <cstdlib>
+#   include <string>
+#   ifdef _WIN32
+#       include <process.h>
+#   else
+#       include <unistd.h>
+#   endif
+#endif
+
+#ifdef CPPFMU_ASYNC_DOSTEP
+#   include <condition_variable>
+#   include <mutex>
+#   include <thread>
+#endif
 
+#include "cppfmu_arena.hpp"
 #include "cppfmu_cs.hpp"
+#include "cppfmu_derivatives.hpp"
+#include "cppfmu_monitor.hpp"
+#include "cppfmu_stats.hpp"
+#include "cppfmu_trace.hpp"
+
+#ifdef CPPFMU_MODEL_EXCHANGE
+#   ifdef CPPFMU_USE_FMI_1_0
+#       error "Model exchange (CPPFMU_MODEL_EXCHANGE) requires FMI 2.0"
+#   endif
+#   include "cppfmu_me.hpp"
+#endif
+
+#if defined(CPPFMU_STATIC_SLAVE) && defined(CPPFMU_STATIC_SLAVE_HEADER)
+#   include CPPFMU_STATIC_SLAVE_HEADER
+#endif
+
+#if defined(CPPFMU_TRACE) && !defined(CPPFMU_TRACE_CAPACITY)
+    // The number of events each instance's tracer has room for.
+#   define CPPFMU_TRACE_CAPACITY 65536
+#endif
+
+
+namespace cppfmu
+{
+namespace detail
+{
+    // Access to the parts of the instance classes that are only used here.
+    struct InstanceAccess
+    {
+        // Prepares the slave for a new step starting at time 't'.
+        static void BeginStep(SlaveInstance& slave, FMIReal t) CPPFMU_NOEXCEPT
+        {
+            slave.m_cancelRequested.store(false, std::memory_order_relaxed);
+            slave.m_stepProgress.store(t, std::memory_order_relaxed);
+            InvalidateDerivatives(slave);
+        }
+
+        // Releases the slave's scratch memory after a step.
+        static void EndStep(SlaveInstance& slave) CPPFMU_NOEXCEPT
+        {
+            if (slave.m_stepArena != nullptr) slave.m_stepArena->Reset();
+        }
+
+        // The slave's step monitor, if any.
+        static StepMonitor* StepMonitorOf(SlaveInstance& slave) CPPFMU_NOEXCEPT
+        {
+            return slave.m_stepMonitor;
+        }
+
+        // Gives the slave access to the call statistics.
+        static void SetCallStatistics(
+            Instance& instance,
+            const CallStatistics* statistics) CPPFMU_NOEXCEPT
+        {
+            instance.m_callStatistics = statistics;
+        }
+
+        // Gives the instance access to the memory of its FMU instance.
+        static void SetMemory(Instance& instance, const Memory* memory)
+            CPPFMU_NOEXCEPT
+        {
+            instance.m_memory = memory;
+        }
+
+        // Gives the instance access to the tracer.
+        static void SetTracer(Instance& instance, Tracer* tracer) CPPFMU_NOEXCEPT
+        {
+            instance.m_tracer = tracer;
+        }
+
+        // Discards the Jacobian held by the instance's derivative estimator.
+        static void InvalidateDerivatives(Instance& instance) CPPFMU_NOEXCEPT
+        {
+            if (instance.m_derivativeEstimator != nullptr) {
+                instance.m_derivativeEstimator->Invalidate();
+            }
+        }
+
+        // The progress reported by the slave during the current step.
+        static FMIReal StepProgress(const SlaveInstance& slave) CPPFMU_NOEXCEPT
+        {
+            return slave.m_stepProgress.load(std::memory_order_relaxed);
+        }
+
+#ifdef CPPFMU_MODEL_EXCHANGE
+        // Makes the model recompute its derivatives and event indicators.
+        static void InvalidateEvaluation(ModelInstance& model) CPPFMU_NOEXCEPT
+        {
+            model.m_evaluated = false;
+        }
+#endif
+    };
+}
+}
 
 
 namespace
@@ -22,23 +136,549 @@ namespace
             , loggerSettings{std::make_shared<cppfmu::Logger::Settings>(memory)}
 #ifdef CPPFMU_USE_FMI_1_0
             , logger{this, cppfmu::CopyString(memory, instanceName), callbackFunctions, loggerSettings}
+            , stepFinished{callbackFunctions.stepFinished}
+            , stepFinishedEnvironment{this}
 #else
             , logger{callbackFunctions.componentEnvironment, cppfmu::CopyString(memory, instanceName), callbackFunctions, loggerSettings}
+            , stepFinished{callbackFunctions.stepFinished}
+            , stepFinishedEnvironment{callbackFunctions.componentEnvironment}
 #endif
             , lastSuccessfulTime{std::numeric_limits<cppfmu::FMIReal>::quiet_NaN()}
         {
             loggerSettings->debugLoggingEnabled = (loggingOn == cppfmu::FMITrue);
+            loggerSettings->Update();
+        }
+
+#ifdef CPPFMU_ASYNC_DOSTEP
+        ~Component()
+        {
+            {
+                std::lock_guard<std::mutex> lock(stepMutex);
+                stepShutdown = true;
+            }
+            stepCondition.notify_all();
+            if (stepThread.joinable()) stepThread.join();
+        }
+
+        // Blocks until the step in progress, if any, has completed.
+        void AwaitStep()
+        {
+            std::unique_lock<std::mutex> lock(stepMutex);
+            stepCondition.wait(lock, [this] { return !stepPending; });
         }
+#else
+        void AwaitStep() CPPFMU_NOEXCEPT { }
+#endif
 
         // General
         cppfmu::Memory memory;
         std::shared_ptr<cppfmu::Logger::Settings> loggerSettings;
         cppfmu::Logger logger;
+#ifdef CPPFMU_TRACE
+        // Null unless tracing is enabled at runtime.  Declared before
+        // 'slave', so it outlives it.
+        cppfmu::UniquePtr<cppfmu::Tracer> tracer;
+        cppfmu::String tracePath{cppfmu::Allocator<char>{memory}};
+#endif
+
+#ifdef CPPFMU_MODEL_EXCHANGE
+        // Model exchange (if this is null, the instance is a slave)
+        cppfmu::UniquePtr<cppfmu::ModelInstance> model;
+#endif
 
         // Co-simulation
         cppfmu::UniquePtr<cppfmu::SlaveInstance> slave;
+#ifdef CPPFMU_USE_FMI_1_0
+        fmiStepFinished stepFinished;
+        fmiComponent stepFinishedEnvironment;
+#else
+        fmi2StepFinished stepFinished;
+        fmi2ComponentEnvironment stepFinishedEnvironment;
+#endif
         cppfmu::FMIReal lastSuccessfulTime;
+#ifdef CPPFMU_FUNCTION_STATISTICS
+        cppfmu::CallStatistics statistics;
+#endif
+        // The status with which the last DoStep() call completed.
+        cppfmu::FMIStatus stepStatus = cppfmu::FMIOK;
+
+#ifdef CPPFMU_ASYNC_DOSTEP
+        /* Asynchronous stepping.  DoStep() is run on 'stepThread', which is
+         * started on the first step.  The step parameters and all of the
+         * co-simulation status variables above are protected by 'stepMutex'
+         * while a step is pending.  Since the worker thread releases the
+         * mutex after the step and every other FMI function acquires it
+         * (see AwaitStep()) before touching the slave, the results of a step
+         * are safely published to subsequent calls.
+         */
+        std::thread stepThread;
+        std::mutex stepMutex;
+        std::condition_variable stepCondition;
+        bool stepPending = false;
+        bool stepShutdown = false;
+        cppfmu::FMIReal stepStart = 0.0;
+        cppfmu::FMIReal stepSize = 0.0;
+        cppfmu::FMIBoolean stepNew = cppfmu::FMITrue;
+#endif
+    };
+
+
+    // The static type through which the slave is called.  See
+    // cppfmu::StaticSlave for an explanation.
+#ifdef CPPFMU_STATIC_SLAVE
+    using Slave = CPPFMU_STATIC_SLAVE;
+    static_assert(
+        std::is_base_of<cppfmu::StaticSlave<Slave>, Slave>::value,
+        "CPPFMU_STATIC_SLAVE must name a class T derived from cppfmu::StaticSlave<T>");
+#   if __cplusplus >= 201402L
+    static_assert(
+        std::is_final<Slave>::value,
+        "CPPFMU_STATIC_SLAVE must name a class declared 'final'");
+#   endif
+#else
+    using Slave = cppfmu::SlaveInstance;
+#endif
+
+    /* Measures the time spent in an FMI function, from its construction to
+     * its destruction, if CPPFMU_FUNCTION_STATISTICS is defined, and records
+     * it as a trace event, if CPPFMU_TRACE is defined and the instance has a
+     * tracer.  Otherwise, it does nothing.
+     *
+     * With CPPFMU_ASYNC_DOSTEP, the time measured for DoStep is the time it
+     * takes to hand the step over to the worker thread.
+     */
+    class CallScope
+    {
+    public:
+#if defined(CPPFMU_FUNCTION_STATISTICS) || defined(CPPFMU_TRACE)
+        CallScope(Component* component, cppfmu::FMIFunction function) CPPFMU_NOEXCEPT
+            : m_component{component}
+            , m_function{function}
+            , m_start{Enabled(component) ? cppfmu::Tracer::Now() : 0}
+        {
+        }
+
+        ~CallScope() CPPFMU_NOEXCEPT
+        {
+            if (!Enabled(m_component)) return;
+            const auto end = cppfmu::Tracer::Now();
+#   ifdef CPPFMU_FUNCTION_STATISTICS
+            m_component->statistics.Record(
+                m_function,
+                end < m_start ? 0 : end - m_start);
+#   endif
+#   ifdef CPPFMU_TRACE
+            if (m_component->tracer) {
+                m_component->tracer->Record(
+                    cppfmu::FMIFunctionName(m_function),
+                    m_start,
+                    end);
+            }
+#   endif
+        }
+
+    private:
+        static bool Enabled(const Component* component) CPPFMU_NOEXCEPT
+        {
+#   ifdef CPPFMU_FUNCTION_STATISTICS
+            (void) component;
+            return true;
+#   else
+            return component->tracer != nullptr;
+#   endif
+        }
+
+        Component* m_component;
+        cppfmu::FMIFunction m_function;
+        std::uint64_t m_start;
+#else
+        CallScope(Component*, cppfmu::FMIFunction) CPPFMU_NOEXCEPT { }
+#endif
+
+        CallScope(const CallScope&) = delete;
+        CallScope& operator=(const CallScope&) = delete;
     };
+
+#ifdef CPPFMU_TRACE
+    /* Returns the path of the trace file for the instance 'instanceName' in
+     * the directory 'directory'.  Characters which may not be valid in file
+     * names are replaced with underscores.  The name also contains the
+     * process ID and a sequence number, so that instances with the same name,
+     * in the same process or in several, don't overwrite each other's files.
+     */
+    cppfmu::String TraceFilePath(
+        const cppfmu::Memory& memory,
+        cppfmu::FMIString directory,
+        cppfmu::FMIString instanceName)
+    {
+        auto path = cppfmu::CopyString(memory, directory);
+        if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+            path += '/';
+        }
+        for (auto c = instanceName; *c; ++c) {
+            const bool valid = (*c >= 'a' && *c <= 'z')
+                || (*c >= 'A' && *c <= 'Z')
+                || (*c >= '0' && *c <= '9')
+                || *c == '-' || *c == '_' || *c == '.';
+            path += valid ? *c : '_';
+        }
+#ifdef _WIN32
+        const auto pid = _getpid();
+#else
+        const auto pid = getpid();
+#endif
+        static std::atomic<unsigned> instanceCount{0};
+        const auto sequence = ++instanceCount;
+        path += '.';
+        path += std::to_string(pid).c_str();
+        path += '-';
+        path += std::to_string(sequence).c_str();
+        path += ".trace.json";
+        return path;
+    }
+#endif
+
+    /* Connects a newly created instance to its component, and sets up its
+     * instrumentation.
+     *
+     * With CPPFMU_TRACE, this creates a tracer for the instance if the
+     * environment variable CPPFMU_TRACE_DIR is set.
+     */
+    void SetUpInstance(
+        Component* component,
+        cppfmu::Instance& instance,
+        cppfmu::FMIString instanceName)
+    {
+        cppfmu::detail::InstanceAccess::SetMemory(instance, &component->memory);
+#ifdef CPPFMU_FUNCTION_STATISTICS
+        cppfmu::detail::InstanceAccess::SetCallStatistics(
+            instance,
+            &component->statistics);
+#endif
+#ifdef CPPFMU_TRACE
+        if (const auto directory = std::getenv("CPPFMU_TRACE_DIR")) {
+            component->tracePath =
+                TraceFilePath(component->memory, directory, instanceName);
+            component->tracer = cppfmu::AllocateUnique<cppfmu::Tracer>(
+                component->memory,
+                component->memory,
+                instanceName,
+                CPPFMU_TRACE_CAPACITY);
+            cppfmu::detail::InstanceAccess::SetTracer(
+                instance,
+                component->tracer.get());
+        }
+#endif
+        (void) instanceName;
+    }
+
+    // Logs the instrumentation and step monitoring results, if any.
+    void LogInstrumentation(Component* component) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_FUNCTION_STATISTICS
+        component->statistics.Log(component->logger);
+#endif
+        if (component->slave == nullptr) return;
+        const auto monitor =
+            cppfmu::detail::InstanceAccess::StepMonitorOf(*component->slave);
+        if (monitor != nullptr) monitor->Report(component->logger);
+    }
+
+    /* Saves the instrumentation results which are kept until the instance
+     * is freed, i.e., writes the trace file if tracing is enabled.
+     * Failures are logged as warnings.
+     */
+    void SaveInstrumentation(Component* component) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_TRACE
+        if (!component->tracer) return;
+        try {
+            component->tracer->Write(component->tracePath.c_str());
+            if (component->tracer->DroppedCount() > 0) {
+                component->logger.Log(
+                    cppfmu::FMIWarning,
+                    "cppfmu",
+                    "Trace buffer full; %lu events were discarded",
+                    static_cast<unsigned long>(component->tracer->DroppedCount()));
+            }
+        } catch (const std::exception& e) {
+            component->logger.Log(cppfmu::FMIWarning, "cppfmu", "%s", e.what());
+        }
+#else
+        (void) component;
+#endif
+    }
+
+    /* Returns the slave, with the static type given by 'Slave'.
+     * If a step is running asynchronously, this waits for it to complete.
+     */
+    inline Slave* SlaveOf(Component* component)
+    {
+#ifdef CPPFMU_MODEL_EXCHANGE
+        if (component->slave == nullptr) {
+            throw std::logic_error("Function only applicable to co-simulation instances");
+        }
+#endif
+        component->AwaitStep();
+        return static_cast<Slave*>(component->slave.get());
+    }
+
+#ifdef CPPFMU_MODEL_EXCHANGE
+    // Returns the model.  Throws if the instance is not a model exchange one.
+    inline cppfmu::ModelInstance* ModelOf(Component* component)
+    {
+        if (component->model == nullptr) {
+            throw std::logic_error("Function only applicable to model exchange instances");
+        }
+        return component->model.get();
+    }
+
+    /* Returns the instance, for the functions which are common to both FMU
+     * types.  With model exchange enabled, these functions are called
+     * through cppfmu::Instance, so CPPFMU_STATIC_SLAVE has no effect on
+     * them.
+     */
+    inline cppfmu::Instance* InstanceOf(Component* component)
+    {
+        if (component->model != nullptr) return component->model.get();
+        return SlaveOf(component);
+    }
+
+    /* Discards everything that is computed from the instance's variables
+     * and kept between calls, after they may have changed: the model's
+     * derivatives and event indicators, and any estimated Jacobian.
+     */
+    inline void InvalidateCaches(Component* component) CPPFMU_NOEXCEPT
+    {
+        if (component->model != nullptr) {
+            cppfmu::detail::InstanceAccess::InvalidateEvaluation(*component->model);
+            cppfmu::detail::InstanceAccess::InvalidateDerivatives(*component->model);
+        } else if (component->slave != nullptr) {
+            cppfmu::detail::InstanceAccess::InvalidateDerivatives(*component->slave);
+        }
+    }
+#else
+    inline Slave* InstanceOf(Component* component)
+    {
+        return SlaveOf(component);
+    }
+
+    // Discards any Jacobian estimated from the slave's previous variables.
+    inline void InvalidateCaches(Component* component) CPPFMU_NOEXCEPT
+    {
+        if (component->slave != nullptr) {
+            cppfmu::detail::InstanceAccess::InvalidateDerivatives(*component->slave);
+        }
+    }
+#endif
+
+    // Checks that the slave created by model code has the static type
+    // declared with CPPFMU_STATIC_SLAVE.
+    inline void CheckSlaveType(const cppfmu::SlaveInstance* slave)
+    {
+#ifdef CPPFMU_STATIC_SLAVE
+        if (slave != nullptr && dynamic_cast<const Slave*>(slave) == nullptr) {
+            throw std::logic_error("Slave instance has wrong type (see CPPFMU_STATIC_SLAVE)");
+        }
+#else
+        (void) slave;
+#endif
+    }
+
+
+    /* Runs the slave's DoStep() function, and returns its status and the
+     * time it reached in 'lastSuccessfulTime'.  Exceptions are logged and
+     * turned into error codes.  The caller records the outcome in the
+     * component.
+     */
+    cppfmu::FMIStatus RunStep(
+        Component* component,
+        cppfmu::FMIReal currentCommunicationPoint,
+        cppfmu::FMIReal communicationStepSize,
+        cppfmu::FMIBoolean newStep,
+        cppfmu::FMIReal& lastSuccessfulTime) CPPFMU_NOEXCEPT
+    {
+        cppfmu::FMIStatus status;
+#if defined(CPPFMU_TRACE) && defined(CPPFMU_ASYNC_DOSTEP)
+        // Show the step itself on the worker thread's timeline.
+        const cppfmu::TraceScope span{component->tracer.get(), "DoStep"};
+#endif
+        const auto monitor =
+            cppfmu::detail::InstanceAccess::StepMonitorOf(*component->slave);
+        std::chrono::steady_clock::time_point start;
+        if (monitor != nullptr) start = std::chrono::steady_clock::now();
+        try {
+            double endTime = currentCommunicationPoint;
+            const auto ok = static_cast<Slave*>(component->slave.get())->DoStep(
+                currentCommunicationPoint,
+                communicationStepSize,
+                newStep,
+                endTime);
+            if (ok) {
+                lastSuccessfulTime =
+                    currentCommunicationPoint + communicationStepSize;
+                status = cppfmu::FMIOK;
+            } else {
+                lastSuccessfulTime = endTime;
+                status = cppfmu::FMIDiscard;
+            }
+        } catch (const cppfmu::FatalError& e) {
+            component->logger.Log(cppfmu::FMIFatal, "", e.what());
+            status = cppfmu::FMIFatal;
+            lastSuccessfulTime = component->lastSuccessfulTime;
+        } catch (const std::exception& e) {
+            component->logger.Log(cppfmu::FMIError, "", e.what());
+            status = cppfmu::FMIError;
+            lastSuccessfulTime = component->lastSuccessfulTime;
+        }
+        if (monitor != nullptr) {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            monitor->Record(
+                currentCommunicationPoint,
+                communicationStepSize,
+                static_cast<std::uint64_t>(ns),
+                component->logger);
+        }
+        cppfmu::detail::InstanceAccess::EndStep(*component->slave);
+        component->logger.Flush();
+        return status;
+    }
+
+
+#ifdef CPPFMU_ASYNC_DOSTEP
+    // The body of the thread which runs asynchronous steps.
+    void StepThread(Component* component)
+    {
+        std::unique_lock<std::mutex> lock(component->stepMutex);
+        for (;;) {
+            component->stepCondition.wait(lock, [component] {
+                return component->stepPending || component->stepShutdown;
+            });
+            if (component->stepShutdown) return;
+            const auto t = component->stepStart;
+            const auto dt = component->stepSize;
+            const auto newStep = component->stepNew;
+            lock.unlock();
+            cppfmu::FMIReal lastSuccessfulTime;
+            const auto status =
+                RunStep(component, t, dt, newStep, lastSuccessfulTime);
+            lock.lock();
+            // The outcome and the end of the step must be published
+            // together, so that a master which sees the new status can start
+            // the next step right away.
+            component->lastSuccessfulTime = lastSuccessfulTime;
+            component->stepStatus = status;
+            component->stepPending = false;
+            component->stepCondition.notify_all();
+            if (component->stepFinished != nullptr) {
+                lock.unlock();
+                component->stepFinished(component->stepFinishedEnvironment, status);
+                lock.lock();
+            }
+        }
+    }
+#endif
+
+
+    /* Called from fmi2DoStep()/fmiDoStep().  Runs the step synchronously,
+     * or, if CPPFMU_ASYNC_DOSTEP is defined, hands it over to the worker
+     * thread and returns FMIPending.
+     */
+    cppfmu::FMIStatus DoStep(
+        Component* component,
+        cppfmu::FMIReal currentCommunicationPoint,
+        cppfmu::FMIReal communicationStepSize,
+        cppfmu::FMIBoolean newStep) CPPFMU_NOEXCEPT
+    {
+        const CallScope scope{component, cppfmu::FMIFunction::DoStep};
+#ifdef CPPFMU_MODEL_EXCHANGE
+        if (component->slave == nullptr) {
+            component->logger.Log(
+                cppfmu::FMIError,
+                "cppfmu",
+                "Function only applicable to co-simulation instances");
+            return cppfmu::FMIError;
+        }
+#endif
+#ifdef CPPFMU_ASYNC_DOSTEP
+        try {
+            std::lock_guard<std::mutex> lock(component->stepMutex);
+            if (component->stepPending) {
+                component->logger.Log(
+                    cppfmu::FMIError,
+                    "cppfmu",
+                    "DoStep called while another step is pending");
+                return cppfmu::FMIError;
+            }
+            // This must happen before the step is handed over to the worker
+            // thread, so that a cancellation request made immediately after
+            // fmi2DoStep() returns isn't lost.
+            cppfmu::detail::InstanceAccess::BeginStep(
+                *component->slave,
+                currentCommunicationPoint);
+            if (!component->stepThread.joinable()) {
+                component->stepThread = std::thread(StepThread, component);
+            }
+            component->stepStart = currentCommunicationPoint;
+            component->stepSize = communicationStepSize;
+            component->stepNew = newStep;
+            component->stepPending = true;
+            component->stepStatus = cppfmu::FMIPending;
+            component->stepCondition.notify_all();
+            return cppfmu::FMIPending;
+        } catch (const std::exception& e) {
+            component->logger.Log(cppfmu::FMIError, "", e.what());
+            return cppfmu::FMIError;
+        }
+#else
+        cppfmu::detail::InstanceAccess::BeginStep(
+            *component->slave,
+            currentCommunicationPoint);
+        cppfmu::FMIReal lastSuccessfulTime;
+        const auto status = RunStep(
+            component,
+            currentCommunicationPoint,
+            communicationStepSize,
+            newStep,
+            lastSuccessfulTime);
+        component->lastSuccessfulTime = lastSuccessfulTime;
+        component->stepStatus = status;
+        return status;
+#endif
+    }
+
+
+    // Called from fmi2GetStatus()/fmiGetStatus() for the DoStep status.
+    cppfmu::FMIStatus GetStepStatus(Component* component) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_ASYNC_DOSTEP
+        std::lock_guard<std::mutex> lock(component->stepMutex);
+#endif
+        return component->stepStatus;
+    }
+
+
+    /* Called from fmi2GetRealStatus()/fmiGetRealStatus().  While a step is
+     * pending, this returns the progress reported by the slave.
+     */
+    cppfmu::FMIReal GetLastSuccessfulTime(Component* component) CPPFMU_NOEXCEPT
+    {
+#ifdef CPPFMU_ASYNC_DOSTEP
+        std::lock_guard<std::mutex> lock(component->stepMutex);
+        if (component->stepPending) {
+            return cppfmu::detail::InstanceAccess::StepProgress(*component->slave);
+        }
+#endif
+        return component->lastSuccessfulTime;
+    }
+
+
+    // Whether a step is currently in progress.
+    bool IsStepPending(Component* component) CPPFMU_NOEXCEPT
+    {
+        return GetStepStatus(component) == cppfmu::FMIPending;
+    }
 }
 
 
@@ -83,6 +723,8 @@ fmiComponent fmiInstantiateSlave(
             interactive,
             component->memory,
             component->logger);
+        CheckSlaveType(component->slave.get());
+        SetUpInstance(component.get(), *component->slave, instanceName);
         return component.release();
     } catch (const cppfmu::FatalError& e) {
         functions.logger(nullptr, instanceName, fmiFatal, "", e.what());
@@ -97,6 +739,9 @@ fmiComponent fmiInstantiateSlave(
 void fmiFreeSlaveInstance(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    component->AwaitStep();
+    SaveInstrumentation(component);
+    component->logger.Flush();
     // The Component object was allocated using cppfmu::AllocateUnique(),
     // which uses cppfmu::New() internally, so we use cppfmu::Delete() to
     // release it again.
@@ -111,15 +756,16 @@ fmiStatus fmiInitializeSlave(
     fmiReal      tStop)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetupExperiment};
     try {
-        component->slave->SetupExperiment(
+        SlaveOf(component)->SetupExperiment(
             fmiFalse,
             0.0,
             tStart,
             stopTimeDefined,
             tStop);
-        component->slave->EnterInitializationMode();
-        component->slave->ExitInitializationMode();
+        SlaveOf(component)->EnterInitializationMode();
+        SlaveOf(component)->ExitInitializationMode();
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -134,8 +780,9 @@ fmiStatus fmiInitializeSlave(
 fmiStatus fmiResetSlave(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::Reset};
     try {
-        component->slave->Reset();
+        SlaveOf(component)->Reset();
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -150,8 +797,11 @@ fmiStatus fmiResetSlave(fmiComponent c)
 fmiStatus fmiTerminateSlave(fmiComponent c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::Terminate};
     try {
-        component->slave->Terminate();
+        SlaveOf(component)->Terminate();
+        LogInstrumentation(component);
+        component->logger.Flush();
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -167,7 +817,9 @@ fmiStatus fmiSetDebugLogging(
     fmiComponent c,
     fmiBoolean loggingOn)
 {
-    reinterpret_cast<Component*>(c)->loggerSettings->debugLoggingEnabled = (loggingOn == fmiTrue);
+    const auto& settings = reinterpret_cast<Component*>(c)->loggerSettings;
+    settings->debugLoggingEnabled = (loggingOn == fmiTrue);
+    settings->Update();
     return fmiOK;
 }
 
@@ -179,8 +831,9 @@ fmiStatus fmiGetReal(
     fmiReal value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetReal};
     try {
-        component->slave->GetReal(vr, nvr, value);
+        SlaveOf(component)->GetReal(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -198,8 +851,9 @@ fmiStatus fmiGetInteger(
     fmiInteger value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetInteger};
     try {
-        component->slave->GetInteger(vr, nvr, value);
+        SlaveOf(component)->GetInteger(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -217,8 +871,9 @@ fmiStatus fmiGetBoolean(
     fmiBoolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetBoolean};
     try {
-        component->slave->GetBoolean(vr, nvr, value);
+        SlaveOf(component)->GetBoolean(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -236,8 +891,9 @@ fmiStatus fmiGetString(
     fmiString value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetString};
     try {
-        component->slave->GetString(vr, nvr, value);
+        SlaveOf(component)->GetString(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -256,8 +912,9 @@ fmiStatus fmiSetReal(
     const fmiReal value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetReal};
     try {
-        component->slave->SetReal(vr, nvr, value);
+        SlaveOf(component)->SetReal(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -275,8 +932,9 @@ fmiStatus fmiSetInteger(
     const fmiInteger value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetInteger};
     try {
-        component->slave->SetInteger(vr, nvr, value);
+        SlaveOf(component)->SetInteger(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -290,8 +948,9 @@ fmiStatus fmiSetInteger(
 fmiStatus fmiSetBoolean (fmiComponent c, const fmiValueReference vr[], size_t nvr, const fmiBoolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetBoolean};
     try {
-        component->slave->SetBoolean(vr, nvr, value);
+        SlaveOf(component)->SetBoolean(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -305,8 +964,9 @@ fmiStatus fmiSetBoolean (fmiComponent c, const fmiValueReference vr[], size_t nv
 fmiStatus fmiSetString  (fmiComponent c, const fmiValueReference vr[], size_t nvr, const fmiString  value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetString};
     try {
-        component->slave->SetString(vr, nvr, value);
+        SlaveOf(component)->SetString(vr, nvr, value);
         return fmiOK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmiFatal, "", e.what());
@@ -351,11 +1011,9 @@ fmiStatus fmiGetRealOutputDerivatives(
 
 fmiStatus fmiCancelStep(fmiComponent c)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmiError,
-        "cppfmu",
-        "FMI function not supported: fmiCancelStep");
-    return fmiError;
+    // We don't use SlaveOf() here, since it would wait for the step to end.
+    reinterpret_cast<Component*>(c)->slave->CancelStep();
+    return fmiOK;
 }
 
 
@@ -365,42 +1023,30 @@ fmiStatus fmiDoStep(
     fmiReal      communicationStepSize,
     fmiBoolean   newStep)
 {
-    const auto component = reinterpret_cast<Component*>(c);
-    try {
-        double endTime = currentCommunicationPoint;
-        const auto ok = component->slave->DoStep(
-            currentCommunicationPoint,
-            communicationStepSize,
-            newStep,
-            endTime);
-        if (ok) {
-            component->lastSuccessfulTime =
-                currentCommunicationPoint + communicationStepSize;
-            return fmiOK;
-        } else {
-            component->lastSuccessfulTime = endTime;
-            return fmiDiscard;
-        }
-    } catch (const cppfmu::FatalError& e) {
-        component->logger.Log(fmiFatal, "", e.what());
-        return fmiFatal;
-    } catch (const std::exception& e) {
-        component->logger.Log(fmiError, "", e.what());
-        return fmiError;
-    }
+    return DoStep(
+        reinterpret_cast<Component*>(c),
+        currentCommunicationPoint,
+        communicationStepSize,
+        newStep);
 }
 
 
 fmiStatus fmiGetStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
-    fmiStatus* /*value*/)
+    const fmiStatusKind s,
+    fmiStatus* value)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmiError,
-        "cppfmu",
-        "FMI function not supported: fmiGetStatus");
-    return fmiError;
+    const auto component = reinterpret_cast<Component*>(c);
+    if (s == fmiDoStepStatus) {
+        *value = GetStepStatus(component);
+        return fmiOK;
+    } else {
+        component->logger.Log(
+            fmiError,
+            "cppfmu",
+            "Invalid status inquiry for fmiGetStatus");
+        return fmiError;
+    }
 }
 
 
@@ -412,7 +1058,7 @@ fmiStatus fmiGetRealStatus(
 {
     const auto component = reinterpret_cast<Component*>(c);
     if (s == fmiLastSuccessfulTime) {
-        *value = component->lastSuccessfulTime;
+        *value = GetLastSuccessfulTime(component);
         return fmiOK;
     } else {
         component->logger.Log(
@@ -453,14 +1099,20 @@ fmiStatus fmiGetBooleanStatus(
 
 fmiStatus fmiGetStringStatus(
     fmiComponent c,
-    const fmiStatusKind /*s*/,
-    fmiString*  /*value*/)
+    const fmiStatusKind s,
+    fmiString* value)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmiError,
-        "cppfmu",
-        "FMI function not supported: fmiGetStringStatus");
-    return fmiError;
+    const auto component = reinterpret_cast<Component*>(c);
+    if (s == fmiPendingStatus) {
+        *value = IsStepPending(component) ? "Step in progress" : "";
+        return fmiOK;
+    } else {
+        component->logger.Log(
+            fmiError,
+            "cppfmu",
+            "Invalid status inquiry for fmiGetStringStatus");
+        return fmiError;
+    }
 }
 
 
@@ -493,6 +1145,23 @@ fmi2Component fmi2Instantiate(
     fmi2Boolean loggingOn)
 {
     try {
+#ifdef CPPFMU_MODEL_EXCHANGE
+        if (fmuType == fmi2ModelExchange) {
+            auto component = cppfmu::AllocateUnique<Component>(cppfmu::Memory{*functions},
+                instanceName,
+                *functions,
+                loggingOn);
+            component->model = CppfmuInstantiateModel(
+                instanceName,
+                fmuGUID,
+                fmuResourceLocation,
+                visible,
+                component->memory,
+                component->logger);
+            SetUpInstance(component.get(), *component->model, instanceName);
+            return component.release();
+        }
+#endif
         if (fmuType != fmi2CoSimulation) {
             throw std::logic_error("Unsupported FMU instance type requested (only co-simulation is supported)");
         }
@@ -510,6 +1179,8 @@ fmi2Component fmi2Instantiate(
             cppfmu::FMIFalse,
             component->memory,
             component->logger);
+        CheckSlaveType(component->slave.get());
+        SetUpInstance(component.get(), *component->slave, instanceName);
         return component.release();
     } catch (const cppfmu::FatalError& e) {
         functions->logger(nullptr, instanceName, fmi2Fatal, "", e.what());
@@ -524,6 +1195,9 @@ fmi2Component fmi2Instantiate(
 void fmi2FreeInstance(fmi2Component c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    component->AwaitStep();
+    SaveInstrumentation(component);
+    component->logger.Flush();
     // The Component object was allocated using cppfmu::AllocateUnique(),
     // which uses cppfmu::New() internally, so we use cppfmu::Delete() to
     // release it again.
@@ -538,6 +1212,8 @@ fmi2Status fmi2SetDebugLogging(
     const fmi2String categories[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    // The step thread may be logging with the current settings.
+    component->AwaitStep();
 
     std::vector<cppfmu::String, cppfmu::Allocator<cppfmu::String>> newCategories(
             cppfmu::Allocator<cppfmu::String>(component->memory));
@@ -547,6 +1223,7 @@ fmi2Status fmi2SetDebugLogging(
 
     component->loggerSettings->debugLoggingEnabled = (loggingOn == fmi2True);
     component->loggerSettings->loggedCategories.swap(newCategories);
+    component->loggerSettings->Update();
     return fmi2OK;
 }
 
@@ -560,8 +1237,9 @@ fmi2Status fmi2SetupExperiment(
     fmi2Real      stopTime)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetupExperiment};
     try {
-        component->slave->SetupExperiment(
+        InstanceOf(component)->SetupExperiment(
             toleranceDefined,
             tolerance,
             startTime,
@@ -581,8 +1259,10 @@ fmi2Status fmi2SetupExperiment(
 fmi2Status fmi2EnterInitializationMode(fmi2Component c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::EnterInitializationMode};
     try {
-        component->slave->EnterInitializationMode();
+        InstanceOf(component)->EnterInitializationMode();
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -597,8 +1277,10 @@ fmi2Status fmi2EnterInitializationMode(fmi2Component c)
 fmi2Status fmi2ExitInitializationMode(fmi2Component c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::ExitInitializationMode};
     try {
-        component->slave->ExitInitializationMode();
+        InstanceOf(component)->ExitInitializationMode();
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -613,8 +1295,11 @@ fmi2Status fmi2ExitInitializationMode(fmi2Component c)
 fmi2Status fmi2Terminate(fmi2Component c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::Terminate};
     try {
-        component->slave->Terminate();
+        InstanceOf(component)->Terminate();
+        LogInstrumentation(component);
+        component->logger.Flush();
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -629,8 +1314,10 @@ fmi2Status fmi2Terminate(fmi2Component c)
 fmi2Status fmi2Reset(fmi2Component c)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::Reset};
     try {
-        component->slave->Reset();
+        InstanceOf(component)->Reset();
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -649,8 +1336,9 @@ fmi2Status fmi2GetReal(
     fmi2Real value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetReal};
     try {
-        component->slave->GetReal(vr, nvr, value);
+        InstanceOf(component)->GetReal(vr, nvr, value);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -668,8 +1356,9 @@ fmi2Status fmi2GetInteger(
     fmi2Integer value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetInteger};
     try {
-        component->slave->GetInteger(vr, nvr, value);
+        InstanceOf(component)->GetInteger(vr, nvr, value);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -687,8 +1376,9 @@ fmi2Status fmi2GetBoolean(
     fmi2Boolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetBoolean};
     try {
-        component->slave->GetBoolean(vr, nvr, value);
+        InstanceOf(component)->GetBoolean(vr, nvr, value);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -706,8 +1396,9 @@ fmi2Status fmi2GetString(
     fmi2String value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetString};
     try {
-        component->slave->GetString(vr, nvr, value);
+        InstanceOf(component)->GetString(vr, nvr, value);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -726,8 +1417,10 @@ fmi2Status fmi2SetReal(
     const fmi2Real value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetReal};
     try {
-        component->slave->SetReal(vr, nvr, value);
+        InstanceOf(component)->SetReal(vr, nvr, value);
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -745,8 +1438,10 @@ fmi2Status fmi2SetInteger(
     const fmi2Integer value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetInteger};
     try {
-        component->slave->SetInteger(vr, nvr, value);
+        InstanceOf(component)->SetInteger(vr, nvr, value);
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -764,8 +1459,10 @@ fmi2Status fmi2SetBoolean(
     const fmi2Boolean value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetBoolean};
     try {
-        component->slave->SetBoolean(vr, nvr, value);
+        InstanceOf(component)->SetBoolean(vr, nvr, value);
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -783,8 +1480,10 @@ fmi2Status fmi2SetString(
     const fmi2String value[])
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetString};
     try {
-        component->slave->SetString(vr, nvr, value);
+        InstanceOf(component)->SetString(vr, nvr, value);
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -801,8 +1500,9 @@ fmi2Status fmi2GetFMUstate(
     fmi2FMUstate* state)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetFMUState};
     try {
-        component->slave->GetFMUState(state);
+        InstanceOf(component)->GetFMUState(state);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -818,8 +1518,10 @@ fmi2Status fmi2SetFMUstate(
     fmi2FMUstate state)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetFMUState};
     try {
-        component->slave->SetFMUState(state);
+        InstanceOf(component)->SetFMUState(state);
+        InvalidateCaches(component);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -836,8 +1538,9 @@ fmi2Status fmi2FreeFMUstate(
 {
     if (state == nullptr) return fmi2OK;
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::FreeFMUState};
     try {
-        component->slave->FreeFMUState(*state);
+        InstanceOf(component)->FreeFMUState(*state);
         *state = nullptr;
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
@@ -855,8 +1558,9 @@ fmi2Status fmi2SerializedFMUstateSize(
     size_t* size)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SerializedFMUStateSize};
     try {
-        *size = component->slave->SerializedFMUStateSize(state);
+        *size = InstanceOf(component)->SerializedFMUStateSize(state);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -874,8 +1578,9 @@ fmi2Status fmi2SerializeFMUstate(
     size_t size)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SerializeFMUState};
     try {
-        component->slave->SerializeFMUState(state, data, size);
+        InstanceOf(component)->SerializeFMUState(state, data, size);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -893,8 +1598,9 @@ fmi2Status fmi2DeSerializeFMUstate(
     fmi2FMUstate* state)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::DeserializeFMUState};
     try {
-        *state = component->slave->DeserializeFMUState(data, size);
+        *state = InstanceOf(component)->DeserializeFMUState(data, size);
         return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
@@ -908,18 +1614,26 @@ fmi2Status fmi2DeSerializeFMUstate(
 
 fmi2Status fmi2GetDirectionalDerivative(
     fmi2Component c,
-    const fmi2ValueReference[],
-    size_t,
-    const fmi2ValueReference[],
-    size_t,
-    const fmi2Real[],
-    fmi2Real[])
+    const fmi2ValueReference vUnknown[],
+    size_t nUnknown,
+    const fmi2ValueReference vKnown[],
+    size_t nKnown,
+    const fmi2Real dvKnown[],
+    fmi2Real dvUnknown[])
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmi2Error,
-        "cppfmu",
-        "FMI function not supported: fmi2GetDirectionalDerivative");
-    return fmi2Error;
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetDirectionalDerivative};
+    try {
+        InstanceOf(component)->GetDirectionalDerivative(
+            vUnknown, nUnknown, vKnown, nKnown, dvKnown, dvUnknown);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
 }
 
 fmi2Status fmi2SetRealInputDerivatives(
@@ -950,28 +1664,59 @@ fmi2Status fmi2GetRealOutputDerivatives(
     return fmi2Error;
 }
 
-fmi2Status fmi2DoStep(
+#ifdef CPPFMU_MODEL_EXCHANGE
+
+/* Model exchange */
+fmi2Status fmi2EnterEventMode(fmi2Component c)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::EnterEventMode};
+    try {
+        ModelOf(component)->EnterEventMode();
+        InvalidateCaches(component);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2NewDiscreteStates(
     fmi2Component c,
-    fmi2Real currentCommunicationPoint,
-    fmi2Real communicationStepSize,
-    fmi2Boolean /*noSetFMUStatePriorToCurrentPoint*/)
+    fmi2EventInfo* eventInfo)
 {
     const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::NewDiscreteStates};
     try {
-        double endTime = currentCommunicationPoint;
-        const auto ok = component->slave->DoStep(
-            currentCommunicationPoint,
-            communicationStepSize,
-            fmi2True,
-            endTime);
-        if (ok) {
-            component->lastSuccessfulTime =
-                currentCommunicationPoint + communicationStepSize;
-            return fmi2OK;
-        } else {
-            component->lastSuccessfulTime = endTime;
-            return fmi2Discard;
-        }
+        cppfmu::EventInfo info;
+        ModelOf(component)->NewDiscreteStates(info);
+        eventInfo->newDiscreteStatesNeeded = info.newDiscreteStatesNeeded ? fmi2True : fmi2False;
+        eventInfo->terminateSimulation = info.terminateSimulation ? fmi2True : fmi2False;
+        eventInfo->nominalsOfContinuousStatesChanged = info.nominalsOfContinuousStatesChanged ? fmi2True : fmi2False;
+        eventInfo->valuesOfContinuousStatesChanged = info.valuesOfContinuousStatesChanged ? fmi2True : fmi2False;
+        eventInfo->nextEventTimeDefined = info.nextEventTimeDefined ? fmi2True : fmi2False;
+        eventInfo->nextEventTime = info.nextEventTime;
+        InvalidateCaches(component);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2EnterContinuousTimeMode(fmi2Component c)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::EnterContinuousTimeMode};
+    try {
+        ModelOf(component)->EnterContinuousTimeMode();
+        return fmi2OK;
     } catch (const cppfmu::FatalError& e) {
         component->logger.Log(fmi2Fatal, "", e.what());
         return fmi2Fatal;
@@ -981,27 +1726,196 @@ fmi2Status fmi2DoStep(
     }
 }
 
+fmi2Status fmi2CompletedIntegratorStep(
+    fmi2Component c,
+    fmi2Boolean noSetFMUStatePriorToCurrentPoint,
+    fmi2Boolean* enterEventMode,
+    fmi2Boolean* terminateSimulation)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::CompletedIntegratorStep};
+    try {
+        bool enter = false;
+        bool terminate = false;
+        ModelOf(component)->CompletedIntegratorStep(
+            noSetFMUStatePriorToCurrentPoint == fmi2True,
+            enter,
+            terminate);
+        *enterEventMode = enter ? fmi2True : fmi2False;
+        *terminateSimulation = terminate ? fmi2True : fmi2False;
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2SetTime(fmi2Component c, fmi2Real time)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetTime};
+    try {
+        ModelOf(component)->SetTime(time);
+        InvalidateCaches(component);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2SetContinuousStates(
+    fmi2Component c,
+    const fmi2Real x[],
+    size_t nx)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::SetContinuousStates};
+    try {
+        ModelOf(component)->SetContinuousStates(x, nx);
+        InvalidateCaches(component);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2GetDerivatives(
+    fmi2Component c,
+    fmi2Real derivatives[],
+    size_t nx)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetDerivatives};
+    try {
+        ModelOf(component)->GetDerivatives(derivatives, nx);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2GetEventIndicators(
+    fmi2Component c,
+    fmi2Real eventIndicators[],
+    size_t ni)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetEventIndicators};
+    try {
+        ModelOf(component)->GetEventIndicators(eventIndicators, ni);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2GetContinuousStates(
+    fmi2Component c,
+    fmi2Real x[],
+    size_t nx)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetContinuousStates};
+    try {
+        ModelOf(component)->GetContinuousStates(x, nx);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+fmi2Status fmi2GetNominalsOfContinuousStates(
+    fmi2Component c,
+    fmi2Real x_nominal[],
+    size_t nx)
+{
+    const auto component = reinterpret_cast<Component*>(c);
+    const CallScope scope{component, cppfmu::FMIFunction::GetNominalsOfContinuousStates};
+    try {
+        ModelOf(component)->GetNominalsOfContinuousStates(x_nominal, nx);
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
+}
+
+#endif // CPPFMU_MODEL_EXCHANGE
+
+
+/* Co-simulation */
+fmi2Status fmi2DoStep(
+    fmi2Component c,
+    fmi2Real currentCommunicationPoint,
+    fmi2Real communicationStepSize,
+    fmi2Boolean /*noSetFMUStatePriorToCurrentPoint*/)
+{
+    return DoStep(
+        reinterpret_cast<Component*>(c),
+        currentCommunicationPoint,
+        communicationStepSize,
+        fmi2True);
+}
+
 fmi2Status fmi2CancelStep(fmi2Component c)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmi2Error,
-        "cppfmu",
-        "FMI function not supported: fmi2CancelStep");
-    return fmi2Error;
+    // We don't use SlaveOf() here, since it would wait for the step to end.
+    const auto component = reinterpret_cast<Component*>(c);
+    if (component->slave == nullptr) {
+        component->logger.Log(
+            fmi2Error,
+            "cppfmu",
+            "Function only applicable to co-simulation instances");
+        return fmi2Error;
+    }
+    component->slave->CancelStep();
+    return fmi2OK;
 }
 
 
 /* Inquire slave status */
 fmi2Status fmi2GetStatus(
     fmi2Component c,
-    const fmi2StatusKind,
-    fmi2Status*)
+    const fmi2StatusKind s,
+    fmi2Status* value)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmi2Error,
-        "cppfmu",
-        "FMI function not supported: fmi2GetStatus");
-    return fmi2Error;
+    const auto component = reinterpret_cast<Component*>(c);
+    if (s == fmi2DoStepStatus) {
+        *value = GetStepStatus(component);
+        return fmi2OK;
+    } else {
+        component->logger.Log(
+            fmi2Error,
+            "cppfmu",
+            "Invalid status inquiry for fmi2GetStatus");
+        return fmi2Error;
+    }
 }
 
 fmi2Status fmi2GetRealStatus(
@@ -1011,7 +1925,7 @@ fmi2Status fmi2GetRealStatus(
 {
     const auto component = reinterpret_cast<Component*>(c);
     if (s == fmi2LastSuccessfulTime) {
-        *value = component->lastSuccessfulTime;
+        *value = GetLastSuccessfulTime(component);
         return fmi2OK;
     } else {
         component->logger.Log(
@@ -1036,26 +1950,45 @@ fmi2Status fmi2GetIntegerStatus(
 
 fmi2Status fmi2GetBooleanStatus(
     fmi2Component c,
-    const fmi2StatusKind,
-    fmi2Boolean*)
+    const fmi2StatusKind s,
+    fmi2Boolean* value)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmi2Error,
-        "cppfmu",
-        "FMI function not supported: fmi2GetBooleanStatus");
-    return fmi2Error;
+    const auto component = reinterpret_cast<Component*>(c);
+    if (s != fmi2Terminated) {
+        component->logger.Log(
+            fmi2Error,
+            "cppfmu",
+            "Invalid status inquiry for fmi2GetBooleanStatus");
+        return fmi2Error;
+    }
+    try {
+        *value = SlaveOf(component)->TerminationRequested() ? fmi2True : fmi2False;
+        return fmi2OK;
+    } catch (const cppfmu::FatalError& e) {
+        component->logger.Log(fmi2Fatal, "", e.what());
+        return fmi2Fatal;
+    } catch (const std::exception& e) {
+        component->logger.Log(fmi2Error, "", e.what());
+        return fmi2Error;
+    }
 }
 
 fmi2Status fmi2GetStringStatus(
     fmi2Component c,
-    const fmi2StatusKind,
-    fmi2String*)
+    const fmi2StatusKind s,
+    fmi2String* value)
 {
-    reinterpret_cast<Component*>(c)->logger.Log(
-        fmi2Error,
-        "cppfmu",
-        "FMI function not supported: fmi2GetStringStatus");
-    return fmi2Error;
+    const auto component = reinterpret_cast<Component*>(c);
+    if (s == fmi2PendingStatus) {
+        *value = IsStepPending(component) ? "Step in progress" : "";
+        return fmi2OK;
+    } else {
+        component->logger.Log(
+            fmi2Error,
+            "cppfmu",
+            "Invalid status inquiry for fmi2GetStringStatus");
+        return fmi2Error;
+    }
 }
 
 
@@ -0,0 +1,68 @@
+#include <cppfmu_arena.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    bool IsAligned(const void* p, std::size_t alignment)
+    {
+        return reinterpret_cast<std::uintptr_t>(p) % alignment == 0;
+    }
+}
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    {
+        cppfmu::StepArena arena{memory, 1024};
+        assert(cppfmu_test::AllocationCount() == 0);
+
+        // Alignment
+        const auto c = arena.Allocate(1, 1);
+        const auto d = arena.Allocate(sizeof(double), alignof(double));
+        const auto e = arena.Allocate(64, 64);
+        assert(c != d && IsAligned(d, alignof(double)) && IsAligned(e, 64));
+        assert(cppfmu_test::AllocationCount() == 1);
+
+        // Allocations which don't fit in the current chunk (including one
+        // which is larger than a chunk) get new chunks.
+        arena.Allocate(1000);
+        arena.Allocate(5000);
+        assert(cppfmu_test::AllocationCount() == 3);
+        const auto capacity = arena.Capacity();
+
+        // After a reset, the chunks are replaced with a single one which is
+        // large enough for a whole cycle, so the next cycle doesn't
+        // allocate.
+        arena.Reset();
+        assert(cppfmu_test::AllocationCount() == 4 && cppfmu_test::FreeCount() == 3);
+        assert(arena.Capacity() == capacity);
+        for (int cycle = 0; cycle < 3; ++cycle) {
+            arena.Allocate(1, 1);
+            arena.Allocate(sizeof(double), alignof(double));
+            arena.Allocate(64, 64);
+            arena.Allocate(1000);
+            arena.Allocate(5000);
+            arena.Reset();
+        }
+        assert(cppfmu_test::AllocationCount() == 4);
+
+        // Containers
+        for (int cycle = 0; cycle < 3; ++cycle) {
+            cppfmu::ArenaVector<double> v{cppfmu::ArenaAllocator<double>{arena}};
+            for (int i = 0; i < 100; ++i) v.push_back(i);
+            assert(v[99] == 99.0);
+            arena.Reset();
+        }
+        assert(cppfmu_test::AllocationCount() == 4);
+    }
+    assert(cppfmu_test::FreeCount() == cppfmu_test::AllocationCount());
+    return 0;
+}
@@ -0,0 +1,581 @@
+#include <cppfmu_continuous.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    // x'' = -x, with x(0) = 1 and x'(0) = 0, so x(t) = cos(t).
+    class Oscillator : public cppfmu::ContinuousSlave
+    {
+    public:
+        Oscillator(
+            const cppfmu::Memory& memory,
+            const cppfmu::IntegratorSettings& settings)
+            : ContinuousSlave(memory, 2, settings)
+        {
+            States()[0] = 1.0;
+        }
+
+        void Derivatives(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal dx[]) override
+        {
+            dx[0] = x[1];
+            dx[1] = -x[0];
+        }
+
+        void UpdateOutputs(cppfmu::FMIReal time) override
+        {
+            outputTime = time;
+        }
+
+        using ContinuousSlave::States;
+        using ContinuousSlave::Time;
+        using ContinuousSlave::CancelStep;
+        using ContinuousSlave::SetIntegratorSettings;
+
+        cppfmu::FMIReal outputTime = -1.0;
+    };
+
+    // x' = -k x, whose stiffness forces an adaptive method to take small
+    // steps, with a derivative function that cancels the step at t > 0.5.
+    class Decay : public cppfmu::ContinuousSlave
+    {
+    public:
+        Decay(const cppfmu::Memory& memory, std::size_t n, double k)
+            : ContinuousSlave(memory, n)
+            , k_{k}
+        {
+            for (std::size_t i = 0; i < n; ++i) States()[i] = 1.0;
+        }
+
+        void Derivatives(
+            cppfmu::FMIReal t,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal dx[]) override
+        {
+            for (std::size_t i = 0; i < StateCount(); ++i) dx[i] = -k_ * x[i];
+            if (cancelAfter >= 0.0 && t > cancelAfter) CancelStep();
+            if (failAfter >= 0.0 && t > failAfter) {
+                throw std::runtime_error("Derivatives failed");
+            }
+        }
+
+        using ContinuousSlave::States;
+        using ContinuousSlave::Time;
+        using ContinuousSlave::SetIntegratorSettings;
+
+        double cancelAfter = -1.0;
+        double failAfter = -1.0;
+
+    private:
+        double k_;
+    };
+
+    /* The heat equation on a line, discretised by finite differences, with
+     * zero boundary values: a stiff system with a tridiagonal Jacobian.
+     * Starting from the slowest eigenmode, x[i] = sin(pi*(i+1)/(n+1)), the
+     * solution is x(t) = x(0)*exp(-lambda*t).
+     */
+    class Heat : public cppfmu::ContinuousSlave
+    {
+    public:
+        Heat(
+            const cppfmu::Memory& memory,
+            std::size_t n,
+            double diffusivity,
+            bool sparse,
+            bool analytic = false)
+            : ContinuousSlave(memory, n, Settings())
+            , d_{diffusivity}
+            , analytic_{analytic}
+        {
+            const double pi = 3.14159265358979323846;
+            for (std::size_t i = 0; i < n; ++i) {
+                States()[i] = std::sin(pi * (i + 1) / (n + 1));
+            }
+            lambda = d_ * (2.0 - 2.0 * std::cos(pi / (n + 1)));
+            if (sparse) {
+                std::vector<std::size_t> rows, columns;
+                for (std::size_t i = 0; i < n; ++i) {
+                    for (std::size_t j = (i > 0 ? i - 1 : 0); j <= i + 1 && j < n; ++j) {
+                        rows.push_back(i);
+                        columns.push_back(j);
+                    }
+                }
+                SetJacobianSparsity(rows.data(), columns.data(), rows.size());
+            }
+        }
+
+        static cppfmu::IntegratorSettings Settings()
+        {
+            auto settings = cppfmu::IntegratorSettings{};
+            settings.method = cppfmu::IntegrationMethod::Rosenbrock;
+            settings.relativeTolerance = 1e-4;
+            settings.absoluteTolerance = 1e-8;
+            return settings;
+        }
+
+        void Derivatives(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal dx[]) override
+        {
+            const auto n = StateCount();
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto left = i > 0 ? x[i - 1] : 0.0;
+                const auto right = i + 1 < n ? x[i + 1] : 0.0;
+                dx[i] = d_ * (left - 2.0*x[i] + right);
+            }
+        }
+
+        void Jacobian(
+            cppfmu::FMIReal t,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal jacobian[]) override
+        {
+            if (!analytic_) {
+                ContinuousSlave::Jacobian(t, x, jacobian);
+                return;
+            }
+            const auto n = StateCount();
+            std::fill(jacobian, jacobian + n*n, 0.0);
+            for (std::size_t i = 0; i < n; ++i) {
+                jacobian[i*n + i] = -2.0 * d_;
+                if (i > 0) jacobian[i*n + i - 1] = d_;
+                if (i + 1 < n) jacobian[i*n + i + 1] = d_;
+            }
+        }
+
+        using ContinuousSlave::States;
+        using ContinuousSlave::SetIntegratorSettings;
+        using ContinuousSlave::SetJacobianSparsity;
+
+        double lambda;
+
+    private:
+        double d_;
+        bool analytic_;
+    };
+
+    /* Damped oscillators, each coupled to the one before it, with an
+     * analytic Jacobian which has two subdiagonals and one superdiagonal.
+     * Once the oscillations have died out, the steps grow so long that
+     * the factorisation of the iteration matrix must interchange rows.
+     */
+    class Oscillators : public cppfmu::ContinuousSlave
+    {
+    public:
+        Oscillators(const cppfmu::Memory& memory, std::size_t n, bool banded)
+            : ContinuousSlave(memory, n, Heat::Settings())
+        {
+            std::vector<std::size_t> rows, columns;
+            for (std::size_t i = 0; i < n; ++i) {
+                States()[i] = 1.0;
+                for (std::size_t j = (i > 1 ? i - 2 : 0); j <= i + 1 && j < n; ++j) {
+                    rows.push_back(i);
+                    columns.push_back(j);
+                }
+            }
+            if (banded) SetJacobianSparsity(rows.data(), columns.data(), rows.size());
+        }
+
+        void Derivatives(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal dx[]) override
+        {
+            const auto n = StateCount();
+            for (std::size_t i = 0; i < n; ++i) {
+                dx[i] = -c * x[i] + (i >= 2 ? 0.5 * x[i - 2] : 0.0);
+                if (i % 2 == 0) {
+                    if (i + 1 < n) dx[i] += w * x[i + 1];
+                } else {
+                    dx[i] -= w * x[i - 1];
+                }
+            }
+        }
+
+        void Jacobian(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal /*x*/[],
+            cppfmu::FMIReal jacobian[]) override
+        {
+            const auto n = StateCount();
+            std::fill(jacobian, jacobian + n*n, 0.0);
+            for (std::size_t i = 0; i < n; ++i) {
+                jacobian[i*n + i] = -c;
+                if (i >= 2) jacobian[i*n + i - 2] = 0.5;
+                if (i % 2 == 0) {
+                    if (i + 1 < n) jacobian[i*n + i + 1] = w;
+                } else {
+                    jacobian[i*n + i - 1] = -w;
+                }
+            }
+        }
+
+        using ContinuousSlave::States;
+
+        static constexpr double c = 100.0;
+        static constexpr double w = 1000.0;
+    };
+
+    // A ball dropped from a height of 1 m onto an elastic floor.
+    class Ball : public cppfmu::ContinuousSlave
+    {
+    public:
+        Ball(
+            const cppfmu::Memory& memory,
+            const cppfmu::IntegratorSettings& settings,
+            bool bounce)
+            : ContinuousSlave(memory, 2, settings)
+            , bounce_{bounce}
+        {
+            States()[0] = 1.0;
+            SetEventIndicatorCount(1);
+        }
+
+        void Derivatives(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal dx[]) override
+        {
+            dx[0] = x[1];
+            dx[1] = -g;
+        }
+
+        void EventIndicators(
+            cppfmu::FMIReal /*t*/,
+            const cppfmu::FMIReal x[],
+            cppfmu::FMIReal z[]) override
+        {
+            z[0] = x[0];
+        }
+
+        bool HandleEvent(cppfmu::FMIReal time, const int directions[]) override
+        {
+            assert(time == Time());
+            assert(directions[0] == -1);
+            eventTimes.push_back(time);
+            if (bounce_) States()[1] = -States()[1];
+            return !bounce_;
+        }
+
+        using ContinuousSlave::States;
+
+        static constexpr double g = 9.81;
+        std::vector<double> eventTimes;
+
+    private:
+        bool bounce_;
+    };
+
+    // The largest error in a Heat slave's states at time t, relative to the
+    // largest state.
+    double HeatError(Heat& heat, double t, std::size_t n)
+    {
+        const double pi = 3.14159265358979323846;
+        const auto scale = std::exp(-heat.lambda * t);
+        double worst = 0.0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto exact = std::sin(pi * (i + 1) / (n + 1)) * scale;
+            worst = std::max(worst, std::fabs(heat.States()[i] - exact));
+        }
+        return worst / scale;
+    }
+}
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+    cppfmu::FMIReal endOfStep = 0.0;
+
+    // RK4 divides each communication step into equal substeps, and is
+    // fourth-order accurate.
+    {
+        auto settings = cppfmu::IntegratorSettings{};
+        settings.method = cppfmu::IntegrationMethod::RK4;
+        settings.stepSize = 0.03;
+        Oscillator osc{memory, settings};
+        assert(reinterpret_cast<std::uintptr_t>(osc.States()) % 64 == 0);
+        osc.SetupExperiment(false, 0.0, 0.0, false, 0.0);
+        for (int i = 0; i < 100; ++i) {
+            const auto completed = osc.DoStep(i * 0.1, 0.1, true, endOfStep);
+            assert(completed);
+            assert(endOfStep == i * 0.1 + 0.1);
+        }
+        assert(std::fabs(osc.States()[0] - std::cos(10.0)) < 1e-5);
+        assert(std::fabs(osc.States()[1] + std::sin(10.0)) < 1e-5);
+        assert(osc.Statistics().steps == 400);
+        assert(osc.Statistics().rejectedSteps == 0);
+        assert(osc.Statistics().evaluations == 1600);
+        assert(std::fabs(osc.Statistics().lastStepSize - 0.025) < 1e-12);
+        assert(osc.outputTime == endOfStep);
+        assert(osc.Time() == endOfStep);
+    }
+
+    // Dormand-Prince meets its tolerance, with far fewer steps than the
+    // fixed step size would require, and the step size carries over
+    // between communication steps.
+    {
+        auto settings = cppfmu::IntegratorSettings{};
+        settings.stepSize = 1e-4;
+        Oscillator osc{memory, settings};
+        osc.SetupExperiment(true, 1e-8, 0.0, false, 0.0);
+        for (int i = 0; i < 10; ++i) {
+            const auto completed = osc.DoStep(i * 1.0, 1.0, true, endOfStep);
+            assert(completed);
+        }
+        assert(endOfStep == 10.0);
+        assert(std::fabs(osc.States()[0] - std::cos(10.0)) < 1e-6);
+        assert(std::fabs(osc.States()[1] + std::sin(10.0)) < 1e-6);
+        const auto& stats = osc.Statistics();
+        assert(stats.steps > 10 && stats.steps < 1000);
+        assert(stats.lastStepSize > 1e-2);
+        // Six new stages per attempted step, plus one at the start of each
+        // communication step.
+        assert(stats.evaluations == 6 * (stats.steps + stats.rejectedSteps) + 10);
+
+        osc.Reset();
+        assert(osc.Statistics().steps == 0);
+    }
+
+    // A large initial step is rejected and shrunk.
+    {
+        auto settings = cppfmu::IntegratorSettings{};
+        settings.stepSize = 10.0;
+        Decay decay{memory, 1, 50.0};
+        decay.SetIntegratorSettings(settings);
+        const auto completed = decay.DoStep(0.0, 1.0, true, endOfStep);
+        assert(completed);
+        assert(decay.Statistics().rejectedSteps > 0);
+        assert(std::fabs(decay.States()[0] - std::exp(-50.0)) < 1e-6);
+    }
+
+    // Many states, which don't fill a whole number of cache lines.
+    {
+        Decay decay{memory, 1001, 1.0};
+        const auto completed = decay.DoStep(0.0, 1.0, true, endOfStep);
+        assert(completed);
+        for (std::size_t i = 0; i < 1001; ++i) {
+            assert(std::fabs(decay.States()[i] - std::exp(-1.0)) < 1e-6);
+        }
+    }
+
+    // A cancelled step stops between internal steps and reports where.
+    {
+        Decay decay{memory, 1, 1.0};
+        decay.cancelAfter = 0.5;
+        const auto completed = decay.DoStep(0.0, 1.0, true, endOfStep);
+        assert(!completed);
+        assert(endOfStep > 0.5 && endOfStep < 1.0);
+        assert(std::fabs(decay.States()[0] - std::exp(-endOfStep)) < 1e-6);
+    }
+
+    // If a step fails partway, the time is that of the last accepted
+    // internal step, which the states correspond to.
+    {
+        const cppfmu::IntegrationMethod methods[] = {
+            cppfmu::IntegrationMethod::RK4,
+            cppfmu::IntegrationMethod::DormandPrince,
+            cppfmu::IntegrationMethod::Rosenbrock,
+        };
+        for (const auto method : methods) {
+            auto settings = cppfmu::IntegratorSettings{};
+            settings.method = method;
+            settings.stepSize = 0.01;
+            Decay decay{memory, 1, 1.0};
+            decay.SetIntegratorSettings(settings);
+            decay.failAfter = 0.5;
+            bool threw = false;
+            try {
+                decay.DoStep(0.0, 1.0, true, endOfStep);
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            assert(threw);
+            const auto t = decay.Time();
+            assert(t > 0.0 && t <= 0.5);
+            assert(std::fabs(decay.States()[0] - std::exp(-t)) < 1e-4);
+        }
+    }
+
+    // Too strict a minimum step size makes the step fail.
+    {
+        auto settings = cppfmu::IntegratorSettings{};
+        settings.stepSize = 1.0;
+        settings.minStepSize = 0.5;
+        Decay decay{memory, 1, 50.0};
+        decay.SetIntegratorSettings(settings);
+        bool threw = false;
+        try {
+            decay.DoStep(0.0, 1.0, true, endOfStep);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+
+        settings.stepSize = 0.0;
+        threw = false;
+        try {
+            decay.SetIntegratorSettings(settings);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // The Rosenbrock method takes far fewer steps than Dormand-Prince on a
+    // stiff problem, and reuses the factorised iteration matrix across
+    // communication steps once the step size has settled.
+    {
+        const std::size_t n = 50;
+        Heat heat{memory, n, 1e4, true};
+        for (int i = 0; i < 20; ++i) {
+            const auto completed = heat.DoStep(i * 0.01, 0.01, true, endOfStep);
+            assert(completed);
+        }
+        assert(std::fabs(endOfStep - 0.2) < 1e-15);
+        assert(HeatError(heat, 0.2, n) < 1e-3);
+        const auto stats = heat.Statistics();
+        assert(stats.steps < 1000);
+        assert(stats.factorizations < stats.steps / 2);
+        // The tridiagonal sparsity pattern needs three colours, so each
+        // Jacobian costs four evaluations, one of which doubles as the
+        // first stage of the step.
+        assert(stats.jacobianEvaluations >= 1);
+        assert(stats.evaluations
+            == 2 * (stats.steps + stats.rejectedSteps) + 3 * stats.jacobianEvaluations);
+
+        auto explicitSettings = cppfmu::IntegratorSettings{};
+        explicitSettings.relativeTolerance = 1e-4;
+        explicitSettings.absoluteTolerance = 1e-8;
+        Heat explicitHeat{memory, n, 1e4, false};
+        explicitHeat.SetIntegratorSettings(explicitSettings);
+        for (int i = 0; i < 20; ++i) {
+            const auto completed =
+                explicitHeat.DoStep(i * 0.01, 0.01, true, endOfStep);
+            assert(completed);
+        }
+        assert(explicitHeat.Statistics().steps > 2 * stats.steps);
+
+        // Without a sparsity pattern, each column is perturbed separately,
+        // and with an analytic Jacobian, none are, but the results are the
+        // same.
+        Heat dense{memory, n, 1e4, false};
+        Heat analytic{memory, n, 1e4, false, true};
+        for (int i = 0; i < 20; ++i) {
+            auto completed = dense.DoStep(i * 0.01, 0.01, true, endOfStep);
+            assert(completed);
+            completed = analytic.DoStep(i * 0.01, 0.01, true, endOfStep);
+            assert(completed);
+        }
+        const auto& denseStats = dense.Statistics();
+        assert(denseStats.evaluations
+            == 2 * (denseStats.steps + denseStats.rejectedSteps)
+                + n * denseStats.jacobianEvaluations);
+        const auto& analyticStats = analytic.Statistics();
+        assert(analyticStats.evaluations
+            == 2 * (analyticStats.steps + analyticStats.rejectedSteps));
+        assert(HeatError(dense, 0.2, n) < 1e-3);
+        assert(HeatError(analytic, 0.2, n) < 1e-3);
+
+        bool threw = false;
+        try {
+            const std::size_t rows[] = { 0, n };
+            const std::size_t columns[] = { 0, 0 };
+            heat.SetJacobianSparsity(rows, columns, 2);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // A narrowly banded sparsity pattern makes the iteration matrix be
+    // factorised in band storage, which gives the same results as the
+    // dense factorisation.
+    {
+        const std::size_t n = 20;
+        Oscillators banded{memory, n, true};
+        Oscillators dense{memory, n, false};
+        for (int i = 0; i < 10; ++i) {
+            auto completed = banded.DoStep(i * 0.1, 0.1, true, endOfStep);
+            assert(completed);
+            completed = dense.DoStep(i * 0.1, 0.1, true, endOfStep);
+            assert(completed);
+            for (std::size_t k = 0; k < n; ++k) {
+                assert(std::fabs(banded.States()[k] - dense.States()[k]) < 1e-12);
+            }
+        }
+        assert(banded.Statistics().steps == dense.Statistics().steps);
+        assert(banded.Statistics().lastStepSize > 0.01);
+    }
+
+    // Very stiff decay, where an explicit method would need tens of
+    // thousands of steps.
+    {
+        auto settings = cppfmu::IntegratorSettings{};
+        settings.method = cppfmu::IntegrationMethod::Rosenbrock;
+        settings.relativeTolerance = 1e-3;
+        settings.absoluteTolerance = 1e-6;
+        Decay decay{memory, 1, 1e5};
+        decay.SetIntegratorSettings(settings);
+        const auto completed = decay.DoStep(0.0, 1.0, true, endOfStep);
+        assert(completed);
+        assert(std::fabs(decay.States()[0]) < 1e-6);
+        assert(decay.Statistics().steps < 1000);
+    }
+
+    // Events are located precisely with every method, and either end the
+    // communication step or are handled within it.
+    {
+        const double impact = std::sqrt(2.0 / Ball::g);
+        auto settings = cppfmu::IntegratorSettings{};
+        const cppfmu::IntegrationMethod methods[] = {
+            cppfmu::IntegrationMethod::RK4,
+            cppfmu::IntegrationMethod::DormandPrince,
+            cppfmu::IntegrationMethod::Rosenbrock,
+        };
+        for (const auto method : methods) {
+            settings.method = method;
+            settings.stepSize = 0.01;
+
+            Ball ball{memory, settings, false};
+            auto completed = ball.DoStep(0.0, 1.0, true, endOfStep);
+            assert(!completed);
+            assert(std::fabs(endOfStep - impact) < 1e-9);
+            assert(endOfStep >= impact);
+            assert(std::fabs(ball.States()[0]) < 1e-8);
+            assert(ball.Statistics().events == 1);
+            // The next step doesn't trigger the same event again.
+            completed = ball.DoStep(endOfStep, 0.1, true, endOfStep);
+            assert(completed);
+            assert(ball.eventTimes.size() == 1);
+
+            Ball bouncing{memory, settings, true};
+            completed = bouncing.DoStep(0.0, 1.0, true, endOfStep);
+            assert(completed);
+            completed = bouncing.DoStep(1.0, 1.0, true, endOfStep);
+            assert(completed);
+            assert(bouncing.eventTimes.size() == 2);
+            assert(std::fabs(bouncing.eventTimes[0] - impact) < 1e-9);
+            assert(std::fabs(bouncing.eventTimes[1] - 3 * impact) < 1e-8);
+            const auto dt = 2.0 - 3 * impact;
+            const auto v = Ball::g * impact;
+            assert(std::fabs(bouncing.States()[0] - (v*dt - 0.5*Ball::g*dt*dt)) < 1e-6);
+            assert(std::fabs(bouncing.States()[1] - (v - Ball::g*dt)) < 1e-6);
+        }
+    }
+    return 0;
+}
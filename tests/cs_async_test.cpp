@@ -0,0 +1,168 @@
+#include <fmi2Functions.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <thread>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    std::atomic<int> stepsFinished{0};
+}
+
+
+extern "C" void logger(
+    fmi2ComponentEnvironment,
+    fmi2String,
+    fmi2Status,
+    fmi2String,
+    fmi2String message,
+    ...) noexcept
+{
+    va_list args;
+    va_start(args, message);
+    std::vfprintf(stderr, message, args);
+    std::fprintf(stderr, "\n");
+    va_end(args);
+}
+
+extern "C" void stepFinished(fmi2ComponentEnvironment env, fmi2Status status) noexcept
+{
+    assert(env == &stepsFinished);
+    assert(status == fmi2OK || status == fmi2Discard);
+    ++stepsFinished;
+}
+
+
+int main()
+{
+    const auto callbacks = fmi2CallbackFunctions{
+        &logger,
+        &cppfmu_test::TestAllocate,
+        &cppfmu_test::TestFree,
+        &stepFinished,
+        &stepsFinished,
+    };
+    const auto instance = fmi2Instantiate(
+        "MyInstance",
+        fmi2CoSimulation,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(instance);
+    {
+        const auto rc = fmi2SetupExperiment(
+            instance, fmi2False, 0.0, 0.0, fmi2False, 0.0);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2EnterInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2ExitInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+
+    const fmi2ValueReference vr = 0;
+    const fmi2Real value = 3.0;
+    {
+        const auto rc = fmi2SetReal(instance, &vr, 1, &value);
+        assert(rc == fmi2OK);
+    }
+
+    // Poll until the step has completed
+    {
+        const auto rc = fmi2DoStep(instance, 0.0, 0.1, fmi2True);
+        assert(rc == fmi2Pending);
+        fmi2Status status = fmi2Pending;
+        while (status == fmi2Pending) {
+            const auto src = fmi2GetStatus(instance, fmi2DoStepStatus, &status);
+            assert(src == fmi2OK);
+            std::this_thread::yield();
+        }
+        assert(status == fmi2OK);
+        fmi2Real t = 0.0;
+        const auto trc = fmi2GetRealStatus(instance, fmi2LastSuccessfulTime, &t);
+        assert(trc == fmi2OK);
+        assert(t == 0.1);
+        fmi2Boolean terminated = fmi2True;
+        const auto brc = fmi2GetBooleanStatus(instance, fmi2Terminated, &terminated);
+        assert(brc == fmi2OK);
+        assert(terminated == fmi2False);
+    }
+
+    // Other functions wait for the step to complete
+    {
+        const auto rc = fmi2DoStep(instance, 0.1, 0.1, fmi2True);
+        assert(rc == fmi2Pending);
+        fmi2Real val = 0.0;
+        const auto grc = fmi2GetReal(instance, &vr, 1, &val);
+        assert(grc == fmi2OK);
+        assert(val == value);
+        fmi2Status status = fmi2Pending;
+        const auto src = fmi2GetStatus(instance, fmi2DoStepStatus, &status);
+        assert(src == fmi2OK);
+        assert(status == fmi2OK);
+    }
+
+    // A new step may be started as soon as polling shows that the previous
+    // one has completed.
+    const int pollSteps = 1000;
+    for (int i = 0; i < pollSteps; ++i) {
+        const auto rc = fmi2DoStep(instance, 0.2, 0.05, fmi2True);
+        assert(rc == fmi2Pending);
+        fmi2Status status = fmi2Pending;
+        while (status == fmi2Pending) {
+            const auto src = fmi2GetStatus(instance, fmi2DoStepStatus, &status);
+            assert(src == fmi2OK);
+        }
+        assert(status == fmi2OK);
+    }
+
+    // Cancellation
+    {
+        const fmi2Real negative = -1.0;
+        const auto rc = fmi2SetReal(instance, &vr, 1, &negative);
+        assert(rc == fmi2OK);
+        const auto drc = fmi2DoStep(instance, 0.25, 0.5, fmi2True);
+        assert(drc == fmi2Pending);
+        fmi2Real t = 0.0;
+        while (t != 0.5) {
+            const auto trc = fmi2GetRealStatus(instance, fmi2LastSuccessfulTime, &t);
+            assert(trc == fmi2OK);
+            std::this_thread::yield();
+        }
+        const auto crc = fmi2CancelStep(instance);
+        assert(crc == fmi2OK);
+        fmi2Status status = fmi2Pending;
+        while (status == fmi2Pending) {
+            const auto src = fmi2GetStatus(instance, fmi2DoStepStatus, &status);
+            assert(src == fmi2OK);
+            std::this_thread::yield();
+        }
+        assert(status == fmi2Discard);
+        const auto trc = fmi2GetRealStatus(instance, fmi2LastSuccessfulTime, &t);
+        assert(trc == fmi2OK);
+        assert(t == 0.5);
+    }
+
+    {
+        const auto rc = fmi2SetReal(instance, &vr, 1, &value);
+        assert(rc == fmi2OK);
+        const auto drc = fmi2DoStep(instance, 0.75, 0.1, fmi2True);
+        assert(drc == fmi2Pending);
+        const auto trc = fmi2Terminate(instance);
+        assert(trc == fmi2OK);
+    }
+    // The callback is invoked just after the step is marked as completed.
+    while (stepsFinished < 4 + pollSteps) std::this_thread::yield();
+    fmi2FreeInstance(instance);
+    return 0;
+}
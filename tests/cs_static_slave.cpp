@@ -0,0 +1,5 @@
+// Unity build of the test slave and fmi_functions.cpp, with the slave
+// called through its static type.
+#define CPPFMU_STATIC_SLAVE TestSlave
+#include "cs_slave.cpp"
+#include "../fmi_functions.cpp"
@@ -0,0 +1,134 @@
+#include <cppfmu_stats.hpp>
+#include <fmi2Functions.h>
+
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    std::vector<std::string> statsMessages;
+}
+
+
+extern "C" void logger(
+    fmi2ComponentEnvironment,
+    fmi2String,
+    fmi2Status,
+    fmi2String category,
+    fmi2String message,
+    ...) noexcept
+{
+    char buffer[1024];
+    va_list args;
+    va_start(args, message);
+    std::vsnprintf(buffer, sizeof buffer, message, args);
+    va_end(args);
+    if (std::strcmp(category, "cppfmu.stats") == 0) {
+        statsMessages.push_back(buffer);
+    } else {
+        std::fprintf(stderr, "%s\n", buffer);
+    }
+}
+
+
+void TestHistogram()
+{
+    using cppfmu::LatencyHistogram;
+    for (std::uint64_t v = 0; v < 100000; v += 7) {
+        const auto i = LatencyHistogram::BucketIndex(v);
+        assert(i < LatencyHistogram::BUCKET_COUNT);
+        assert(v <= LatencyHistogram::BucketLimit(i));
+        assert(i == 0 || v > LatencyHistogram::BucketLimit(i - 1));
+        // At most 12.5% too large
+        assert(LatencyHistogram::BucketLimit(i) - v <= v / 8);
+    }
+    assert(LatencyHistogram::BucketIndex(~std::uint64_t{0}) == LatencyHistogram::BUCKET_COUNT - 1);
+
+    cppfmu::FunctionStatistics f;
+    assert(f.Percentile(50.0) == 0 || f.calls == 0);
+    for (std::uint64_t v = 1; v <= 1000; ++v) f.Record(v * 1000);
+    assert(f.calls == 1000 && f.minNs == 1000 && f.maxNs == 1000000);
+    assert(f.totalNs == 500500000);
+    const auto p50 = f.Percentile(50.0);
+    assert(p50 >= 500000 && p50 <= 500000 + 500000 / 8);
+    const auto p99 = f.Percentile(99.0);
+    assert(p99 >= 990000 && p99 <= 1000000);
+    assert(f.Percentile(100.0) == 1000000);
+    assert(f.Percentile(0.0) >= 1000 && f.Percentile(0.0) <= 1000 + 1000 / 8);
+}
+
+
+int main()
+{
+    TestHistogram();
+
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto instance = fmi2Instantiate(
+        "MyInstance",
+        fmi2CoSimulation,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(instance);
+    {
+        const auto rc = fmi2SetupExperiment(
+            instance, fmi2False, 0.0, 0.0, fmi2False, 0.0);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2EnterInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2ExitInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+
+    const fmi2ValueReference vr = 0;
+    fmi2Real value = 3.0;
+    for (int i = 0; i < 5; ++i) {
+        {
+            const auto rc = fmi2SetReal(instance, &vr, 1, &value);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2DoStep(instance, i * 0.1, 0.1, fmi2True);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2GetReal(instance, &vr, 1, &value);
+            assert(rc == fmi2OK);
+        }
+    }
+    const fmi2ValueReference badVr = 1;
+    {
+        const auto rc = fmi2GetReal(instance, &badVr, 1, &value);
+        assert(rc == fmi2Error);
+    }
+
+    assert(statsMessages.empty());
+    {
+        const auto rc = fmi2Terminate(instance);
+        assert(rc == fmi2OK);
+    }
+    fmi2FreeInstance(instance);
+
+    // One message per function called before fmi2Terminate(), in the order
+    // of cppfmu::FMIFunction.
+    assert(statsMessages.size() == 6);
+    assert(statsMessages[0].find("fmi2SetupExperiment: calls=1 ") == 0);
+    assert(statsMessages[3].find("fmi2GetReal: calls=6 ") == 0);
+    assert(statsMessages[4].find("fmi2SetReal: calls=5 ") == 0);
+    assert(statsMessages[5].find("fmi2DoStep: calls=5 ") == 0);
+    assert(statsMessages[5].find(" p99.9=") != std::string::npos);
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <fmi2Functions.h>
 
 #include <cassert>
+#include <cmath>
 #include <cstdarg>
 #include <cstdint>
 #include <cstdio>
@@ -8,6 +9,8 @@
 #include <string>
 #include <vector>
 
+#include "test_memory.hpp"
+
 
 const double TEST_VALUE = 2.0;
 const char* const TEST_INSTANCE_NAME = "MyInstance";
@@ -29,22 +32,11 @@ extern "C" void logger(
     va_end(args);
 }
 
-extern "C" void* alloc(std::size_t nobj, std::size_t size) noexcept
-{
-    return std::malloc(nobj*size);
-}
-
 
 int main()
 {
     // Instantiation and setup
-    const auto callbacks = fmi2CallbackFunctions{
-        &logger,
-        &alloc,
-        &std::free,
-        nullptr,
-        nullptr,
-    };
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
     const auto instance = fmi2Instantiate(
         TEST_INSTANCE_NAME,
         fmi2CoSimulation,
@@ -157,6 +149,18 @@ int main()
         assert(rc == fmi2OK);
         assert(val == value1);
     }
+    {
+        // Estimated by finite differences, leaving the value unchanged
+        const fmi2Real seed = 2.0;
+        fmi2Real derivative = 0.0;
+        const auto rc = fmi2GetDirectionalDerivative(
+            instance, &validVr, 1, &validVr, 1, &seed, &derivative);
+        assert(rc == fmi2OK);
+        assert(std::fabs(derivative - 2.0) < 1e-6);
+        fmi2Real val = 0.0;
+        fmi2GetReal(instance, &validVr, 1, &val);
+        assert(val == value1);
+    }
     {
         const fmi2ValueReference invalidVr = 1;
         fmi2Real val = -1.0;
@@ -0,0 +1,185 @@
+#include <cppfmu_trace.hpp>
+#include <fmi2Functions.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifdef _WIN32
+#   include <process.h>
+#else
+#   include <unistd.h>
+#endif
+
+#include "test_memory.hpp"
+
+
+extern "C" void logger(
+    fmi2ComponentEnvironment,
+    fmi2String,
+    fmi2Status,
+    fmi2String,
+    fmi2String message,
+    ...) noexcept
+{
+    std::fprintf(stderr, "%s\n", message);
+}
+
+
+std::string ReadFile(const char* path)
+{
+    const auto file = std::fopen(path, "r");
+    assert(file);
+    std::string contents;
+    char buffer[4096];
+    std::size_t n;
+    while ((n = std::fread(buffer, 1, sizeof buffer, file)) > 0) {
+        contents.append(buffer, n);
+    }
+    std::fclose(file);
+    std::remove(path);
+    return contents;
+}
+
+
+std::size_t CountOccurrences(const std::string& haystack, const std::string& needle)
+{
+    std::size_t count = 0;
+    for (auto pos = haystack.find(needle);
+            pos != std::string::npos;
+            pos = haystack.find(needle, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+
+void TestTracer()
+{
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto memory = cppfmu::Memory{callbacks};
+
+    cppfmu::Tracer tracer{memory, "my \"tracer\"", 4};
+    assert(tracer.Size() == 0);
+    assert(tracer.DroppedCount() == 0);
+
+    tracer.Record("first", 1000, 2500);
+    {
+        const cppfmu::TraceScope span{&tracer, "second"};
+        const cppfmu::TraceScope nothing{nullptr, "ignored"};
+    }
+    assert(tracer.Size() == 2);
+    for (int i = 0; i < 4; ++i) tracer.Record("more", 3000, 4000);
+    assert(tracer.Size() == 4);
+    assert(tracer.DroppedCount() == 2);
+
+    tracer.Write("tracer_test.trace.json");
+    const auto json = ReadFile("tracer_test.trace.json");
+    assert(json.find("\"droppedEvents\":2") != std::string::npos);
+    assert(json.find("\"args\":{\"name\":\"my \\\"tracer\\\"\"}") != std::string::npos);
+    assert(json.find("{\"name\":\"first\",\"ph\":\"X\",\"ts\":1.000,\"dur\":1.500,") != std::string::npos);
+    assert(CountOccurrences(json, "\"second\"") == 1);
+    assert(CountOccurrences(json, "\"more\"") == 2);
+    assert(CountOccurrences(json, "\"ignored\"") == 0);
+
+    bool threw = false;
+    try {
+        tracer.Write("no/such/directory/file.json");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+
+void TestInstance()
+{
+#ifdef _WIN32
+    _putenv_s("CPPFMU_TRACE_DIR", ".");
+#else
+    setenv("CPPFMU_TRACE_DIR", ".", 1);
+#endif
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto instance = fmi2Instantiate(
+        "trace/instance",
+        fmi2CoSimulation,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(instance);
+    // A second instance with the same name must get its own trace file.
+    const auto namesake = fmi2Instantiate(
+        "trace/instance",
+        fmi2CoSimulation,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(namesake);
+    {
+        const auto rc = fmi2SetupExperiment(
+            instance, fmi2False, 0.0, 0.0, fmi2False, 0.0);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2EnterInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2ExitInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    const fmi2ValueReference vr = 0;
+    fmi2Real value = 1.0;
+    for (int i = 0; i < 3; ++i) {
+        {
+            const auto rc = fmi2SetReal(instance, &vr, 1, &value);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2DoStep(instance, i * 0.1, 0.1, fmi2True);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2GetReal(instance, &vr, 1, &value);
+            assert(rc == fmi2OK);
+        }
+    }
+    {
+        const auto rc = fmi2Terminate(instance);
+        assert(rc == fmi2OK);
+    }
+    fmi2FreeInstance(namesake);
+    fmi2FreeInstance(instance);
+
+#ifdef _WIN32
+    const auto pid = std::to_string(_getpid());
+#else
+    const auto pid = std::to_string(getpid());
+#endif
+    const auto namesakeJson =
+        ReadFile(("./trace_instance." + pid + "-2.trace.json").c_str());
+    assert(CountOccurrences(namesakeJson, "\"fmi2DoStep\"") == 0);
+
+    const auto json =
+        ReadFile(("./trace_instance." + pid + "-1.trace.json").c_str());
+    assert(json.find("\"args\":{\"name\":\"trace/instance\"}") != std::string::npos);
+    assert(CountOccurrences(json, "\"fmi2SetupExperiment\"") == 1);
+    assert(CountOccurrences(json, "\"fmi2SetReal\"") == 3);
+    assert(CountOccurrences(json, "\"fmi2DoStep\"") == 3);
+    assert(CountOccurrences(json, "\"fmi2GetReal\"") == 3);
+    assert(CountOccurrences(json, "\"fmi2Terminate\"") == 1);
+    assert(json.find("\"droppedEvents\":0") != std::string::npos);
+}
+
+
+int main()
+{
+    TestTracer();
+    TestInstance();
+    return 0;
+}
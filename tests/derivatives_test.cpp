@@ -0,0 +1,411 @@
+#include <cppfmu_cs.hpp>
+#include <cppfmu_derivatives.hpp>
+#include <cppfmu_state.hpp>
+#include <cppfmu_variables.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+const std::size_t N = 8;
+
+
+/* A slave with outputs y[i] = u[i]^2 + u[i-1] + u[i+1], i.e., a tridiagonal
+ * Jacobian.  It counts the calls to SetReal() in a variable which is part
+ * of its FMU state, so we can check that the estimates leave it unchanged.
+ */
+class Tridiagonal : public cppfmu::SlaveInstance
+{
+public:
+    explicit Tridiagonal(const cppfmu::Memory& memory, bool withState = true)
+        : m_variables{memory}
+        , m_states{memory}
+        , m_estimator{memory}
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            m_u[i] = 1.0 + i;
+            m_variables.AddReal(static_cast<cppfmu::FMIValueReference>(i), &m_u[i]);
+            m_variables.AddReal(static_cast<cppfmu::FMIValueReference>(100 + i), &m_y[i]);
+        }
+        m_states.Add(m_u);
+        m_states.Add(m_y);
+        m_states.Add(m_setCount);
+        UseVariableTable(m_variables);
+        if (withState) UseStateTable(m_states);
+        Update();
+    }
+
+    void SetReal(
+        const cppfmu::FMIValueReference vr[],
+        std::size_t nvr,
+        const cppfmu::FMIReal value[]) override
+    {
+        SlaveInstance::SetReal(vr, nvr, value);
+        ++m_setCount;
+        Update();
+    }
+
+    bool DoStep(
+        cppfmu::FMIReal,
+        cppfmu::FMIReal,
+        cppfmu::FMIBoolean,
+        cppfmu::FMIReal&) override
+    {
+        return true;
+    }
+
+    // The outputs are computed in SetReal(), so they are always up to date.
+    void EvaluateOutputs() override
+    {
+    }
+
+    void UseEstimator() { UseDerivativeEstimator(m_estimator); }
+
+    cppfmu::DerivativeEstimator& Estimator() { return m_estimator; }
+
+    int SetCount() const { return m_setCount; }
+
+private:
+    void Update()
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            m_y[i] = m_u[i] * m_u[i]
+                + (i > 0 ? m_u[i-1] : 0.0)
+                + (i + 1 < N ? m_u[i+1] : 0.0);
+        }
+    }
+
+    cppfmu::FMIReal m_u[N] = {};
+    cppfmu::FMIReal m_y[N] = {};
+    int m_setCount = 0;
+    cppfmu::VariableTable m_variables;
+    cppfmu::StateTable m_states;
+    cppfmu::DerivativeEstimator m_estimator;
+};
+
+
+/* A slave with outputs y[i] = u[i]^2 + u[(i+1) % N], which it only
+ * computes in DoStep(), like most slaves do.  It doesn't implement
+ * EvaluateOutputs(), so it doesn't support finite-difference derivatives.
+ */
+class Stepped : public cppfmu::SlaveInstance
+{
+public:
+    explicit Stepped(const cppfmu::Memory& memory)
+        : m_variables{memory}
+        , m_states{memory}
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            m_u[i] = 1.0 + i;
+            m_variables.AddReal(static_cast<cppfmu::FMIValueReference>(i), &m_u[i]);
+            m_variables.AddReal(static_cast<cppfmu::FMIValueReference>(100 + i), &m_y[i]);
+        }
+        m_states.Add(m_u);
+        m_states.Add(m_y);
+        UseVariableTable(m_variables);
+        UseStateTable(m_states);
+    }
+
+    bool DoStep(
+        cppfmu::FMIReal,
+        cppfmu::FMIReal,
+        cppfmu::FMIBoolean,
+        cppfmu::FMIReal&) override
+    {
+        Update();
+        return true;
+    }
+
+protected:
+    void Update()
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            m_y[i] = m_u[i] * m_u[i] + m_u[(i + 1) % N];
+        }
+    }
+
+private:
+    cppfmu::FMIReal m_u[N] = {};
+    cppfmu::FMIReal m_y[N] = {};
+    cppfmu::VariableTable m_variables;
+    cppfmu::StateTable m_states;
+};
+
+
+// The same slave, but able to compute its outputs outside DoStep().
+class Evaluating : public Stepped
+{
+public:
+    explicit Evaluating(const cppfmu::Memory& memory) : Stepped(memory) { }
+
+    void EvaluateOutputs() override
+    {
+        if (evaluationsBeforeFailure >= 0 && evaluationsBeforeFailure-- == 0) {
+            throw std::runtime_error("Evaluation failed");
+        }
+        Update();
+    }
+
+    int evaluationsBeforeFailure = -1;
+};
+
+
+double Exact(const Tridiagonal& slave, std::size_t i, std::size_t j)
+{
+    if (i == j) {
+        cppfmu::FMIValueReference vr = static_cast<cppfmu::FMIValueReference>(j);
+        cppfmu::FMIReal u = 0.0;
+        slave.GetReal(&vr, 1, &u);
+        return 2.0 * u;
+    }
+    return (i + 1 == j || j + 1 == i) ? 1.0 : 0.0;
+}
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    cppfmu::FMIValueReference inputs[N], outputs[N];
+    for (std::size_t i = 0; i < N; ++i) {
+        inputs[i] = static_cast<cppfmu::FMIValueReference>(i);
+        outputs[i] = static_cast<cppfmu::FMIValueReference>(100 + i);
+    }
+
+    // Greedy colouring of a tridiagonal structure needs three colours
+    {
+        std::vector<std::size_t> starts{0}, rows;
+        for (std::size_t j = 0; j < N; ++j) {
+            for (std::size_t i = (j > 0 ? j - 1 : 0); i <= j + 1 && i < N; ++i) {
+                rows.push_back(i);
+            }
+            starts.push_back(rows.size());
+        }
+        std::vector<std::size_t> colors(N);
+        const auto count = cppfmu::ColorColumns(
+            memory, N, N, starts.data(), rows.data(), colors.data());
+        assert(count == 3);
+        for (std::size_t j = 0; j < N; ++j) assert(colors[j] == j % 3);
+    }
+
+    // Single directional derivative, without an estimator
+    {
+        Tridiagonal slave{memory};
+        const int setCount = slave.SetCount();
+        cppfmu::FMIReal seed[N] = {}, result[N] = {};
+        seed[2] = 1.0;
+        seed[3] = -0.5;
+        slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+        for (std::size_t i = 0; i < N; ++i) {
+            const auto exact = Exact(slave, i, 2) - 0.5 * Exact(slave, i, 3);
+            assert(std::fabs(result[i] - exact) < 1e-6);
+        }
+        assert(slave.SetCount() == setCount);
+
+        // A zero seed gives zero, without any evaluation
+        const cppfmu::FMIReal zero[N] = {};
+        slave.GetDirectionalDerivative(outputs, N, inputs, N, zero, result);
+        for (std::size_t i = 0; i < N; ++i) assert(result[i] == 0.0);
+        assert(slave.SetCount() == setCount);
+    }
+
+    // Full Jacobian, dense and with a sparsity pattern
+    {
+        Tridiagonal slave{memory};
+        auto& estimator = slave.Estimator();
+        std::vector<cppfmu::FMIReal> jacobian(N * N);
+        estimator.GetJacobian(slave, outputs, N, inputs, N, jacobian.data());
+        assert(estimator.EvaluationCount() == N);
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t j = 0; j < N; ++j) {
+                assert(std::fabs(jacobian[i*N + j] - Exact(slave, i, j)) < 1e-6);
+            }
+        }
+
+        std::vector<std::size_t> rows, columns;
+        for (std::size_t j = 0; j < N; ++j) {
+            for (std::size_t i = (j > 0 ? j - 1 : 0); i <= j + 1 && i < N; ++i) {
+                rows.push_back(i);
+                columns.push_back(j);
+            }
+        }
+        estimator.SetSparsity(
+            outputs, N, inputs, N, rows.data(), columns.data(), rows.size());
+        std::vector<cppfmu::FMIReal> sparse(N * N, -1.0);
+        estimator.GetJacobian(slave, outputs, N, inputs, N, sparse.data());
+        assert(estimator.EvaluationCount() == N + 3);
+        for (std::size_t k = 0; k < N * N; ++k) {
+            assert(std::fabs(sparse[k] - jacobian[k]) < 1e-6);
+        }
+
+        // A subset of the variables, in a different order
+        const cppfmu::FMIValueReference someOutputs[] = {103, 101};
+        const cppfmu::FMIValueReference someInputs[] = {2, 1, 0};
+        cppfmu::FMIReal sub[6] = {};
+        estimator.GetJacobian(slave, someOutputs, 2, someInputs, 3, sub);
+        assert(std::fabs(sub[0] - 1.0) < 1e-6 && sub[1] == 0.0 && sub[2] == 0.0);
+        assert(std::fabs(sub[3] - 1.0) < 1e-6);
+        assert(std::fabs(sub[4] - Exact(slave, 1, 1)) < 1e-6);
+        assert(std::fabs(sub[5] - 1.0) < 1e-6);
+
+        const std::size_t outOfRange = N;
+        const std::size_t zeroIndex = 0;
+        try {
+            estimator.SetSparsity(
+                outputs, N, inputs, N, &outOfRange, &zeroIndex, 1);
+            assert(false);
+        } catch (const std::invalid_argument&) { }
+    }
+
+    // Parallel estimation on clones gives the same result as the serial one
+    {
+        Tridiagonal slave{memory};
+        cppfmu::FMIValueReference vr = 4;
+        const cppfmu::FMIReal u = -3.0;
+        slave.SetReal(&vr, 1, &u);
+
+        std::vector<cppfmu::FMIReal> serial(N * N), parallel(N * N);
+        slave.Estimator().GetJacobian(slave, outputs, N, inputs, N, serial.data());
+
+        int clones = 0;
+        slave.Estimator().SetParallelism(3, [&] {
+            ++clones;
+            return cppfmu::UniquePtr<cppfmu::Instance>{
+                cppfmu::AllocateUnique<Tridiagonal>(memory, memory)};
+        });
+        slave.Estimator().GetJacobian(slave, outputs, N, inputs, N, parallel.data());
+        assert(clones == 2);
+        for (std::size_t k = 0; k < N * N; ++k) assert(parallel[k] == serial[k]);
+
+        // The clones are reused
+        slave.Estimator().GetJacobian(slave, outputs, N, inputs, N, parallel.data());
+        assert(clones == 2);
+        for (std::size_t k = 0; k < N * N; ++k) assert(parallel[k] == serial[k]);
+    }
+
+    // With an estimator, unit seeds are served from one Jacobian
+    {
+        Tridiagonal slave{memory};
+        slave.UseEstimator();
+        const int setCount = slave.SetCount();
+        for (std::size_t j = 0; j < N; ++j) {
+            cppfmu::FMIReal seed[N] = {}, result[N] = {};
+            seed[j] = 1.0;
+            slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+            for (std::size_t i = 0; i < N; ++i) {
+                assert(std::fabs(result[i] - Exact(slave, i, j)) < 1e-6);
+            }
+        }
+        assert(slave.Estimator().EvaluationCount() == N);
+        assert(slave.SetCount() == setCount);
+
+        // After invalidation, the Jacobian is estimated anew
+        cppfmu::FMIValueReference vr = 0;
+        const cppfmu::FMIReal u = 10.0;
+        slave.SetReal(&vr, 1, &u);
+        slave.Estimator().Invalidate();
+        cppfmu::FMIReal seed[N] = {1.0}, result[N] = {};
+        slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+        assert(slave.Estimator().EvaluationCount() == 2 * N);
+        assert(std::fabs(result[0] - 20.0) < 1e-5);
+    }
+
+    // Outputs which are computed in DoStep() are evaluated explicitly, and
+    // left as they were.
+    {
+        Evaluating slave{memory};
+        cppfmu::FMIReal endOfStep = 0.0;
+        const auto completed = slave.DoStep(0.0, 1.0, cppfmu::FMITrue, endOfStep);
+        assert(completed);
+        // The outputs are now out of date.
+        cppfmu::FMIValueReference vr = 3;
+        const cppfmu::FMIReal u = 2.5;
+        slave.SetReal(&vr, 1, &u);
+        cppfmu::FMIReal before[N] = {}, after[N] = {};
+        slave.GetReal(outputs, N, before);
+
+        cppfmu::FMIReal seed[N] = {}, result[N] = {};
+        seed[3] = 1.0;
+        slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+        for (std::size_t i = 0; i < N; ++i) {
+            const auto exact = i == 3 ? 2.0 * u : i == 2 ? 1.0 : 0.0;
+            assert(std::fabs(result[i] - exact) < 1e-6);
+        }
+        slave.GetReal(outputs, N, after);
+        for (std::size_t i = 0; i < N; ++i) assert(after[i] == before[i]);
+
+        // The estimator evaluates the outputs too.
+        cppfmu::DerivativeEstimator estimator{memory};
+        std::vector<cppfmu::FMIReal> jacobian(N * N);
+        estimator.GetJacobian(slave, outputs, N, inputs, N, jacobian.data());
+        assert(std::fabs(jacobian[3*N + 3] - 2.0 * u) < 1e-6);
+        assert(std::fabs(jacobian[2*N + 3] - 1.0) < 1e-6);
+        slave.GetReal(outputs, N, after);
+        for (std::size_t i = 0; i < N; ++i) assert(after[i] == before[i]);
+
+        // If the estimate fails, the state is still restored.
+        cppfmu::FMIReal inputsBefore[N] = {}, inputsAfter[N] = {};
+        slave.GetReal(inputs, N, inputsBefore);
+        slave.evaluationsBeforeFailure = 1;
+        bool threw = false;
+        try {
+            slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        slave.GetReal(inputs, N, inputsAfter);
+        slave.GetReal(outputs, N, after);
+        for (std::size_t i = 0; i < N; ++i) {
+            assert(inputsAfter[i] == inputsBefore[i]);
+            assert(after[i] == before[i]);
+        }
+
+        slave.evaluationsBeforeFailure = 3;
+        threw = false;
+        try {
+            estimator.Invalidate();
+            estimator.GetJacobian(slave, outputs, N, inputs, N, jacobian.data());
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        slave.GetReal(inputs, N, inputsAfter);
+        slave.GetReal(outputs, N, after);
+        for (std::size_t i = 0; i < N; ++i) {
+            assert(inputsAfter[i] == inputsBefore[i]);
+            assert(after[i] == before[i]);
+        }
+    }
+
+    // A slave which can't evaluate its outputs outside DoStep() can't
+    // estimate derivatives, rather than report zeros.
+    {
+        Stepped slave{memory};
+        cppfmu::FMIReal seed[N] = {1.0}, result[N] = {};
+        bool threw = false;
+        try {
+            slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+        } catch (const std::logic_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // FMU state support is required
+    {
+        Tridiagonal slave{memory, false};
+        cppfmu::FMIReal seed[N] = {1.0}, result[N] = {};
+        try {
+            slave.GetDirectionalDerivative(outputs, N, inputs, N, seed, result);
+            assert(false);
+        } catch (const std::logic_error&) { }
+    }
+
+    return 0;
+}
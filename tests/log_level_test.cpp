@@ -0,0 +1,68 @@
+// Checks that log statements below CPPFMU_MIN_LOG_LEVEL are compiled out.
+// CPPFMU_MIN_LOG_LEVEL is set to CPPFMU_LOG_LEVEL_INFO in CMakeLists.txt.
+#include <cppfmu_common.hpp>
+
+#include <cassert>
+#include <memory>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    int logCount = 0;
+
+    extern "C" void logger(
+        cppfmu::FMIComponentEnvironment,
+        cppfmu::FMIString,
+        cppfmu::FMIStatus,
+        cppfmu::FMIString,
+        cppfmu::FMIString,
+        ...)
+    {
+        ++logCount;
+    }
+
+    int evaluations = 0;
+
+    int Evaluate()
+    {
+        return ++evaluations;
+    }
+}
+
+
+int main()
+{
+    static_assert(CPPFMU_MIN_LOG_LEVEL == CPPFMU_LOG_LEVEL_INFO, "CPPFMU_MIN_LOG_LEVEL not set");
+    static_assert(!CPPFMU_LOG_LEVEL_ENABLED(CPPFMU_LOG_LEVEL_DEBUG), "DEBUG should be disabled");
+    static_assert(CPPFMU_LOG_LEVEL_ENABLED(CPPFMU_LOG_LEVEL_INFO), "INFO should be enabled");
+
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto memory = cppfmu::Memory{callbacks};
+    const auto settings = std::make_shared<cppfmu::Logger::Settings>(memory);
+    settings->debugLoggingEnabled = true;
+    settings->Update();
+    auto log = cppfmu::Logger{
+        nullptr, cppfmu::CopyString(memory, "test"), callbacks, settings};
+    const auto category = log.RegisterCategory("test");
+
+    // Compiled out, even though debug logging is enabled at run time
+    CPPFMU_LOG_TRACE(log, category, "%d", Evaluate());
+    CPPFMU_LOG_DEBUG(log, "test", "%d", Evaluate());
+    assert(logCount == 0 && evaluations == 0);
+
+    // Compiled in
+    CPPFMU_LOG_INFO(log, category, "%d", Evaluate());
+    CPPFMU_LOG_WARNING(log, "test", "%d", Evaluate());
+    CPPFMU_LOG_ERROR(log, category, "message");
+    assert(logCount == 3 && evaluations == 2);
+
+    // Disabled at run time: the arguments are not evaluated.
+    settings->loggedCategories.push_back(cppfmu::CopyString(memory, "other"));
+    settings->Update();
+    CPPFMU_LOG_INFO(log, category, "%d", Evaluate());
+    CPPFMU_LOG_WARNING(log, "test", "%d", Evaluate());
+    assert(logCount == 3 && evaluations == 2);
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <cppfmu_logging.hpp>
+
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    int logCount = 0;
+    std::string lastCategory;
+    std::string lastMessage;
+    cppfmu::FMIStatus lastStatus = cppfmu::FMIOK;
+
+    extern "C" void logger(
+        cppfmu::FMIComponentEnvironment,
+        cppfmu::FMIString,
+        cppfmu::FMIStatus status,
+        cppfmu::FMIString category,
+        cppfmu::FMIString message,
+        ...)
+    {
+        ++logCount;
+        lastCategory = category;
+        lastStatus = status;
+        char buffer[1024];
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(buffer, sizeof buffer, message, args);
+        va_end(args);
+        lastMessage = buffer;
+    }
+
+    bool BufferMessage(cppfmu::LogBuffer& buffer, int thread, ...)
+    {
+        const char category[] = {static_cast<char>('0' + thread), '\0'};
+        std::va_list args;
+        va_start(args, thread);
+        const auto ok = buffer.Push(cppfmu::FMIOK, category, "%d", args);
+        va_end(args);
+        return ok;
+    }
+
+    void SetLoggedCategories(
+        cppfmu::Logger::Settings& settings,
+        const cppfmu::Memory& memory,
+        std::initializer_list<const char*> categories)
+    {
+        settings.loggedCategories.clear();
+        for (const auto c : categories) {
+            settings.loggedCategories.push_back(cppfmu::CopyString(memory, c));
+        }
+        settings.Update();
+    }
+}
+
+
+int main()
+{
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto memory = cppfmu::Memory{callbacks};
+    const auto settings = std::make_shared<cppfmu::Logger::Settings>(memory);
+    settings->Update();
+    auto log = cppfmu::Logger{
+        nullptr, cppfmu::CopyString(memory, "test"), callbacks, settings};
+
+    // Registration is idempotent, and copies share the categories.
+    const auto a = log.RegisterCategory("a");
+    const auto b = log.RegisterCategory("b");
+    assert(a.Id() == 0 && b.Id() == 1);
+    auto copy = log;
+    const auto copyOfB = copy.RegisterCategory("b");
+    assert(copyOfB.Id() == 1);
+    assert(std::strcmp(copy.CategoryName(a), "a") == 0);
+
+    // All categories are enabled by default, but debug logging is off.
+    assert(log.Enabled(a) && log.Enabled(b));
+    assert(!log.DebugEnabled(a) && !log.DebugEnabled(b));
+    log.Log(cppfmu::FMIOK, b, "message %d", 1);
+    assert(logCount == 1 && lastCategory == "b");
+    log.DebugLog(cppfmu::FMIOK, b, "message");
+    assert(logCount == 1);
+
+    // Restricting the categories
+    settings->debugLoggingEnabled = true;
+    SetLoggedCategories(*settings, memory, {"b", "c"});
+    assert(!log.Enabled(a) && log.Enabled(b));
+    assert(!log.DebugEnabled(a) && log.DebugEnabled(b));
+    log.DebugLog(cppfmu::FMIOK, a, "message");
+    assert(logCount == 1);
+    log.DebugLog(cppfmu::FMIOK, b, "message");
+    assert(logCount == 2);
+
+    // Categories registered later take the current settings into account.
+    const auto c = log.RegisterCategory("c");
+    const auto d = log.RegisterCategory("d");
+    assert(log.Enabled(c) && !log.Enabled(d));
+    log.Log(cppfmu::FMIOK, c, "message");
+    assert(logCount == 3 && lastCategory == "c");
+
+    // The string-based functions are equivalent.
+    log.Log(cppfmu::FMIOK, "a", "message");
+    log.DebugLog(cppfmu::FMIOK, "c", "message");
+    assert(logCount == 4);
+
+    SetLoggedCategories(*settings, memory, {});
+    assert(log.Enabled(a) && log.DebugEnabled(d));
+
+    // Limit
+    for (unsigned i = 4; i < cppfmu::Logger::MAX_CATEGORIES; ++i) {
+        log.RegisterCategory(std::to_string(i).c_str());
+    }
+    const auto last = log.RegisterCategory("63");
+    assert(last.Id() == 63 && log.Enabled(last));
+    bool threw = false;
+    try { log.RegisterCategory("too many"); } catch (const std::length_error&) { threw = true; }
+    assert(threw);
+
+    // Buffering
+    log.EnableBuffering(4);
+    logCount = 0;
+    log.Log(cppfmu::FMIOK, a, "message %d", 1);
+    copy.Log(cppfmu::FMIWarning, "b", "message %s", "100%");
+    assert(logCount == 0);
+    log.Flush();
+    assert(logCount == 2);
+    assert(lastStatus == cppfmu::FMIWarning && lastCategory == "b");
+    assert(lastMessage == "message 100%");
+
+    // Errors are not buffered, but flush the buffer first.
+    log.Log(cppfmu::FMIOK, a, "message %d", 2);
+    log.Log(cppfmu::FMIError, "", "error");
+    assert(logCount == 4 && lastMessage == "error");
+
+    // Overflow
+    for (int i = 0; i < 10; ++i) log.Log(cppfmu::FMIOK, a, "message %d", i);
+    assert(logCount == 4);
+    log.Flush();
+    assert(logCount == 9);
+    assert(lastStatus == cppfmu::FMIWarning && lastCategory == "cppfmu");
+    assert(lastMessage.find("6 log messages") == 0);
+    log.Flush();
+    assert(logCount == 9);
+
+    // Truncation
+    {
+        const std::string longMessage(1000, 'x');
+        log.Log(cppfmu::FMIOK, a, "%s", longMessage.c_str());
+        log.Flush();
+        assert(lastMessage.size() == cppfmu::LogBuffer::MAX_MESSAGE_LENGTH);
+    }
+
+    // Concurrent producers
+    {
+        cppfmu::LogBuffer buffer{memory, 64};
+        assert(buffer.Capacity() == 64);
+        std::vector<std::thread> threads;
+        int received[4] = {};
+        bool ordered = true;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 1000; ++i) {
+                    while (!BufferMessage(buffer, t, i)) std::this_thread::yield();
+                }
+            });
+        }
+        int total = 0;
+        while (total < 4000) {
+            buffer.Drain([&] (cppfmu::FMIStatus, cppfmu::FMIString category, cppfmu::FMIString message) {
+                const auto t = category[0] - '0';
+                ordered = ordered && std::atoi(message) == received[t];
+                ++received[t];
+                ++total;
+            });
+        }
+        for (auto& th : threads) th.join();
+        assert(ordered);
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include <cppfmu_me.hpp>
+#include <cppfmu_variables.hpp>
+#include <fmi2Functions.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    int evaluations = 0;
+}
+
+
+// A bouncing ball.  States: height and velocity.  Event indicator: height.
+class Ball : public cppfmu::ModelInstance
+{
+public:
+    explicit Ball(cppfmu::Memory memory)
+        : variables_(memory)
+    {
+        variables_.AddReal(0, x_, 2);
+        variables_.AddReal(2, &restitution_);
+        variables_.AddReal(3, &kineticEnergy_);
+        UseVariableTable(variables_);
+        UseContinuousStates(x_, dx_, 2);
+        UseEventIndicators(z_, 1);
+    }
+
+    void NewDiscreteStates(cppfmu::EventInfo& eventInfo) override
+    {
+        if (x_[0] <= 0.0 && x_[1] < 0.0) {
+            x_[0] = 0.0;
+            x_[1] = -restitution_ * x_[1];
+            eventInfo.valuesOfContinuousStatesChanged = true;
+        }
+    }
+
+protected:
+    void Evaluate() override
+    {
+        ++evaluations;
+        dx_[0] = x_[1];
+        dx_[1] = -9.81;
+        z_[0] = x_[0];
+        kineticEnergy_ = 0.5 * x_[1] * x_[1];
+    }
+
+private:
+    cppfmu::VariableTable variables_;
+    cppfmu::FMIReal x_[2] = {1.0, 0.0};
+    cppfmu::FMIReal dx_[2];
+    cppfmu::FMIReal z_[1];
+    cppfmu::FMIReal restitution_ = 0.5;
+    // An output, per unit mass.
+    cppfmu::FMIReal kineticEnergy_ = 0.0;
+};
+
+
+cppfmu::UniquePtr<cppfmu::ModelInstance> CppfmuInstantiateModel(
+    cppfmu::FMIString /*instanceName*/,
+    cppfmu::FMIString /*fmuGUID*/,
+    cppfmu::FMIString /*fmuResourceLocation*/,
+    cppfmu::FMIBoolean /*visible*/,
+    cppfmu::Memory memory,
+    cppfmu::Logger /*logger*/)
+{
+    return cppfmu::AllocateUnique<Ball>(memory, memory);
+}
+
+
+extern "C" void logger(
+    fmi2ComponentEnvironment,
+    fmi2String,
+    fmi2Status,
+    fmi2String,
+    fmi2String message,
+    ...) noexcept
+{
+    std::fprintf(stderr, "%s\n", message);
+}
+
+
+int main()
+{
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto instance = fmi2Instantiate(
+        "ball",
+        fmi2ModelExchange,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(instance);
+
+    // Co-simulation functions are rejected.
+    {
+        const auto rc = fmi2DoStep(instance, 0.0, 0.1, fmi2True);
+        assert(rc == fmi2Error);
+    }
+    {
+        const auto rc = fmi2CancelStep(instance);
+        assert(rc == fmi2Error);
+    }
+
+    {
+        const auto rc = fmi2SetupExperiment(
+            instance, fmi2False, 0.0, 0.0, fmi2False, 0.0);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2EnterInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2ExitInitializationMode(instance);
+        assert(rc == fmi2OK);
+    }
+    fmi2EventInfo eventInfo;
+    {
+        const auto rc = fmi2NewDiscreteStates(instance, &eventInfo);
+        assert(rc == fmi2OK);
+    }
+    assert(!eventInfo.newDiscreteStatesNeeded && !eventInfo.terminateSimulation);
+    assert(!eventInfo.nextEventTimeDefined);
+    {
+        const auto rc = fmi2EnterContinuousTimeMode(instance);
+        assert(rc == fmi2OK);
+    }
+
+    fmi2Real nominals[2];
+    {
+        const auto rc =
+            fmi2GetNominalsOfContinuousStates(instance, nominals, 2);
+        assert(rc == fmi2OK);
+    }
+    assert(nominals[0] == 1.0 && nominals[1] == 1.0);
+
+    // Integrate with explicit Euler until the ball bounces.
+    const double h = 0.001;
+    double t = 0.0;
+    fmi2Real x[2], dx[2], z[1];
+    {
+        const auto rc = fmi2GetContinuousStates(instance, x, 2);
+        assert(rc == fmi2OK);
+    }
+    assert(x[0] == 1.0 && x[1] == 0.0);
+    bool bounced = false;
+    int steps = 0;
+    evaluations = 0;
+    while (t < 1.0) {
+        // Derivatives and event indicators at the same point only cost one
+        // evaluation, including the event indicators at the end of the
+        // previous step.
+        {
+            const auto rc = fmi2GetDerivatives(instance, dx, 2);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2GetEventIndicators(instance, z, 1);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2GetDerivatives(instance, dx, 2);
+            assert(rc == fmi2OK);
+        }
+        ++steps;
+        assert(evaluations == steps);
+
+        t += h;
+        x[0] += h * dx[0];
+        x[1] += h * dx[1];
+        {
+            const auto rc = fmi2SetTime(instance, t);
+            assert(rc == fmi2OK);
+        }
+        {
+            const auto rc = fmi2SetContinuousStates(instance, x, 2);
+            assert(rc == fmi2OK);
+        }
+        fmi2Boolean enterEventMode, terminateSimulation;
+        {
+            const auto rc = fmi2CompletedIntegratorStep(
+                instance, fmi2True, &enterEventMode, &terminateSimulation);
+            assert(rc == fmi2OK);
+        }
+        assert(!enterEventMode && !terminateSimulation);
+
+        {
+            const auto rc = fmi2GetEventIndicators(instance, z, 1);
+            assert(rc == fmi2OK);
+        }
+        if (z[0] <= 0.0) {
+            auto rc = fmi2EnterEventMode(instance);
+            assert(rc == fmi2OK);
+            rc = fmi2NewDiscreteStates(instance, &eventInfo);
+            assert(rc == fmi2OK);
+            assert(eventInfo.valuesOfContinuousStatesChanged);
+            rc = fmi2EnterContinuousTimeMode(instance);
+            assert(rc == fmi2OK);
+            rc = fmi2GetContinuousStates(instance, x, 2);
+            assert(rc == fmi2OK);
+            assert(x[0] == 0.0 && x[1] > 0.0);
+            bounced = true;
+            break;
+        }
+    }
+    assert(bounced);
+    // The ball falls 1 m in about sqrt(2/9.81) s.
+    assert(t > 0.44 && t < 0.46);
+
+    // Setting variables invalidates the evaluation.
+    const fmi2ValueReference vr = 2;
+    const fmi2Real restitution = 0.9;
+    evaluations = 0;
+    {
+        const auto rc = fmi2GetDerivatives(instance, dx, 2);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2GetDerivatives(instance, dx, 2);
+        assert(rc == fmi2OK);
+    }
+    assert(evaluations == 1);
+    {
+        const auto rc = fmi2SetReal(instance, &vr, 1, &restitution);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2GetDerivatives(instance, dx, 2);
+        assert(rc == fmi2OK);
+    }
+    assert(evaluations == 2);
+
+    // Outputs are evaluated for the current states before they are read.
+    {
+        const fmi2Real newStates[] = {0.5, -2.0};
+        const auto rc = fmi2SetContinuousStates(instance, newStates, 2);
+        assert(rc == fmi2OK);
+    }
+    {
+        const fmi2ValueReference outputVR = 3;
+        fmi2Real energy = 0.0;
+        const auto rc = fmi2GetReal(instance, &outputVR, 1, &energy);
+        assert(rc == fmi2OK);
+        assert(energy == 2.0);
+    }
+    {
+        const auto rc = fmi2GetDerivatives(instance, dx, 2);
+        assert(rc == fmi2OK);
+    }
+    assert(evaluations == 3);
+
+    // Array sizes are checked.
+    {
+        const auto rc = fmi2GetDerivatives(instance, dx, 1);
+        assert(rc == fmi2Error);
+    }
+    {
+        const auto rc = fmi2SetContinuousStates(instance, x, 3);
+        assert(rc == fmi2Error);
+    }
+
+    {
+        const auto rc = fmi2Terminate(instance);
+        assert(rc == fmi2OK);
+    }
+    fmi2FreeInstance(instance);
+
+    // Co-simulation instances can still be created, but don't support
+    // model exchange functions.
+    const auto slave = fmi2Instantiate(
+        "slave",
+        fmi2CoSimulation,
+        "04b947f3-c057-4860-b59b-eb0bd6fa52be",
+        nullptr,
+        &callbacks,
+        fmi2False,
+        fmi2False);
+    assert(slave);
+    {
+        const auto rc = fmi2DoStep(slave, 0.0, 0.1, fmi2True);
+        assert(rc == fmi2OK);
+    }
+    {
+        const auto rc = fmi2GetDerivatives(slave, dx, 2);
+        assert(rc == fmi2Error);
+    }
+    fmi2FreeInstance(slave);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <cppfmu_monitor.hpp>
+
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    struct Message
+    {
+        cppfmu::FMIStatus status;
+        std::string category;
+        std::string text;
+    };
+    std::vector<Message> messages;
+
+    extern "C" void logger(
+        cppfmu::FMIComponentEnvironment,
+        cppfmu::FMIString,
+        cppfmu::FMIStatus status,
+        cppfmu::FMIString category,
+        cppfmu::FMIString message,
+        ...)
+    {
+        char buffer[1024];
+        std::va_list args;
+        va_start(args, message);
+        std::vsnprintf(buffer, sizeof buffer, message, args);
+        va_end(args);
+        messages.push_back(Message{status, category, buffer});
+    }
+
+    bool Near(double a, double b)
+    {
+        return a >= b && a <= b * 1.125;
+    }
+}
+
+
+int main()
+{
+    const auto callbacks = cppfmu_test::Callbacks(&logger);
+    const auto memory = cppfmu::Memory{callbacks};
+    const auto settings = std::make_shared<cppfmu::Logger::Settings>(memory);
+    settings->Update();
+    auto log = cppfmu::Logger{
+        nullptr, cppfmu::CopyString(memory, "test"), callbacks, settings};
+
+    // Several percentiles in one pass agree with separate calls.
+    cppfmu::LatencyHistogram histogram;
+    for (std::uint64_t v = 1; v <= 10000; ++v) histogram.Record(v * 37);
+    const double p[] = { 0.0, 50.0, 99.0, 99.9, 100.0 };
+    std::uint64_t values[5];
+    histogram.Percentiles(p, values, 5);
+    for (int i = 0; i < 5; ++i) assert(values[i] == histogram.Percentile(p[i]));
+
+    // A deadline of zero means "the step size".  Steps of 1 ms take 0.5 ms,
+    // except every 10th step, which takes 2 ms.
+    cppfmu::StepMonitor monitor{0.0, 50};
+    cppfmu::VariableTable table{memory};
+    monitor.AddOutputs(table, 100, 200);
+    for (int i = 0; i < 100; ++i) {
+        const std::uint64_t ns = (i % 10 == 9) ? 2000000 : 500000;
+        monitor.Record(i * 0.001, 0.001, ns, log);
+        if (i == 48) assert(messages.empty());
+    }
+    assert(monitor.StepCount() == 100);
+    assert(monitor.DeadlineMissCount() == 10);
+    assert(monitor.MaxStepTime() == 2000000);
+
+    // The misses are logged in two batches.
+    assert(messages.size() == 2);
+    for (const auto& m : messages) {
+        assert(m.status == cppfmu::FMIWarning);
+        assert(m.category == "cppfmu.realtime");
+        assert(m.text.find("5 of the last 50 steps missed their deadline") == 0);
+        assert(m.text.find("worst: 2.000ms for a deadline of 1.000ms") != std::string::npos);
+    }
+    assert(messages[0].text.find("at t=0.009)") != std::string::npos);
+    assert(messages[1].text.find("at t=0.059)") != std::string::npos);
+
+    // The outputs can be read from the variable table.
+    const cppfmu::FMIValueReference realVrs[] = { 100, 101, 102, 103, 104 };
+    cppfmu::FMIReal reals[5];
+    table.GetReal(realVrs, 5, reals);
+    assert(reals[cppfmu::StepMonitor::LAST_STEP_TIME] == 0.002);
+    assert(Near(reals[cppfmu::StepMonitor::STEP_TIME_P50], 0.0005));
+    assert(reals[cppfmu::StepMonitor::STEP_TIME_P99] == 0.002);
+    assert(reals[cppfmu::StepMonitor::STEP_TIME_P999] == 0.002);
+    assert(reals[cppfmu::StepMonitor::STEP_TIME_MAX] == 0.002);
+    const cppfmu::FMIValueReference integerVrs[] = { 200, 201 };
+    cppfmu::FMIInteger integers[2];
+    table.GetInteger(integerVrs, 2, integers);
+    assert(integers[cppfmu::StepMonitor::STEP_COUNT] == 100);
+    assert(integers[cppfmu::StepMonitor::DEADLINE_MISS_COUNT] == 10);
+
+    // With a fixed deadline, and reporting only at the end.
+    messages.clear();
+    monitor.Clear();
+    assert(monitor.StepCount() == 0);
+    assert(monitor.Output(cppfmu::StepMonitor::STEP_TIME_MAX) == 0.0);
+    monitor.SetDeadline(0.003);
+    monitor.SetReportInterval(0);
+    monitor.Record(0.0, 0.001, 2000000, log);
+    monitor.Record(0.001, 0.001, 4000000, log);
+    monitor.Record(0.002, 0.001, 1000000, log);
+    assert(messages.empty());
+    assert(monitor.Output(cppfmu::StepMonitor::DEADLINE_MISS_COUNT) == 1);
+    assert(monitor.Output(cppfmu::StepMonitor::LAST_STEP_TIME) == 0.001);
+    monitor.Report(log);
+    assert(messages.size() == 2);
+    assert(messages[0].text.find("1 of the last 3 steps") == 0);
+    assert(messages[0].text.find("deadline of 3.000ms, at t=0.001)") != std::string::npos);
+    assert(messages[1].status == cppfmu::FMIOK);
+    assert(messages[1].text.find("Step time: steps=3 misses=1 ") == 0);
+    assert(messages[1].text.find(" max=4.000ms") != std::string::npos);
+
+    // Nothing more to report.
+    monitor.Report(log);
+    assert(messages.size() == 3);
+    assert(messages[2].status == cppfmu::FMIOK);
+    return 0;
+}
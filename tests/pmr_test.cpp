@@ -0,0 +1,63 @@
+#include <cppfmu_pmr.hpp>
+
+#include <cassert>
+#include <cstdint>
+
+#if !CPPFMU_HAS_PMR
+#   error "This test requires std::pmr support"
+#endif
+
+#include "test_memory.hpp"
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    {
+        cppfmu::MemoryResource host{memory};
+        assert(host.GetMemory() == memory);
+        assert(host.is_equal(host));
+        assert(host == cppfmu::MemoryResource{memory});
+        assert(!host.is_equal(*std::pmr::new_delete_resource()));
+
+        // Direct use, with fundamental and extended alignment
+        const auto p = host.allocate(100, 8);
+        const auto q = host.allocate(100, 256);
+        assert(reinterpret_cast<std::uintptr_t>(q) % 256 == 0);
+        assert(cppfmu_test::AllocationCount() == 2);
+        host.deallocate(p, 100, 8);
+        host.deallocate(q, 100, 256);
+        assert(cppfmu_test::FreeCount() == 2);
+
+        // Containers
+        {
+            cppfmu::pmr::String s{"a string which is too long for SSO", &host};
+            cppfmu::pmr::Vector<double> v{&host};
+            for (int i = 0; i < 100; ++i) v.push_back(i);
+            assert(v[99] == 99.0 && s.size() > 30);
+            assert(cppfmu_test::AllocationCount() > 3);
+        }
+        assert(cppfmu_test::AllocationCount() == cppfmu_test::FreeCount());
+
+        // A standard pool on top of host memory
+        {
+            std::pmr::unsynchronized_pool_resource pool{&host};
+            const auto before = cppfmu_test::AllocationCount();
+            {
+                cppfmu::pmr::Vector<cppfmu::pmr::String> strings{&pool};
+                for (int i = 0; i < 1000; ++i) {
+                    strings.emplace_back(64, 'x');
+                }
+                strings.clear();
+                for (int i = 0; i < 1000; ++i) {
+                    strings.emplace_back(64, 'y');
+                }
+            }
+            const auto after = cppfmu_test::AllocationCount();
+            assert(after > before && after < before + 100);
+        }
+        assert(cppfmu_test::AllocationCount() == cppfmu_test::FreeCount());
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <cppfmu_pool.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+namespace
+{
+    bool IsZero(const void* p, std::size_t size)
+    {
+        const auto b = static_cast<const unsigned char*>(p);
+        for (std::size_t i = 0; i < size; ++i) if (b[i] != 0) return false;
+        return true;
+    }
+
+    struct Counted
+    {
+        explicit Counted(int& c) : count(c) { ++count; }
+        ~Counted() { --count; }
+        int& count;
+    };
+}
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    {
+        cppfmu::PoolMemory pool{memory, false, 4096};
+        auto pooled = cppfmu::Memory{pool};
+        assert(pooled == cppfmu::Memory{pool});
+        assert(!(pooled == memory));
+
+        // Blocks are zeroed and aligned, and freed blocks are recycled
+        // without going to the simulation environment.
+        const auto a = pooled.Alloc(3, 8);
+        assert(a != nullptr && IsZero(a, 24));
+        assert(reinterpret_cast<std::uintptr_t>(a) % 16 == 0);
+        assert(cppfmu_test::AllocationCount() == 1);
+        std::memset(a, 0xff, 24);
+        pooled.Free(a);
+        const auto b = pooled.Alloc(1, 20);
+        assert(b == a && IsZero(b, 20));
+        pooled.Free(b);
+        assert(cppfmu_test::FreeCount() == 0);
+
+        // Different size classes don't share blocks.
+        const auto c = pooled.Alloc(1, 100);
+        const auto d = pooled.Alloc(1, 1000);
+        assert(c != a && d != a && c != d);
+        pooled.Free(c);
+        pooled.Free(d);
+
+        // Large allocations bypass the pool.
+        const auto allocsBefore = cppfmu_test::AllocationCount();
+        const auto e = pooled.Alloc(1, cppfmu::PoolMemory::MAX_POOLED_SIZE + 1);
+        assert(e != nullptr && cppfmu_test::AllocationCount() == allocsBefore + 1);
+        pooled.Free(e);
+        assert(cppfmu_test::FreeCount() == 1);
+
+        // Overflow
+        const auto huge = pooled.Alloc(static_cast<std::size_t>(-1) / 2, 4);
+        assert(huge == nullptr);
+
+        auto s = pool.Statistics();
+        assert(s.allocations == 5 && s.deallocations == 5);
+        assert(s.upstreamAllocations == 4 && s.upstreamDeallocations == 1);
+        assert(s.bytesInUse == 0 && s.bytesReserved == 3 * 4096);
+
+        // Containers, New()/Delete() and AllocateUnique()
+        {
+            using Alloc = cppfmu::Allocator<std::pair<const int, double>>;
+            std::map<int, double, std::less<int>, Alloc> m{Alloc{pooled}};
+            for (int i = 0; i < 1000; ++i) m[i] = i;
+            assert(pool.Statistics().allocations == 1005);
+            assert(pool.Statistics().bytesInUse >= 1000 * sizeof(double));
+
+            int count = 0;
+            const auto p = cppfmu::New<Counted>(pooled, count);
+            assert(count == 1);
+            cppfmu::Delete(pooled, p);
+            assert(count == 0);
+            {
+                auto u = cppfmu::AllocateUnique<Counted>(pooled, count);
+                assert(count == 1);
+            }
+            assert(count == 0);
+        }
+        s = pool.Statistics();
+        assert(s.allocations == s.deallocations && s.bytesInUse == 0);
+    }
+    assert(cppfmu_test::AllocationCount() == cppfmu_test::FreeCount());
+
+    // Concurrent use
+    {
+        cppfmu::PoolMemory pool{memory};
+        auto pooled = cppfmu::Memory{pool};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&pooled, t] {
+                std::vector<void*> blocks;
+                for (int i = 0; i < 10000; ++i) {
+                    const auto size = static_cast<std::size_t>(8 + (i * 7 + t) % 200);
+                    const auto p = pooled.Alloc(1, size);
+                    assert(p != nullptr && IsZero(p, size));
+                    std::memset(p, t + 1, size);
+                    blocks.push_back(p);
+                    if (blocks.size() > 50) {
+                        pooled.Free(blocks.front());
+                        blocks.erase(blocks.begin());
+                    }
+                }
+                for (const auto p : blocks) pooled.Free(p);
+            });
+        }
+        for (auto& t : threads) t.join();
+        const auto s = pool.Statistics();
+        assert(s.allocations == 40000 && s.deallocations == 40000);
+        assert(s.bytesInUse == 0);
+    }
+    assert(cppfmu_test::AllocationCount() == cppfmu_test::FreeCount());
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <cppfmu_serialization.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+    const char* const GUID = "{f1e4a1d6-7a3c-4f8e-9c55-2b61f0c8a9d3}";
+    const std::uint32_t TAG_A = 0x41414141;
+    const std::uint32_t TAG_B = 0x42424242;
+
+    void Write(cppfmu::StateWriter& w)
+    {
+        const double reals[] = {1.0, -2.5, 1e300};
+        const std::int16_t shorts[] = {1, -1, 32767};
+        w.BeginSection(TAG_A);
+        w.WriteUInt32(0xdeadbeef);
+        w.WriteReal(3.25);
+        w.WriteInt64(-42);
+        w.WriteArray(shorts, 3);
+        w.WriteArray(reals, 3);
+        w.WriteString("hello", 5);
+        w.EndSection();
+        w.BeginSection(TAG_B);
+        w.WriteInt32(-7);
+        w.WriteUInt64(7);
+        w.EndSection();
+    }
+
+    template<typename F>
+    bool Throws(F f)
+    {
+        try { f(); } catch (const std::exception&) { return true; }
+        return false;
+    }
+}
+
+
+int main()
+{
+    // The measuring writer agrees with the real one.
+    cppfmu::StateWriter measure{GUID};
+    Write(measure);
+    const auto size = measure.Finish();
+    assert(size % 8 == 0);
+
+    std::vector<cppfmu::FMIByte> data(size);
+    cppfmu::StateWriter writer{data.data(), data.size(), GUID};
+    Write(writer);
+    const auto written = writer.Finish();
+    assert(written == size);
+
+    // The header is little-endian.
+    assert(data[0] == 'C' && data[1] == 'F' && data[2] == 'M' && data[3] == 'U');
+    assert(data[4] == 1 && data[5] == 0);
+
+    // Round trip.  Fields which are not read are skipped when the next
+    // section is opened.
+    {
+        cppfmu::StateReader r{data.data(), data.size(), GUID};
+        r.OpenSection(TAG_A);
+        const auto u32 = r.ReadUInt32();
+        assert(u32 == 0xdeadbeef);
+        const auto real = r.ReadReal();
+        assert(real == 3.25);
+        const auto i64 = r.ReadInt64();
+        assert(i64 == -42);
+        std::int16_t shorts[3];
+        r.ReadArray(shorts, 3);
+        assert(shorts[0] == 1 && shorts[1] == -1 && shorts[2] == 32767);
+        double reals[3];
+        r.ReadArray(reals, 3);
+        assert(reals[0] == 1.0 && reals[1] == -2.5 && reals[2] == 1e300);
+        std::string s;
+        r.ReadString(s);
+        assert(s == "hello");
+        const auto threw = Throws([&] { r.ReadUInt32(); });
+        assert(threw);
+    }
+    {
+        cppfmu::StateReader r{data.data(), data.size(), GUID};
+        r.OpenSection(TAG_A);
+        r.ReadUInt32();
+        r.OpenSection(TAG_B);
+        const auto i32 = r.ReadInt32();
+        assert(i32 == -7);
+        const auto u64 = r.ReadUInt64();
+        assert(u64 == 7);
+    }
+    {
+        cppfmu::StateReader r{data.data(), data.size(), GUID};
+        const auto threw = Throws([&] { r.OpenSection(TAG_B); });
+        assert(threw);
+    }
+
+    // Incompatible or damaged data is rejected.
+    {
+        const auto otherGuid = Throws([&] {
+            cppfmu::StateReader r(data.data(), data.size(), "other");
+        });
+        assert(otherGuid);
+        const auto truncated = Throws([&] {
+            cppfmu::StateReader r(data.data(), data.size() - 8, GUID);
+        });
+        assert(truncated);
+        const auto headerOnly = Throws([&] {
+            cppfmu::StateReader r(data.data(), 16, GUID);
+        });
+        assert(headerOnly);
+    }
+    {
+        auto bad = data;
+        bad[4] = 2;
+        const auto threw = Throws([&] {
+            cppfmu::StateReader r(bad.data(), bad.size(), GUID);
+        });
+        assert(threw);
+    }
+    {
+        auto bad = data;
+        bad[size - 10] ^= 1;
+        const auto threw = Throws([&] {
+            cppfmu::StateReader r(bad.data(), bad.size(), GUID);
+        });
+        assert(threw);
+    }
+
+    // The buffer must be large enough.
+    {
+        std::vector<cppfmu::FMIByte> small(size - 8);
+        cppfmu::StateWriter w{small.data(), small.size(), GUID};
+        const auto threw = Throws([&] { Write(w); w.Finish(); });
+        assert(threw);
+    }
+
+    // Compression of typical model state: zeros, repeated values and
+    // slowly varying numbers.
+    {
+        std::vector<double> values(4096, 0.0);
+        for (std::size_t i = 0; i < 1024; ++i) values[i] = std::sin(i * 0.001);
+        for (std::size_t i = 1024; i < 2048; ++i) values[i] = 42.0;
+        const auto write = [&] (cppfmu::StateWriter& w) {
+            w.BeginSection(TAG_A);
+            w.WriteArray(values.data(), values.size());
+            w.EndSection();
+            return w.Finish();
+        };
+        cppfmu::StateWriter m{GUID};
+        std::vector<cppfmu::FMIByte> state(write(m));
+        cppfmu::StateWriter w{state.data(), state.size(), GUID};
+        write(w);
+
+        std::vector<cppfmu::FMIByte> compressed(state.size());
+        const auto n = cppfmu::CompressState(state.data(), state.size(), compressed.data());
+        assert(n < state.size() / 4);
+        assert(cppfmu::IsCompressedState(compressed.data(), n));
+        assert(!cppfmu::IsCompressedState(state.data(), state.size()));
+        const auto unreadable = Throws([&] {
+            cppfmu::StateReader r(compressed.data(), n, GUID);
+        });
+        assert(unreadable);
+
+        const auto decompressedSize =
+            cppfmu::DecompressedStateSize(compressed.data(), n);
+        assert(decompressedSize == state.size());
+        std::vector<cppfmu::FMIByte> decompressed(state.size());
+        cppfmu::DecompressState(compressed.data(), n, decompressed.data());
+        assert(decompressed == state);
+        cppfmu::StateReader r{decompressed.data(), decompressed.size(), GUID};
+
+        // A size which the compressed data doesn't back up is rejected
+        {
+            auto forged = compressed;
+            forged[32 + 5] = 0x10;
+            const auto threw = Throws([&] {
+                cppfmu::DecompressedStateSize(forged.data(), n);
+            });
+            assert(threw);
+        }
+
+        // Damaged compressed data is rejected
+        compressed[n - 1] ^= 1;
+        const auto damaged = Throws([&] {
+            cppfmu::DecompressState(compressed.data(), n, decompressed.data());
+        });
+        assert(damaged);
+    }
+
+    // Incompressible data is stored as-is.
+    {
+        std::uint64_t x = 88172645463325252u;
+        std::vector<std::uint64_t> noise(512);
+        for (auto& v : noise) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            v = x;
+        }
+        cppfmu::StateWriter m{GUID};
+        m.BeginSection(TAG_A);
+        m.WriteArray(noise.data(), noise.size());
+        std::vector<cppfmu::FMIByte> state(m.Finish());
+        cppfmu::StateWriter w{state.data(), state.size(), GUID};
+        w.BeginSection(TAG_A);
+        w.WriteArray(noise.data(), noise.size());
+        w.Finish();
+
+        std::vector<cppfmu::FMIByte> compressed(state.size());
+        const auto n = cppfmu::CompressState(state.data(), state.size(), compressed.data());
+        assert(n == state.size());
+        assert(!cppfmu::IsCompressedState(compressed.data(), n));
+    }
+    return 0;
+}
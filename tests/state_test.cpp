@@ -0,0 +1,356 @@
+#include <cppfmu_cs.hpp>
+#include <cppfmu_state.hpp>
+#include <cppfmu_variables.hpp>
+
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include "test_memory.hpp"
+
+
+struct Block
+{
+    int n;
+    double x[3];
+};
+
+
+/* A slave whose variables are all registered with both a variable table
+ * and a state table with incremental snapshots, and which relies on the
+ * default SetXxx() functions.
+ */
+class IncrementalSlave : public cppfmu::SlaveInstance
+{
+public:
+    explicit IncrementalSlave(const cppfmu::Memory& memory)
+        : m_variables{memory}
+        , m_states{memory}
+    {
+        m_variables.AddReal(0, &m_x[0]);
+        m_variables.AddReal(1, &m_x[1]);
+        m_variables.AddInteger(2, &m_n);
+        m_variables.AddReal(3, &m_v[1]);
+        m_states.EnableIncrementalSnapshots(4);
+        m_states.Add(m_x);
+        m_states.Add(m_n);
+        m_states.Add(m_v);
+        UseVariableTable(m_variables);
+        UseStateTable(m_states);
+    }
+
+    bool DoStep(
+        cppfmu::FMIReal,
+        cppfmu::FMIReal,
+        cppfmu::FMIBoolean,
+        cppfmu::FMIReal&) override
+    {
+        return true;
+    }
+
+private:
+    cppfmu::FMIReal m_x[2] = {};
+    cppfmu::FMIInteger m_n = 0;
+    std::vector<cppfmu::FMIReal> m_v = std::vector<cppfmu::FMIReal>(3, 0.0);
+    cppfmu::VariableTable m_variables;
+    cppfmu::StateTable m_states;
+};
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    double d = 1.0;
+    Block b = {1, {1.0, 2.0, 3.0}};
+    std::vector<double, cppfmu::Allocator<double>> v(
+        {1.0, 2.0}, cppfmu::Allocator<double>{memory});
+    auto s = cppfmu::CopyString(memory, "abc");
+
+    cppfmu::StateTable table{memory};
+    table.Add(d);
+    table.Add(b);
+    table.Add(v);
+    table.Add(s);
+
+    // Snapshot and restore
+    cppfmu::FMIFMUState state = nullptr;
+    table.GetState(&state);
+    assert(state != nullptr);
+    d = 2.0;
+    b.x[1] = -1.0;
+    v.assign(10, 5.0);
+    s = "a much longer string than before";
+    table.SetState(state);
+    assert(d == 1.0);
+    assert(b.n == 1 && b.x[1] == 2.0);
+    assert(v.size() == 2 && v[0] == 1.0 && v[1] == 2.0);
+    assert(s == "abc");
+
+    // Memory is reused if the state fits, and reallocated otherwise
+    {
+        const auto old = state;
+        d = 3.0;
+        table.GetState(&state);
+        assert(state == old);
+        v.assign(1000, 7.0);
+        table.GetState(&state);
+        d = 0.0;
+        v.clear();
+        table.SetState(state);
+        assert(d == 3.0 && v.size() == 1000 && v[999] == 7.0);
+    }
+
+    // Serialization
+    {
+        const auto size = table.SerializedStateSize(state);
+        std::vector<cppfmu::FMIByte> data(size);
+        table.SerializeState(state, data.data(), data.size());
+        table.FreeState(state);
+
+        d = 0.0;
+        v.clear();
+        s.clear();
+        const auto restored = table.DeserializeState(data.data(), data.size());
+        table.SetState(restored);
+        assert(d == 3.0 && v.size() == 1000 && s == "abc");
+        table.FreeState(restored);
+
+        bool threw = false;
+        try {
+            table.DeserializeState(data.data(), data.size() / 2);
+        } catch (const std::exception&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // A state from a different table is rejected
+    {
+        cppfmu::StateTable other{memory};
+        other.Add(d);
+        cppfmu::FMIFMUState otherState = nullptr;
+        other.GetState(&otherState);
+        bool threw = false;
+        try { table.SetState(otherState); } catch (const std::logic_error&) { threw = true; }
+        assert(threw);
+        other.FreeState(otherState);
+    }
+
+    // A serialized state from a different FMU is rejected
+    {
+        cppfmu::StateTable a{memory, "guid-a"};
+        cppfmu::StateTable b{memory, "guid-b"};
+        a.Add(d);
+        b.Add(d);
+        cppfmu::FMIFMUState aState = nullptr;
+        a.GetState(&aState);
+        std::vector<cppfmu::FMIByte> data(a.SerializedStateSize(aState));
+        a.SerializeState(aState, data.data(), data.size());
+        a.FreeState(aState);
+        bool threw = false;
+        try { b.DeserializeState(data.data(), data.size()); } catch (const std::runtime_error&) { threw = true; }
+        assert(threw);
+        a.FreeState(a.DeserializeState(data.data(), data.size()));
+    }
+
+    // Compressed serialization
+    {
+        double big[1000] = {};
+        cppfmu::StateTable c{memory};
+        c.Add(big);
+        c.EnableCompression();
+        cppfmu::FMIFMUState cState = nullptr;
+        big[0] = 1.0;
+        c.GetState(&cState);
+        const auto size = c.SerializedStateSize(cState);
+        assert(size < sizeof big / 4);
+
+        // A snapshot which is overwritten is compressed again.
+        big[0] = 2.0;
+        c.GetState(&cState);
+        std::vector<cppfmu::FMIByte> data(c.SerializedStateSize(cState));
+        c.SerializeState(cState, data.data(), data.size());
+        c.FreeState(cState);
+
+        big[0] = 0.0;
+        const auto restored = c.DeserializeState(data.data(), data.size());
+        c.SetState(restored);
+        assert(big[0] == 2.0);
+        c.FreeState(restored);
+
+        // A state whose size doesn't fit the table is rejected before it
+        // is decompressed.
+        double bigger[2000] = {};
+        cppfmu::StateTable other{memory};
+        other.Add(bigger);
+        other.EnableCompression();
+        cppfmu::FMIFMUState otherState = nullptr;
+        other.GetState(&otherState);
+        std::vector<cppfmu::FMIByte> otherData(other.SerializedStateSize(otherState));
+        other.SerializeState(otherState, otherData.data(), otherData.size());
+        other.FreeState(otherState);
+        bool threw = false;
+        try {
+            c.DeserializeState(otherData.data(), otherData.size());
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // Incremental snapshots
+    {
+        double big[1000] = {};
+        double small = 0.0;
+        cppfmu::StateTable inc{memory};
+        inc.EnableIncrementalSnapshots(2);
+        const auto bigRegion = inc.Add(big);
+        const auto smallRegion = inc.Add(small);
+
+        cppfmu::FMIFMUState s0 = nullptr;
+        inc.GetState(&s0);
+        const auto fullSize = inc.SerializedStateSize(s0);
+
+        // A delta only contains the dirty region, but restores everything.
+        small = 1.0;
+        inc.MarkDirty(smallRegion);
+        cppfmu::FMIFMUState s1 = nullptr;
+        inc.GetState(&s1);
+        assert(static_cast<cppfmu::FMIFMUState>(s1) != s0);
+        big[0] = 1.0;
+        inc.MarkDirty(bigRegion);
+        small = 2.0;
+        inc.MarkDirty(smallRegion);
+        cppfmu::FMIFMUState s2 = nullptr;
+        inc.GetState(&s2);
+
+        big[0] = 5.0;
+        small = 5.0;
+        inc.SetState(s1);
+        assert(big[0] == 0.0 && small == 1.0);
+
+        // Freeing a base doesn't invalidate the deltas that depend on it.
+        inc.FreeState(s0);
+        inc.SetState(s2);
+        assert(big[0] == 1.0 && small == 2.0);
+
+        // Serialization produces a full, self-contained state.
+        assert(inc.SerializedStateSize(s1) == fullSize);
+        std::vector<cppfmu::FMIByte> data(fullSize);
+        inc.SerializeState(s1, data.data(), data.size());
+        inc.FreeState(s1);
+        const auto restored = inc.DeserializeState(data.data(), data.size());
+        inc.SetState(restored);
+        assert(big[0] == 0.0 && small == 1.0);
+        inc.FreeState(restored);
+
+        // Repeatedly taking a snapshot into the same state; after the
+        // maximum chain length, a full snapshot is taken again.
+        for (int i = 0; i < 5; ++i) {
+            small = 10.0 + i;
+            inc.MarkDirty(smallRegion);
+            inc.GetState(&s2);
+        }
+        small = 0.0;
+        inc.SetState(s2);
+        assert(small == 14.0 && big[0] == 0.0);
+        inc.FreeState(s2);
+    }
+
+    // Values set by the environment are included in delta snapshots
+    {
+        IncrementalSlave slave{memory};
+        const cppfmu::FMIValueReference vr[] = {0, 1, 2};
+        cppfmu::FMIReal x[2] = {1.0, 2.0};
+        cppfmu::FMIInteger n = 3;
+        slave.SetReal(vr, 2, x);
+        slave.SetInteger(vr + 2, 1, &n);
+        cppfmu::FMIFMUState s0 = nullptr;
+        slave.GetFMUState(&s0);
+
+        x[1] = 20.0;
+        slave.SetReal(vr + 1, 1, x + 1);
+        n = 30;
+        slave.SetInteger(vr + 2, 1, &n);
+        cppfmu::FMIFMUState s1 = nullptr;
+        slave.GetFMUState(&s1);
+
+        x[0] = -1.0;
+        x[1] = -1.0;
+        n = -1;
+        slave.SetReal(vr, 2, x);
+        slave.SetInteger(vr + 2, 1, &n);
+
+        slave.SetFMUState(s1);
+        slave.GetReal(vr, 2, x);
+        slave.GetInteger(vr + 2, 1, &n);
+        assert(x[0] == 1.0 && x[1] == 20.0 && n == 30);
+
+        slave.SetFMUState(s0);
+        slave.GetReal(vr, 2, x);
+        slave.GetInteger(vr + 2, 1, &n);
+        assert(x[0] == 1.0 && x[1] == 2.0 && n == 3);
+
+        slave.FreeFMUState(s1);
+        slave.FreeFMUState(s0);
+    }
+
+    // Saving into the last snapshot again updates it in place
+    {
+        IncrementalSlave slave{memory};
+        const cppfmu::FMIValueReference vr[] = {0, 1, 2};
+        cppfmu::FMIReal x[2] = {1.0, 2.0};
+        slave.SetReal(vr, 2, x);
+        cppfmu::FMIFMUState s = nullptr;
+        slave.GetFMUState(&s);
+        const auto first = s;
+
+        const auto allocations = cppfmu_test::AllocationCount();
+        for (int i = 0; i < 10; ++i) {
+            x[1] = 10.0 * i;
+            slave.SetReal(vr + 1, 1, x + 1);
+            slave.GetFMUState(&s);
+            assert(s == first);
+        }
+        assert(cppfmu_test::AllocationCount() == allocations);
+
+        x[0] = -1.0;
+        x[1] = -1.0;
+        slave.SetReal(vr, 2, x);
+        slave.SetFMUState(s);
+        slave.GetReal(vr, 2, x);
+        assert(x[0] == 1.0 && x[1] == 90.0);
+
+        slave.FreeFMUState(s);
+    }
+
+    // Variables in a registered vector's elements are marked too.
+    {
+        IncrementalSlave slave{memory};
+        const cppfmu::FMIValueReference vr = 3;
+        cppfmu::FMIReal v = 1.0;
+        slave.SetReal(&vr, 1, &v);
+        cppfmu::FMIFMUState s0 = nullptr;
+        slave.GetFMUState(&s0);
+
+        v = 2.0;
+        slave.SetReal(&vr, 1, &v);
+        cppfmu::FMIFMUState s1 = nullptr;
+        slave.GetFMUState(&s1);
+
+        v = -1.0;
+        slave.SetReal(&vr, 1, &v);
+        slave.SetFMUState(s1);
+        slave.GetReal(&vr, 1, &v);
+        assert(v == 2.0);
+
+        slave.SetFMUState(s0);
+        slave.GetReal(&vr, 1, &v);
+        assert(v == 1.0);
+
+        slave.FreeFMUState(s1);
+        slave.FreeFMUState(s0);
+    }
+    return 0;
+}
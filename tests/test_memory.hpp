@@ -0,0 +1,73 @@
+// Memory management callbacks shared by the tests.
+#ifndef CPPFMU_TEST_MEMORY_HPP
+#define CPPFMU_TEST_MEMORY_HPP
+
+#include <cppfmu_common.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+
+
+namespace cppfmu_test
+{
+    namespace detail
+    {
+        inline std::atomic<int>& AllocationCounter() noexcept
+        {
+            static std::atomic<int> count{0};
+            return count;
+        }
+
+        inline std::atomic<int>& FreeCounter() noexcept
+        {
+            static std::atomic<int> count{0};
+            return count;
+        }
+    }
+
+    // Forward to std::calloc() and std::free(), and count the calls.
+    extern "C" inline void* TestAllocate(std::size_t nobj, std::size_t size) noexcept
+    {
+        ++detail::AllocationCounter();
+        return std::calloc(nobj, size);
+    }
+
+    extern "C" inline void TestFree(void* ptr) noexcept
+    {
+        if (ptr != nullptr) ++detail::FreeCounter();
+        std::free(ptr);
+    }
+
+    // The number of blocks allocated and freed with the callbacks so far.
+    inline int AllocationCount() noexcept { return detail::AllocationCounter(); }
+    inline int FreeCount() noexcept { return detail::FreeCounter(); }
+
+    /* Returns callback functions which allocate memory with TestAllocate()
+     * and TestFree(), and pass log messages to 'logger' (which may be null).
+     * The other members are null.
+     */
+    inline cppfmu::FMICallbackFunctions Callbacks(
+        cppfmu::FMICallbackLogger logger = nullptr) noexcept
+    {
+        return cppfmu::FMICallbackFunctions{
+            logger,
+            &TestAllocate,
+            &TestFree,
+#ifdef CPPFMU_USE_FMI_1_0
+            nullptr,
+#else
+            nullptr,
+            nullptr,
+#endif
+        };
+    }
+
+    // Returns a cppfmu::Memory which uses the callbacks above.
+    inline cppfmu::Memory Memory() noexcept
+    {
+        return cppfmu::Memory{Callbacks()};
+    }
+}
+
+#endif // header guard
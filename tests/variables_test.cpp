@@ -0,0 +1,180 @@
+#include <cppfmu_cs.hpp>
+#include <cppfmu_variables.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "test_memory.hpp"
+
+
+int main()
+{
+    const auto memory = cppfmu_test::Memory();
+
+    cppfmu::FMIReal x = 1.0;
+    cppfmu::FMIReal y = 2.0;
+    cppfmu::FMIInteger n = 3;
+    cppfmu::FMIBoolean b = cppfmu::FMIFalse;
+    auto s = cppfmu::CopyString(memory, "hello");
+
+    auto table = cppfmu::VariableTable{memory};
+    table.AddReal(0, &x);
+    table.AddReal(1, &y);
+    table.AddReal(2, &x); // alias of vr 0
+    table.AddInteger(0, &n);
+    table.AddBoolean(0, &b);
+    table.AddString(0, &s);
+
+    // Get/set with dense value references
+    {
+        const cppfmu::FMIValueReference vr[] = {2, 1, 0};
+        cppfmu::FMIReal val[3] = {};
+        table.GetReal(vr, 3, val);
+        assert(val[0] == 1.0 && val[1] == 2.0 && val[2] == 1.0);
+
+        const cppfmu::FMIReal newVal[] = {5.0, 6.0};
+        table.SetReal(vr, 2, newVal);
+        assert(x == 5.0 && y == 6.0);
+    }
+    {
+        const cppfmu::FMIValueReference vr = 0;
+        const cppfmu::FMIInteger i = 7;
+        table.SetInteger(&vr, 1, &i);
+        assert(n == 7);
+        const cppfmu::FMIBoolean t = cppfmu::FMITrue;
+        table.SetBoolean(&vr, 1, &t);
+        assert(b == cppfmu::FMITrue);
+        const cppfmu::FMIString str = "world";
+        table.SetString(&vr, 1, &str);
+        cppfmu::FMIString out = nullptr;
+        table.GetString(&vr, 1, &out);
+        assert(std::strcmp(out, "world") == 0);
+    }
+
+    // Contiguous blocks
+    cppfmu::FMIReal block[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    table.AddReal(10, block, 8);
+    {
+        const cppfmu::FMIValueReference vr[] = {11, 12, 13, 0, 14, 15, 17, 16};
+        cppfmu::FMIReal val[8] = {};
+        table.GetReal(vr, 8, val);
+        assert(val[0] == 1 && val[1] == 2 && val[2] == 3 && val[3] == 5.0);
+        assert(val[4] == 4 && val[5] == 5 && val[6] == 7 && val[7] == 6);
+
+        const cppfmu::FMIReal newVal[] = {-1, -2, -3, -4, -5, -6, -7, -8};
+        table.SetReal(vr, 8, newVal);
+        assert(block[1] == -1 && block[2] == -2 && block[3] == -3 && x == -4);
+        assert(block[4] == -5 && block[5] == -6 && block[7] == -7 && block[6] == -8);
+    }
+
+    // Sparse value references
+    cppfmu::FMIReal z = 3.0;
+    table.AddReal(1000000, &z);
+    cppfmu::FMIReal sparse[100] = {};
+    for (int i = 0; i < 100; ++i) {
+        sparse[i] = i;
+        table.AddReal(2000000 + 7919 * i, &sparse[i]);
+    }
+    {
+        const cppfmu::FMIValueReference vr[] = {1000000, 1, 2000000 + 7919 * 42};
+        cppfmu::FMIReal val[3] = {};
+        table.GetReal(vr, 3, val);
+        assert(val[0] == 3.0 && val[1] == 6.0 && val[2] == 42.0);
+    }
+
+    // A single far value reference doesn't stop blocks from being copied
+    // in one go, whether they are below or above it.
+    {
+        cppfmu::VariableTable mixed{memory};
+        cppfmu::FMIReal low[16] = {};
+        cppfmu::FMIReal high[16] = {};
+        cppfmu::FMIReal far = 0.0;
+        mixed.AddReal(0, low, 16);
+        mixed.AddReal(4000000000u, &far);
+        mixed.AddReal(3000000000u, high, 16);
+        assert(mixed.ContiguousRealCount(0) == 16);
+        assert(mixed.ContiguousRealCount(5) == 11);
+        assert(mixed.ContiguousRealCount(3000000000u) == 16);
+        assert(mixed.ContiguousRealCount(3000000010u) == 6);
+        assert(mixed.ContiguousRealCount(4000000000u) == 1);
+        assert(mixed.ContiguousRealCount(16) == 0);
+
+        cppfmu::FMIValueReference vr[18];
+        cppfmu::FMIReal val[18];
+        for (int i = 0; i < 16; ++i) {
+            vr[i] = 3000000000u + i;
+            val[i] = i + 0.5;
+        }
+        vr[16] = 4000000000u;
+        val[16] = -1.0;
+        vr[17] = 3;
+        val[17] = 3.5;
+        mixed.SetReal(vr, 18, val);
+        assert(high[0] == 0.5 && high[15] == 15.5 && far == -1.0 && low[3] == 3.5);
+        cppfmu::FMIReal out[18] = {};
+        mixed.GetReal(vr, 18, out);
+        for (int i = 0; i < 18; ++i) assert(out[i] == val[i]);
+    }
+
+    // Errors
+    {
+        const cppfmu::FMIValueReference vr = 2000001;
+        cppfmu::FMIReal val = -1.0;
+        bool threw = false;
+        try { table.GetReal(&vr, 1, &val); } catch (const std::logic_error&) { threw = true; }
+        assert(threw);
+        assert(val == -1.0);
+    }
+    {
+        bool threw = false;
+        try { table.AddReal(1, &z); } catch (const std::logic_error&) { threw = true; }
+        assert(threw);
+    }
+    {
+        // A block which overlaps an existing one leaves the table unchanged.
+        cppfmu::FMIReal other[4] = {};
+        bool threw = false;
+        try { table.AddReal(15, other, 4); } catch (const std::logic_error&) { threw = true; }
+        assert(threw);
+        const cppfmu::FMIValueReference vr = 16;
+        cppfmu::FMIReal val = 0.0;
+        table.GetReal(&vr, 1, &val);
+        assert(val == -8.0);
+    }
+    {
+        // A null string is rejected, and the variable keeps its value.
+        const cppfmu::FMIValueReference vr = 0;
+        const cppfmu::FMIString val = nullptr;
+        bool threw = false;
+        try { table.SetString(&vr, 1, &val); } catch (const std::invalid_argument&) { threw = true; }
+        assert(threw);
+        assert(s == "world");
+    }
+
+    // Variables added after the table has been used, one at a time
+    {
+        cppfmu::FMIInteger many[1000] = {};
+        auto t = cppfmu::VariableTable{memory};
+        for (int i = 0; i < 500; ++i) t.AddInteger(2 * i, many + i);
+        assert(t.FindInteger(998) == many + 499);
+        assert(t.FindInteger(999) == nullptr);
+
+        const cppfmu::FMIValueReference vr[] = {0, 998};
+        const cppfmu::FMIInteger val[] = {1, 2};
+        t.SetInteger(vr, 2, val);
+        assert(many[0] == 1 && many[499] == 2);
+
+        for (int i = 500; i < 1000; ++i) t.AddInteger(100000 + i, many + i);
+        assert(t.FindInteger(100999) == many + 999);
+        assert(t.FindInteger(998) == many + 499);
+        const cppfmu::FMIValueReference vr2 = 100999;
+        cppfmu::FMIInteger out = 0;
+        many[999] = 7;
+        t.GetInteger(&vr2, 1, &out);
+        assert(out == 7);
+        assert(t.FindInteger(100999) == many + 999);
+    }
+    return 0;
+}